@@ -0,0 +1,385 @@
+/*
+ * Throughput and tail latency of the lock-free map against a mutex guarded std::unordered_map,
+ * from 1 up to 64 threads. Not a unit test: it's built as mapBenchmarks and prints one line per
+ * scenario, implementation and thread count, so regressions can be spotted in CI logs.
+ *
+ *   mapBenchmarks [--quick] [--max-threads=N] [--ops=N]
+ */
+
+#include "../../main/cpp/thread_map.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+typedef map::ConcurrentMapProvider<PointerHasher<void *>, true> LockFreeMap;
+
+const int kMaxBenchThreads = 64;
+const int kSafepointPeriod = 1024;
+const int kSignalReads = 4;
+// handler runs timed per writer thread in the signal scenario, writers go on until they have them
+const long kSignalSamples = 1000;
+
+// keys and values are word aligned and never null, as the lock-free map expects
+static void *word(long i) { return (void *)((i + 1) << 3); }
+
+static long nanosNow() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+struct LockFreeImpl {
+    static const char *name() { return "lockfree"; }
+
+    LockFreeMap map;
+
+    explicit LockFreeImpl(int capacity) : map(capacity) {}
+
+    void put(void *key, void *value) { map.put(key, value); }
+
+    void *get(void *key) { return map.get(key); }
+
+    void *remove(void *key) { return map.remove(key); }
+
+    map::GC::EpochType attach() {
+        map::GC::EpochType epoch = GCHelper::attach();
+        GCHelper::enter(epoch);
+        return epoch;
+    }
+
+    void safepoint(map::GC::EpochType &epoch) { GCHelper::safepoint(epoch); }
+
+    void detach(map::GC::EpochType &epoch) { GCHelper::detach(epoch); }
+};
+
+struct LockedImpl {
+    static const char *name() { return "mutex"; }
+
+    std::mutex lock;
+    std::unordered_map<void *, void *> map;
+
+    explicit LockedImpl(int capacity) { map.reserve(capacity); }
+
+    void put(void *key, void *value) {
+        std::lock_guard<std::mutex> guard(lock);
+        map[key] = value;
+    }
+
+    void *get(void *key) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = map.find(key);
+        return it == map.end() ? NULL : it->second;
+    }
+
+    void *remove(void *key) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = map.find(key);
+        if (it == map.end()) return NULL;
+        void *value = it->second;
+        map.erase(it);
+        return value;
+    }
+
+    map::GC::EpochType attach() { return map::GC::kEpochInitial; }
+
+    void safepoint(map::GC::EpochType &) {}
+
+    void detach(map::GC::EpochType &) {}
+};
+
+struct Options {
+    int maxThreads;
+    long opsPerThread;
+};
+
+struct Result {
+    long ops;
+    long elapsedNanos;
+    std::vector<unsigned int> latencies; // ns, one per timed operation
+};
+
+static unsigned int percentile(std::vector<unsigned int> &latencies, double p) {
+    if (latencies.empty()) return 0;
+    size_t index = std::min(latencies.size() - 1, (size_t) (latencies.size() * p));
+    std::nth_element(latencies.begin(), latencies.begin() + index, latencies.end());
+    return latencies[index];
+}
+
+static void report(const char *scenario, const char *impl, int threads, Result &result) {
+    double mops = result.elapsedNanos > 0 ? result.ops * 1000.0 / result.elapsedNanos : 0;
+    unsigned int p50 = percentile(result.latencies, 0.5);
+    unsigned int p99 = percentile(result.latencies, 0.99);
+    unsigned int p999 = percentile(result.latencies, 0.999);
+    unsigned int max = result.latencies.empty() ? 0 : *std::max_element(result.latencies.begin(), result.latencies.end());
+    printf("%-10s %-9s %4d %10.2f %8u %8u %8u %10u\n", scenario, impl, threads, mops, p50, p99, p999, max);
+    fflush(stdout);
+}
+
+/* Runs body(thread, latencies) on every thread once they're all started, the clock covers the
+   slowest one. Each body times its own operations, so setup stays out of the numbers. */
+static Result runThreads(int threads, long opsPerThread,
+                         std::function<void(int, std::vector<unsigned int> &)> body) {
+    std::vector<std::vector<unsigned int>> latencies(threads);
+    std::atomic_int ready(0);
+    std::atomic_bool go(false);
+    std::vector<std::thread> workers;
+
+    for (int t = 0; t < threads; ++t) {
+        latencies[t].reserve(opsPerThread);
+        workers.push_back(std::thread([&, t]() {
+            ready++;
+            while (!go.load(std::memory_order_acquire)) sched_yield();
+            body(t, latencies[t]);
+        }));
+    }
+    while (ready.load() < threads) sched_yield();
+
+    long start = nanosNow();
+    go.store(true, std::memory_order_release);
+    for (size_t t = 0; t < workers.size(); ++t) workers[t].join();
+
+    Result result;
+    result.elapsedNanos = nanosNow() - start;
+    result.ops = 0;
+    for (int t = 0; t < threads; ++t) {
+        result.ops += latencies[t].size();
+        result.latencies.insert(result.latencies.end(), latencies[t].begin(), latencies[t].end());
+    }
+    return result;
+}
+
+#define TIMED(latencies, op)                                \
+    do {                                                    \
+        long opStart = nanosNow();                          \
+        op;                                                 \
+        (latencies).push_back((unsigned int) (nanosNow() - opStart)); \
+    } while (0)
+
+// Disjoint inserts into a table sized for all of them
+template <typename Impl>
+static void benchPut(int threads, long ops) {
+    Impl impl(threads * ops * 2);
+    Result result = runThreads(threads, ops, [&](int t, std::vector<unsigned int> &latencies) {
+        map::GC::EpochType epoch = impl.attach();
+        for (long i = 0; i < ops; ++i) {
+            long key = t * ops + i;
+            TIMED(latencies, impl.put(word(key), word(key)));
+            if (i % kSafepointPeriod == 0) impl.safepoint(epoch);
+        }
+        impl.detach(epoch);
+    });
+    report("put", Impl::name(), threads, result);
+}
+
+// Reads spread over a shared, prefilled table
+template <typename Impl>
+static void benchGet(int threads, long ops) {
+    const long keys = std::max(ops, 1L << 16);
+    Impl impl(keys * 2);
+    for (long key = 0; key < keys; ++key) impl.put(word(key), word(key));
+
+    Result result = runThreads(threads, ops, [&](int t, std::vector<unsigned int> &latencies) {
+        map::GC::EpochType epoch = impl.attach();
+        unsigned long key = t * 2654435761UL;
+        for (long i = 0; i < ops; ++i) {
+            key = (key + 40503) % keys;
+            TIMED(latencies, impl.get(word(key)));
+            if (i % kSafepointPeriod == 0) impl.safepoint(epoch);
+        }
+        impl.detach(epoch);
+    });
+    report("get", Impl::name(), threads, result);
+}
+
+// Disjoint removals out of a prefilled table
+template <typename Impl>
+static void benchRemove(int threads, long ops) {
+    Impl impl(threads * ops * 2);
+    for (long key = 0; key < threads * ops; ++key) impl.put(word(key), word(key));
+
+    Result result = runThreads(threads, ops, [&](int t, std::vector<unsigned int> &latencies) {
+        map::GC::EpochType epoch = impl.attach();
+        for (long i = 0; i < ops; ++i) {
+            long key = t * ops + i;
+            TIMED(latencies, impl.remove(word(key)));
+            if (i % kSafepointPeriod == 0) impl.safepoint(epoch);
+        }
+        impl.detach(epoch);
+    });
+    report("remove", Impl::name(), threads, result);
+}
+
+// Disjoint inserts into the smallest table, so most of the time goes into migrations
+template <typename Impl>
+static void benchGrowth(int threads, long ops) {
+    Impl impl(map::kSizeMin);
+    Result result = runThreads(threads, ops, [&](int t, std::vector<unsigned int> &latencies) {
+        map::GC::EpochType epoch = impl.attach();
+        for (long i = 0; i < ops; ++i) {
+            long key = t * ops + i;
+            TIMED(latencies, impl.put(word(key), word(key)));
+            if (i % kSafepointPeriod == 0) impl.safepoint(epoch);
+        }
+        impl.detach(epoch);
+    });
+    report("growth", Impl::name(), threads, result);
+}
+
+/* Thread start, a sample and thread end through ThreadMap, for made up JNIEnv pointers.
+   Every put takes a pooled bucket, every remove hands it back through the GC. Threads with a
+   slot of their own mark it as the agent's do, the others go through the shared counters. */
+static void benchChurn(int threads, long ops, bool ownSlot) {
+    ThreadMap threadMap;
+    Result result = runThreads(threads, ops, [&](int t, std::vector<unsigned int> &latencies) {
+        if (ownSlot) GCHelper::attachCurrentThread();
+        for (long i = 0; i < ops; ++i) {
+            JNIEnv *env = (JNIEnv *) word(t * ops + i);
+            TIMED(latencies, {
+                threadMap.put(env, "bench", t, i);
+                threadMap.get(env);
+                threadMap.remove(env);
+            });
+        }
+        if (ownSlot) GCHelper::detachCurrentThread();
+    });
+    report("churn", ownSlot ? "slot" : "shared", threads, result);
+}
+
+/* Writers keep inserting and removing while a sampler thread interrupts them with signals,
+   whose handler reads the same table like the profiler's does. Latencies are the handler's. */
+static LockFreeMap *signalMap;
+static std::atomic_long signalReads;
+static __thread unsigned int *handlerLatencies;
+static __thread long handlerCount, handlerCapacity;
+
+static void readInHandler(int, siginfo_t *, void *) {
+    if (handlerLatencies == NULL || handlerCount >= handlerCapacity) return;
+    long start = nanosNow();
+    GCHelper::Section section; // as ThreadMap::get reads
+    for (int i = 0; i < kSignalReads; ++i) signalMap->get(word(i * 7));
+    handlerLatencies[handlerCount++] = (unsigned int) (nanosNow() - start);
+    signalReads.fetch_add(kSignalReads, std::memory_order_relaxed);
+}
+
+static void benchSignalReaders(int threads, long ops) {
+    LockFreeMap table(map::kSizeMin);
+    signalMap = &table;
+    signalReads = 0;
+
+    struct sigaction sa, old;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = readInHandler;
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR2, &sa, &old);
+
+    std::vector<pthread_t> writers(threads);
+    std::atomic_int started(0), finished(0);
+    std::atomic_bool samplerDone(false);
+    std::vector<std::vector<unsigned int>> latencies(threads, std::vector<unsigned int>(kSignalSamples));
+    std::vector<long> counts(threads), writes(threads);
+
+    std::thread sampler([&]() {
+        while (started.load() < threads) sched_yield();
+        // writers block the signal once done, but have to outlive the last pthread_kill
+        for (int next = 0; finished.load() < threads; next = (next + 1) % threads) {
+            pthread_kill(writers[next], SIGUSR2);
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+        }
+        samplerDone = true;
+    });
+
+    Result result = runThreads(threads, ops, [&](int t, std::vector<unsigned int> &) {
+        handlerLatencies = &latencies[t][0];
+        handlerCapacity = kSignalSamples;
+        handlerCount = 0;
+        writers[t] = pthread_self();
+        started++;
+
+        // at least ops writes, and as many more as it takes to be interrupted kSignalSamples times,
+        // percentiles of a handful of runs would mean nothing
+        map::GC::EpochType epoch = GCHelper::attach();
+        GCHelper::enter(epoch);
+        long i;
+        for (i = 0; i < ops || handlerCount < kSignalSamples; ++i) {
+            long key = t * ops + i % ops;
+            table.put(word(key), word(key));
+            if (i % ops % 2 == 1) table.remove(word(key - 1));
+            if (i % kSafepointPeriod == 0) GCHelper::safepoint(epoch);
+        }
+        GCHelper::detach(epoch);
+        writes[t] = i;
+
+        sigset_t block;
+        sigemptyset(&block);
+        sigaddset(&block, SIGUSR2);
+        pthread_sigmask(SIG_BLOCK, &block, NULL);
+        counts[t] = handlerCount;
+        handlerLatencies = NULL;
+        finished++;
+        while (!samplerDone.load()) sched_yield();
+    });
+    sampler.join();
+    sigaction(SIGUSR2, &old, NULL);
+
+    // throughput of the writers, tail latency of the interrupting reads
+    result.ops = 0;
+    for (int t = 0; t < threads; ++t)
+        result.ops += writes[t] * 3 / 2;
+    for (int t = 0; t < threads; ++t)
+        result.latencies.insert(result.latencies.end(), latencies[t].begin(), latencies[t].begin() + counts[t]);
+    report("signal", "lockfree", threads, result);
+}
+
+static void parseOptions(int argc, char **argv, Options &options) {
+    options.maxThreads = kMaxBenchThreads;
+    options.opsPerThread = 1L << 16;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            options.maxThreads = 8;
+            options.opsPerThread = 1L << 12;
+        } else if (strncmp(argv[i], "--max-threads=", 14) == 0) {
+            options.maxThreads = std::max(1, std::min(kMaxBenchThreads, atoi(argv[i] + 14)));
+        } else if (strncmp(argv[i], "--ops=", 6) == 0) {
+            options.opsPerThread = std::max(1L, atol(argv[i] + 6));
+        } else {
+            fprintf(stderr, "usage: %s [--quick] [--max-threads=N] [--ops=N]\n", argv[0]);
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    parseOptions(argc, argv, options);
+
+    printf("%-10s %-9s %4s %10s %8s %8s %8s %10s\n", "scenario", "impl", "thr", "Mops/s", "p50ns", "p99ns", "p99.9ns", "maxns");
+    for (int threads = 1; threads <= options.maxThreads; threads *= 2) {
+        long ops = options.opsPerThread;
+        benchPut<LockFreeImpl>(threads, ops);
+        benchPut<LockedImpl>(threads, ops);
+        benchGet<LockFreeImpl>(threads, ops);
+        benchGet<LockedImpl>(threads, ops);
+        benchRemove<LockFreeImpl>(threads, ops);
+        benchRemove<LockedImpl>(threads, ops);
+        benchGrowth<LockFreeImpl>(threads, ops);
+        benchGrowth<LockedImpl>(threads, ops);
+        benchChurn(threads, ops, true);
+        benchChurn(threads, ops, false);
+        benchSignalReaders(threads, ops);
+    }
+    return 0;
+}
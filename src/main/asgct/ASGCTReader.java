@@ -1,16 +1,46 @@
 package asgct;
 
 import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 import java.util.ArrayList;
-import java.util.List;
 import java.util.Arrays;
+import java.util.Collections;
+import java.util.List;
 
 public class ASGCTReader {
-  // used to store the pointer to jvmti reader
-  public static long reader_ptr;
+  // records are a long timestamp in ms, long thread id, int thread index, int frame count
+  // and an int method index per frame, in native byte order
+  public static final int RECORD_HEADER = 24;
+
+  // moves as many staged samples as fit into a direct buffer, from position 0, and returns
+  // their size in bytes; the negated size of the first record when not even that fits
+  public native static int drain(ByteBuffer buffer);
+
+  // drains samples as primitive arrays for aggregators, returning how many it filled in, or the
+  // negated number of frames the first one's stack needs when frames is too short for it:
+  // - timestamps in ms, java thread ids and stack ids, one per sample; a negative stack id is an
+  //   AsyncGetCallTrace error, the stack id + 1
+  // - stacks drained for the first time take the next ids in order, offsets[0] is how many there
+  //   are and stack k of them has the method indexes frames[offsets[k + 1]] to frames[offsets[k + 2]]
+  public native static int drainArrays(long[] timestamps, long[] threadIds, long[] stackIds,
+                                       long[] frames, long[] offsets);
 
-  // pops the top off the underlying buffer
-  private native static String pop();
+  // names of methods, and threads, from index from on
+  public native static String[] methods(int from);
+
+  public native static String[] threads(int from);
+
+  // samples staged, dropped, overwritten and downsampled, see the agent's readerOverflow option
+  public native static long[] counters();
+
+  private static ByteBuffer buffer = newBuffer(1024 * 1024);
+  private static final List<String> methodNames = new ArrayList<String>();
+  private static final List<String> threadNames = new ArrayList<String>();
+
+  private static ByteBuffer newBuffer(int size) {
+    return ByteBuffer.allocateDirect(size).order(ByteOrder.nativeOrder());
+  }
 
   public static class ASGCTFrame {
     public long timestamp;
@@ -18,16 +48,11 @@ public class ASGCTReader {
     public String name;
     public String[] trace;
 
-    ASGCTFrame(String frame) {
-      String[] items = frame.split(",");
-      this.timestamp = Long.parseLong(items[0]);
-      this.id = Long.parseLong(items[1]);
-      this.name = items[2];
-
-      this.trace = items[3].split("@");
-
-      for (int i = 0; i < trace.length; i++)
-        this.trace[i] = this.trace[i].substring(1, this.trace[i].length()).replace(";", ".").replace("/", ".");
+    ASGCTFrame(long timestamp, long id, String name, String[] trace) {
+      this.timestamp = timestamp;
+      this.id = id;
+      this.name = name;
+      this.trace = trace;
     }
 
     public long getTimestamp() { return timestamp; }
@@ -44,16 +69,36 @@ public class ASGCTReader {
     }
   }
 
-  public static ASGCTFrame[] fetch() {
+  public static synchronized ASGCTFrame[] fetch() {
+    int size = drain(buffer);
+    if (size < 0) {
+      buffer = newBuffer(-size);
+      size = drain(buffer);
+    }
+
     ArrayList<ASGCTFrame> records = new ArrayList<ASGCTFrame>();
-    String raw_record = pop();
-    if (raw_record.length() > 0) {
-      String[] record_arr = raw_record.split("#");
-      for (String record: record_arr) {
-        try {
-          records.add(new ASGCTFrame(record));
-        } catch (Exception e) { }
-      }
+    if (size <= 0)
+      return records.toArray(new ASGCTFrame[0]);
+
+    // the dictionaries cover every index drained so far
+    Collections.addAll(methodNames, methods(methodNames.size()));
+    Collections.addAll(threadNames, threads(threadNames.size()));
+
+    buffer.clear();
+    buffer.limit(size);
+    while (buffer.hasRemaining()) {
+      long timestamp = buffer.getLong();
+      long id = buffer.getLong();
+      String name = threadNames.get(buffer.getInt());
+      int frames = buffer.getInt();
+      // an AsyncGetCallTrace error code
+      if (frames <= 0)
+        continue;
+
+      String[] trace = new String[frames];
+      for (int i = 0; i < frames; i++)
+        trace[i] = methodNames.get(buffer.getInt());
+      records.add(new ASGCTFrame(timestamp, id, name, trace));
     }
 
     return records.toArray(new ASGCTFrame[records.size()]);
@@ -8,6 +8,9 @@
 #include "thread_map.h"
 #include "profiler.h"
 #include "controller.h"
+#include "method_ids.h"
+#include "code_index.h"
+#include "sample_stream.h"
 
 #if defined(__APPLE__) || defined(__FreeBSD__)
 #define GETENV_NEW_THREAD_ASYNC_UNSAFE
@@ -17,6 +20,10 @@ static ConfigurationOptions configuration;
 static Profiler* prof;
 static Controller* controller;
 static ThreadMap threadMap;
+static MethodIdPreparer* methodIds;
+
+// Sanity bound on the JNIEnv offset into a VM thread, see RegisterLiveThreads
+const intptr_t kMaxJniEnvOffset = 4096;
 
 // This has to be here, or the VM turns off class loading events.
 // And AsyncGetCallTrace needs class loading events to be turned on!
@@ -33,57 +40,56 @@ static void JNICALL CompiledMethodLoad(jvmtiEnv* jvmti, jmethodID method,
                                        jint map_length, const jvmtiAddrLocationMap* map,
                                        const void* compile_info) {
     // Needed to enable DebugNonSafepoints info by default
+    IMPLICITLY_USE(jvmti);
+    IMPLICITLY_USE(map_length);
+    IMPLICITLY_USE(map);
+    IMPLICITLY_USE(compile_info);
+    if (configuration.codeIndex) {
+        CodeIndex::instance().addMethod(method, code_addr, code_size);
+    }
 }
 
-// Calls GetClassMethods on a given class to force the creation of
-// jmethodIDs of it.
-void CreateJMethodIDsForClass(jvmtiEnv *jvmti, jclass klass) {
-    jint method_count;
-    JvmtiScopedPtr<jmethodID> methods(jvmti);
-    jvmtiError e = jvmti->GetClassMethods(klass, &method_count, methods.GetRef());
-    if (e != JVMTI_ERROR_NONE && e != JVMTI_ERROR_CLASS_NOT_PREPARED) {
-        // JVMTI_ERROR_CLASS_NOT_PREPARED is okay because some classes may
-        // be loaded but not prepared at this point.
-        JvmtiScopedPtr<char> ksig(jvmti);
-        JVMTI_ERROR_CLEANUP(
-            jvmti->GetClassSignature(klass, ksig.GetRef(), NULL),
-            ksig.AbandonBecauseOfError());
-        logError("Failed to create method IDs for methods in class %s with error %d ",
-                 ksig.Get(), e);
+static void JNICALL CompiledMethodUnload(jvmtiEnv* jvmti, jmethodID method, const void* code_addr) {
+    IMPLICITLY_USE(jvmti);
+    IMPLICITLY_USE(method);
+    if (configuration.codeIndex) {
+        CodeIndex::instance().remove(code_addr);
+    }
+}
+
+static void JNICALL DynamicCodeGenerated(jvmtiEnv* jvmti, const char* name,
+                                         const void* address, jint length) {
+    IMPLICITLY_USE(jvmti);
+    if (configuration.codeIndex) {
+        CodeIndex::instance().addStub(name, address, length);
     }
 }
 
 void JNICALL OnVMInit(jvmtiEnv *jvmti, JNIEnv *jniEnv, jthread thread) {
+    IMPLICITLY_USE(jvmti);
     IMPLICITLY_USE(thread);
 
     TimeUtils::init(); // required to init OS X's clock service
 
-    // Forces the creation of jmethodIDs of the classes that had already
-    // been loaded (eg java.lang.Object, java.lang.ClassLoader) and
-    // OnClassPrepare() misses.
-    jint class_count;
-    JvmtiScopedPtr<jclass> classes(jvmti);
-    JVMTI_ERROR((jvmti->GetLoadedClasses(&class_count, classes.GetRef())));
-    jclass *classList = classes.Get();
-    for (int i = 0; i < class_count; ++i) {
-        jclass klass = classList[i];
-        CreateJMethodIDsForClass(jvmti, klass);
-    }
+    // Creates the jmethodIDs of the classes that had already been loaded
+    // (eg java.lang.Object, java.lang.ClassLoader), on the method id
+    // threads unless configured otherwise.
+    methodIds->start(jniEnv);
 
-    if (!configuration.host.empty() && !configuration.port.empty()) {
+    if ((!configuration.host.empty() && !configuration.port.empty()) || !configuration.controlSocket.empty()) {
         controller->start();
     }
 }
 
 void JNICALL OnClassPrepare(jvmtiEnv *jvmti_env, JNIEnv *jni_env,
         jthread thread, jclass klass) {
-    IMPLICITLY_USE(jni_env);
+    IMPLICITLY_USE(jvmti_env);
     IMPLICITLY_USE(thread);
     // We need to do this to "prime the pump", as it were -- make sure
     // that all of the methodIDs have been initialized internally, for
-    // AsyncGetCallTrace.  I imagine it slows down class loading a mite,
-    // but honestly, how fast does class loading have to be?
-    CreateJMethodIDsForClass(jvmti_env, klass);
+    // AsyncGetCallTrace. Until sampling starts this only queues the class,
+    // so class loading at startup doesn't wait for it.
+    methodIds->prepare(jni_env, klass);
 }
 
 void JNICALL OnVMDeath(jvmtiEnv *jvmti_env, JNIEnv *jni_env) {
@@ -92,6 +98,8 @@ void JNICALL OnVMDeath(jvmtiEnv *jvmti_env, JNIEnv *jni_env) {
 
     if (prof->isRunning())
         prof->stop();
+
+    methodIds->stop();
 }
 
 static bool PrepareJvmti(jvmtiEnv *jvmti) {
@@ -190,6 +198,8 @@ void JNICALL OnNativeMethodBind(jvmtiEnv *jvmti_env, JNIEnv *jni_env, jthread th
 volatile bool main_started = false;
 
 void JNICALL OnThreadStart(jvmtiEnv *jvmti_env, JNIEnv *jni_env, jthread thread) {
+    // the thread's map reads and its samples mark a GC slot of its own from here on
+    GCHelper::attachCurrentThread();
     jvmtiThreadInfo thread_info;
     int error = jvmti_env->GetThreadInfo(thread, &thread_info);
     if (error == JNI_OK) {
@@ -214,6 +224,7 @@ void JNICALL OnThreadStart(jvmtiEnv *jvmti_env, JNIEnv *jni_env, jthread thread)
 void JNICALL OnThreadEnd(jvmtiEnv *jvmti_env, JNIEnv *jni_env, jthread thread) {
     pthread_sigmask(SIG_BLOCK, &prof_signal_mask, NULL);
     threadMap.remove(jni_env);
+    GCHelper::detachCurrentThread();
 }
 
 static bool RegisterJvmti(jvmtiEnv *jvmti) {
@@ -230,6 +241,8 @@ static bool RegisterJvmti(jvmtiEnv *jvmti) {
     callbacks->ClassPrepare = &OnClassPrepare;
 
     callbacks->CompiledMethodLoad = &CompiledMethodLoad;
+    callbacks->CompiledMethodUnload = &CompiledMethodUnload;
+    callbacks->DynamicCodeGenerated = &DynamicCodeGenerated;
 
     callbacks->NativeMethodBind = &OnNativeMethodBind;
     callbacks->ThreadStart = &OnThreadStart;
@@ -241,6 +254,7 @@ static bool RegisterJvmti(jvmtiEnv *jvmti) {
 
     jvmtiEvent events[] = {JVMTI_EVENT_CLASS_LOAD, JVMTI_EVENT_CLASS_PREPARE,
             JVMTI_EVENT_VM_DEATH, JVMTI_EVENT_VM_INIT, JVMTI_EVENT_COMPILED_METHOD_LOAD,
+            JVMTI_EVENT_COMPILED_METHOD_UNLOAD, JVMTI_EVENT_DYNAMIC_CODE_GENERATED,
             JVMTI_EVENT_THREAD_START, JVMTI_EVENT_THREAD_END
 #ifdef GETENV_NEW_THREAD_ASYNC_UNSAFE
         , JVMTI_EVENT_NATIVE_METHOD_BIND
@@ -296,8 +310,38 @@ static void parseArguments(char *options, ConfigurationOptions &configuration) {
                 configuration.host.assign(value, STR_SIZE(value, next));
             } else if (strstr(key, "port") == key) {
                 configuration.port.assign(value, STR_SIZE(value, next));
+            } else if (strstr(key, "controlSocket") == key) {
+                configuration.controlSocket.assign(value, STR_SIZE(value, next));
             } else if (strstr(key, "maxFrames") == key) {
                 configuration.maxFramesToCapture = atoi(value);
+            } else if (strstr(key, "threadFilter") == key) {
+                configuration.threadFilter.assign(value, STR_SIZE(value, next));
+            } else if (strstr(key, "windowBuckets") == key) {
+                configuration.windowBuckets = atoi(value);
+            } else if (strstr(key, "windowBucketSeconds") == key) {
+                configuration.windowBucketSeconds = atoi(value);
+            } else if (strstr(key, "windowMaxStacks") == key) {
+                configuration.windowMaxStacks = atoi(value);
+            } else if (strstr(key, "burstInterval") == key) {
+                configuration.burstInterval = atoi(value);
+            } else if (strstr(key, "burstSeconds") == key) {
+                configuration.burstSeconds = atoi(value);
+            } else if (strstr(key, "burstCpuThreshold") == key) {
+                configuration.burstCpuThreshold = atoi(value);
+            } else if (strstr(key, "methodIdThreads") == key) {
+                configuration.methodIdThreads = atoi(value);
+            } else if (strstr(key, "deferMethodIds") == key) {
+                configuration.deferMethodIds = atoi(value);
+            } else if (strstr(key, "nativeFrames") == key) {
+                configuration.nativeFrames = atoi(value);
+            } else if (strstr(key, "codeIndex") == key) {
+                configuration.codeIndex = atoi(value);
+            } else if (strstr(key, "asgctReader") == key) {
+                configuration.asgctReader = atoi(value);
+            } else if (strstr(key, "readerBudget") == key) {
+                configuration.readerBudget = atoi(value);
+            } else if (strstr(key, "readerOverflow") == key) {
+                configuration.readerOverflow.assign(value, STR_SIZE(value, next));
             } else {
                 logError("WARN: Unknown configuration option: %s=%s\n", key, value);
             }
@@ -305,10 +349,10 @@ static void parseArguments(char *options, ConfigurationOptions &configuration) {
     }
 }
 
-AGENTEXPORT jint JNICALL Agent_OnLoad(JavaVM *jvm, char *options, void *reserved) {
-    IMPLICITLY_USE(reserved);
+// Shared by Agent_OnLoad and Agent_OnAttach, the profiler is only created if everything
+// could be set up.
+static jint LoadAgent(JavaVM *jvm, char *options, jvmtiEnv *&jvmti) {
     int err;
-    jvmtiEnv *jvmti;
     parseArguments(options, configuration);
 
     if ((err = (jvm->GetEnv(reinterpret_cast<void **>(&jvmti), JVMTI_VERSION))) !=
@@ -340,13 +384,129 @@ AGENTEXPORT jint JNICALL Agent_OnLoad(JavaVM *jvm, char *options, void *reserved
     }
 
     Asgct::SetAsgct(Accessors::GetJvmFunction<ASGCTType>("AsyncGetCallTrace"));
+    SampleStream::instance().setJvmti(jvmti);
 
-    prof = new Profiler(jvm, jvmti, configuration, threadMap);
+    methodIds = new MethodIdPreparer(jvmti, configuration.methodIdThreads, configuration.deferMethodIds);
+    prof = new Profiler(jvm, jvmti, configuration, threadMap, methodIds);
     controller = new Controller(jvm, jvmti, prof, configuration);
 
     return 0;
 }
 
+AGENTEXPORT jint JNICALL Agent_OnLoad(JavaVM *jvm, char *options, void *reserved) {
+    IMPLICITLY_USE(reserved);
+    jvmtiEnv *jvmti;
+    return LoadAgent(jvm, options, jvmti);
+}
+
+// Threads already running when the agent attaches never get a ThreadStart. A JNIEnv lives
+// inside the VM's own thread structure, which java.lang.Thread.eetop points to, so its
+// offset from there is learnt from the attaching thread and applied to every other one.
+// A derived JNIEnv is only trusted when it points at the VM's JNI function table, as every
+// real one does. Their OS thread ids aren't known, see kUnknownTid.
+static void RegisterLiveThreads(jvmtiEnv *jvmti, JNIEnv *jniEnv) {
+    jclass threadClass = jniEnv->FindClass("java/lang/Thread");
+    jfieldID eetop = threadClass == NULL ? NULL : jniEnv->GetFieldID(threadClass, "eetop", "J");
+    jmethodID getId = threadClass == NULL ? NULL : jniEnv->GetMethodID(threadClass, "getId", "()J");
+    if (threadClass != NULL) jniEnv->DeleteLocalRef(threadClass);
+    if (eetop == NULL || getId == NULL) {
+        jniEnv->ExceptionClear();
+        logError("WARN: Unable to find the VM thread of java.lang.Thread, running threads stay unnamed\n");
+        return;
+    }
+
+    jthread current;
+    JVMTI_ERROR(jvmti->GetCurrentThread(&current));
+    jlong currentTop = jniEnv->GetLongField(current, eetop);
+    jniEnv->DeleteLocalRef(current);
+    intptr_t envOffset = (intptr_t) jniEnv - (intptr_t) currentTop;
+    if (currentTop == 0 || envOffset < 0 || envOffset > kMaxJniEnvOffset) {
+        logError("WARN: Unexpected JNIEnv offset %ld, running threads stay unnamed\n", (long) envOffset);
+        return;
+    }
+
+    jint threadCount;
+    int skipped = 0;
+    JvmtiScopedPtr<jthread> threads(jvmti);
+    JVMTI_ERROR(jvmti->GetAllThreads(&threadCount, threads.GetRef()));
+    for (int i = 0; i < threadCount; i++) {
+        jthread thread = threads.Get()[i];
+        // zero once the thread has terminated
+        jlong top = jniEnv->GetLongField(thread, eetop);
+        JNIEnv *env = (JNIEnv *) (top + envOffset);
+        jvmtiThreadInfo threadInfo;
+        if (top != 0 && env->functions != jniEnv->functions) {
+            // not laid out like the attaching thread, better unnamed than aliasing another env
+            skipped++;
+        } else if (top != 0 && jvmti->GetThreadInfo(thread, &threadInfo) == JVMTI_ERROR_NONE) {
+            jlong jid = jniEnv->CallLongMethod(thread, getId);
+            threadMap.put(env, threadInfo.name, kUnknownTid, jid);
+            jvmti->Deallocate((unsigned char *) threadInfo.name);
+            jniEnv->DeleteLocalRef(threadInfo.thread_group);
+            jniEnv->DeleteLocalRef(threadInfo.context_class_loader);
+        }
+        jniEnv->DeleteLocalRef(thread);
+    }
+    if (skipped > 0) {
+        logError("WARN: %d running threads have no JNIEnv where expected, they stay unnamed\n", skipped);
+    }
+}
+
+// Attaching again to a loaded agent turns sampling on, or with start=0 off, releasing its
+// buffers until the next start.
+static jint Reattach(JavaVM *jvm, char *options) {
+    ConfigurationOptions requested;
+    parseArguments(options, requested);
+
+    if (!requested.start) {
+        prof->release();
+        return 0;
+    }
+
+    JNIEnv *jniEnv = getJNIEnv(jvm);
+    if (jniEnv == NULL) {
+        logError("ERROR: Failed to obtain JNIEnv\n");
+        return 1;
+    }
+    return prof->start(jniEnv) ? 0 : 1;
+}
+
+AGENTEXPORT jint JNICALL Agent_OnAttach(JavaVM *jvm, char *options, void *reserved) {
+    IMPLICITLY_USE(reserved);
+    if (prof != NULL) {
+        return Reattach(jvm, options);
+    }
+
+    jvmtiEnv *jvmti;
+    if (LoadAgent(jvm, options, jvmti) != 0 || prof == NULL) {
+        logError("ERROR: Failed to attach the profiler\n");
+        return 1;
+    }
+
+    JNIEnv *jniEnv = getJNIEnv(jvm);
+    if (jniEnv == NULL) {
+        logError("ERROR: Failed to obtain JNIEnv\n");
+        return 1;
+    }
+
+    // the VM is long past VMInit, and its main thread past ThreadStart
+    OnVMInit(jvmti, jniEnv, NULL);
+    RegisterLiveThreads(jvmti, jniEnv);
+    main_started = true;
+
+    if (configuration.codeIndex) {
+        // replays the code the VM generated before the agent was there
+        jvmti->GenerateEvents(JVMTI_EVENT_DYNAMIC_CODE_GENERATED);
+        jvmti->GenerateEvents(JVMTI_EVENT_COMPILED_METHOD_LOAD);
+    }
+
+    if (configuration.start) {
+        // waits for the jmethodIDs of every loaded class, created by the method id threads
+        prof->start(jniEnv);
+    }
+    return 0;
+}
+
 AGENTEXPORT void JNICALL Agent_OnUnload(JavaVM *vm) {
     IMPLICITLY_USE(vm);
 
@@ -355,6 +515,7 @@ AGENTEXPORT void JNICALL Agent_OnUnload(JavaVM *vm) {
 
     delete controller;
     delete prof;
+    delete methodIds;
 }
 
 void bootstrapHandle(int signum, siginfo_t *info, void *context) {
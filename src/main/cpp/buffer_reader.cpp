@@ -1,153 +1,381 @@
 #include "buffer_reader.h"
-#include "math.h"
-#include <ctime>
-#include <thread>
-#include <jni.h>
 
-int BufferReader::size() { return data_size.load(std::memory_order_relaxed); }
+#include <limits.h>
+#include <string.h>
 
-bool BufferReader::empty() { return data_size.load(std::memory_order_relaxed) == 0; }
+#include "log_writer.h"
+#include "profiler.h"
+
+static void put(char *&out, const void *value, size_t size) {
+    memcpy(out, value, size);
+    out += size;
+}
+
+bool parseReaderOverflow(const std::string &name, ReaderOverflow &policy) {
+    if (name == "dropNewest") {
+        policy = READER_DROP_NEWEST;
+    } else if (name == "dropOldest") {
+        policy = READER_DROP_OLDEST;
+    } else if (name == "downsample") {
+        policy = READER_DOWNSAMPLE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+size_t BufferReader::slotsFor(size_t budget, int maxFrames) {
+    size_t slotSize = sizeof(Slot) + maxFrames * sizeof(jmethodID);
+    size_t count = budget / slotSize;
+    return count > kReaderMinSlots ? count : kReaderMinSlots;
+}
+
+BufferReader::BufferReader(jvmtiEnv *jvmti, int maxFrames, size_t budget, ReaderOverflow policy) :
+    jvmti_(jvmti), maxFrames_(maxFrames), policy_(policy), slots(slotsFor(budget, maxFrames)),
+    frames(slots.size() * maxFrames), head(0), tail(0), staged(0), dropped(0), overwritten(0),
+    downsampled(0), sequence(0), drainingFrames(maxFrames) {
+    for (size_t i = 0; i < slots.size(); i++) {
+        slots[i].frames = &frames[i * maxFrames];
+    }
+    draining.frames = &drainingFrames[0];
+}
+
+size_t BufferReader::size() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+BufferReader::Counters BufferReader::counters() const {
+    Counters counters;
+    counters.staged = staged.load(std::memory_order_relaxed);
+    counters.dropped = dropped.load(std::memory_order_relaxed);
+    counters.overwritten = overwritten.load(std::memory_order_relaxed);
+    counters.downsampled = downsampled.load(std::memory_order_relaxed);
+    return counters;
+}
+
+// Every stride-th sample is kept: all of them up to half full, then every 2nd, 4th and 8th
+size_t BufferReader::downsampleStride(size_t queued) const {
+    size_t eighths = queued * 8 / slots.size();
+    if (eighths < 4) return 1;
+    if (eighths < 6) return 2;
+    if (eighths < 7) return 4;
+    return 8;
+}
 
 void BufferReader::record(const timespec &ts, const JVMPI_CallTrace &trace, ThreadBucketPtr info) {
-  if (info.defined()) {
-      long ms = ts.tv_sec * 1000;
-      ms += ts.tv_nsec;
+    if (!info.defined()) return;
+
+    size_t current = head.load(std::memory_order_relaxed);
+    size_t oldest = tail.load(std::memory_order_acquire);
+    size_t queued = current - oldest;
+
+    if (policy_ == READER_DOWNSAMPLE && queued < slots.size() && sequence++ % downsampleStride(queued) != 0) {
+        downsampled.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (queued == slots.size()) {
+        if (policy_ != READER_DROP_OLDEST) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        // a reader copying the oldest slot notices it moved on and discards its copy, when the
+        // reader took it first there's room anyway
+        if (tail.compare_exchange_strong(oldest, oldest + 1, std::memory_order_seq_cst)) {
+            overwritten.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    Slot &slot = slots[current % slots.size()];
+    slot.timestamp = (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    slot.jid = info->jid;
+    strncpy(slot.name, info->name, kThreadNameMax - 1);
+    slot.name[kThreadNameMax - 1] = '\0';
+
+    // recovered frames aren't all jmethodIDs, those samples stay failed ones here
+    if (isRecoveredTrace(trace)) {
+        slot.numFrames = trace.frames[trace.num_frames - 1].lineno;
+    } else {
+        slot.numFrames = trace.num_frames < maxFrames_ ? trace.num_frames : maxFrames_;
+        for (int i = 0; i < slot.numFrames; i++) {
+            slot.frames[i] = trace.frames[i].method_id;
+        }
+    }
+
+    head.store(current + 1, std::memory_order_release);
+    staged.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Copies the oldest staged slot into draining, false if there is none. A slot the producer
+// overwrote while it was copied is given up for the next one.
+bool BufferReader::peek(size_t &index) {
+    while (true) {
+        index = tail.load(std::memory_order_seq_cst);
+        if (index == head.load(std::memory_order_acquire)) return false;
+
+        const Slot &slot = slots[index % slots.size()];
+        draining.timestamp = slot.timestamp;
+        draining.jid = slot.jid;
+        memcpy(draining.name, slot.name, kThreadNameMax);
+        draining.name[kThreadNameMax - 1] = '\0';
+        draining.numFrames = slot.numFrames < maxFrames_ ? slot.numFrames : maxFrames_;
+        for (int i = 0; i < draining.numFrames; i++) {
+            draining.frames[i] = slot.frames[i];
+        }
+        // only the producer under dropOldest moves tail besides us, and only before it writes
+        // the slot; the fence keeps the copy above from being read after the check
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (tail.load(std::memory_order_seq_cst) == index) return true;
+    }
+}
 
-      timestamps.push(ms);
+// Hands the peeked slot back to the producer, false if it overwrote it in the meantime
+bool BufferReader::release(size_t index) {
+    return tail.compare_exchange_strong(index, index + 1, std::memory_order_seq_cst);
+}
 
-      ids.push(info->jid);
-      names.push(info->name.c_str());
+int32_t BufferReader::methodIndex(jmethodID method) {
+    std::unordered_map<jmethodID, int32_t>::iterator it = methodIndexes.find(method);
+    if (it != methodIndexes.end()) return it->second;
 
-      vector<jmethodID> method_ids;
-      for (int i = 0; i < trace.num_frames; i++)
-          method_ids.push_back(trace.frames[i].method_id);
+    int32_t index = (int32_t) methodIds.size();
+    methodIndexes[method] = index;
+    methodIds.push_back(method);
+    return index;
+}
 
-      traces.push(method_ids);
+int32_t BufferReader::threadIndex(const Slot &slot) {
+    std::unordered_map<int64_t, int32_t>::iterator it = threadIndexes.find(slot.jid);
+    if (it != threadIndexes.end()) return it->second;
 
-      data_size.store(size() + 1);
-  }
+    int32_t index = (int32_t) threadNames.size();
+    threadIndexes[slot.jid] = index;
+    threadNames.push_back(slot.name);
+    return index;
 }
 
-ASGCTFrame BufferReader::pop() {
-  ASGCTFrame frame;
+long BufferReader::drain(char *out, size_t capacity) {
+    std::lock_guard<std::mutex> guard(drainLock);
 
-  if (!empty()) {
-    vector<jmethodID> trace = traces.front();
-    if (trace.size() > 0) {
-        frame.timestamp = timestamps.front();
-        frame.id = ids.front();
-        frame.name = names.front();
+    char *at = out;
+    size_t current;
+    while (peek(current)) {
+        int32_t numFrames = draining.numFrames > 0 ? draining.numFrames : 0;
+        size_t size = kReaderRecordHeader + numFrames * sizeof(int32_t);
+        if ((size_t) (at - out) + size > capacity) {
+            if (at == out) return -(long) size;
+            break;
+        }
+        if (!release(current)) continue;
 
-        for (int i = 0; i < trace.size(); i++)
-          frame.trace.append(lookUpMethod(trace[i])).append("@");
-        frame.trace.append("#");
+        int32_t thread = threadIndex(draining);
+        put(at, &draining.timestamp, sizeof(draining.timestamp));
+        put(at, &draining.jid, sizeof(draining.jid));
+        put(at, &thread, sizeof(thread));
+        put(at, &draining.numFrames, sizeof(draining.numFrames));
+        for (int i = 0; i < numFrames; i++) {
+            int32_t method = methodIndex(draining.frames[i]);
+            put(at, &method, sizeof(method));
+        }
     }
+    return at - out;
+}
+
+long BufferReader::drainArrays(jlong *timestamps, jlong *threadIds, jlong *stackIdsOut, size_t maxSamples,
+                               jlong *frames, size_t maxFrames, jlong *offsets, size_t maxOffsets) {
+    if (maxOffsets < 3) return 0;
+    std::lock_guard<std::mutex> guard(drainLock);
 
-    timestamps.pop();
-    ids.pop();
-    names.pop();
-    traces.pop();
-
-    data_size.store(size() - 1);
-  }
-
-  return frame;
-}
-
-string BufferReader::lookUpMethod(jmethodID method_id) {
-    // chopped up version of the frame look up in log writer
-    jint error;
-    JvmtiScopedPtr<char> methodName(jvmti_), methodSignature(jvmti_), methodGenericSignature(jvmti_);
-
-    error = jvmti_->GetMethodName(method_id, methodName.GetRef(), methodSignature.GetRef(), methodGenericSignature.GetRef());
-    if (error != JVMTI_ERROR_NONE) {
-        methodName.AbandonBecauseOfError();
-        methodSignature.AbandonBecauseOfError();
-        methodGenericSignature.AbandonBecauseOfError();
-        if (error == JVMTI_ERROR_INVALID_METHODID) {
-            static int once = 0;
-            if (!once) {
-                once = 1;
-                logError("One of your monitoring interfaces "
-                "is having trouble resolving its stack traces.  "
-                "GetMethodName on a jmethodID involved in a stacktrace "
-                "resulted in an INVALID_METHODID error which usually "
-                "indicates its declaring class has been unloaded.\n");
-                logError("Unexpected JVMTI error %d in GetMethodName\n", error);
+    size_t samples = 0;
+    size_t newStacks = 0;
+    offsets[1] = 0;
+    std::string key;
+    size_t current;
+    while (samples < maxSamples && peek(current)) {
+        int64_t stackId;
+        bool newStack = false;
+        key.clear();
+        if (draining.numFrames <= 0) {
+            stackId = (int64_t) draining.numFrames - 1;
+        } else {
+            for (int i = 0; i < draining.numFrames; i++) {
+                int32_t method = methodIndex(draining.frames[i]);
+                key.append((const char *) &method, sizeof(method));
+            }
+            std::unordered_map<std::string, int64_t>::iterator it = stackIds.find(key);
+            if (it != stackIds.end()) {
+                stackId = it->second;
+            } else {
+                if ((size_t) offsets[newStacks + 1] + draining.numFrames > maxFrames || newStacks + 3 > maxOffsets) {
+                    if (samples == 0) return -(long) draining.numFrames;
+                    break;
+                }
+                stackId = (int64_t) stackIds.size();
+                newStack = true;
             }
         }
-        return "";
+        if (!release(current)) continue;
+
+        if (newStack) {
+            stackIds[key] = stackId;
+            jlong *at = frames + offsets[newStacks + 1];
+            for (int i = 0; i < draining.numFrames; i++) {
+                int32_t method;
+                memcpy(&method, key.data() + i * sizeof(method), sizeof(method));
+                at[i] = method;
+            }
+            offsets[newStacks + 2] = offsets[newStacks + 1] + draining.numFrames;
+            newStacks++;
+        }
+        timestamps[samples] = draining.timestamp;
+        threadIds[samples] = draining.jid;
+        stackIdsOut[samples] = stackId;
+        samples++;
     }
+    offsets[0] = (jlong) newStacks;
+    return (long) samples;
+}
 
-    // This block is leaky; why ???
-    // Get class name, put it in signature_ptr
-    jclass declaring_class;
-    JVMTI_ERROR_RET(
-        jvmti_->GetMethodDeclaringClass(method_id, &declaring_class), "");
-
-    JvmtiScopedPtr<char> classSignature(jvmti_), classSignatureGeneric(jvmti_);
-    JVMTI_ERROR_CLEANUP_RET(
-        jvmti_->GetClassSignature(declaring_class, classSignature.GetRef(), classSignatureGeneric.GetRef()),
-        "", { classSignature.AbandonBecauseOfError(); classSignatureGeneric.AbandonBecauseOfError(); });
-
-    // Get source file, put it in source_name_ptr
-    char *fileName;
-    JvmtiScopedPtr<char> source_name_ptr(jvmti_);
-    static char file_unknown[] = "UnknownFile";
-    if (JVMTI_ERROR_NONE != jvmti_->GetSourceFileName(declaring_class, source_name_ptr.GetRef())) {
-        source_name_ptr.AbandonBecauseOfError();
-        fileName = file_unknown;
-    } else {
-        fileName = source_name_ptr.Get();
+void BufferReader::writeMetrics(std::ostream &out) const {
+    Counters current = counters();
+    writeMetric(out, "reader_staged_total", "counter", "Samples staged for ASGCTReader", current.staged);
+    writeMetric(out, "reader_dropped_total", "counter", "Samples ASGCTReader had no room for", current.dropped);
+    writeMetric(out, "reader_overwritten_total", "counter", "Staged samples overwritten before ASGCTReader drained them",
+                current.overwritten);
+    writeMetric(out, "reader_downsampled_total", "counter", "Samples skipped while ASGCTReader fell behind",
+                current.downsampled);
+    writeMetric(out, "reader_staged", "gauge", "Samples waiting for ASGCTReader", size());
+    writeMetric(out, "reader_capacity", "gauge", "Samples ASGCTReader's memory budget stages", capacity());
+}
+
+bool BufferReader::methodName(jmethodID method, std::string &name) {
+    JVMPI_CallFrame frame = {};
+    frame.method_id = method;
+    char fqn[FQN_MAX];
+    if (!frameFqn(jvmti_, frame, fqn)) return false;
+    name = fqn;
+    return true;
+}
+
+void BufferReader::methods(int from, std::vector<std::string> &names) {
+    std::lock_guard<std::mutex> guard(drainLock);
+    names.clear();
+
+    // named on first request only, by then the method was sampled
+    while (methodNames.size() < methodIds.size()) {
+        std::string name;
+        if (!methodName(methodIds[methodNames.size()], name)) {
+            name = "[unknown method]";
+        }
+        methodNames.push_back(name);
+    }
+    for (size_t i = from > 0 ? from : 0; i < methodNames.size(); i++) {
+        names.push_back(methodNames[i]);
     }
+}
 
-    string method;
-    method.append(classSignature.Get()).append(methodName.Get());
+void BufferReader::threads(int from, std::vector<std::string> &names) {
+    std::lock_guard<std::mutex> guard(drainLock);
+    names.clear();
+    for (size_t i = from > 0 ? from : 0; i < threadNames.size(); i++) {
+        names.push_back(threadNames[i]);
+    }
+}
 
-    return method;
+static BufferReader *activeReader() {
+    Profiler *prof = getProfiler();
+    return prof != NULL ? prof->reader() : NULL;
 }
 
-extern void setReader(JNIEnv *env, BufferReader *reader) {
-  // set a reference to the reader so the jni can access it
-  jclass cls = env->FindClass("asgct/ASGCTReader");
-  jfieldID fld = env->GetStaticFieldID(cls, "reader_ptr", "J");
-  env->SetStaticLongField(cls, fld, (jlong)reader);
+static jobjectArray toJavaArray(JNIEnv *env, const std::vector<std::string> &values) {
+    jclass stringClass = env->FindClass("java/lang/String");
+    if (stringClass == NULL) return NULL;
+
+    jobjectArray array = env->NewObjectArray((jsize) values.size(), stringClass, NULL);
+    if (array == NULL) return NULL;
+    for (size_t i = 0; i < values.size(); i++) {
+        jstring value = env->NewStringUTF(values[i].c_str());
+        if (value == NULL) return NULL;
+        env->SetObjectArrayElement(array, (jsize) i, value);
+        env->DeleteLocalRef(value);
+    }
+    return array;
 }
 
-BufferReader *fetchReader(JNIEnv *env) {
-  // grab the reference to the reader
-  jclass cls = env->FindClass("asgct/ASGCTReader");
-  jfieldID fld = env->GetStaticFieldID(cls, "reader_ptr", "J");
-  return (BufferReader *)env->GetStaticLongField(cls, fld);
+extern "C" JNIEXPORT jint JNICALL Java_asgct_ASGCTReader_drain(JNIEnv *env, jclass jcls, jobject buffer) {
+    BufferReader *reader = activeReader();
+    if (reader == NULL) return 0;
+
+    void *address = env->GetDirectBufferAddress(buffer);
+    jlong capacity = env->GetDirectBufferCapacity(buffer);
+    if (address == NULL || capacity < 0) {
+        logError("ERROR: ASGCTReader can only drain into a direct ByteBuffer\n");
+        return 0;
+    }
+    if (capacity > INT_MAX) capacity = INT_MAX;
+
+    return (jint) reader->drain((char *) address, (size_t) capacity);
+}
+
+static jsize smallest(jsize a, jsize b) {
+    return a < b ? a : b;
 }
 
-extern "C" JNIEXPORT jstring JNICALL Java_asgct_ASGCTReader_pop(JNIEnv *env, jclass jcls) {
-  // grab the reader
-  BufferReader *reader = fetchReader(env);
+extern "C" JNIEXPORT jint JNICALL Java_asgct_ASGCTReader_drainArrays(JNIEnv *env, jclass jcls, jlongArray timestamps,
+                                                                     jlongArray threadIds, jlongArray stackIds,
+                                                                     jlongArray frames, jlongArray offsets) {
+    BufferReader *reader = activeReader();
+    if (reader == NULL) return 0;
 
-  string frames;
+    jsize maxSamples = smallest(env->GetArrayLength(timestamps),
+                                smallest(env->GetArrayLength(threadIds), env->GetArrayLength(stackIds)));
+    jsize maxFrames = env->GetArrayLength(frames);
+    jsize maxOffsets = env->GetArrayLength(offsets);
+    if (maxOffsets < 3) {
+        logError("ERROR: ASGCTReader.drainArrays needs room for at least 3 offsets\n");
+        return 0;
+    }
 
-  ASGCTFrame last;
-  last.timestamp = 0;
-  last.id = 0;
-  last.trace = "";
+    // filled natively and copied over in one go each, rather than pinning the arrays meanwhile
+    std::vector<jlong> sampleValues(3 * (size_t) maxSamples);
+    std::vector<jlong> frameValues(maxFrames);
+    std::vector<jlong> offsetValues(maxOffsets);
+    jlong *timestampValues = sampleValues.data();
+    jlong *threadValues = timestampValues + maxSamples;
+    jlong *stackValues = threadValues + maxSamples;
+    long samples = reader->drainArrays(timestampValues, threadValues, stackValues, maxSamples,
+                                       frameValues.data(), maxFrames, offsetValues.data(), maxOffsets);
+    if (samples <= 0) return (jint) samples;
 
-  while (!reader->empty()) {
-      ASGCTFrame frame = reader->pop();
+    jsize newStacks = (jsize) offsetValues[0];
+    env->SetLongArrayRegion(timestamps, 0, (jsize) samples, timestampValues);
+    env->SetLongArrayRegion(threadIds, 0, (jsize) samples, threadValues);
+    env->SetLongArrayRegion(stackIds, 0, (jsize) samples, stackValues);
+    env->SetLongArrayRegion(frames, 0, (jsize) offsetValues[newStacks + 1], frameValues.data());
+    env->SetLongArrayRegion(offsets, 0, newStacks + 2, offsetValues.data());
+    return (jint) samples;
+}
 
-      // check if the frame is garbage or a duplicate
-      if (frame.timestamp == 0 || (frame.timestamp == last.timestamp && frame.id == last.id && frame.trace == last.trace) || frame.trace.size() == 0)
-        continue;
+extern "C" JNIEXPORT jobjectArray JNICALL Java_asgct_ASGCTReader_methods(JNIEnv *env, jclass jcls, jint from) {
+    std::vector<std::string> names;
+    BufferReader *reader = activeReader();
+    if (reader != NULL) reader->methods(from, names);
+    return toJavaArray(env, names);
+}
 
-      frames.append(std::to_string(frame.timestamp)).append(",");
-      frames.append(std::to_string(frame.id)).append(",");
-      frames.append(frame.name).append(",");
-      frames.append(frame.trace.c_str());
+extern "C" JNIEXPORT jlongArray JNICALL Java_asgct_ASGCTReader_counters(JNIEnv *env, jclass jcls) {
+    BufferReader::Counters counters = {};
+    BufferReader *reader = activeReader();
+    if (reader != NULL) counters = reader->counters();
 
-      last.timestamp = frame.timestamp;
-      last.id = frame.id;
-      last.trace = frame.trace;
-  }
+    jlong values[] = { counters.staged, counters.dropped, counters.overwritten, counters.downsampled };
+    jlongArray array = env->NewLongArray(4);
+    if (array != NULL) env->SetLongArrayRegion(array, 0, 4, values);
+    return array;
+}
 
-  return env->NewStringUTF(frames.c_str());
+extern "C" JNIEXPORT jobjectArray JNICALL Java_asgct_ASGCTReader_threads(JNIEnv *env, jclass jcls, jint from) {
+    std::vector<std::string> names;
+    BufferReader *reader = activeReader();
+    if (reader != NULL) reader->threads(from, names);
+    return toJavaArray(env, names);
 }
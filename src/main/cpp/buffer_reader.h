@@ -3,57 +3,166 @@
 
 #include <jni.h>
 #include <jvmti.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "globals.h"
 #include "circular_queue.h"
-#include <queue>
-
-using std::string;
-using std::queue;
-using std::vector;
-
-struct ASGCTFrame {
-  long timestamp;
-  long id;
-  string name;
-  string trace;
-
-  ASGCTFrame() {
-      this->timestamp = 0;
-      this->id = 0;
-      this->trace = "";
-  }
-};
-
+#include "metrics.h"
+
+// Memory staged samples may take by default, and the fewest slots a budget is rounded up to
+const size_t kReaderDefaultBudget = 4 * 1024 * 1024;
+const size_t kReaderMinSlots = 16;
+
+// What happens to a sample that finds the staging ring full, or filling up for downsampling
+enum ReaderOverflow { READER_DROP_NEWEST, READER_DROP_OLDEST, READER_DOWNSAMPLE };
+
+// dropNewest, dropOldest or downsample, false for anything else
+bool parseReaderOverflow(const std::string &name, ReaderOverflow &policy);
+
+/**
+ * Records drain writes into ASGCTReader's direct ByteBuffer, in native byte order:
+ * long epoch ms, long java thread id, int thread index, int frame count (an AsyncGetCallTrace
+ * error when not positive) and an int method index per frame, leaf first. Indexes refer to the
+ * thread and method dictionaries, which only grow and are fetched separately.
+ */
+const size_t kReaderRecordHeader = 2 * sizeof(int64_t) + 2 * sizeof(int32_t);
+
+/**
+ * Hands samples to Java code running in the profiled JVM through ASGCTReader. The processor
+ * thread stages samples into preallocated slots of a single producer, single consumer ring,
+ * without locking or allocating. Java threads drain the ring into a direct ByteBuffer as packed
+ * records; they take a lock among themselves, never one the processor waits for. Methods are
+ * named through JVMTI once, when Java first asks for the dictionary entry.
+ *
+ * The ring takes as many slots of maxFrames frames as fit into the memory budget, so a reader
+ * that stalls costs that much and no more. Once it's full the overflow policy either drops new
+ * samples, overwrites the oldest ones, or drops all but every 2nd, 4th and 8th sample as the
+ * ring passes half, three quarters and seven eighths full, and drops new ones once it's full.
+ */
 class BufferReader : public QueueListener {
-
 public:
-    explicit BufferReader(jvmtiEnv *jvmti) : jvmti_(jvmti), data_size(0) { }
+    struct Counters {
+        long staged;
+        // by the policy, all of them for a full ring but under dropOldest
+        long dropped;
+        // oldest samples given up for newer ones
+        long overwritten;
+        long downsampled;
+    };
+
+    BufferReader(jvmtiEnv *jvmti, int maxFrames, size_t budget = kReaderDefaultBudget,
+                 ReaderOverflow policy = READER_DROP_NEWEST);
+
+    virtual ~BufferReader() {
+    }
+
+    // Producer side, called by the processor for every sample
+    virtual void record(const timespec &ts, const JVMPI_CallTrace &trace, ThreadBucketPtr info = ThreadBucketPtr(nullptr));
 
-    int size();
+    // Writes as many whole records as fit into out and returns their size. When not even the
+    // first one fits, returns the negated size it needs and leaves it staged.
+    long drain(char *out, size_t capacity);
 
-    bool empty();
+    // Struct of arrays drain for aggregators, see ASGCTReader.drainArrays. Fills in up to
+    // maxSamples timestamps, java thread ids and stack ids, a negative stack id being the
+    // AsyncGetCallTrace error stackId + 1. Stacks first drained by this call take the next ids
+    // in order: offsets[0] is their count and the k-th of them has the method indexes from
+    // frames[offsets[k + 1]] up to frames[offsets[k + 2]]. Returns the samples drained, or the
+    // negated frames the first sample's stack needs when they don't fit.
+    long drainArrays(jlong *timestamps, jlong *threadIds, jlong *stackIds, size_t maxSamples,
+                     jlong *frames, size_t maxFrames, jlong *offsets, size_t maxOffsets);
 
-    virtual void record(const timespec &ts, const JVMPI_CallTrace &trace, ThreadBucketPtr info = ThreadBucketPtr(nullptr));
+    // Names of the methods, and threads, from index from on that drained records refer to
+    void methods(int from, std::vector<std::string> &names);
 
-    ASGCTFrame pop();
+    void threads(int from, std::vector<std::string> &names);
 
+    size_t size() const;
+
+    size_t capacity() const { return slots.size(); }
+
+    Counters counters() const;
+
+    // Prometheus text format, see ProfilerMetrics
+    void writeMetrics(std::ostream &out) const;
+
+protected:
+    // package.Class.method, false if it can't be named
+    virtual bool methodName(jmethodID method, std::string &name);
 
 private:
+    struct Slot {
+        int64_t timestamp;
+        int64_t jid;
+        char name[kThreadNameMax];
+        int32_t numFrames;
+        jmethodID *frames;
+    };
+
     jvmtiEnv *const jvmti_;
+    const int maxFrames_;
+    const ReaderOverflow policy_;
 
-    std::atomic<int> data_size;
+    std::vector<Slot> slots;
+    std::vector<jmethodID> frames;
 
-    queue<long> timestamps;
-    queue<long> ids;
-    queue<string> names;
-    queue<vector<jmethodID>> traces;
+    // the processor's and the readers' index, each on a cache line of its own
+    char padding0[kCacheLineSize];
+    std::atomic<size_t> head;
+    char padding1[kCacheLineSize];
+    std::atomic<size_t> tail;
+    char padding2[kCacheLineSize];
 
-    string lookUpMethod(jmethodID);
+    // producer side
+    std::atomic_long staged;
+    std::atomic_long dropped;
+    std::atomic_long overwritten;
+    std::atomic_long downsampled;
+    unsigned long sequence;
+
+    // consumer side, under drainLock
+    std::mutex drainLock;
+    // the slot being drained, copied out before it's released as the producer may overwrite it
+    Slot draining;
+    std::vector<jmethodID> drainingFrames;
+    std::unordered_map<jmethodID, int32_t> methodIndexes;
+    std::vector<jmethodID> methodIds;
+    std::vector<std::string> methodNames;
+    std::unordered_map<int64_t, int32_t> threadIndexes;
+    std::vector<std::string> threadNames;
+    // stacks as their method indexes, for drainArrays
+    std::unordered_map<std::string, int64_t> stackIds;
+
+    static size_t slotsFor(size_t budget, int maxFrames);
+
+    size_t downsampleStride(size_t queued) const;
+
+    bool peek(size_t &index);
+
+    bool release(size_t index);
+
+    int32_t methodIndex(jmethodID method);
+
+    int32_t threadIndex(const Slot &slot);
+
+    DISALLOW_COPY_AND_ASSIGN(BufferReader);
 };
 
-extern void setReader(JNIEnv *, BufferReader *);
+extern "C" JNIEXPORT jint JNICALL Java_asgct_ASGCTReader_drain(JNIEnv *, jclass, jobject);
+
+extern "C" JNIEXPORT jint JNICALL Java_asgct_ASGCTReader_drainArrays(JNIEnv *, jclass, jlongArray, jlongArray,
+                                                                     jlongArray, jlongArray, jlongArray);
+
+extern "C" JNIEXPORT jobjectArray JNICALL Java_asgct_ASGCTReader_methods(JNIEnv *, jclass, jint);
 
-extern BufferReader *fetchReader(JNIEnv *);
+extern "C" JNIEXPORT jobjectArray JNICALL Java_asgct_ASGCTReader_threads(JNIEnv *, jclass, jint);
 
-extern "C" JNIEXPORT jstring JNICALL Java_asgct_ASGCTReader_pop(JNIEnv *, jclass);
+extern "C" JNIEXPORT jlongArray JNICALL Java_asgct_ASGCTReader_counters(JNIEnv *, jclass);
 
 #endif // BUFFER_READER_H
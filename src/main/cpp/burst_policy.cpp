@@ -0,0 +1,78 @@
+#include "burst_policy.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+TRACE_DEFINE_BEGIN(Burst, kTraceBurstTotal)
+    TRACE_DEFINE("burst started by process cpu")
+    TRACE_DEFINE("burst started on request")
+TRACE_DEFINE_END(Burst, kTraceBurstTotal);
+
+std::atomic<unsigned long> BurstPolicy::requests(0);
+
+BurstPolicy::BurstPolicy(const ConfigurationOptions &conf)
+        : burstInterval_(conf.burstInterval > 0 ? conf.burstInterval : 0),
+          burstMillis_(conf.burstSeconds > 0 ? conf.burstSeconds * 1000L : DEFAULT_BURST_SECONDS * 1000L),
+          cpuThreshold_(conf.burstCpuThreshold),
+          burstUntil_(0), lastCheck_(-1), lastCpu_(-1),
+          // requests made before this policy existed were meant for its predecessor
+          seenRequests_(requests.load(std::memory_order_relaxed)) {
+}
+
+void BurstPolicy::requestBurst() {
+    requests.fetch_add(1, std::memory_order_relaxed);
+}
+
+int BurstPolicy::interval(long nowMillis) {
+    if (!enabled()) return 0;
+
+    unsigned long pending = requests.load(std::memory_order_relaxed);
+    if (pending != seenRequests_) {
+        seenRequests_ = pending;
+        TRACE(Burst, kTraceBurstRequested);
+        startBurst(nowMillis);
+    }
+
+    if (cpuThreshold_ > 0 && (lastCheck_ < 0 || nowMillis - lastCheck_ >= kBurstCpuCheckPeriod)) {
+        long cpuMillis = processCpuMillis();
+        if (cpuMillis >= 0) observeCpu(nowMillis, cpuMillis);
+    }
+
+    return nowMillis < burstUntil_ ? burstInterval_ : 0;
+}
+
+void BurstPolicy::observeCpu(long nowMillis, long cpuMillis) {
+    if (lastCheck_ >= 0 && nowMillis > lastCheck_) {
+        long percent = (cpuMillis - lastCpu_) * 100 / (nowMillis - lastCheck_);
+        if (cpuThreshold_ > 0 && percent >= cpuThreshold_) {
+            if (nowMillis >= burstUntil_) TRACE(Burst, kTraceBurstCpu);
+            startBurst(nowMillis); // keeps extending while the process stays hot
+        }
+    }
+    lastCheck_ = nowMillis;
+    lastCpu_ = cpuMillis;
+}
+
+void BurstPolicy::startBurst(long nowMillis) {
+    burstUntil_ = nowMillis + burstMillis_;
+}
+
+long BurstPolicy::processCpuMillis() {
+    static const long ticksPerSecond = sysconf(_SC_CLK_TCK);
+
+    char buf[1024];
+    FILE *stat = fopen("/proc/self/stat", "r");
+    if (stat == NULL) return -1;
+    size_t length = fread(buf, 1, sizeof(buf) - 1, stat);
+    fclose(stat);
+    buf[length] = '\0';
+
+    // the command name may contain spaces, fields are counted from the closing paren
+    const char *fields = strrchr(buf, ')');
+    unsigned long utime, stime;
+    if (fields == NULL || ticksPerSecond <= 0 ||
+        sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        return -1;
+    }
+    return (long) ((utime + stime) * 1000 / ticksPerSecond);
+}
@@ -0,0 +1,60 @@
+#ifndef BURST_POLICY_H
+#define BURST_POLICY_H
+
+#include <atomic>
+
+#include "globals.h"
+
+#include "trace.h"
+
+const int kTraceBurstTotal = 2;
+
+const int kTraceBurstCpu = 0;
+const int kTraceBurstRequested = 1;
+
+TRACE_DECLARE(Burst, kTraceBurstTotal);
+
+// How often process CPU is read from /proc/self/stat while looking for a burst threshold
+const long kBurstCpuCheckPeriod = 1000;
+
+/**
+ * Decides when the processor switches from its baseline sampling interval to a short burst
+ * interval. A burst lasts burstSeconds and is started either by process CPU reaching
+ * burstCpuThreshold percent of one core, or by requestBurst() (Agent.trigger() from Java).
+ * Only the processing thread calls into it, requestBurst() may be called from anywhere.
+ */
+class BurstPolicy {
+public:
+    explicit BurstPolicy(const ConfigurationOptions &conf);
+
+    bool enabled() const { return burstInterval_ > 0; }
+
+    // Sampling interval in ms while a burst is on, 0 while on the baseline
+    int interval(long nowMillis);
+
+    // Feeds a process CPU time reading, taken at nowMillis
+    void observeCpu(long nowMillis, long cpuMillis);
+
+    static void requestBurst();
+
+    // user + system time of this process in ms, -1 if /proc/self/stat can't be read
+    static long processCpuMillis();
+
+private:
+    const int burstInterval_;
+    const long burstMillis_;
+    const int cpuThreshold_;
+
+    long burstUntil_;
+    long lastCheck_;
+    long lastCpu_;
+    unsigned long seenRequests_;
+
+    static std::atomic<unsigned long> requests;
+
+    void startBurst(long nowMillis);
+
+    DISALLOW_COPY_AND_ASSIGN(BurstPolicy);
+};
+
+#endif // BURST_POLICY_H
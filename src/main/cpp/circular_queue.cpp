@@ -1,4 +1,7 @@
 #include "circular_queue.h"
+#include "error_histogram.h"
+#include "metrics.h"
+#include "sample_stream.h"
 #include <iostream>
 #include <unistd.h>
 
@@ -16,6 +19,7 @@ bool CircularQueue::push(const timespec &ts, const JVMPI_CallTrace &item, Thread
         currentInput = input.load(std::memory_order_relaxed);
         nextInput = advance(currentInput);
         if (output.load(std::memory_order_relaxed) == nextInput) {
+            Metrics.queueDrops.fetch_add(1, std::memory_order_relaxed);
             return false;
         }
         // TODO: have someone review the memory ordering constraints
@@ -25,6 +29,7 @@ bool CircularQueue::push(const timespec &ts, const JVMPI_CallTrace &item, Thread
     buffer[currentInput].tspec.tv_nsec = ts.tv_nsec;
     buffer[currentInput].info = std::move(info);
     buffer[currentInput].is_committed.store(COMMITTED, std::memory_order_release);
+    Metrics.queuePushes.fetch_add(1, std::memory_order_relaxed);
 
     return true;
 }
@@ -57,6 +62,10 @@ bool CircularQueue::pop() {
         usleep(1);
     }
 
+    size_t queued = (input.load(std::memory_order_relaxed) + Capacity - current_output) % Capacity;
+    Metrics.popped(buffer[current_output].tspec.tv_sec, queued);
+    ErrorHistogram::instance().record(buffer[current_output].trace, buffer[current_output].info);
+    SampleStream::instance().record(buffer[current_output].tspec, buffer[current_output].trace, buffer[current_output].info);
     listener_.record(buffer[current_output].tspec, buffer[current_output].trace, std::move(buffer[current_output].info));
     
     // 0 out all frames so the next write is clean
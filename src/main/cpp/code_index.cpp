@@ -0,0 +1,159 @@
+#include "code_index.h"
+
+#include <algorithm>
+#include <map>
+
+TRACE_DEFINE_BEGIN(CodeIndex, kTraceCodeIndexTotal)
+    TRACE_DEFINE("code ranges added")
+    TRACE_DEFINE("code ranges removed")
+    TRACE_DEFINE("snapshots merged")
+    TRACE_DEFINE("pcs attributed")
+TRACE_DEFINE_END(CodeIndex, kTraceCodeIndexTotal);
+
+CodeIndex &CodeIndex::instance() {
+    static CodeIndex index;
+    return index;
+}
+
+CodeIndex::CodeIndex() : current(new Snapshot()), readers(0) {
+}
+
+CodeIndex::~CodeIndex() {
+    for (size_t i = 0; i < retired.size(); i++) {
+        delete retired[i];
+    }
+    delete current.load(std::memory_order_relaxed);
+}
+
+void CodeIndex::addMethod(jmethodID method, const void *address, jint length) {
+    if (method == NULL || length <= 0) return;
+
+    CodeRange range = {(uintptr_t) address, (uintptr_t) address + length, method, NULL};
+    std::lock_guard<std::mutex> guard(lock);
+    append(range);
+    TRACE(CodeIndex, kTraceCodeIndexAdded);
+}
+
+void CodeIndex::addStub(const char *name, const void *address, jint length) {
+    if (length <= 0) return;
+
+    std::lock_guard<std::mutex> guard(lock);
+    const char *interned = stubNames.insert(name ? name : "").first->c_str();
+    CodeRange range = {(uintptr_t) address, (uintptr_t) address + length, NULL, interned};
+    append(range);
+    TRACE(CodeIndex, kTraceCodeIndexAdded);
+}
+
+void CodeIndex::remove(const void *address) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    // the removal has to cover the range, readers only see the pc
+    CodeRange range;
+    if (!current.load(std::memory_order_relaxed)->find((uintptr_t) address, range) ||
+        range.start != (uintptr_t) address) {
+        return;
+    }
+    range.method = NULL;
+    range.stub = NULL;
+    append(range);
+    TRACE(CodeIndex, kTraceCodeIndexRemoved);
+}
+
+bool CodeIndex::find(uintptr_t pc, CodeRange &range) {
+    readers.fetch_add(1, std::memory_order_seq_cst);
+    bool found = current.load(std::memory_order_seq_cst)->find(pc, range);
+    readers.fetch_sub(1, std::memory_order_release);
+
+    if (found) TRACE(CodeIndex, kTraceCodeIndexFound);
+    return found;
+}
+
+size_t CodeIndex::size() {
+    std::lock_guard<std::mutex> guard(lock);
+    return current.load(std::memory_order_relaxed)->sorted.size();
+}
+
+bool CodeIndex::Snapshot::find(uintptr_t pc, CodeRange &range) const {
+    for (int i = pendingCount.load(std::memory_order_acquire) - 1; i >= 0; i--) {
+        if (pending[i].start <= pc && pc < pending[i].end) {
+            range = pending[i];
+            return range.method != NULL || range.stub != NULL;
+        }
+    }
+
+    CodeRange key = {pc, 0, NULL, NULL};
+    auto it = std::upper_bound(sorted.begin(), sorted.end(), key,
+                               [](const CodeRange &a, const CodeRange &b) { return a.start < b.start; });
+    if (it == sorted.begin() || pc >= (--it)->end) return false;
+    range = *it;
+    return true;
+}
+
+// Called with the lock held
+void CodeIndex::append(const CodeRange &range) {
+    Snapshot *snapshot = current.load(std::memory_order_relaxed);
+    if (snapshot->pendingCount.load(std::memory_order_relaxed) == kCodeIndexPendingSize) {
+        merge();
+        snapshot = current.load(std::memory_order_relaxed);
+    }
+
+    int count = snapshot->pendingCount.load(std::memory_order_relaxed);
+    snapshot->pending[count] = range;
+    snapshot->pendingCount.store(count + 1, std::memory_order_release);
+}
+
+// Called with the lock held, folds the pending changes into a new snapshot and swaps it in
+void CodeIndex::merge() {
+    Snapshot *old = current.load(std::memory_order_relaxed);
+
+    // the newest change for each start address
+    std::map<uintptr_t, CodeRange> changes;
+    int count = old->pendingCount.load(std::memory_order_relaxed);
+    for (int i = 0; i < count; i++) {
+        changes[old->pending[i].start] = old->pending[i];
+    }
+
+    Snapshot *next = new Snapshot();
+    std::vector<CodeRange> &out = next->sorted;
+    std::vector<bool> fresh;
+    out.reserve(old->sorted.size() + changes.size());
+    fresh.reserve(old->sorted.size() + changes.size());
+
+    auto push = [&](const CodeRange &range, bool changed) {
+        if (range.method == NULL && range.stub == NULL) return;
+        // code unloaded without an event, an overlapping change wins over what was there
+        while (!out.empty() && out.back().end > range.start) {
+            if (fresh.back() && !changed) return;
+            out.pop_back();
+            fresh.pop_back();
+        }
+        out.push_back(range);
+        fresh.push_back(changed);
+    };
+
+    auto change = changes.begin();
+    for (size_t i = 0; i < old->sorted.size(); i++) {
+        const CodeRange &range = old->sorted[i];
+        for (; change != changes.end() && change->first < range.start; ++change) {
+            push(change->second, true);
+        }
+        // replaced or removed, the change itself is pushed above
+        if (change != changes.end() && change->first == range.start) continue;
+        push(range, false);
+    }
+    for (; change != changes.end(); ++change) {
+        push(change->second, true);
+    }
+
+    current.store(next, std::memory_order_seq_cst);
+    retired.push_back(old);
+    TRACE(CodeIndex, kTraceCodeIndexMerged);
+
+    // a reader arriving from here on can only see the new snapshot
+    if (readers.load(std::memory_order_seq_cst) == 0) {
+        for (size_t i = 0; i < retired.size(); i++) {
+            delete retired[i];
+        }
+        retired.clear();
+    }
+}
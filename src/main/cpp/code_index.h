@@ -0,0 +1,93 @@
+#ifndef CODE_INDEX_H
+#define CODE_INDEX_H
+
+#include <stdint.h>
+#include <jvmti.h>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "globals.h"
+
+#include "trace.h"
+
+const int kTraceCodeIndexTotal = 4;
+
+const int kTraceCodeIndexAdded = 0;
+const int kTraceCodeIndexRemoved = 1;
+const int kTraceCodeIndexMerged = 2;
+const int kTraceCodeIndexFound = 3;
+
+TRACE_DECLARE(CodeIndex, kTraceCodeIndexTotal);
+
+// Changes a snapshot takes before they are merged into a new one
+const int kCodeIndexPendingSize = 256;
+
+struct CodeRange {
+    uintptr_t start;
+    uintptr_t end;
+    // the compiled method, NULL for a stub
+    jmethodID method;
+    // interned name of a stub, NULL for a compiled method. Both NULL marks a removed range.
+    const char *stub;
+};
+
+/**
+ * Address ranges of JIT compiled methods and VM stubs, fed by the CompiledMethodLoad,
+ * CompiledMethodUnload and DynamicCodeGenerated events, so that a pc AsyncGetCallTrace
+ * couldn't walk from can still be attributed.
+ *
+ * Readers search an immutable sorted snapshot, then the changes appended to it since it was
+ * published, newest first. Once those fill up, a writer merges them into a new snapshot and
+ * swaps it in. Lookups don't lock or allocate and can run in a signal handler; retired
+ * snapshots are freed by a later writer once it sees no reader in flight.
+ */
+class CodeIndex {
+public:
+    static CodeIndex &instance();
+
+    void addMethod(jmethodID method, const void *address, jint length);
+
+    void addStub(const char *name, const void *address, jint length);
+
+    void remove(const void *address);
+
+    // Async-signal-safe
+    bool find(uintptr_t pc, CodeRange &range);
+
+    // Ranges in the current snapshot, pending changes excluded
+    size_t size();
+
+    CodeIndex();
+
+    ~CodeIndex();
+
+private:
+    struct Snapshot {
+        std::vector<CodeRange> sorted;
+        CodeRange pending[kCodeIndexPendingSize];
+        std::atomic_int pendingCount;
+
+        Snapshot() : pendingCount(0) {
+        }
+
+        bool find(uintptr_t pc, CodeRange &range) const;
+    };
+
+    std::mutex lock;
+    std::atomic<Snapshot *> current;
+    std::atomic_int readers;
+    std::vector<Snapshot *> retired;
+    // stub names outlive the DynamicCodeGenerated callback, std::set keeps them in place
+    std::set<std::string> stubNames;
+
+    void append(const CodeRange &range);
+
+    void merge();
+
+    DISALLOW_COPY_AND_ASSIGN(CodeIndex);
+};
+
+#endif // CODE_INDEX_H
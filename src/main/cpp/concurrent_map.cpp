@@ -19,24 +19,120 @@ TRACE_DEFINE_BEGIN(LFMap, kTraceLFMapTotal)
     TRACE_DEFINE("[LockFreeMapProvider::remove] Remove value race detected (giving up)")
     TRACE_DEFINE("[LockFreeMapProvider::migrationStart#1] Conflicting migration found")
     TRACE_DEFINE("[LockFreeMapProvider::migrationStart#2] Conflicting migration found")
-    TRACE_DEFINE("[Migration::run] Can't participate in job that already ended")
+    TRACE_DEFINE("[Migration::run] Can't help a job that already ended")
     TRACE_DEFINE("[Migration::run] Migration interrupted by end of job")
     TRACE_DEFINE("[Migration::run] Overflow detected during migration")
     TRACE_DEFINE("[Migration::run] Data was migrated completely")
     TRACE_DEFINE("[Migration::run] No more blocks to migrate")
-    TRACE_DEFINE("[Migration::run] Not the last thread")
+    TRACE_DEFINE("[Migration::run] Not the last thread, or out of budget")
     TRACE_DEFINE("[Migration::run] Publishing successful migration")
     TRACE_DEFINE("[Migration::run] Starting successful overflow migration")
     TRACE_DEFINE("[Migration::run] Overflow migration already started before")
-    TRACE_DEFINE("[Migration::migrateRange] Unallocated cell migration flag")
+    TRACE_DEFINE("[Migration::migrateRange] Unallocated cell moved by an overflowed migration")
     TRACE_DEFINE("[Migration::migrateRange] Unallocated cell insert race")
     TRACE_DEFINE("[Migration::migrateRange] Allocated cell value insert race")
-    TRACE_DEFINE("[Migration::migrateRange] Allocated cell migration flag")
+    TRACE_DEFINE("[Migration::migrateRange] Allocated cell moved by an overflowed migration")
     TRACE_DEFINE("[Migration::migrateRange] Destination insert overflow when migrating a bucket")
-    TRACE_DEFINE("[Migration::migrateRange] Racing erase when migrating allocated bucket")
+    TRACE_DEFINE("[Migration::migrateRange] Racing write or erase after the bucket was copied")
+    TRACE_DEFINE("[LockFreeMapPrimitives::findForward] Read followed a migration")
 TRACE_DEFINE_END(LFMap, kTraceLFMapTotal);
 
-const GC::EpochType GC::kEpochInitial = -1;
+const GC::EpochType GC::kEpochInitial = nullptr;
+
+GC::EpochType GC::attachThread() {
+	Slot *slot;
+	// recycle a slot left by a detached thread before growing the list
+	for (slot = slots.load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+		bool expected = false;
+		if (!slot->inUse.load(std::memory_order_relaxed) &&
+				slot->inUse.compare_exchange_strong(expected, true, std::memory_order_seq_cst))
+			break;
+	}
+
+	if (slot == nullptr) {
+		slot = new Slot();
+		slot->next = slots.load(std::memory_order_relaxed);
+		while (!slots.compare_exchange_weak(slot->next, slot, std::memory_order_acq_rel));
+	}
+	// a fresh thread holds no references yet, it reads once it enters a section
+	slot->epoch.store(kQuiescent, std::memory_order_seq_cst);
+	return slot;
+}
+
+void GC::detachThread(EpochType &localEpoch) {
+	exit(localEpoch);
+	localEpoch->inUse.store(false, std::memory_order_seq_cst);
+	localEpoch = kEpochInitial;
+
+	// garbage only waits for the remaining sections now, two epochs cover all of it
+	collect();
+}
+
+// Lock-free and async-signal-safe, moves the global epoch on if every section has seen it
+bool GC::tryAdvance() {
+	unsigned long current = globalEpoch.load(std::memory_order_seq_cst);
+	// shared readers of the previous epoch share the next one's parity
+	if (shared[(current + 1) & 1].load(std::memory_order_seq_cst) != 0)
+		return false;
+	for (Slot *slot = slots.load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+		unsigned long epoch = slot->epoch.load(std::memory_order_seq_cst);
+		if (slot->inUse.load(std::memory_order_seq_cst) && epoch != kQuiescent && epoch != current)
+			return false;
+	}
+	return globalEpoch.compare_exchange_strong(current, current + 1, std::memory_order_seq_cst);
+}
+
+void GC::reclaimJob(Retired *node) {
+	JobGarbage *garbage = static_cast<JobGarbage*>(node);
+	delete garbage->job;
+	delete garbage;
+#ifdef DEBUG_MAP_GC
+	DefaultGC.statsRemoved++;
+#endif
+}
+
+void GC::pushPending(Retired *first, Retired *last) {
+	last->next = pending.load(std::memory_order_relaxed);
+	while (!pending.compare_exchange_weak(last->next, first, std::memory_order_release));
+}
+
+// Takes the whole pending list, frees what is old enough and puts the rest back
+void GC::reclaim() {
+	Retired *list = pending.exchange(nullptr, std::memory_order_acquire);
+	if (list == nullptr)
+		return;
+
+	unsigned long current = globalEpoch.load(std::memory_order_seq_cst);
+	Retired *keepFirst = nullptr, *keepLast = nullptr;
+	while (list != nullptr) {
+		Retired *garbage = list;
+		list = list->next;
+
+		if (garbage->epoch + 2 <= current) {
+			garbage->reclaim(garbage);
+			Metrics.gcReclaimed.fetch_add(1, std::memory_order_relaxed);
+		} else {
+			garbage->next = keepFirst;
+			keepFirst = garbage;
+			if (keepLast == nullptr)
+				keepLast = garbage;
+		}
+	}
+
+	if (keepFirst != nullptr)
+		pushPending(keepFirst, keepLast);
+}
+
+GC::~GC() {
+	Retired *list = pending.exchange(nullptr, std::memory_order_acquire);
+	while (list != nullptr) {
+		Retired *garbage = list;
+		list = list->next;
+		garbage->reclaim(garbage);
+		Metrics.gcReclaimed.fetch_add(1, std::memory_order_relaxed);
+	}
+	// slots are left alone, threads detaching during shutdown may still write to them
+}
 
 GC DefaultGC;
 }
\ No newline at end of file
@@ -21,7 +21,10 @@
 #endif
 
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <cassert>
+#include <type_traits>
 
 #if __cplusplus < 201103L 
 #	define nullptr NULL
@@ -30,11 +33,12 @@
 #include <vector>
 #include <mutex>
 
+#include "metrics.h"
 #include "trace.h"
 
 namespace map {
 
-const int kTraceLFMapTotal = 31;
+const int kTraceLFMapTotal = 32;
 TRACE_DECLARE(LFMap, kTraceLFMapTotal);
 
 // Configurable parameters
@@ -43,6 +47,7 @@ const int kMaxJumpsAllowed = 8;
 const int kMigrationChunkSize = 32;
 const int kSizeMin = 32; // min size of hash map
 const int kMaxSampleSize = 256;
+const int kMigrationStepChunks = 4; // chunks a writer migrates before it gets back to its own write
 
 typedef void* KeyType;
 typedef int64_t HashType;
@@ -113,22 +118,11 @@ public:
 		return job_load(std::memory_order_acquire);
 	}
 
-	void participate() {
-		Job *prevJob = nullptr;
-		while (true) {
-			Job *cjob = job_load(std::memory_order_acquire);
-			if (cjob == prevJob) { // this job is done, wait for a new job
-				while (true) {
-					cjob = job_load(std::memory_order_acquire);
-					if (cjob != prevJob)
-						break;
-					sched_yield();
-				}
-			}
-			if (cjob == (Job*)-1) return;
+	// runs a bounded share of the current job, never waits for it to finish
+	void help() {
+		Job *cjob = job_load(std::memory_order_acquire);
+		if (cjob != nullptr && cjob != (Job*)-1)
 			cjob->run();
-			prevJob = cjob;
-		}
 	}
 
 	void end() {
@@ -151,11 +145,14 @@ struct HashTable {
 	std::atomic_int freeBuckets;
 	std::mutex mutex; // for allocation guard
 	JobCoordinator coordinator; // migration coordinator
+	// Table that entries are copied to once they're marked MapValMove, set before the first one
+	// is. Entries that were not moved by the migration that set it went further down the chain.
+	std::atomic<HashTable*> next;
 
 	HashTable(size_t initialSize) : 
 			  sizeMask(std::max(nearestPow2(initialSize), kSizeMin) - 1),
 			  array(new LockFreeMapEntry[sizeMask + 1]),
-			  freeBuckets(0.75 * (sizeMask + 1)) {
+			  freeBuckets(0.75 * (sizeMask + 1)), next(nullptr) {
 		for (int i = 0; i < sizeMask + 1; i++) {
 			array[i].hash = MapHashEmpty;
 			array[i].value = MapValEmpty;
@@ -172,102 +169,157 @@ struct HashTable {
 	}
 };
 
+/**
+ * Epoch based reclamation without locks. Readers mark their read-side sections: an attached
+ * thread publishes the global epoch in its own slot when it enters one and clears it when it
+ * exits, readers without a slot, signal handlers of unattached threads among them, count
+ * themselves under the epoch's parity in counters every such reader shares. The global epoch moves on once every reader inside a section has seen it,
+ * threads outside of one never hold it back however long they stay idle. Garbage scheduled
+ * during epoch E is freed once the global epoch reaches E + 2, since by then every section that
+ * could have reached it has exited. Frees happen outside of any lock, by whichever thread
+ * reclaims first.
+ */
 class GC {
+public:
+	// Intrusive link for objects handed to the GC, reclaim runs once no reader can reach them
+	struct Retired {
+		Retired *next;
+		unsigned long epoch; // global epoch when it was retired
+		void (*reclaim)(Retired *node);
+	};
+
 private:
-	std::mutex mutex;
-	int totalThreads;
-	std::atomic_int globalEpoch;
-	std::atomic_int remaining;
-	std::vector<JobCoordinator::Job*> recentGarbage;
-	std::vector<JobCoordinator::Job*> oldGarbage;
+	// a slot's epoch while its thread is outside of any read-side section
+	static const unsigned long kQuiescent = 0;
 
-#ifdef DEBUG_MAP_GC
-public:
-	int statsScheduled;
-	int statsRemoved;
-#endif
+	struct Slot {
+		std::atomic<unsigned long> epoch;
+		std::atomic_bool inUse;
+		Slot *next; // immutable once published, slots are only freed with the GC
+
+		Slot() : epoch(kQuiescent), inUse(true), next(nullptr) {}
+	};
+
+	struct JobGarbage : Retired {
+		JobCoordinator::Job *job;
+	};
+
+	std::atomic<unsigned long> globalEpoch;
+	std::atomic<Slot*> slots;
+	std::atomic<Retired*> pending;
+	// readers inside a section without a slot, by the parity of the epoch they entered in
+	std::atomic_long shared[2];
+
+	bool tryAdvance();
+
+	void reclaim();
+
+	void pushPending(Retired *first, Retired *last);
+
+	static void reclaimJob(Retired *node);
 
-	void newEpoch() { // within mutex
 #ifdef DEBUG_MAP_GC
-		statsRemoved += oldGarbage.size();
+public:
+	std::atomic_int statsScheduled;
+	std::atomic_int statsRemoved;
 #endif
-		for (std::vector<JobCoordinator::Job*>::iterator it = oldGarbage.begin() ; it != oldGarbage.end(); ++it) {
-			delete *it;
-		}
-		oldGarbage.clear();
-		recentGarbage.swap(oldGarbage);
-		remaining.store(totalThreads, std::memory_order_relaxed);
-		globalEpoch.fetch_add(1, std::memory_order_release);
-	}
 
 public:
-	typedef unsigned int EpochType;
+	typedef Slot* EpochType;
 	static const EpochType kEpochInitial;
 
-	GC() : totalThreads(0), globalEpoch(1), remaining(0) {
+	GC() : globalEpoch(1), slots(nullptr), pending(nullptr) {
+		shared[0] = 0;
+		shared[1] = 0;
 #ifdef DEBUG_MAP_GC
 		statsScheduled = 0;
 		statsRemoved = 0;
 #endif
 	}
 
-	EpochType attachThread() {
-		std::lock_guard<std::mutex> guard(mutex);
-		totalThreads++;
-		remaining.fetch_add(1, std::memory_order_relaxed);
-		return globalEpoch.load(std::memory_order_relaxed) - 1; // force thread to move to global epoch at least once
+	EpochType attachThread();
+
+	void detachThread(EpochType &localEpoch);
+
+	/* starts a read-side section on the thread's slot, lock-free and async-signal-safe */
+	void enter(EpochType localEpoch) {
+		localEpoch->epoch.store(globalEpoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
 	}
 
-	void detachThread(EpochType &localEpoch) {
-		std::lock_guard<std::mutex> guard(mutex);
-		totalThreads--;
-		int rem;
-		if (localEpoch < globalEpoch) {
-			rem = remaining.fetch_sub(1, std::memory_order_relaxed) - 1;
-		} else {
-			rem = remaining.load(std::memory_order_relaxed);
-		}
-		if (rem == 0) 
-			newEpoch();
-		localEpoch = kEpochInitial;
+	void exit(EpochType localEpoch) {
+		localEpoch->epoch.store(kQuiescent, std::memory_order_seq_cst);
 	}
 
-	void safepoint(EpochType &localEpoch) {
-		std::lock_guard<std::mutex> guard(mutex);
-		int rem;
+	/* enter() unless the thread is inside a section already, which then covers this one too;
+	   only the outermost one exits. Async-signal-safe, a handler nesting a section into the
+	   thread's sees its slot either before or after the thread's own store. */
+	bool enterOutermost(EpochType localEpoch) {
+		if (localEpoch->epoch.load(std::memory_order_relaxed) != kQuiescent)
+			return false;
+		enter(localEpoch);
+		return true;
+	}
 
-		if (localEpoch < globalEpoch) {
-			localEpoch = globalEpoch;
-			rem = remaining.fetch_sub(1, std::memory_order_relaxed) - 1;
-		} else {
-			rem = remaining.load(std::memory_order_relaxed);
+	/* starts a read-side section for a reader without a slot, lock-free and async-signal-safe,
+	   exitShared takes what it returned */
+	unsigned long enterShared() {
+		while (true) {
+			unsigned long epoch = globalEpoch.load(std::memory_order_seq_cst);
+			shared[epoch & 1].fetch_add(1, std::memory_order_seq_cst);
+			if (globalEpoch.load(std::memory_order_seq_cst) == epoch)
+				return epoch;
+			// moved on meanwhile, we may be counted under the parity of a later epoch
+			shared[epoch & 1].fetch_sub(1, std::memory_order_seq_cst);
 		}
-		if (rem == 0)
-			newEpoch();
 	}
 
-	/* for reads within signal handler */
+	void exitShared(unsigned long epoch) {
+		shared[epoch & 1].fetch_sub(1, std::memory_order_seq_cst);
+	}
+
+	/* a quiescent point within a section, the section goes on in the current epoch */
+	void safepoint(EpochType &localEpoch) {
+		if (localEpoch->epoch.load(std::memory_order_relaxed) != kQuiescent)
+			enter(localEpoch);
+		collect();
+	}
+
+	/* for reads within signal handler, moves the epoch on but never frees */
 	void ss_safepoint(EpochType &localEpoch) {
-		EpochType global = globalEpoch.load(std::memory_order_acquire);
-		if (localEpoch < global) { // no thread can move global epoch since remaining > 0
-			remaining.fetch_sub(1, std::memory_order_relaxed);
-			localEpoch = global;
+		if (localEpoch->epoch.load(std::memory_order_relaxed) != kQuiescent)
+			enter(localEpoch);
+		if (pending.load(std::memory_order_relaxed) != nullptr)
+			tryAdvance();
+	}
+
+	/* frees what no section can reach anymore, never from a signal handler */
+	void collect() {
+		if (pending.load(std::memory_order_relaxed) != nullptr) {
+			if (tryAdvance())
+				tryAdvance();
+			reclaim();
 		}
 	}
 
 	void scheduleDelete(JobCoordinator::Job *successfulMigration) {
-		std::lock_guard<std::mutex> guard(mutex);
 #ifdef DEBUG_MAP_GC
 		statsScheduled++;
 #endif
-		recentGarbage.push_back(successfulMigration);
+		JobGarbage *garbage = new JobGarbage;
+		garbage->job = successfulMigration;
+		garbage->reclaim = &GC::reclaimJob;
+		retire(garbage);
 	}
 
-	~GC() {
-		std::move(recentGarbage.begin(), recentGarbage.end(), std::back_inserter(oldGarbage));
-		recentGarbage.clear();
-		newEpoch();
+	/* lock-free and allocation free, can be called from a signal handler */
+	void retire(Retired *node) {
+		// read after the object was unlinked, so nobody can reach it from a later epoch
+		node->epoch = globalEpoch.load(std::memory_order_seq_cst);
+		pushPending(node, node);
+		Metrics.gcRetired.fetch_add(1, std::memory_order_relaxed);
 	}
+
+	~GC();
 };
 
 extern GC DefaultGC;
@@ -277,7 +329,10 @@ enum InsertOutcome { INSERT_OK, INSERT_OVERFLOW, INSERT_HELP_MIGRATION };
 class LockFreeMapPrimitives {
 public:
 	static HashTable::LockFreeMapEntry *find(HashTable *root, KeyType key, HashFunction hasher) {
-		HashType tHash = hasher(key);
+		return find(root, hasher(key));
+	}
+
+	static HashTable::LockFreeMapEntry *find(HashTable *root, HashType tHash) {
 		int i = tHash & root->sizeMask;
 		while (true) {
 			HashTable::LockFreeMapEntry* entr = root->array + i;
@@ -402,6 +457,63 @@ public:
 		prev->deltaNext.store(MapDeltaEmpty, std::memory_order_release);
 		return INSERT_OVERFLOW; // no free space in neighbourhood
 	}
+
+	/*
+	 * The helpers below follow root->next once tHash was found moved, or not found while a
+	 * migration is running. An entry is copied before it's marked moved, so the first table
+	 * down the chain that holds it unmoved has its current value. Each of them is bounded by
+	 * the length of the chain and never waits for the migration.
+	 */
+	static ValueType findForward(HashTable *root, HashType tHash) {
+		TRACE(LFMap, 31);
+		for (HashTable *t = root->next.load(std::memory_order_acquire); t != nullptr; t = t->next.load(std::memory_order_acquire)) {
+			HashTable::LockFreeMapEntry *entr = find(t, tHash);
+			ValueType value = entr ? entr->value.load(std::memory_order_acquire) : MapValMove;
+			if (value != MapValMove)
+				return value;
+		}
+		return MapValEmpty;
+	}
+
+	static InsertOutcome insertForward(HashTable *root, HashType tHash, ValueType value, ValueType& oldValue) {
+		HashTable *t = root->next.load(std::memory_order_acquire);
+		while (t != nullptr) {
+			HashTable *next = t->next.load(std::memory_order_acquire);
+			HashTable::LockFreeMapEntry *entr = find(t, tHash);
+			if (entr != nullptr) {
+				oldValue = entr->value.load(std::memory_order_acquire);
+				if (oldValue != MapValMove) {
+					if (entr->value.compare_exchange_strong(oldValue, value, std::memory_order_acq_rel))
+						return INSERT_OK;
+					continue; // raced with a write or with the entry being moved, look again
+				}
+			} else if (next == nullptr) { // a new key goes to the last table
+				InsertOutcome res = insertOrUpdate(t, tHash, value, oldValue);
+				if (res != INSERT_HELP_MIGRATION)
+					return res;
+				continue; // moved in the meantime, next is set now
+			}
+			t = next;
+		}
+		return INSERT_HELP_MIGRATION;
+	}
+
+	static ValueType removeForward(HashTable *root, HashType tHash) {
+		for (HashTable *t = root->next.load(std::memory_order_acquire); t != nullptr; t = t->next.load(std::memory_order_acquire)) {
+			HashTable::LockFreeMapEntry *entr = find(t, tHash);
+			ValueType oldValue = entr ? entr->value.load(std::memory_order_acquire) : MapValMove;
+			if (oldValue == MapValEmpty)
+				return MapValEmpty;
+			if (oldValue != MapValMove) {
+				if (entr->value.compare_exchange_strong(oldValue, MapValEmpty, std::memory_order_acq_rel))
+					return oldValue;
+				if (oldValue != MapValMove)
+					return MapValEmpty; // a concurrent write or erase, pretending that value was overwritten
+			}
+			// moved, or never copied to this table
+		}
+		return MapValEmpty;
+	}
 };
 
 class AbstractMapProvider {
@@ -459,6 +571,7 @@ struct Migration : public JobCoordinator::Job {
 		}
 	}
 
+	// migrates at most kMigrationStepChunks chunks, the last one out of a finished job publishes it
 	virtual void run() {
 		int probe = state.load(std::memory_order_relaxed);
 		do {
@@ -468,10 +581,11 @@ struct Migration : public JobCoordinator::Job {
 			}
 		} while (!state.compare_exchange_weak(probe, probe + 2, std::memory_order_relaxed));
 
-		for (int it = 0; it < nSources; it++) {
+		int budget = kMigrationStepChunks;
+		for (int it = 0; it < nSources && budget > 0; it++) {
 			HashTable *table = sources[it].table;
 
-			while (true) {
+			for (; budget > 0; budget--) {
 				if (state.load(std::memory_order_relaxed) & 1) {
 					TRACE(LFMap, 17);
 					goto end_migration;
@@ -499,11 +613,10 @@ struct Migration : public JobCoordinator::Job {
 
 end_migration:
 		int stateProbe = state.fetch_sub(2, std::memory_order_acq_rel); // see all changes
-		if (stateProbe > 3) {
+		if (stateProbe != 3) {
 			TRACE(LFMap, 21);
-			return; // not the last one
+			return; // not the last one, or out of budget with work left for the next writer
 		}
-		assert(stateProbe == 3);
 
 		if (!overflowed.load(std::memory_order_relaxed)) {
 			TRACE(LFMap, 22);
@@ -532,6 +645,7 @@ end_migration:
 				
 				m->unitsRemaining = unitsRemaining + dest->getMigrationSize();
 
+				dest->next.store(m->dest, std::memory_order_release);
 				origTable->coordinator.set(m);
 			} else {
 				TRACE(LFMap, 24);
@@ -539,6 +653,11 @@ end_migration:
 		}
 	}
 
+	/*
+	 * Copies every live entry of the chunk to dest before marking it MapValMove, so that readers
+	 * and writers that find it moved can carry on in dest without waiting. Only the thread that
+	 * claimed the chunk touches an unmoved entry's copy.
+	 */
 	bool migrateRange(HashTable *from, int startIndex) {
 		int last = std::min(startIndex + kMigrationChunkSize, from->sizeMask + 1);
 
@@ -546,52 +665,46 @@ end_migration:
 			HashTable::LockFreeMapEntry *entry = &from->array[index];
 			while (true) {
 				HashType srcHash = entry->hash.load(std::memory_order_relaxed);
-				ValueType srcValue;
+				ValueType srcValue = entry->value.load(std::memory_order_acquire);
 
-				if (srcHash == MapHashEmpty) { // unused cell
-					srcValue = MapValEmpty; // expect null for unused cell value
-					if (entry->value.compare_exchange_strong(srcValue, MapValMove, std::memory_order_relaxed)) {
-						break; // nothing to move to new table
-					} else if (srcValue == MapValMove) {
-						TRACE(LFMap, 25);
-						break; // found previous unfinished migration
-					}
+				if (srcValue == MapValMove) {
+					TRACE(LFMap, srcHash == MapHashEmpty ? 25 : 28);
+					break; // moved by a previous, overflowed migration
+				}
+
+				if (srcHash == MapHashEmpty && srcValue != MapValEmpty) {
 					TRACE(LFMap, 26);
-					// someone placed value to the cell, reread
-				} else { // used cell: deleted or not
-					srcValue = entry->value.load(std::memory_order_relaxed); // we only need a pointer
-					if (srcValue == MapValEmpty) { // deleted cell
-						if (entry->value.compare_exchange_strong(srcValue, MapValMove, std::memory_order_relaxed)) {
-							break; // nothing to move to new table
-						}
-						TRACE(LFMap, 27);
-						// someone placed value to the cell, evacuation required
-					} else if (srcValue == MapValMove) {
-						TRACE(LFMap, 28);
-						break; // found previous unfinished migration
-					}
+					continue; // a cell allocated since its hash was read, reread
+				}
 
-					while (!entry->value.compare_exchange_strong(srcValue, MapValMove, std::memory_order_relaxed)) sched_yield();
-
-					// only 1 thread can migrate bucket at time, so srcValue != MapValMove and srcHash is not in dest
-					if (srcValue != MapValEmpty) {
-						ValueType oldValue;
-						InsertOutcome res = LockFreeMapPrimitives::insertOrUpdate(dest, srcHash, srcValue, oldValue);
-						if (res == INSERT_OVERFLOW) {
-							TRACE(LFMap, 29);
-							entry->value.store(srcValue, std::memory_order_release); // return replaced value
-							return true; // overflow
-						}
-					} else {
-						TRACE(LFMap, 30);
-					}
+				if (srcValue == MapValEmpty) { // unused or deleted cell
+					if (srcHash != MapHashEmpty) // drop the copy of an earlier attempt, if any
+						forget(srcHash);
+					if (entry->value.compare_exchange_strong(srcValue, MapValMove, std::memory_order_acq_rel))
+						break; // nothing to move to new table
+					TRACE(LFMap, srcHash == MapHashEmpty ? 26 : 27);
+					continue; // someone placed value to the cell, reread
+				}
 
-					break; // next element
+				ValueType oldValue;
+				if (LockFreeMapPrimitives::insertOrUpdate(dest, srcHash, srcValue, oldValue) == INSERT_OVERFLOW) {
+					TRACE(LFMap, 29);
+					return true; // overflow, the entry stays where it is
 				}
+				if (entry->value.compare_exchange_strong(srcValue, MapValMove, std::memory_order_acq_rel))
+					break; // next element
+
+				TRACE(LFMap, 30); // written or erased since it was copied, copy again
 			}
 		}
 		return false;
 	}
+
+	void forget(HashType hash) {
+		HashTable::LockFreeMapEntry *copy = LockFreeMapPrimitives::find(dest, hash);
+		if (copy != nullptr)
+			copy->value.store(MapValEmpty, std::memory_order_release);
+	}
 };
 
 /* Hasher assumed to be collision free. */
@@ -661,6 +774,7 @@ private:
 		m->sources[0].index.store(0, std::memory_order_relaxed);
 		m->unitsRemaining = table->getMigrationSize();
 
+		table->next.store(m->dest, std::memory_order_release);
 		table->coordinator.set(m);
 	}
 
@@ -674,64 +788,76 @@ public:
 		delete curr_load(std::memory_order_acquire);
 	}
 
+	/* Writers never wait for a migration. A writer that runs into one migrates a few chunks of
+	   it and then writes where the key lives by now, see LockFreeMapPrimitives::insertForward. */
 	virtual ValueType put(KeyType key, ValueType value) {
+		HashType hash = hasher(key);
 		bool doubleSize = false;
 		while (true) {
 			HashTable *root = curr_load(std::memory_order_acquire);
 			ValueType oldValue;
-			InsertOutcome res = LockFreeMapPrimitives::insertOrUpdate(root, key, value, hasher, oldValue);
+			InsertOutcome res = LockFreeMapPrimitives::insertOrUpdate(root, hash, value, oldValue);
 
 			if (res == INSERT_OK) {
 				return oldValue;
 			} else if (res == INSERT_OVERFLOW) {
 				migrationStart(root, doubleSize);
+				// double the size for the next overflow in a row
+				doubleSize = true;
 			}
 
-			// help migration
-			root->coordinator.participate();
+			root->coordinator.help();
 
-			// double the size for the next overflow in a row
-			doubleSize = true;
+			if (root->next.load(std::memory_order_acquire) != nullptr &&
+				LockFreeMapPrimitives::insertForward(root, hash, value, oldValue) == INSERT_OK) {
+				return oldValue;
+			}
+			// the destination is full as well, it's grown once the migration is published
 		}
 	}
 
-	// this is the only function that can be called from signal handler
+	// this is the only function that can be called from signal handler, it never waits
 	virtual ValueType get(KeyType key) {
-		while (true) {
-			HashTable *root = curr_load(std::memory_order_acquire);
+		HashType hash = hasher(key);
+		HashTable *root = curr_load(std::memory_order_acquire);
 
-			HashTable::LockFreeMapEntry *el = LockFreeMapPrimitives::find(root, key, hasher);
-			ValueType res = el ? el->value.load(std::memory_order_acquire) : MapValEmpty;
+		HashTable::LockFreeMapEntry *el = LockFreeMapPrimitives::find(root, hash);
+		ValueType res = el ? el->value.load(std::memory_order_acquire) : MapValEmpty;
 
-			if (res != MapValMove)
-				return res;
+		if (res != MapValMove && (el != nullptr || root->next.load(std::memory_order_acquire) == nullptr))
+			return res;
 
-			if (!signalSafeReaders)
-				root->coordinator.participate();
-		}
+		// moved, or added to the destination since the migration started
+		if (!signalSafeReaders)
+			root->coordinator.help();
+		return LockFreeMapPrimitives::findForward(root, hash);
 	}
 
 	virtual ValueType remove(KeyType key) {
-		while (true) {
-			HashTable *root = curr_load(std::memory_order_acquire);
+		HashType hash = hasher(key);
+		HashTable *root = curr_load(std::memory_order_acquire);
 
-			HashTable::LockFreeMapEntry *entr = LockFreeMapPrimitives::find(root, key, hasher);
-			if (entr == nullptr) { // not found
+		HashTable::LockFreeMapEntry *entr = LockFreeMapPrimitives::find(root, hash);
+		ValueType oldValue = entr ? entr->value.load(std::memory_order_relaxed) : MapValMove;
+
+		if (oldValue == MapValMove) {
+			if (root->next.load(std::memory_order_acquire) == nullptr) { // not found
 				TRACE(LFMap, 11);
 				return MapValEmpty;
 			}
+			root->coordinator.help();
+			return LockFreeMapPrimitives::removeForward(root, hash);
+		}
 
-			ValueType oldValue = entr->value.load(std::memory_order_relaxed);
-			if (oldValue != MapValMove && entr->value.compare_exchange_strong(oldValue, MapValEmpty, std::memory_order_acquire)) {
-				TRACE(LFMap, 12);
-				return oldValue;
-			} else if (oldValue != MapValMove) { // CAS failed
-				// there's a concurrent write or erase, giving up and pretending that value was overwritten
-				TRACE(LFMap, 13);
-				return MapValEmpty;
-			}
-			root->coordinator.participate();
+		if (entr->value.compare_exchange_strong(oldValue, MapValEmpty, std::memory_order_acquire)) {
+			TRACE(LFMap, 12);
+			return oldValue;
+		} else if (oldValue == MapValMove) { // moved meanwhile
+			return LockFreeMapPrimitives::removeForward(root, hash);
 		}
+		// there's a concurrent write or erase, giving up and pretending that value was overwritten
+		TRACE(LFMap, 13);
+		return MapValEmpty;
 	}
 
 	// Migration callback, called once per successful migration
@@ -746,17 +872,26 @@ public:
 		return root->sizeMask + 1;
 	}
 
+	// counts the tables of a migration in flight too, exact once no writer is in the middle of one
 	int unsafeUsed() {
 		int size = 0;
 		HashTable *root = curr_load(std::memory_order_acquire);
-		for (int i = 0; i < root->sizeMask + 1; i++) {
-			ValueType value = root->array[i].value.load(std::memory_order_relaxed);
-			if (value != MapValEmpty && value != MapValMove)
-				size++;
+		for (HashTable *t = root; t != nullptr; t = t->next.load(std::memory_order_acquire)) {
+			for (int i = 0; i < t->sizeMask + 1; i++) {
+				ValueType value = t->array[i].value.load(std::memory_order_relaxed);
+				if (value != MapValEmpty && value != MapValMove)
+					size++;
+			}
 		}
 		return size;
 	}
 
+	// a migration of the current table has started and isn't published yet
+	bool unsafeMigrating() {
+		HashTable *root = curr_load(std::memory_order_acquire);
+		return root->next.load(std::memory_order_acquire) != nullptr;
+	}
+
 	int unsafeDirty() {
 		int size = 0;
 		HashTable *root = curr_load(std::memory_order_acquire);
@@ -768,6 +903,101 @@ public:
 	}
 };
 
+/*
+ * Maps a key or value type to the word stored in the table. Pointer-sized types are stored
+ * as they are, so a value can't be nullptr (MapValEmpty) or all ones (MapValMove). Narrower
+ * integral types are shifted and tagged, every value round-trips.
+ */
+template <typename T, bool narrow = (sizeof(T) < sizeof(void*))>
+struct WordCodec {
+	static_assert(sizeof(T) == sizeof(void*), "map words can't hold types wider than a pointer");
+
+	static void* encode(T value) {
+		void *word;
+		memcpy(&word, &value, sizeof(word));
+		return word;
+	}
+
+	static T decode(void *word) {
+		T value;
+		memcpy(&value, &word, sizeof(value));
+		return value;
+	}
+};
+
+template <typename T>
+struct WordCodec<T, true> {
+	static_assert(std::is_integral<T>::value && !std::is_same<T, bool>::value,
+		"only integral types narrower than a pointer can be stored");
+	typedef typename std::make_unsigned<T>::type Bits;
+
+	static void* encode(T value) {
+		return (void*)(((uintptr_t)(Bits)value << 1) | 1);
+	}
+
+	static T decode(void *word) {
+		return (T)(Bits)((uintptr_t)word >> 1);
+	}
+};
+
+/*
+ * Typed front end of ConcurrentMapProvider. Hasher::hash(K) has to be collision free and must
+ * not return MapHashEmpty. find is the only call that is safe from a signal handler, it takes
+ * no references, never waits for a migration and, when signalSafeReaders is set, never helps
+ * one. Values that need reclaiming once removed are the caller's business, see ThreadMapBase.
+ */
+template <typename K, typename V, typename Hasher, bool signalSafeReaders = true>
+class ConcurrentMap {
+private:
+	struct WordHasher {
+		static HashType hash(KeyType key) {
+			return Hasher::hash(WordCodec<K>::decode(key));
+		}
+	};
+
+	ConcurrentMapProvider<WordHasher, signalSafeReaders> map;
+
+	static bool decode(ValueType word, V *value) {
+		if (word == MapValEmpty) return false;
+		if (value != nullptr) *value = WordCodec<V>::decode(word);
+		return true;
+	}
+
+public:
+	explicit ConcurrentMap(size_t initialSize = kSizeMin) : map(initialSize) {}
+
+	ConcurrentMap(const ConcurrentMap&) = delete;
+	ConcurrentMap& operator=(const ConcurrentMap&) = delete;
+
+	// true when it replaced a mapping, whose value is copied into previous
+	bool put(K key, V value, V *previous = nullptr) {
+		ValueType word = WordCodec<V>::encode(value);
+		assert(word != MapValEmpty && word != MapValMove);
+		return decode(map.put(WordCodec<K>::encode(key), word), previous);
+	}
+
+	bool find(K key, V &value) {
+		return decode(map.get(WordCodec<K>::encode(key)), &value);
+	}
+
+	bool contains(K key) {
+		return decode(map.get(WordCodec<K>::encode(key)), nullptr);
+	}
+
+	// true when key was mapped, its value is copied into previous
+	bool remove(K key, V *previous = nullptr) {
+		return decode(map.remove(WordCodec<K>::encode(key)), previous);
+	}
+
+	int capacity() {
+		return map.capacity();
+	}
+
+	int unsafeUsed() {
+		return map.unsafeUsed();
+	}
+};
+
 } // namespace map end
 
 #endif
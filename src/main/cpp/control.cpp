@@ -86,6 +86,31 @@ JNIEXPORT void JNICALL Java_com_insightfullogic_honest_1profiler_core_control_Ag
     }
 }
 
+extern "C"
+JNIEXPORT jstring JNICALL Java_com_insightfullogic_honest_1profiler_core_control_Agent_getThreadFilter(JNIEnv *env, jclass klass) {
+    Profiler *prof = getProfiler();
+
+    return env->NewStringUTF(prof->getThreadFilter().c_str());
+}
+
+extern "C"
+JNIEXPORT void JNICALL Java_com_insightfullogic_honest_1profiler_core_control_Agent_setThreadFilter(JNIEnv *env, jclass klass, jstring threadFilter) {
+    Profiler *prof = getProfiler();
+
+    if (threadFilter == NULL) {
+        prof->setThreadFilter(NULL);
+    } else {
+        const char *nativeString = env->GetStringUTFChars(threadFilter, 0);
+        prof->setThreadFilter((char*)nativeString);
+        env->ReleaseStringUTFChars(threadFilter, nativeString);
+    }
+}
+
+extern "C"
+JNIEXPORT void JNICALL Java_com_insightfullogic_honest_1profiler_core_control_Agent_trigger(JNIEnv *env, jclass klass) {
+    BurstPolicy::requestBurst();
+}
+
 extern "C"
 JNIEXPORT void JNICALL Java_com_insightfullogic_honest_1profiler_core_control_Agent_setSamplingInterval(JNIEnv *env, jclass klass, jint intervalMin, jint intervalMax) {
     Profiler *prof = getProfiler();
@@ -1,5 +1,9 @@
 #include "controller.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sstream>
+
 void controllerRunnable(jvmtiEnv *jvmti_env, JNIEnv *jni_env, void *arg) {
     IMPLICITLY_USE(jvmti_env);
     IMPLICITLY_USE(jni_env);
@@ -36,6 +40,11 @@ void Controller::start() {
     }
 }
 
+void Controller::serve() {
+    isRunning_.store(true, std::memory_order_relaxed);
+    run();
+}
+
 void Controller::stop() {
     isRunning_.store(false, std::memory_order_relaxed);
 }
@@ -44,13 +53,20 @@ bool Controller::isRunning() const {
     return isRunning_.load();
 }
 
-void Controller::run() {
+#ifdef MSG_NOSIGNAL
+const int kSendFlags = MSG_NOSIGNAL;
+#else
+const int kSendFlags = 0;
+#endif
+
+static bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+int Controller::openTcpListener() {
     struct addrinfo hints, *res;
-    char buf[MAX_DATA_SIZE];
-    struct sockaddr_storage clientAddress;
-    socklen_t addressSize = sizeof(clientAddress);
-    ssize_t bytesRead;
-    int result, listener, clientConnection;
+    int result, listener;
     const int yes = 1;
 
     memset(&hints, 0, sizeof hints);
@@ -60,57 +76,430 @@ void Controller::run() {
 
     if ((result = getaddrinfo(configuration_.host.c_str(), configuration_.port.c_str(), &hints, &res)) != 0) {
         logError("ERROR: getaddrinfo: %s\n", gai_strerror(result));
-        return;
+        return -1;
     }
 
     if ((listener = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) == -1) {
         logError("ERROR: Failed to open socket: %s\n", strerror(errno));
-        return;
+        freeaddrinfo(res);
+        return -1;
     }
 
     setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
 
     if (bind(listener, res->ai_addr, res->ai_addrlen) == -1) {
         logError("ERROR: Failed to bind successfully: %s\n", strerror(errno));
+        freeaddrinfo(res);
         close(listener);
-        return;
+        return -1;
     }
+    freeaddrinfo(res);
 
-    if (listen(listener, 3) == -1) {
+    if (listen(listener, SOMAXCONN) == -1 || !setNonBlocking(listener)) {
         logError("ERROR: Failed to listen: %s\n", strerror(errno));
-        return;
+        close(listener);
+        return -1;
+    }
+    return listener;
+}
+
+int Controller::openUnixListener() {
+    struct sockaddr_un address;
+    const std::string &path = configuration_.controlSocket;
+
+    if (path.size() >= sizeof(address.sun_path)) {
+        logError("ERROR: Control socket path is too long: %s\n", path.c_str());
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == -1) {
+        logError("ERROR: Failed to open socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // left behind by an earlier run, anything but a socket isn't ours to remove
+    struct stat info;
+    if (lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) unlink(path.c_str());
+    if (bind(listener, (struct sockaddr *) &address, sizeof(address)) == -1) {
+        logError("ERROR: Failed to bind %s: %s\n", path.c_str(), strerror(errno));
+        close(listener);
+        return -1;
+    }
+
+    if (listen(listener, SOMAXCONN) == -1 || !setNonBlocking(listener)) {
+        logError("ERROR: Failed to listen: %s\n", strerror(errno));
+        close(listener);
+        unlink(path.c_str());
+        return -1;
+    }
+    return listener;
+}
+
+void Controller::run() {
+    EventPoller poller;
+    if (!poller.valid()) return;
+
+    int tcpListener = -1, unixListener = -1;
+    if (!configuration_.host.empty() && !configuration_.port.empty()) {
+        tcpListener = openTcpListener();
+        if (tcpListener != -1) poller.add(tcpListener);
+    }
+    if (!configuration_.controlSocket.empty()) {
+        unixListener = openUnixListener();
+        if (unixListener != -1) poller.add(unixListener);
+    }
+    if (tcpListener == -1 && unixListener == -1) return;
+
+    std::thread worker;
+    if (pipe(wakeFds_) == -1 || !setNonBlocking(wakeFds_[0]) || !setNonBlocking(wakeFds_[1])
+            || !poller.add(wakeFds_[0])) {
+        logError("ERROR: Failed to set up the controller worker: %s\n", strerror(errno));
+        if (wakeFds_[0] != -1) close(wakeFds_[0]);
+        if (wakeFds_[1] != -1) close(wakeFds_[1]);
+        wakeFds_[0] = wakeFds_[1] = -1;
+    } else {
+        stopJobs_ = false;
+        worker = std::thread(&Controller::runJobs, this);
     }
 
+    std::map<int, Client> clients;
+    std::vector<PollEvent> events;
+    int streams = 0;
     while (isRunning_.load(std::memory_order_relaxed)) {
+        poller.wait(events, streams > 0 ? kStreamFlushMillis : kControllerPollMillis);
+
+        for (size_t i = 0; i < events.size(); i++) {
+            const PollEvent &event = events[i];
+            if (event.fd == tcpListener || event.fd == unixListener) {
+                acceptClients(event.fd, poller, clients);
+                continue;
+            }
+            if (event.fd == wakeFds_[0]) {
+                finishJobs(poller, clients);
+                continue;
+            }
+
+            std::map<int, Client>::iterator it = clients.find(event.fd);
+            if (it == clients.end()) continue;
+            Client &client = it->second;
+
+            bool open = !event.failed;
+            if (open && event.readable) open = readCommands(event.fd, client);
+            if (!settle(event.fd, client, open, poller)) clients.erase(it);
+        }
+
+        streams = 0;
+        for (std::map<int, Client>::iterator it = clients.begin(); it != clients.end();) {
+            Client &client = it->second;
+            if (!client.stream) {
+                ++it;
+                continue;
+            }
+            streams++;
+            // leaves the samples with the subscriber while the client is behind, where they
+            // are bounded
+            if (client.output.size() < kStreamBufferSize) {
+                client.stream->take(client.output);
+            }
+            if (!client.output.empty() && !writeReplies(it->first, client)) {
+                closeClient(it->first, client, poller);
+                clients.erase(it++);
+                continue;
+            }
+            poller.modify(it->first, !client.closing && !client.busy, !client.output.empty());
+            ++it;
+        }
+    }
+
+    if (worker.joinable()) {
+        // the job running is let finish, the queued ones are dropped with their clients
+        {
+            std::lock_guard<std::mutex> guard(jobsLock_);
+            stopJobs_ = true;
+            jobs_.clear();
+        }
+        jobsReady_.notify_all();
+        worker.join();
+        finished_.clear();
+        poller.remove(wakeFds_[0]);
+        close(wakeFds_[0]);
+        close(wakeFds_[1]);
+        wakeFds_[0] = wakeFds_[1] = -1;
+    }
+    for (std::map<int, Client>::iterator it = clients.begin(); it != clients.end(); ++it) {
+        closeClient(it->first, it->second, poller);
+    }
+    if (tcpListener != -1) close(tcpListener);
+    if (unixListener != -1) {
+        close(unixListener);
+        unlink(configuration_.controlSocket.c_str());
+    }
+}
+
+bool Controller::settle(int fd, Client &client, bool open, EventPoller &poller) {
+    if (open && !client.output.empty()) open = writeReplies(fd, client);
+    // a subscriber that shut its side down may still be reading, and a client waiting on the
+    // worker still has replies to come
+    if (open && (client.closing || client.http) && client.output.empty() && !client.stream && !client.busy) {
+        open = false;
+    }
+
+    if (!open) {
+        closeClient(fd, client, poller);
+        return false;
+    }
+    // only ask for writability while there's something to write, and stop reading from a
+    // client that shut its side down or is waiting on the worker
+    poller.modify(fd, !client.closing && !client.busy, !client.output.empty());
+    return true;
+}
+
+void Controller::closeClient(int fd, Client &client, EventPoller &poller) {
+    if (client.stream) {
+        SampleStream::instance().unsubscribe(client.stream);
+        client.stream.reset();
+    }
+    poller.remove(fd);
+    close(fd);
+}
+
+void Controller::acceptClients(int listener, EventPoller &poller, std::map<int, Client> &clients) {
+    struct sockaddr_storage clientAddress;
+    socklen_t addressSize;
+    int clientConnection;
+
+    while (true) {
+        addressSize = sizeof(clientAddress);
         if ((clientConnection = accept(listener, (struct sockaddr *) &clientAddress, &addressSize)) == -1) {
-            logError("ERROR: Failed to accept incoming connection: %s\n", strerror(errno));
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                logError("ERROR: Failed to accept incoming connection: %s\n", strerror(errno));
+            }
+            return;
+        }
+
+        if (clients.size() >= (size_t) kMaxControllerClients) {
+            logError("WARN: Too many controller clients, refusing a connection\n");
+            close(clientConnection);
+            continue;
+        }
+        if (!setNonBlocking(clientConnection) || !poller.add(clientConnection)) {
+            logError("ERROR: Failed to register a controller client: %s\n", strerror(errno));
+            close(clientConnection);
             continue;
         }
+        Client &client = clients[clientConnection] = Client();
+        client.id = ++connections_;
+    }
+}
 
-        if ((bytesRead = recv(clientConnection, buf, MAX_DATA_SIZE - 1, 0)) == -1) {
+bool Controller::readCommands(int fd, Client &client) {
+    char buf[4096];
+    while (!client.closing && !client.busy) {
+        ssize_t bytesRead = recv(fd, buf, sizeof(buf), 0);
+        if (bytesRead == 0) {
+            client.closing = true;
+        } else if (bytesRead > 0) {
+            client.input.append(buf, bytesRead);
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else {
             logError("ERROR: Failed to read data from client: %s\n", strerror(errno));
+            return false;
+        }
+
+        if (!runCommands(fd, client)) return false;
+    }
+    return true;
+}
+
+bool Controller::runCommands(int fd, Client &client) {
+    std::ostringstream replies;
+    size_t begin = 0, end;
+    while (!client.busy && (end = client.input.find('\n', begin)) != std::string::npos) {
+        std::string command = client.input.substr(begin, end - begin);
+        if (!command.empty() && command[command.size() - 1] == '\r') command.erase(command.size() - 1);
+        begin = end + 1;
+        if (!command.empty() && !client.stream && !client.http) execute(fd, client, &command[0], replies);
+    }
+    client.input.erase(0, begin);
+
+    // while busy the input holds the commands after the one on the worker, at most a read's worth
+    if (!client.busy && client.input.size() > kMaxCommandSize) {
+        logError("WARN: Controller command too long, dropping the client\n");
+        return false;
+    }
+
+    if (client.closing && !client.busy && !client.input.empty() && !client.stream && !client.http) {
+        execute(fd, client, &client.input[0], replies);
+        client.input.clear();
+    }
+    client.output += replies.str();
+
+    if (client.output.size() > kMaxPendingReply) {
+        logError("WARN: Controller client isn't reading its replies, dropping it\n");
+        return false;
+    }
+    return true;
+}
+
+bool Controller::writeReplies(int fd, Client &client) {
+    size_t sent = 0;
+    while (sent < client.output.size()) {
+        ssize_t result = send(fd, client.output.c_str() + sent, client.output.size() - sent, kSendFlags);
+        if (result > 0) {
+            sent += result;
+        } else if (result == -1 && errno == EINTR) {
+            continue;
+        } else if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
         } else {
-            buf[bytesRead] = '\0';
-
-            if (strstr(buf, "start") == buf) {
-                startSampling();
-            } else if (strstr(buf, "stop") == buf) {
-                stopSampling();
-            } else if (strstr(buf, "status") == buf) {
-                reportStatus(clientConnection);
-            } else if (strstr(buf, "get ") == buf) {
-                getProfilerParam(clientConnection, buf + 4);
-            } else if (strstr(buf, "set ") == buf) {
-                setProfilerParam(buf + 4);
-            } else {
-                logError("WARN: Unknown command received, ignoring: %s\n", buf);
-            }
+            logError("ERROR: Failed to respond to client: %s\n", strerror(errno));
+            return false;
+        }
+    }
+    client.output.erase(0, sent);
+    return true;
+}
+
+void Controller::execute(int fd, Client &client, char *command, std::ostream &out) {
+    if (strstr(command, "start") == command || strstr(command, "stop") == command
+            || strstr(command, "set ") == command) {
+        submit(fd, client, command);
+    } else if (strstr(command, "status") == command) {
+        reportStatus(out);
+    } else if (strstr(command, "get ") == command) {
+        getProfilerParam(out, command + 4);
+    } else if (strstr(command, "trigger") == command) {
+        BurstPolicy::requestBurst();
+    } else if (strstr(command, "dump") == command) {
+        dumpWindow(out, command + 4);
+    } else if (strstr(command, "pprof") == command) {
+        exportProfile(out, command + 5);
+    } else if (strstr(command, "metrics") == command) {
+        writeMetrics(out);
+    } else if (strstr(command, "GET ") == command) {
+        serveHttp(client, command + 4, out);
+    } else if (strstr(command, "stream") == command) {
+        subscribe(client, command + 6);
+    } else {
+        logError("WARN: Unknown command received, ignoring: %s\n", command);
+    }
+}
+
+void Controller::submit(int fd, Client &client, char *command) {
+    if (wakeFds_[0] == -1) {
+        // no worker, the event loop waits for it
+        runJob(command);
+        return;
+    }
+    Job job;
+    job.fd = fd;
+    job.client = client.id;
+    job.command = command;
+    {
+        std::lock_guard<std::mutex> guard(jobsLock_);
+        jobs_.push_back(job);
+    }
+    jobsReady_.notify_one();
+    client.busy = true;
+}
+
+void Controller::runJobs() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGPROF);
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL) < 0) {
+        logError("ERROR: unable to set controller worker signal mask\n");
+    }
+
+    // starting the profiler needs a JNIEnv, the thread start callback unblocks SIGPROF again
+    JNIEnv *env = NULL;
+    if (jvm_ != NULL) {
+        JavaVMAttachArgs args = {JNI_VERSION_1_6, (char *) "Honest Profiler Controller Worker", NULL};
+        if (jvm_->AttachCurrentThreadAsDaemon((void **) &env, &args) != JNI_OK) {
+            logError("ERROR: Failed to attach the controller worker, start won't work\n");
+            env = NULL;
+        }
+        pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    }
+
+    std::unique_lock<std::mutex> guard(jobsLock_);
+    while (true) {
+        jobsReady_.wait(guard, [this] { return stopJobs_ || !jobs_.empty(); });
+        if (stopJobs_) break;
+
+        Job job = jobs_.front();
+        jobs_.pop_front();
+        guard.unlock();
+        runJob(&job.command[0]);
+        guard.lock();
+
+        finished_.push_back(job);
+        char wake = 0;
+        while (write(wakeFds_[1], &wake, 1) == -1 && errno == EINTR) {
         }
+    }
+    guard.unlock();
+
+    if (env != NULL) jvm_->DetachCurrentThread();
+}
+
+void Controller::runJob(char *command) {
+    if (strstr(command, "start") == command) {
+        startSampling();
+    } else if (strstr(command, "stop") == command) {
+        stopSampling();
+    } else if (strstr(command, "set ") == command) {
+        setProfilerParam(command + 4);
+    }
+}
+
+void Controller::finishJobs(EventPoller &poller, std::map<int, Client> &clients) {
+    char buf[64];
+    while (read(wakeFds_[0], buf, sizeof(buf)) > 0) {
+    }
 
-        close(clientConnection);
+    std::vector<Job> finished;
+    {
+        std::lock_guard<std::mutex> guard(jobsLock_);
+        finished.swap(finished_);
+    }
+    for (size_t i = 0; i < finished.size(); i++) {
+        const Job &job = finished[i];
+        std::map<int, Client>::iterator it = clients.find(job.fd);
+        // closed while the job ran
+        if (it == clients.end() || it->second.id != job.client) continue;
+
+        Client &client = it->second;
+        client.busy = false;
+        bool open = runCommands(job.fd, client);
+        if (!settle(job.fd, client, open, poller)) clients.erase(it);
     }
+}
 
-    close(listener);
+// stream [samples], see SampleStream for the format
+void Controller::subscribe(Client &client, char *mode) {
+    std::istringstream input(mode);
+    std::string kind;
+    input >> kind;
+
+    if (!kind.empty() && kind != "samples" && kind != "stacks") {
+        logError("WARN: Expected stream [samples|stacks], ignoring: %s\n", mode);
+        return;
+    }
+    client.stream = SampleStream::instance().subscribe(kind != "samples");
+}
+
+void Controller::writeMetrics(std::ostream &out) {
+    Metrics.write(out);
+    BufferReader *reader = profiler_->reader();
+    if (reader != NULL) reader->writeMetrics(out);
 }
 
 void Controller::startSampling() {
@@ -128,24 +517,154 @@ void Controller::stopSampling() {
     profiler_->stop();
 }
 
-void Controller::reportStatus(int clientConnection) {
+void Controller::reportStatus(std::ostream &out) {
     bool samplingIsRunning = profiler_->isRunning();
-    // ensures there's space for status, log file path, comma, newline, and NULL
-    std::string filePath = profiler_->getFilePath();
-    const char *logFilePath = filePath.c_str();
-    int bufSize = strlen(logFilePath) + 10;
-    char buf[bufSize];
+    out << (samplingIsRunning ? "started" : "stopped") << ',' << profiler_->getFilePath() << '\n';
+}
 
-    snprintf(buf, bufSize, "%s,%s\n", samplingIsRunning ? "started" : "stopped", logFilePath);
+// dump <from> <to> [file], bounds are epoch seconds or, when not positive, seconds relative to now.
+// Without a file the merged folded stacks are sent back over the connection.
+void Controller::dumpWindow(std::ostream &out, char *rangeDesc) {
+    std::istringstream input(rangeDesc);
+    long from, to;
+    std::string filePath;
 
-    int length = strlen(buf);
+    if (!(input >> from >> to)) {
+        logError("WARN: Expected dump <from> <to> [file], ignoring: %s\n", rangeDesc);
+        return;
+    }
+    input >> filePath;
 
-    if (send(clientConnection, buf, length, 0) <= 0) {
-        logError("ERROR: Failed to respond to client: %s\n", strerror(errno));
+    time_t now = time(NULL);
+    if (from <= 0) from += now;
+    if (to <= 0) to += now;
+
+    std::stringstream buffer;
+    long samples;
+    if (filePath.empty()) {
+        samples = profiler_->dumpWindow(buffer, from, to);
+    } else {
+        std::ofstream file(filePath.c_str(), std::ios::out | std::ios::trunc);
+        if (!file) {
+            logError("ERROR: Failed to open %s for the window dump\n", filePath.c_str());
+            return;
+        }
+        samples = profiler_->dumpWindow(file, from, to);
+        buffer << samples << " samples written to " << filePath << '\n';
     }
+
+    if (samples < 0) {
+        logError("WARN: Dump requested but the agent isn't keeping a rolling window\n");
+        return;
+    }
+    out << buffer.str();
+}
+
+bool Controller::windowProfile(time_t from, time_t to, std::string &profile) {
+    std::vector<WindowStack> stacks;
+    long truncated;
+    if (profiler_->windowStacks(from, to, stacks, truncated) < 0) {
+        logError("WARN: Profile requested but the agent isn't keeping a rolling window\n");
+        return false;
+    }
+
+    // the interval is randomised between min and max, a sample stands for their average
+    int64_t periodNanos = (int64_t) (profiler_->getSamplingIntervalMin() + profiler_->getSamplingIntervalMax()) * 500000;
+    return gzipCompress(pprofProfile(stacks, truncated, from, to, periodNanos), profile);
 }
 
-void Controller::getProfilerParam(int clientConnection, char *param) {
+// pprof <from> <to> [file], bounds as for dump. Without a file the reply is the size of the
+// profile on a line of its own, followed by the gzipped profile.
+void Controller::exportProfile(std::ostream &out, char *rangeDesc) {
+    std::istringstream input(rangeDesc);
+    long from, to;
+    std::string filePath;
+
+    if (!(input >> from >> to)) {
+        logError("WARN: Expected pprof <from> <to> [file], ignoring: %s\n", rangeDesc);
+        return;
+    }
+    input >> filePath;
+
+    time_t now = time(NULL);
+    if (from <= 0) from += now;
+    if (to <= 0) to += now;
+
+    std::string profile;
+    if (!windowProfile(from, to, profile)) return;
+
+    if (filePath.empty()) {
+        out << profile.size() << '\n' << profile;
+        return;
+    }
+    std::ofstream file(filePath.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!file || !file.write(profile.data(), profile.size())) {
+        logError("ERROR: Failed to write the profile to %s\n", filePath.c_str());
+        return;
+    }
+    out << profile.size() << " bytes written to " << filePath << '\n';
+}
+
+static void httpResponse(std::ostream &out, const char *status, const char *contentType, const std::string &body) {
+    out << "HTTP/1.1 " << status << "\r\n"
+        << "Content-Type: " << contentType << "\r\n"
+        << "Content-Length: " << body.size() << "\r\n"
+        << "Connection: close\r\n\r\n"
+        << body;
+}
+
+static long queryParameter(const std::string &query, const char *name, long fallback) {
+    std::string key = std::string(name) + "=";
+    size_t at = 0;
+    while (at < query.size()) {
+        size_t end = query.find('&', at);
+        if (end == std::string::npos) end = query.size();
+        if (query.compare(at, key.size(), key) == 0) {
+            return atol(query.c_str() + at + key.size());
+        }
+        at = end + 1;
+    }
+    return fallback;
+}
+
+// GET /pprof answers with the profile of the last seconds (60 by default) of the window,
+// or of [from, to] with bounds as for dump. /debug/pprof/profile is an alias for pprof's tools.
+// GET /metrics is for Prometheus to scrape.
+void Controller::serveHttp(Client &client, char *request, std::ostream &out) {
+    client.http = true;
+
+    std::string target(request);
+    target = target.substr(0, target.find(' '));
+    std::string path = target.substr(0, target.find('?'));
+    std::string query = path.size() < target.size() ? target.substr(path.size() + 1) : "";
+
+    if (path == "/metrics") {
+        std::ostringstream metrics;
+        writeMetrics(metrics);
+        httpResponse(out, "200 OK", "text/plain; version=0.0.4", metrics.str());
+        return;
+    }
+
+    if (path != "/pprof" && path != "/debug/pprof/profile") {
+        httpResponse(out, "404 Not Found", "text/plain", "unknown path " + path + "\n");
+        return;
+    }
+
+    time_t now = time(NULL);
+    long from = queryParameter(query, "from", -queryParameter(query, "seconds", 60));
+    long to = queryParameter(query, "to", 0);
+    if (from <= 0) from += now;
+    if (to <= 0) to += now;
+
+    std::string profile;
+    if (!windowProfile(from, to, profile)) {
+        httpResponse(out, "404 Not Found", "text/plain", "the agent isn't keeping a rolling window\n");
+        return;
+    }
+    httpResponse(out, "200 OK", "application/octet-stream", profile);
+}
+
+void Controller::getProfilerParam(std::ostream &out, char *param) {
     std::stringstream buffer;
     if (strstr(param, "intervalMin") == param) {
         buffer << profiler_->getSamplingIntervalMin();
@@ -159,16 +678,40 @@ void Controller::getProfilerParam(int clientConnection, char *param) {
         buffer << profiler_->getMaxFramesToCapture();
     } else if (strstr(param, "logPath") == param) {
         buffer << profiler_->getFilePath();
+    } else if (strstr(param, "threadFilter") == param) {
+        buffer << profiler_->getThreadFilter();
+    } else if (strstr(param, "threadPool") == param) {
+        ThreadBucketPool::Occupancy pool = ThreadBucketPool::instance().occupancy();
+        buffer << pool.inUse
+            << ' '
+            << pool.capacity
+            << ' '
+            << pool.heapAllocated;
+    } else if (strstr(param, "asgctErrors") == param) {
+        // one line for all samples, then one per thread with its name last
+        ErrorHistogram::Row total;
+        std::vector<ErrorHistogram::Row> threads;
+        ErrorHistogram::instance().snapshot(total, threads);
+        buffer << "all ";
+        ErrorHistogram::writeCounts(buffer, total, ' ');
+        for (size_t i = 0; i < threads.size(); i++) {
+            buffer << "\ntid=" << threads[i].tid << ' ';
+            ErrorHistogram::writeCounts(buffer, threads[i], ' ');
+            buffer << " name=" << threads[i].name;
+        }
+    } else if (strstr(param, "burst") == param) {
+        buffer << configuration_.burstInterval
+            << ' '
+            << configuration_.burstSeconds
+            << ' '
+            << configuration_.burstCpuThreshold;
     } else {
         logError("WARN: Unknown parameter, ignoring: %s\n", param);
         return;
     }
 
     buffer << '\n';
-    std::string content = buffer.str();
-    if (send(clientConnection, content.c_str(), content.size(), 0) <= 0) {
-        logError("ERROR: Failed to respond to client: %s\n", strerror(errno));
-    }
+    out << buffer.str();
 }
 
 void Controller::setProfilerParam(char *paramDesc) {
@@ -184,6 +727,10 @@ void Controller::setProfilerParam(char *paramDesc) {
     if (command == "logPath") {
         input >> stringArg;
         profiler_->setFilePath((char*)stringArg.c_str());
+    } else if (command == "threadFilter") {
+        // an absent argument clears the filter
+        input >> stringArg;
+        profiler_->setThreadFilter((char*)stringArg.c_str());
     } else {
         input >> numericArg1;
         if (command == "intervalMin") {
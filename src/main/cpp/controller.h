@@ -4,6 +4,11 @@
 #include "globals.h"
 #include "common.h"
 #include "profiler.h"
+#include "error_histogram.h"
+#include "event_poller.h"
+#include "sample_stream.h"
+#include "pprof.h"
+#include "metrics.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,20 +17,61 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/un.h>
 #include <netdb.h>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
 #include <jvmti.h>
 
-#define MAX_DATA_SIZE 100
+// Longest command line accepted, a client sending more without a newline is dropped
+const size_t kMaxCommandSize = 4096;
+// Replies a client may leave unread before it is dropped, a window dump can be large
+const size_t kMaxPendingReply = 64 * 1024 * 1024;
+const int kMaxControllerClients = 1024;
+// How often the event loop checks whether it was stopped
+const int kControllerPollMillis = 100;
+// How often streamed samples are flushed to their subscribers
+const int kStreamFlushMillis = 10;
 
+/**
+ * Takes newline terminated commands from any number of clients over TCP and a Unix domain
+ * socket. Connections stay open, so a client can pipeline commands and read the replies in
+ * order. A single thread multiplexes every connection with epoll (poll where there's none),
+ * all sockets are non-blocking and replies are buffered, so a slow client only holds up
+ * itself. A command left unterminated when the client shuts its side down still runs.
+ *
+ * "start", "stop" and "set" can take seconds (a jmethodID backfill, reaping the processor),
+ * so they run one at a time on a worker thread, attached to the VM when there is one. The
+ * client's later commands wait for it so its replies stay in order, other clients don't.
+ *
+ * A connection opening with an HTTP GET is answered as HTTP and closed, see serveHttp.
+ *
+ * "stream" turns a connection into a SampleStream subscriber, of interned stacks or with
+ * "stream samples" of every sample's frames. Anything it sends afterwards is ignored. Its
+ * samples are only moved to the socket while less than a buffer's worth is unsent, so a slow
+ * subscriber ends up missing samples rather than growing without bound.
+ */
 class Controller {
 public:
     explicit Controller(JavaVM *jvm, jvmtiEnv *jvmti, Profiler *profiler, ConfigurationOptions &configuration) :
-            jvm_(jvm), jvmti_(jvmti), profiler_(profiler), configuration_(configuration), isRunning_(false) {
+            jvm_(jvm), jvmti_(jvmti), profiler_(profiler), configuration_(configuration), isRunning_(false),
+            connections_(0), stopJobs_(false) {
+        wakeFds_[0] = wakeFds_[1] = -1;
 
     }
 
     void start();
 
+    // Runs the event loop on the calling thread until stop(), without a VM to start a thread in
+    void serve();
+
     void stop();
 
     void run();
@@ -33,22 +79,100 @@ public:
     bool isRunning() const;
 
 private:
+    struct Client {
+        std::string input;
+        std::string output;
+        // the client shut down its side, close once the replies are out
+        bool closing;
+        StreamSubscriberPtr stream;
+        // answered an HTTP request, the rest of it is ignored and the connection closed
+        bool http;
+        // one of its commands is on the worker, the rest of its input waits and isn't read
+        bool busy;
+        // tells the connection from a later one reusing its descriptor
+        uint64_t id;
+
+        Client() : closing(false), http(false), busy(false), id(0) {
+        }
+    };
+
+    // a command for the worker, handed back to the event loop once it has run
+    struct Job {
+        int fd;
+        uint64_t client;
+        std::string command;
+    };
+
     JavaVM *const jvm_;
     jvmtiEnv *const jvmti_;
     Profiler *const profiler_;
     
     const ConfigurationOptions &configuration_;
     std::atomic_bool isRunning_;
+    uint64_t connections_;
+
+    std::mutex jobsLock_;
+    std::condition_variable jobsReady_;
+    std::deque<Job> jobs_;
+    std::vector<Job> finished_;
+    bool stopJobs_;
+    // written by the worker when it finishes a job, polled by the event loop
+    int wakeFds_[2];
+
+    int openTcpListener();
+
+    int openUnixListener();
+
+    void acceptClients(int listener, EventPoller &poller, std::map<int, Client> &clients);
+
+    // false once the client should be closed
+    bool readCommands(int fd, Client &client);
+
+    // runs the complete commands in the client's input, up to one handed to the worker
+    bool runCommands(int fd, Client &client);
+
+    bool writeReplies(int fd, Client &client);
+
+    // writes what's pending and updates the poller, false once the client was closed
+    bool settle(int fd, Client &client, bool open, EventPoller &poller);
+
+    void execute(int fd, Client &client, char *command, std::ostream &out);
+
+    void submit(int fd, Client &client, char *command);
+
+    // the worker's loop, runs the jobs in order until stopJobs_
+    void runJobs();
+
+    void runJob(char *command);
+
+    // resumes the clients whose jobs are done
+    void finishJobs(EventPoller &poller, std::map<int, Client> &clients);
+
+    void subscribe(Client &client, char *mode);
+
+    // the agent's metrics, the in process reader's included when there is one
+    void writeMetrics(std::ostream &out);
+
+    void closeClient(int fd, Client &client, EventPoller &poller);
 
     void startSampling();
 
     void stopSampling();
 
-    void reportStatus(int clientConnection);
+    void reportStatus(std::ostream &out);
 
-    void getProfilerParam(int clientConnection, char *param);
+    void getProfilerParam(std::ostream &out, char *param);
 
     void setProfilerParam(char *paramDesc);
+
+    void dumpWindow(std::ostream &out, char *rangeDesc);
+
+    // Gzipped pprof profile of the window for [from, to], false without a window
+    bool windowProfile(time_t from, time_t to, std::string &profile);
+
+    void exportProfile(std::ostream &out, char *rangeDesc);
+
+    void serveHttp(Client &client, char *request, std::ostream &out);
 };
 
 #endif
@@ -0,0 +1,132 @@
+#include "error_histogram.h"
+
+#include <string.h>
+
+static const char *const kErrorBucketNames[kErrorBuckets] = {
+    "walked",
+    "native",
+    "noClassLoad",
+    "gcActive",
+    "unknownNotJava",
+    "notWalkableNotJava",
+    "unknownJava",
+    "notWalkableJava",
+    "unknownState",
+    "threadExit",
+    "deopt",
+    "safepoint",
+    "other"
+};
+
+long ErrorHistogram::Row::samples() const {
+    long sum = 0;
+    for (int i = 0; i < kErrorBuckets; i++) {
+        sum += counts[i];
+    }
+    return sum;
+}
+
+ErrorHistogram &ErrorHistogram::instance() {
+    static ErrorHistogram histogram;
+    return histogram;
+}
+
+ErrorHistogram::ErrorHistogram() {
+    for (int i = 0; i < kErrorBuckets; i++) {
+        totals[i].store(0, std::memory_order_relaxed);
+        overflow.counts[i].store(0, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < kErrorHistogramThreads; i++) {
+        slots[i].tid.store(0, std::memory_order_relaxed);
+        slots[i].named.store(false, std::memory_order_relaxed);
+        for (int j = 0; j < kErrorBuckets; j++) {
+            slots[i].counts[j].store(0, std::memory_order_relaxed);
+        }
+    }
+    overflow.tid.store(0, std::memory_order_relaxed);
+    overflow.named.store(false, std::memory_order_relaxed);
+}
+
+int ErrorHistogram::bucketOf(const JVMPI_CallTrace &trace) {
+    jint error = trace.num_frames;
+    if (isRecoveredTrace(trace)) {
+        error = trace.frames[trace.num_frames - 1].lineno;
+    } else if (error > 0) {
+        return kErrorBucketWalked;
+    }
+    if (error < -kNumCallTraceErrors) return kErrorBucketOther;
+    return 1 - error;
+}
+
+const char *ErrorHistogram::bucketName(int bucket) {
+    return bucket >= 0 && bucket < kErrorBuckets ? kErrorBucketNames[bucket] : "";
+}
+
+void ErrorHistogram::record(const JVMPI_CallTrace &trace, ThreadBucketPtr &info) {
+    int bucket = bucketOf(trace);
+    totals[bucket].fetch_add(1, std::memory_order_relaxed);
+    if (!info.defined()) return;
+
+    slotFor(info->tid, info->name).counts[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+// Open addressing on the tid, a slot is claimed once and kept for good
+ErrorHistogram::Slot &ErrorHistogram::slotFor(int tid, const char *name) {
+    if (tid == 0) return overflow;
+
+    unsigned int start = (unsigned int) tid * 2654435761u % kErrorHistogramThreads;
+    for (int i = 0; i < kErrorHistogramThreads; i++) {
+        Slot &slot = slots[(start + i) % kErrorHistogramThreads];
+        int current = slot.tid.load(std::memory_order_acquire);
+        if (current == tid) return slot;
+        if (current != 0) continue;
+
+        int empty = 0;
+        if (slot.tid.compare_exchange_strong(empty, tid, std::memory_order_acq_rel)) {
+            strncpy(slot.name, name, kThreadNameMax - 1);
+            slot.name[kThreadNameMax - 1] = '\0';
+            slot.named.store(true, std::memory_order_release);
+            return slot;
+        }
+        // somebody else claimed it, possibly for the same thread
+        if (empty == tid) return slot;
+    }
+    return overflow;
+}
+
+void ErrorHistogram::copy(const std::atomic_long *counts, Row &row) {
+    for (int i = 0; i < kErrorBuckets; i++) {
+        row.counts[i] = counts[i].load(std::memory_order_relaxed);
+    }
+}
+
+void ErrorHistogram::snapshot(Row &total, std::vector<Row> &threads) const {
+    total.tid = 0;
+    total.name.clear();
+    copy(totals, total);
+
+    threads.clear();
+    for (int i = 0; i < kErrorHistogramThreads; i++) {
+        const Slot &slot = slots[i];
+        Row row;
+        row.tid = slot.tid.load(std::memory_order_acquire);
+        if (row.tid == 0) continue;
+        if (slot.named.load(std::memory_order_acquire)) row.name = slot.name;
+        copy(slot.counts, row);
+        threads.push_back(row);
+    }
+
+    Row other;
+    other.tid = 0;
+    other.name = "[other threads]";
+    copy(overflow.counts, other);
+    if (other.samples() > 0) threads.push_back(other);
+}
+
+void ErrorHistogram::writeCounts(std::ostream &out, const Row &row, char separator) {
+    out << "samples=" << row.samples();
+    for (int i = 0; i < kErrorBuckets; i++) {
+        if (row.counts[i] == 0) continue;
+        out << separator << bucketName(i) << '=' << row.counts[i];
+    }
+}
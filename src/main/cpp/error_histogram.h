@@ -0,0 +1,78 @@
+#ifndef ERROR_HISTOGRAM_H
+#define ERROR_HISTOGRAM_H
+
+#include <atomic>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "globals.h"
+#include "stacktraces.h"
+#include "thread_map.h"
+
+// Samples are counted as walked, under one of the AsyncGetCallTrace codes 0 to -10, or as
+// other for a code this agent doesn't know about
+const int kErrorBucketWalked = 0;
+const int kErrorBucketOther = kNumCallTraceErrors + 2;
+const int kErrorBuckets = kNumCallTraceErrors + 3;
+
+// Threads broken down individually, the rest are counted together under tid 0
+const int kErrorHistogramThreads = 256;
+
+/**
+ * How many samples AsyncGetCallTrace walked and how many it failed on, per error code, in
+ * total and per thread. A high share of GC or safepoint failures means the profile is biased
+ * away from whatever runs there.
+ *
+ * Counted by the queue consumers as they pop samples. Counters and thread slots are fixed
+ * size and only ever updated with atomics, so a reader can snapshot them at any time.
+ */
+class ErrorHistogram {
+public:
+    struct Row {
+        int tid;
+        std::string name;
+        long counts[kErrorBuckets];
+
+        long samples() const;
+
+        long failures() const { return samples() - counts[kErrorBucketWalked]; }
+    };
+
+    static ErrorHistogram &instance();
+
+    static int bucketOf(const JVMPI_CallTrace &trace);
+
+    // short name of a bucket, as used in the controller and log output
+    static const char *bucketName(int bucket);
+
+    void record(const JVMPI_CallTrace &trace, ThreadBucketPtr &info);
+
+    // totals, then every thread seen so far, the overflow row included once it's used
+    void snapshot(Row &total, std::vector<Row> &threads) const;
+
+    // bucket=count for every non empty bucket, separated by separator
+    static void writeCounts(std::ostream &out, const Row &row, char separator);
+
+    ErrorHistogram();
+
+private:
+    struct Slot {
+        std::atomic_int tid;
+        std::atomic_bool named;
+        char name[kThreadNameMax];
+        std::atomic_long counts[kErrorBuckets];
+    };
+
+    std::atomic_long totals[kErrorBuckets];
+    Slot slots[kErrorHistogramThreads];
+    Slot overflow;
+
+    Slot &slotFor(int tid, const char *name);
+
+    static void copy(const std::atomic_long *counts, Row &row);
+
+    DISALLOW_COPY_AND_ASSIGN(ErrorHistogram);
+};
+
+#endif // ERROR_HISTOGRAM_H
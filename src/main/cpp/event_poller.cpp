@@ -0,0 +1,131 @@
+#include "event_poller.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+
+EventPoller::EventPoller() : epollFd(epoll_create1(EPOLL_CLOEXEC)), ready(64) {
+    if (epollFd == -1) {
+        logError("ERROR: Failed to create an epoll instance: %s\n", strerror(errno));
+    }
+}
+
+EventPoller::~EventPoller() {
+    if (epollFd != -1) close(epollFd);
+}
+
+bool EventPoller::valid() const {
+    return epollFd != -1;
+}
+
+static epoll_event eventFor(int fd, bool readable, bool writable) {
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = (readable ? EPOLLIN | EPOLLRDHUP : 0) | (writable ? EPOLLOUT : 0);
+    event.data.fd = fd;
+    return event;
+}
+
+bool EventPoller::add(int fd) {
+    epoll_event event = eventFor(fd, true, false);
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+bool EventPoller::modify(int fd, bool readable, bool writable) {
+    epoll_event event = eventFor(fd, readable, writable);
+    return epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) == 0;
+}
+
+void EventPoller::remove(int fd) {
+    epoll_event event = eventFor(fd, false, false);
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, &event);
+}
+
+int EventPoller::wait(std::vector<PollEvent> &events, int timeoutMillis) {
+    events.clear();
+    int count = epoll_wait(epollFd, &ready[0], (int) ready.size(), timeoutMillis);
+    if (count < 0) {
+        if (errno != EINTR) logError("ERROR: epoll_wait failed: %s\n", strerror(errno));
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        PollEvent event;
+        event.fd = ready[i].data.fd;
+        // a peer that shut down its side may still have commands buffered for us
+        event.readable = (ready[i].events & (EPOLLIN | EPOLLRDHUP)) != 0;
+        event.writable = (ready[i].events & EPOLLOUT) != 0;
+        event.failed = (ready[i].events & (EPOLLERR | EPOLLHUP)) != 0;
+        events.push_back(event);
+    }
+    return count;
+}
+
+#else
+
+EventPoller::EventPoller() {
+}
+
+EventPoller::~EventPoller() {
+}
+
+bool EventPoller::valid() const {
+    return true;
+}
+
+bool EventPoller::add(int fd) {
+    pollfd entry;
+    entry.fd = fd;
+    entry.events = POLLIN;
+    entry.revents = 0;
+    fds.push_back(entry);
+    return true;
+}
+
+bool EventPoller::modify(int fd, bool readable, bool writable) {
+    for (size_t i = 0; i < fds.size(); i++) {
+        if (fds[i].fd == fd) {
+            fds[i].events = (readable ? POLLIN : 0) | (writable ? POLLOUT : 0);
+            return true;
+        }
+    }
+    return false;
+}
+
+void EventPoller::remove(int fd) {
+    for (size_t i = 0; i < fds.size(); i++) {
+        if (fds[i].fd == fd) {
+            fds[i] = fds.back();
+            fds.pop_back();
+            return;
+        }
+    }
+}
+
+int EventPoller::wait(std::vector<PollEvent> &events, int timeoutMillis) {
+    events.clear();
+    if (fds.empty()) {
+        usleep(timeoutMillis * 1000);
+        return 0;
+    }
+    int count = poll(&fds[0], fds.size(), timeoutMillis);
+    if (count < 0) {
+        if (errno != EINTR) logError("ERROR: poll failed: %s\n", strerror(errno));
+        return 0;
+    }
+
+    for (size_t i = 0; i < fds.size(); i++) {
+        if (fds[i].revents == 0) continue;
+        PollEvent event;
+        event.fd = fds[i].fd;
+        event.readable = (fds[i].revents & (POLLIN | POLLHUP)) != 0;
+        event.writable = (fds[i].revents & POLLOUT) != 0;
+        event.failed = (fds[i].revents & (POLLERR | POLLNVAL)) != 0;
+        events.push_back(event);
+    }
+    return (int) events.size();
+}
+
+#endif
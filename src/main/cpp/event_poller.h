@@ -0,0 +1,54 @@
+#ifndef EVENT_POLLER_H
+#define EVENT_POLLER_H
+
+#include <vector>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#include "globals.h"
+
+struct PollEvent {
+    int fd;
+    bool readable;
+    bool writable;
+    // error or hang up, the descriptor should be closed
+    bool failed;
+};
+
+/**
+ * Level triggered readiness of a set of descriptors, on epoll where there is one and on
+ * poll elsewhere. Descriptors are added for reading, and changed to whatever is needed.
+ */
+class EventPoller {
+public:
+    EventPoller();
+
+    ~EventPoller();
+
+    bool valid() const;
+
+    bool add(int fd);
+
+    bool modify(int fd, bool readable, bool writable);
+
+    void remove(int fd);
+
+    // Waits up to timeoutMillis, returns the number of events, 0 on a timeout or interrupt
+    int wait(std::vector<PollEvent> &events, int timeoutMillis);
+
+private:
+#ifdef __linux__
+    int epollFd;
+    std::vector<epoll_event> ready;
+#else
+    std::vector<pollfd> fds;
+#endif
+
+    DISALLOW_COPY_AND_ASSIGN(EventPoller);
+};
+
+#endif // EVENT_POLLER_H
@@ -26,6 +26,11 @@ const int DEFAULT_SAMPLING_INTERVAL = 1;
 const int DEFAULT_SAMPLES = 1;
 const int DEFAULT_MAX_FRAMES_TO_CAPTURE = 128;
 const int MAX_FRAMES_TO_CAPTURE = 2048;
+const int DEFAULT_WINDOW_BUCKET_SECONDS = 60;
+const int DEFAULT_WINDOW_MAX_STACKS = 1024;
+const int DEFAULT_BURST_SECONDS = 30;
+const int DEFAULT_METHOD_ID_THREADS = 2;
+const int DEFAULT_READER_BUDGET_KB = 4096;
 
 #if defined(STATIC_ALLOCATION_ALLOCA)
   #define STATIC_ARRAY(NAME, TYPE, SIZE, MAXSZ) TYPE *NAME = (TYPE*)alloca((SIZE) * sizeof(TYPE))
@@ -46,8 +51,36 @@ struct ConfigurationOptions {
     std::string logFilePath;
     std::string host;
     std::string port;
+    /** Path of a Unix domain socket the controller listens on as well, or instead */
+    std::string controlSocket;
     bool start;
     int maxFramesToCapture;
+    /** ':'-separated thread name prefixes, empty samples every thread */
+    std::string threadFilter;
+    /** Buckets kept in memory instead of writing a log, 0 writes a log */
+    int windowBuckets;
+    int windowBucketSeconds;
+    /** Distinct stacks per bucket, the rest are counted as truncated */
+    int windowMaxStacks;
+    /** Interval in ms sampled at during a burst, 0 never bursts */
+    int burstInterval;
+    int burstSeconds;
+    /** Process CPU, in percent of one core, that starts a burst, 0 only bursts on request */
+    int burstCpuThreshold;
+    /** Agent threads creating jmethodIDs of classes loaded before sampling starts, 0 creates them on the loading thread */
+    int methodIdThreads;
+    /** Leaves jmethodID creation of those classes until sampling first starts, which waits for all of it */
+    bool deferMethodIds;
+    /** Walks frame pointers of samples AsyncGetCallTrace fails on, recording native frames */
+    bool nativeFrames;
+    /** Attributes samples AsyncGetCallTrace fails on to the JIT compiled method or VM stub they interrupted */
+    bool codeIndex;
+    /** Stages samples for ASGCTReader to drain in process instead of writing a log */
+    bool asgctReader;
+    /** Memory in KB samples staged for ASGCTReader may take */
+    int readerBudget;
+    /** dropNewest, dropOldest or downsample, what to do once that's used up */
+    std::string readerOverflow;
 
     ConfigurationOptions() :
             samplingIntervalMin(DEFAULT_SAMPLING_INTERVAL),
@@ -56,8 +89,23 @@ struct ConfigurationOptions {
             logFilePath(""),
             host(""),
             port(""),
+            controlSocket(""),
             start(true),
-            maxFramesToCapture(DEFAULT_MAX_FRAMES_TO_CAPTURE) {
+            maxFramesToCapture(DEFAULT_MAX_FRAMES_TO_CAPTURE),
+            threadFilter(""),
+            windowBuckets(0),
+            windowBucketSeconds(DEFAULT_WINDOW_BUCKET_SECONDS),
+            windowMaxStacks(DEFAULT_WINDOW_MAX_STACKS),
+            burstInterval(0),
+            burstSeconds(DEFAULT_BURST_SECONDS),
+            burstCpuThreshold(0),
+            methodIdThreads(DEFAULT_METHOD_ID_THREADS),
+            deferMethodIds(false),
+            nativeFrames(false),
+            codeIndex(false),
+            asgctReader(false),
+            readerBudget(DEFAULT_READER_BUDGET_KB),
+            readerOverflow("dropNewest") {
     }
 
     ConfigurationOptions(const ConfigurationOptions &config) :
@@ -67,8 +115,23 @@ struct ConfigurationOptions {
             logFilePath(config.logFilePath),
             host(config.host),
             port(config.port),
+            controlSocket(config.controlSocket),
             start(config.start),
-            maxFramesToCapture(config.maxFramesToCapture) {
+            maxFramesToCapture(config.maxFramesToCapture),
+            threadFilter(config.threadFilter),
+            windowBuckets(config.windowBuckets),
+            windowBucketSeconds(config.windowBucketSeconds),
+            windowMaxStacks(config.windowMaxStacks),
+            burstInterval(config.burstInterval),
+            burstSeconds(config.burstSeconds),
+            burstCpuThreshold(config.burstCpuThreshold),
+            methodIdThreads(config.methodIdThreads),
+            deferMethodIds(config.deferMethodIds),
+            nativeFrames(config.nativeFrames),
+            codeIndex(config.codeIndex),
+            asgctReader(config.asgctReader),
+            readerBudget(config.readerBudget),
+            readerOverflow(config.readerOverflow) {
     }
 
     virtual ~ConfigurationOptions() {
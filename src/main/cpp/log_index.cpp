@@ -0,0 +1,68 @@
+#include "log_index.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+LogIndex::LogIndex() : written(0), finished(false) {
+    current.offset = 0;
+    current.bytes = 0;
+    current.firstMillis = 0;
+    current.lastMillis = 0;
+    current.samples = 0;
+}
+
+void LogIndex::close() {
+    if (current.bytes > 0) chunks_.push_back(current);
+    current.offset = written;
+    current.bytes = 0;
+    current.firstMillis = 0;
+    current.lastMillis = 0;
+    current.samples = 0;
+    current.threads.clear();
+}
+
+void LogIndex::add(int64_t millis, size_t bytes) {
+    if (current.bytes > 0 && (current.bytes >= LOG_CHUNK_BYTES ||
+                              millis - current.firstMillis >= LOG_CHUNK_SECONDS * 1000L)) {
+        close();
+    }
+
+    // samples are written in about the order they're taken, not quite
+    if (current.bytes == 0) {
+        current.firstMillis = millis;
+        current.lastMillis = millis;
+    } else {
+        current.firstMillis = std::min(current.firstMillis, millis);
+        current.lastMillis = std::max(current.lastMillis, millis);
+    }
+    current.bytes += bytes;
+    written += bytes;
+}
+
+void LogIndex::addSample(int64_t millis, int64_t jid, size_t bytes) {
+    add(millis, bytes);
+    current.samples++;
+    std::vector<int64_t>::iterator it = std::lower_bound(current.threads.begin(), current.threads.end(), jid);
+    if (it == current.threads.end() || *it != jid) current.threads.insert(it, jid);
+}
+
+void LogIndex::write(std::ostream &out) {
+    if (finished) return;
+    finished = true;
+    close();
+
+    for (size_t i = 0; i < chunks_.size(); i++) {
+        const LogChunk &chunk = chunks_[i];
+        out << LOG_CHUNK_LINE << chunk.offset << "," << chunk.bytes << "," << chunk.firstMillis << ","
+            << chunk.lastMillis << "," << chunk.samples << ",";
+        for (size_t j = 0; j < chunk.threads.size(); j++) {
+            out << chunk.threads[j] << ";";
+        }
+        out << "end\n";
+    }
+
+    char trailer[LOG_INDEX_TRAILER_SIZE + 1];
+    snprintf(trailer, sizeof(trailer), "%s%0*lld\n", LOG_INDEX_TRAILER, LOG_INDEX_DIGITS, (long long) written);
+    out.write(trailer, LOG_INDEX_TRAILER_SIZE);
+    out.flush();
+}
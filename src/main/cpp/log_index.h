@@ -0,0 +1,67 @@
+#ifndef LOG_INDEX_H
+#define LOG_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+
+// A chunk of the log is closed once it spans this long or holds this much, whichever is first
+const int LOG_CHUNK_SECONDS = 30;
+const int64_t LOG_CHUNK_BYTES = 8 * 1024 * 1024;
+
+/**
+ * The footer index LogWriter appends when it's done with a log, after the last sample line:
+ *   #chunk,<offset>,<bytes>,<first ms>,<last ms>,<samples>,<jid>;...;<jid>;end
+ * per chunk in the order they were written, then the trailer
+ *   #index,<offset of the first #chunk line, zero padded to 20 digits>
+ * which has a fixed size, so a reader finds the index from the last bytes of the file alone.
+ * Sample lines carry their thread and frame names, so any chunk can be read without the rest.
+ * A log without the trailer was cut short and has to be read from the start.
+ */
+const char LOG_CHUNK_LINE[] = "#chunk,";
+const char LOG_INDEX_TRAILER[] = "#index,";
+const int LOG_INDEX_DIGITS = 20;
+const size_t LOG_INDEX_TRAILER_SIZE = sizeof(LOG_INDEX_TRAILER) - 1 + LOG_INDEX_DIGITS + 1;
+
+// Where a stretch of the log is, when its samples were taken and which threads took them
+struct LogChunk {
+    int64_t offset;
+    int64_t bytes;
+    int64_t firstMillis;
+    int64_t lastMillis;
+    int64_t samples;
+    // Java thread ids, sorted
+    std::vector<int64_t> threads;
+};
+
+// Follows the lines LogWriter writes to split them into chunks and index them
+class LogIndex {
+public:
+    LogIndex();
+
+    // A line about to be written at the end of the log, the time it's about
+    void add(int64_t millis, size_t bytes);
+
+    // A sample line about to be written at the end of the log
+    void addSample(int64_t millis, int64_t jid, size_t bytes);
+
+    // Chunks closed so far
+    const std::vector<LogChunk> &chunks() const { return chunks_; }
+
+    // Closes the last chunk and writes the footer, only the first time it's called
+    void write(std::ostream &out);
+
+private:
+    std::vector<LogChunk> chunks_;
+    LogChunk current;
+    int64_t written;
+    bool finished;
+
+    void close();
+
+    LogIndex(const LogIndex &);
+    void operator=(const LogIndex &);
+};
+
+#endif // LOG_INDEX_H
@@ -1,7 +1,9 @@
 #include <cstdlib>
 
 #include "log_writer.h"
+#include "metrics.h"
 #include <math.h>
+#include <chrono>
 
 using std::copy;
 
@@ -15,7 +17,7 @@ static bool IS_LITTLE_ENDIAN = isLittleEndian();
 
 LogWriter::LogWriter(std::string &fileName, jvmtiEnv *jvmti) :
     file(fileName, std::ofstream::out | std::ofstream::binary), output_(this->file),
-    frameInfoFoo(NULL), jvmti_(jvmti) {
+    frameInfoFoo(NULL), jvmti_(jvmti), lastErrorRecord(0) {
     if (output_.fail()) {
         // The JVM will still continue to run though; could call abort() to terminate the JVM abnormally.
         logError("ERROR: Failed to open file %s for writing\n", fileName.c_str());
@@ -23,10 +25,19 @@ LogWriter::LogWriter(std::string &fileName, jvmtiEnv *jvmti) :
 }
 
 LogWriter::LogWriter(ostream &output, GetFrameInformation frameLookup, jvmtiEnv *jvmti) :
-    file(), output_(output), frameInfoFoo(frameLookup), jvmti_(jvmti) {
+    file(), output_(output), frameInfoFoo(frameLookup), jvmti_(jvmti), lastErrorRecord(0) {
     // Old interface for backward compatibility and testing purposes
 }
 
+LogWriter::~LogWriter() {
+    // a stream handed in may already be gone, whoever owns it writes the index
+    if (file.is_open()) writeIndex();
+}
+
+void LogWriter::writeIndex() {
+    index_.write(output_);
+}
+
 template<typename T>
 void LogWriter::writeValue(const T &value) {
     if (IS_LITTLE_ENDIAN) {
@@ -105,10 +116,17 @@ void LogWriter::record(const JVMPI_CallTrace &trace, ThreadBucketPtr info) {
 void LogWriter::record(const timespec &ts, const JVMPI_CallTrace &trace, ThreadBucketPtr info) {
   //recordTraceStart(trace.num_frames, (map::HashType)trace.env_id, ts, info);
 
+  if (lastErrorRecord == 0) {
+    lastErrorRecord = ts.tv_sec;
+  } else if (ts.tv_sec - lastErrorRecord >= ERROR_RECORD_SECONDS) {
+    recordErrors(ts);
+  }
+
   if (info.defined()) {
     long ms = ts.tv_sec * 1000;
     ms += round(ts.tv_nsec / 1.0e6);
-    output_ << info->name.c_str() << "," << ms << "," << info->jid << ",";
+    line.str("");
+    line << info->name << "," << ms << "," << info->jid << ",";
 
     for (int i = 0; i < trace.num_frames; i++) {
         JVMPI_CallFrame frame = trace.frames[i];
@@ -127,15 +145,79 @@ void LogWriter::record(const timespec &ts, const JVMPI_CallTrace &trace, ThreadB
         inspectMethod(methodId, frame);
         */
 
-        char fqn[256];
-        if (lookupFrameInformation2(frame, (char *)fqn)) {
-          output_ << fqn << ";";
+        if (frame.lineno == kNativeFrameLineNo || frame.lineno == kStubFrameLineNo) {
+          line << nativeFrameName(frame) << ";";
+          continue;
+        }
+        if (frame.method_id == NULL && isRecoveredTrace(trace)) {
+          line << "[asgct error " << frame.lineno << "];";
+          continue;
+        }
+
+        const char *name = frameName(frame);
+        if (name != NULL) {
+          line << name << ";";
         }
     }
-    output_ << "end" << std::endl;
+    line << "end\n";
+
+    std::string text = line.str();
+    index_.addSample(ms, info->jid, text.size());
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    output_.write(text.data(), text.size());
+    output_.flush();
+    std::chrono::nanoseconds took = std::chrono::steady_clock::now() - start;
+    Metrics.writes.fetch_add(1, std::memory_order_relaxed);
+    Metrics.bytesWritten.fetch_add(text.size(), std::memory_order_relaxed);
+    Metrics.writeNanos.fetch_add(took.count(), std::memory_order_relaxed);
   }
 }
 
+void LogWriter::recordErrors(const timespec &ts) {
+    lastErrorRecord = ts.tv_sec;
+
+    ErrorHistogram::Row total;
+    std::vector<ErrorHistogram::Row> threads;
+    ErrorHistogram::instance().snapshot(total, threads);
+
+    long ms = ts.tv_sec * 1000;
+    ms += round(ts.tv_nsec / 1.0e6);
+    line.str("");
+    line << "#asgct," << ms << ",";
+    ErrorHistogram::writeCounts(line, total, ';');
+    line << ";end\n";
+
+    std::string text = line.str();
+    index_.add(ms, text.size());
+    output_.write(text.data(), text.size());
+    output_.flush();
+}
+
+// Resolved name of the frame's method, NULL if it can't be resolved (it's retried next time)
+const char *LogWriter::frameName(const JVMPI_CallFrame &frame) {
+    int id;
+    if (methodIds.find(frame.method_id, id)) {
+        Metrics.methodCacheHits.fetch_add(1, std::memory_order_relaxed);
+        return methodNames[id].c_str();
+    }
+    Metrics.methodCacheMisses.fetch_add(1, std::memory_order_relaxed);
+
+    char fqn[FQN_MAX];
+    if (!lookupFrameInformation2(frame, (char *)fqn)) {
+        return NULL;
+    }
+
+    methodNames.push_back(fqn);
+    // a put may finish a migration and retire the old table, stay in a section until it's out of it
+    {
+        GCHelper::Section section;
+        methodIds.put(frame.method_id, (int)methodNames.size() - 1);
+    }
+    map::DefaultGC.collect();
+    Metrics.methodCacheSize.store(methodNames.size(), std::memory_order_relaxed);
+    return methodNames.back().c_str();
+}
+
 void LogWriter::inspectMethod(const method_id methodId, const JVMPI_CallFrame &frame) {
     if (knownMethods.count(methodId) > 0) {
         return;
@@ -299,6 +381,10 @@ bool LogWriter::lookupFrameInformation(const JVMPI_CallFrame &frame) {
 }
 
 bool LogWriter::lookupFrameInformation2(const JVMPI_CallFrame &frame, char *fqn) {
+  return frameFqn(jvmti_, frame, fqn);
+}
+
+bool frameFqn(jvmtiEnv *jvmti_, const JVMPI_CallFrame &frame, char *fqn) {
   jint error;
   JvmtiScopedPtr<char> methodName(jvmti_), methodSignature(jvmti_), methodGenericSignature(jvmti_);
 
@@ -337,7 +423,7 @@ bool LogWriter::lookupFrameInformation2(const JVMPI_CallFrame &frame, char *fqn)
     if (*p == '/' || *p == ';') *p = '.';
       ++p;
   }
-  sprintf(fqn, "%s%s", classSignature.Get()+1, methodName.Get());
+  snprintf(fqn, FQN_MAX, "%s%s", classSignature.Get()+1, methodName.Get());
 
   /*
   // Get source file, put it in source_name_ptr
@@ -2,10 +2,16 @@
 
 #include <unordered_set>
 #include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
 
 #include "thread_map.h"
 #include "circular_queue.h"
 #include "stacktraces.h"
+#include "native_frames.h"
+#include "error_histogram.h"
+#include "log_index.h"
 
 #ifndef LOG_WRITER_H
 #define LOG_WRITER_H
@@ -31,8 +37,17 @@ public:
     }
 };
 
+// Writes the "package.Class.method" name of the frame's method into fqn, which holds
+// FQN_MAX bytes, false if JVMTI can't tell
+const size_t FQN_MAX = 256;
+
+bool frameFqn(jvmtiEnv *jvmti, const JVMPI_CallFrame &frame, char *fqn);
+
 typedef bool (*GetFrameInformation)(const JVMPI_CallFrame &frame, MethodListener &logWriter);
 
+// jmethodIDs point to word aligned slots
+typedef map::ConcurrentMap<jmethodID, int, PointerHasher<void *>, false> MethodIdMap;
+
 const size_t FIFO_SIZE = 10;
 const byte TRACE_START = 1; // maintain backward compatibility
 const byte TRACE_WITH_TIME = 11;
@@ -41,6 +56,8 @@ const byte FRAME_FULL = 21;
 const byte NEW_METHOD = 3; // maintain backward compatibility
 const byte NEW_METHOD_SIGNATURE = 31;
 const byte THREAD_META = 4;
+// How often the AsyncGetCallTrace error counts go into the log, as a #asgct line
+const int ERROR_RECORD_SECONDS = 10;
 // Error values for line number. If BCI is an error value we report the BCI error value.
 const jint ERR_NO_LINE_INFO = -100;
 const jint ERR_NO_LINE_FOUND= -101;
@@ -55,6 +72,9 @@ public:
 
     explicit LogWriter(ostream &output, GetFrameInformation frameLookup, jvmtiEnv *jvmti);
 
+    // a log file gets its footer index here, see writeIndex
+    virtual ~LogWriter();
+
     virtual void record(const timespec &ts, const JVMPI_CallTrace &trace, ThreadBucketPtr info = ThreadBucketPtr(nullptr));
 
     void record(const JVMPI_CallTrace &trace, ThreadBucketPtr info = ThreadBucketPtr(nullptr));
@@ -67,8 +87,17 @@ public:
     // between 32 and 64 bits
     void recordFrame(const jint bci, const jint lineNumber, method_id methodId);
 
+    // #asgct,<ms>,samples=<n>;<bucket>=<n>;...;end with the totals of ErrorHistogram
+    void recordErrors(const timespec &ts);
+
     void recordFrame(const jint bci, method_id methodId);
 
+    // Appends the index of the chunks written so far, see log_index.h. Nothing may be
+    // recorded afterwards.
+    void writeIndex();
+
+    const LogIndex &index() const { return index_; }
+
     bool lookupFrameInformation(const JVMPI_CallFrame &frame);
     bool lookupFrameInformation2(const JVMPI_CallFrame &frame, char *fqn);
 
@@ -90,6 +119,18 @@ private:
 
     unordered_set<map::HashType> knownThreads;
 
+    // jmethodID -> index of its resolved name, so each method goes through JVMTI once
+    MethodIdMap methodIds;
+
+    std::vector<std::string> methodNames;
+
+    time_t lastErrorRecord;
+
+    LogIndex index_;
+
+    // a sample's line is built here and written in one go, to measure the write
+    std::ostringstream line;
+
     template<typename T>
     void writeValue(const T &value);
 
@@ -101,6 +142,8 @@ private:
 
     jint getLineNo(jint bci, jmethodID methodId);
 
+    const char *frameName(const JVMPI_CallFrame &frame);
+
     DISALLOW_COPY_AND_ASSIGN(LogWriter);
 };
 
@@ -0,0 +1,199 @@
+#include "method_ids.h"
+
+#include <algorithm>
+
+TRACE_DEFINE_BEGIN(MethodIds, kTraceMethodIdsTotal)
+    TRACE_DEFINE("classes queued for jmethodID creation")
+    TRACE_DEFINE("classes prepared by a worker")
+    TRACE_DEFINE("classes prepared inline")
+    TRACE_DEFINE("classes prepared while draining")
+TRACE_DEFINE_END(MethodIds, kTraceMethodIdsTotal);
+
+MethodIdPreparer::MethodIdPreparer(jvmtiEnv *jvmti, int workers, bool deferred)
+        : jvmti_(jvmti), workers_(std::max(0, std::min(workers, kMaxMethodIdThreads))),
+          inFlight(0), released(!deferred), stopping(false), started(false),
+          prepareInline(workers_ == 0 && !deferred) {
+}
+
+void MethodIdPreparer::prepareClass(jvmtiEnv *jvmti, jclass klass) {
+    jint method_count;
+    JvmtiScopedPtr<jmethodID> methods(jvmti);
+    jvmtiError e = jvmti->GetClassMethods(klass, &method_count, methods.GetRef());
+    if (e != JVMTI_ERROR_NONE && e != JVMTI_ERROR_CLASS_NOT_PREPARED) {
+        // JVMTI_ERROR_CLASS_NOT_PREPARED is okay because some classes may
+        // be loaded but not prepared at this point.
+        JvmtiScopedPtr<char> ksig(jvmti);
+        JVMTI_ERROR_CLEANUP(
+            jvmti->GetClassSignature(klass, ksig.GetRef(), NULL),
+            ksig.AbandonBecauseOfError());
+        logError("Failed to create method IDs for methods in class %s with error %d ",
+                 ksig.Get(), e);
+    }
+}
+
+void MethodIdPreparer::start(JNIEnv *jniEnv) {
+    // classes prepared from here on may be missing from the list, some get prepared twice
+    started.store(true, std::memory_order_release);
+
+    // Forces the creation of jmethodIDs of the classes that had already
+    // been loaded (eg java.lang.Object, java.lang.ClassLoader) and
+    // prepare() skipped.
+    jint class_count;
+    JvmtiScopedPtr<jclass> classes(jvmti_);
+    JVMTI_ERROR((jvmti_->GetLoadedClasses(&class_count, classes.GetRef())));
+    jclass *classList = classes.Get();
+
+    for (int i = 0; i < class_count; ++i) {
+        if (prepareInline.load(std::memory_order_acquire)) {
+            prepareClass(jvmti_, classList[i]);
+            TRACE(MethodIds, kTraceMethodIdsPreparedInline);
+        } else {
+            // the workers aren't running yet
+            enqueue(jniEnv->NewGlobalRef(classList[i]));
+        }
+        // GetLoadedClasses hands out local refs
+        jniEnv->DeleteLocalRef(classList[i]);
+    }
+
+    for (int i = 0; i < workers_; ++i) {
+        jthread thread = newThread(jniEnv, "Honest Profiler MethodId Thread");
+        jvmtiError result = jvmti_->RunAgentThread(thread, workerRunnable, this, JVMTI_THREAD_NORM_PRIORITY);
+        if (result != JVMTI_ERROR_NONE) {
+            logError("ERROR: Running jmethodID thread failed with: %d\n", result);
+        }
+    }
+}
+
+void MethodIdPreparer::prepare(JNIEnv *jniEnv, jclass klass) {
+    if (!started.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    if (!prepareInline.load(std::memory_order_acquire)) {
+        jobject ref = jniEnv->NewGlobalRef(klass);
+        std::unique_lock<std::mutex> guard(lock);
+        if (!prepareInline.load(std::memory_order_relaxed)) {
+            queue.push_back(ref);
+            TRACE(MethodIds, kTraceMethodIdsQueued);
+            if (released) ready.notify_one();
+            return;
+        }
+        guard.unlock();
+        // a drain started in between, it may have already returned
+        jniEnv->DeleteGlobalRef(ref);
+    }
+
+    prepareClass(jvmti_, klass);
+    TRACE(MethodIds, kTraceMethodIdsPreparedInline);
+}
+
+void MethodIdPreparer::enqueue(jobject ref) {
+    std::lock_guard<std::mutex> guard(lock);
+    queue.push_back(ref);
+    TRACE(MethodIds, kTraceMethodIdsQueued);
+}
+
+void MethodIdPreparer::drain(JNIEnv *jniEnv) {
+    if (!started.load(std::memory_order_acquire)) {
+        // sampling started before VMInit, start() queues the loaded classes for the workers
+        // rather than preparing every one of them inline
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            released = true;
+        }
+        ready.notify_all();
+        return;
+    }
+
+    if (prepareInline.load(std::memory_order_acquire)) {
+        std::unique_lock<std::mutex> guard(lock);
+        idle.wait(guard, [this] { return stopping || (queue.empty() && inFlight == 0); });
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        prepareInline.store(true, std::memory_order_release);
+        released = true;
+    }
+    ready.notify_all();
+
+    std::vector<jobject> batch;
+    while (takeBatch(batch, false)) {
+        for (jobject ref : batch) {
+            prepareClass(jvmti_, (jclass) ref);
+            TRACE(MethodIds, kTraceMethodIdsPreparedByDrain);
+        }
+        finishBatch(jniEnv, batch);
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this] { return stopping || (queue.empty() && inFlight == 0); });
+}
+
+void MethodIdPreparer::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    ready.notify_all();
+    idle.notify_all();
+}
+
+long MethodIdPreparer::pending() {
+    std::lock_guard<std::mutex> guard(lock);
+    return (long) queue.size() + inFlight;
+}
+
+bool MethodIdPreparer::takeBatch(std::vector<jobject> &batch, bool wait) {
+    std::unique_lock<std::mutex> guard(lock);
+    if (wait) {
+        ready.wait(guard, [this] { return stopping || (released && !queue.empty()); });
+    }
+    if (stopping || queue.empty()) {
+        return false;
+    }
+
+    size_t taken = std::min(queue.size(), (size_t) kMethodIdBatchSize);
+    batch.assign(queue.end() - taken, queue.end());
+    queue.resize(queue.size() - taken);
+    inFlight += (int) taken;
+    if (!queue.empty()) ready.notify_one();
+    return true;
+}
+
+void MethodIdPreparer::finishBatch(JNIEnv *jniEnv, std::vector<jobject> &batch) {
+    for (jobject ref : batch) {
+        jniEnv->DeleteGlobalRef(ref);
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    inFlight -= (int) batch.size();
+    batch.clear();
+    if (queue.empty() && inFlight == 0) idle.notify_all();
+}
+
+void MethodIdPreparer::work(JNIEnv *jniEnv) {
+    std::vector<jobject> batch;
+    while (takeBatch(batch, true)) {
+        for (jobject ref : batch) {
+            prepareClass(jvmti_, (jclass) ref);
+            TRACE(MethodIds, kTraceMethodIdsPreparedByWorker);
+        }
+        finishBatch(jniEnv, batch);
+    }
+}
+
+void JNICALL MethodIdPreparer::workerRunnable(jvmtiEnv *jvmti, JNIEnv *jniEnv, void *arg) {
+    IMPLICITLY_USE(jvmti);
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGPROF);
+
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL) < 0) {
+        logError("ERROR: unable to set jmethodID thread signal mask\n");
+    }
+
+    ((MethodIdPreparer *) arg)->work(jniEnv);
+}
@@ -0,0 +1,88 @@
+#ifndef METHOD_IDS_H
+#define METHOD_IDS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "globals.h"
+#include "common.h"
+
+#include "trace.h"
+
+const int kTraceMethodIdsTotal = 4;
+
+const int kTraceMethodIdsQueued = 0;
+const int kTraceMethodIdsPreparedByWorker = 1;
+const int kTraceMethodIdsPreparedInline = 2;
+const int kTraceMethodIdsPreparedByDrain = 3;
+
+TRACE_DECLARE(MethodIds, kTraceMethodIdsTotal);
+
+// Classes a worker takes off the queue at once
+const int kMethodIdBatchSize = 256;
+const int kMaxMethodIdThreads = 16;
+
+/**
+ * Forces the creation of jmethodIDs, which AsyncGetCallTrace can't do from a signal handler.
+ *
+ * With workers > 0 classes are queued and prepared by that many agent threads in the
+ * background, so VMInit, class loading and starting to sample don't pay for it; samples taken
+ * before a worker reaches a class show its frames as unknown. A deferred preparer keeps its
+ * workers idle until sampling starts and drain() is called: it waits for the queue to empty,
+ * helping from the calling thread, and from then on every class is prepared on the thread
+ * preparing it. With no workers and no deferral classes are prepared inline from the start.
+ */
+class MethodIdPreparer {
+public:
+    MethodIdPreparer(jvmtiEnv *jvmti, int workers, bool deferred);
+
+    // From VMInit on: queues every loaded class and starts the workers
+    void start(JNIEnv *jniEnv);
+
+    // From ClassPrepare, classes prepared before start() are picked up by it
+    void prepare(JNIEnv *jniEnv, jclass klass);
+
+    // Returns once every queued class has its jmethodIDs. Before start() there is nothing to
+    // wait for, the workers are only let go.
+    void drain(JNIEnv *jniEnv);
+
+    // Workers exit, whatever is still queued is left to the dying VM
+    void stop();
+
+    long pending();
+
+    // Calls GetClassMethods on a given class to force the creation of jmethodIDs of it
+    static void prepareClass(jvmtiEnv *jvmti, jclass klass);
+
+private:
+    jvmtiEnv *const jvmti_;
+    const int workers_;
+
+    std::mutex lock;
+    std::condition_variable ready;
+    std::condition_variable idle;
+    // global refs
+    std::vector<jobject> queue;
+    int inFlight;
+    bool released;
+    bool stopping;
+
+    std::atomic<bool> started;
+    std::atomic<bool> prepareInline;
+
+    static void JNICALL workerRunnable(jvmtiEnv *jvmti, JNIEnv *jniEnv, void *arg);
+
+    void work(JNIEnv *jniEnv);
+
+    bool takeBatch(std::vector<jobject> &batch, bool wait);
+
+    void finishBatch(JNIEnv *jniEnv, std::vector<jobject> &batch);
+
+    void enqueue(jobject ref);
+
+    DISALLOW_COPY_AND_ASSIGN(MethodIdPreparer);
+};
+
+#endif // METHOD_IDS_H
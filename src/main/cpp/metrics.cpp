@@ -0,0 +1,87 @@
+#include "metrics.h"
+
+#include <time.h>
+
+#include "error_histogram.h"
+#include "thread_map.h"
+
+ProfilerMetrics Metrics;
+
+void ProfilerMetrics::popped(time_t second, uint64_t occupancy) {
+    samples.fetch_add(1, std::memory_order_relaxed);
+    if (occupancy > queueHighWater.load(std::memory_order_relaxed)) {
+        queueHighWater.store(occupancy, std::memory_order_relaxed);
+    }
+
+    int64_t current = sampleSecond.load(std::memory_order_relaxed);
+    if (second != current) {
+        // a second without samples in between leaves nothing for the last one
+        uint64_t last = second == current + 1 ? sampleSecondCount.load(std::memory_order_relaxed) : 0;
+        samplesLastSecond.store(last, std::memory_order_relaxed);
+        sampleSecond.store(second, std::memory_order_relaxed);
+        sampleSecondCount.store(0, std::memory_order_relaxed);
+    }
+    sampleSecondCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void writeMetric(std::ostream &out, const char *name, const char *type, const char *help, uint64_t value) {
+    out << "# HELP honest_profiler_" << name << ' ' << help << '\n'
+        << "# TYPE honest_profiler_" << name << ' ' << type << '\n'
+        << "honest_profiler_" << name << ' ' << value << '\n';
+}
+
+void ProfilerMetrics::write(std::ostream &out) const {
+    writeMetric(out, "queue_pushes_total", "counter", "Samples pushed onto the queue",
+                queuePushes.load(std::memory_order_relaxed));
+    writeMetric(out, "queue_drops_total", "counter", "Samples dropped because the queue was full",
+                queueDrops.load(std::memory_order_relaxed));
+    writeMetric(out, "queue_high_water", "gauge", "Most samples found queued by a consumer",
+                queueHighWater.load(std::memory_order_relaxed));
+
+    writeMetric(out, "samples_total", "counter", "Samples taken off the queue",
+                samples.load(std::memory_order_relaxed));
+    // stale once sampling stopped
+    uint64_t lastSecond = samplesLastSecond.load(std::memory_order_relaxed);
+    if (time(NULL) - sampleSecond.load(std::memory_order_relaxed) > 1) lastSecond = 0;
+    writeMetric(out, "samples_per_second", "gauge", "Samples taken off the queue during the last full second",
+                lastSecond);
+
+    ErrorHistogram::Row total;
+    std::vector<ErrorHistogram::Row> threads;
+    ErrorHistogram::instance().snapshot(total, threads);
+    out << "# HELP honest_profiler_asgct_samples_total Samples by AsyncGetCallTrace outcome\n"
+        << "# TYPE honest_profiler_asgct_samples_total counter\n";
+    for (int i = 0; i < kErrorBuckets; i++) {
+        out << "honest_profiler_asgct_samples_total{outcome=\"" << ErrorHistogram::bucketName(i) << "\"} "
+            << total.counts[i] << '\n';
+    }
+
+    writeMetric(out, "written_bytes_total", "counter", "Bytes written to the log",
+                bytesWritten.load(std::memory_order_relaxed));
+    writeMetric(out, "writes_total", "counter", "Samples written to the log",
+                writes.load(std::memory_order_relaxed));
+    out << "# HELP honest_profiler_write_seconds_total Time spent writing samples to the log\n"
+        << "# TYPE honest_profiler_write_seconds_total counter\n"
+        << "honest_profiler_write_seconds_total " << writeNanos.load(std::memory_order_relaxed) / 1e9 << '\n';
+
+    writeMetric(out, "method_cache_hits_total", "counter", "Method names found in the log writer's cache",
+                methodCacheHits.load(std::memory_order_relaxed));
+    writeMetric(out, "method_cache_misses_total", "counter", "Method names resolved through JVMTI",
+                methodCacheMisses.load(std::memory_order_relaxed));
+    writeMetric(out, "method_cache_size", "gauge", "Method names in the log writer's cache",
+                methodCacheSize.load(std::memory_order_relaxed));
+
+    out << "# HELP honest_profiler_processor_cpu_seconds_total CPU time of the processing threads\n"
+        << "# TYPE honest_profiler_processor_cpu_seconds_total counter\n"
+        << "honest_profiler_processor_cpu_seconds_total " << processorCpuNanos.load(std::memory_order_relaxed) / 1e9 << '\n';
+
+    ThreadBucketPool::Occupancy pool = ThreadBucketPool::instance().occupancy();
+    // released buckets count until the GC reclaims them, so this runs a little ahead of the
+    // threads the map knows
+    writeMetric(out, "thread_buckets_in_use", "gauge", "Thread buckets taken from the pool and not yet back in it",
+                pool.inUse);
+    uint64_t retired = gcRetired.load(std::memory_order_relaxed);
+    uint64_t reclaimed = gcReclaimed.load(std::memory_order_relaxed);
+    writeMetric(out, "gc_backlog", "gauge", "Retired map objects waiting for an epoch to free them",
+                retired > reclaimed ? retired - reclaimed : 0);
+}
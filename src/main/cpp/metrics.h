@@ -0,0 +1,52 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <ostream>
+
+const size_t kCacheLineSize = 64;
+
+/**
+ * Health counters of the profiler itself, served in the Prometheus text format by the
+ * controller. Everything is a relaxed atomic, some of it bumped from the signal handler.
+ * Counters written by sampled threads, by the queue consumer and by the agent's other
+ * threads sit on cache lines of their own, so bumping them doesn't bounce the other lines.
+ */
+struct ProfilerMetrics {
+    // sampled threads, in the signal handler
+    alignas(kCacheLineSize) std::atomic<uint64_t> queuePushes;
+    std::atomic<uint64_t> queueDrops;
+
+    // the queue consumers
+    alignas(kCacheLineSize) std::atomic<uint64_t> queueHighWater;
+    std::atomic<uint64_t> samples;
+    std::atomic<int64_t> sampleSecond;
+    std::atomic<uint64_t> sampleSecondCount;
+    std::atomic<uint64_t> samplesLastSecond;
+    std::atomic<uint64_t> bytesWritten;
+    std::atomic<uint64_t> writes;
+    std::atomic<uint64_t> writeNanos;
+    std::atomic<uint64_t> methodCacheHits;
+    std::atomic<uint64_t> methodCacheMisses;
+    std::atomic<uint64_t> methodCacheSize;
+    std::atomic<uint64_t> processorCpuNanos;
+
+    // whoever retires or reclaims map garbage
+    alignas(kCacheLineSize) std::atomic<uint64_t> gcRetired;
+    std::atomic<uint64_t> gcReclaimed;
+
+    // Consumer side, counts a popped sample and the queue occupancy it was popped at
+    void popped(time_t second, uint64_t occupancy);
+
+    // Prometheus text exposition format, version 0.0.4
+    void write(std::ostream &out) const;
+};
+
+// HELP, TYPE and the sample of a metric without labels, name without the honest_profiler_ prefix
+void writeMetric(std::ostream &out, const char *name, const char *type, const char *help, uint64_t value);
+
+// zero initialised as a static, usable before any constructor ran
+extern ProfilerMetrics Metrics;
+
+#endif // METRICS_H
@@ -0,0 +1,326 @@
+#include "native_frames.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <ucontext.h>
+#endif
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define NATIVE_UNWINDING_SUPPORTED
+#endif
+
+// the smallest page size around, a range checked readable at this granularity stays readable
+const uintptr_t kUnwindPageSize = 4096;
+
+bool NativeUnwinder::available() {
+#ifdef NATIVE_UNWINDING_SUPPORTED
+    // containers may filter the syscall out
+    static const bool canRead = [] {
+        uintptr_t probe = 42, copy = 0;
+        struct iovec local = {&copy, sizeof(copy)};
+        struct iovec remote = {&probe, sizeof(probe)};
+        if (process_vm_readv(getpid(), &local, 1, &remote, 1, 0) == (ssize_t) sizeof(copy) && copy == probe) {
+            return true;
+        }
+        logError("WARN: process_vm_readv is unavailable, native frames won't be recorded\n");
+        return false;
+    }();
+    return canRead;
+#else
+    logError("WARN: Native frames aren't supported on this platform\n");
+    return false;
+#endif
+}
+
+// Reads the saved frame pointer and return address at fp. readablePage remembers the last
+// page process_vm_readv got through, so most frames are read directly.
+bool NativeUnwinder::readFrame(uintptr_t fp, uintptr_t *frame, uintptr_t &readablePage) {
+#ifdef NATIVE_UNWINDING_SUPPORTED
+    uintptr_t page = fp & ~(kUnwindPageSize - 1);
+    bool samePage = (fp + 2 * sizeof(uintptr_t) - 1) < page + kUnwindPageSize;
+    if (samePage && page == readablePage) {
+        frame[0] = ((uintptr_t *) fp)[0];
+        frame[1] = ((uintptr_t *) fp)[1];
+        return true;
+    }
+
+    struct iovec local = {frame, 2 * sizeof(uintptr_t)};
+    struct iovec remote = {(void *) fp, 2 * sizeof(uintptr_t)};
+    if (process_vm_readv(getpid(), &local, 1, &remote, 1, 0) != (ssize_t) (2 * sizeof(uintptr_t))) {
+        return false;
+    }
+    if (samePage) readablePage = page;
+    return true;
+#else
+    IMPLICITLY_USE(fp);
+    IMPLICITLY_USE(frame);
+    IMPLICITLY_USE(readablePage);
+    return false;
+#endif
+}
+
+bool NativeUnwinder::registers(void *context, uintptr_t &pc, uintptr_t &fp, uintptr_t &sp) {
+#ifdef NATIVE_UNWINDING_SUPPORTED
+    if (context == NULL) return false;
+
+    const ucontext_t *uc = (const ucontext_t *) context;
+#if defined(__x86_64__)
+    pc = (uintptr_t) uc->uc_mcontext.gregs[REG_RIP];
+    fp = (uintptr_t) uc->uc_mcontext.gregs[REG_RBP];
+    sp = (uintptr_t) uc->uc_mcontext.gregs[REG_RSP];
+#else
+    pc = (uintptr_t) uc->uc_mcontext.pc;
+    fp = (uintptr_t) uc->uc_mcontext.regs[29];
+    sp = (uintptr_t) uc->uc_mcontext.sp;
+#endif
+    return true;
+#else
+    IMPLICITLY_USE(context);
+    IMPLICITLY_USE(pc);
+    IMPLICITLY_USE(fp);
+    IMPLICITLY_USE(sp);
+    return false;
+#endif
+}
+
+uintptr_t NativeUnwinder::pc(void *context) {
+    uintptr_t pc = 0, fp, sp;
+    return registers(context, pc, fp, sp) ? pc : 0;
+}
+
+int NativeUnwinder::unwind(void *context, JVMPI_CallFrame *frames, int maxFrames) {
+#ifdef NATIVE_UNWINDING_SUPPORTED
+    uintptr_t pc, fp, sp;
+    if (maxFrames <= 0 || !registers(context, pc, fp, sp)) return 0;
+
+    int count = 0;
+    frames[count].lineno = kNativeFrameLineNo;
+    frames[count].method_id = (jmethodID) pc;
+    count++;
+
+    uintptr_t readablePage = 0;
+    while (count < maxFrames) {
+        // callers live further up the stack than the interrupted function
+        if (fp < sp || (fp & (sizeof(uintptr_t) - 1)) != 0) break;
+
+        uintptr_t frame[2];
+        if (!readFrame(fp, frame, readablePage) || frame[1] == 0) break;
+
+        frames[count].lineno = kNativeFrameLineNo;
+        frames[count].method_id = (jmethodID) frame[1];
+        count++;
+
+        if (frame[0] <= fp || frame[0] - fp > kMaxNativeFrameSize) break;
+        fp = frame[0];
+    }
+    return count;
+#else
+    IMPLICITLY_USE(context);
+    IMPLICITLY_USE(frames);
+    IMPLICITLY_USE(maxFrames);
+    return 0;
+#endif
+}
+
+std::string nativeFrameName(const JVMPI_CallFrame &frame) {
+    if (frame.lineno == kStubFrameLineNo) {
+        return std::string("[") + (const char *) frame.method_id + "]";
+    }
+    return NativeSymbolizer::instance().name((uintptr_t) frame.method_id);
+}
+
+NativeSymbolizer::Module::Module(const std::string &p) : path(p), loaded(false) {
+    size_t slash = path.rfind('/');
+    shortName = slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+NativeSymbolizer &NativeSymbolizer::instance() {
+    static NativeSymbolizer symbolizer;
+    return symbolizer;
+}
+
+NativeSymbolizer::NativeSymbolizer() : lastRefresh(0) {
+}
+
+std::string NativeSymbolizer::name(uintptr_t pc) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto cached = cache.find(pc);
+    if (cached != cache.end()) return cached->second;
+
+    if (cache.size() >= kNativeNameCacheSize) cache.clear();
+    return cache.emplace(pc, resolve(pc)).first->second;
+}
+
+std::string NativeSymbolizer::resolve(uintptr_t pc) {
+    std::ostringstream name;
+    const Mapping *mapping = mappingFor(pc);
+    if (mapping == NULL) {
+        name << "[native 0x" << std::hex << pc << "]";
+        return name.str();
+    }
+
+    Module &module = *mapping->module;
+    if (!module.loaded) {
+        module.loaded = true;
+        if (!loadElf(module)) {
+            logError("WARN: Unable to read symbols of %s\n", module.path.c_str());
+        }
+    }
+
+    // the address the ELF file gives this pc, from the segment the mapping was loaded from
+    uintptr_t address = pc - mapping->start + mapping->offset;
+    auto segment = module.segments.upper_bound(mapping->offset);
+    if (segment != module.segments.begin()) {
+        address += (--segment)->second;
+    }
+
+    Symbol key = {address, 0, 0};
+    auto symbol = std::upper_bound(module.symbols.begin(), module.symbols.end(), key);
+    if (symbol != module.symbols.begin()) {
+        --symbol;
+        if (symbol->size == 0 || address < symbol->address + symbol->size) {
+            return module.shortName + "`" + (module.names.c_str() + symbol->nameOffset);
+        }
+    }
+
+    name << module.shortName << "`0x" << std::hex << address;
+    return name.str();
+}
+
+const NativeSymbolizer::Mapping *NativeSymbolizer::mappingFor(uintptr_t pc) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        Mapping key = {pc, 0, 0, NULL};
+        auto it = std::upper_bound(mappings.begin(), mappings.end(), key);
+        if (it != mappings.begin() && pc < (--it)->end) {
+            return &*it;
+        }
+
+        // libraries loaded since the last read
+        time_t now = time(NULL);
+        if (attempt > 0 || now - lastRefresh < kNativeMapsRefreshSeconds) break;
+        lastRefresh = now;
+        refreshMappings();
+    }
+    return NULL;
+}
+
+void NativeSymbolizer::refreshMappings() {
+#ifdef __linux__
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps == NULL) {
+        logError("WARN: Unable to read /proc/self/maps\n");
+        return;
+    }
+
+    std::vector<Mapping> found;
+    char line[4096];
+    while (fgets(line, sizeof(line), maps) != NULL) {
+        unsigned long start, end, offset;
+        char perms[8];
+        int pathStart = 0;
+        if (sscanf(line, "%lx-%lx %7s %lx %*s %*s %n", &start, &end, perms, &offset, &pathStart) != 4 ||
+            pathStart == 0 || strchr(perms, 'x') == NULL || line[pathStart] != '/') {
+            continue;
+        }
+
+        std::string path(line + pathStart);
+        path.erase(path.find_last_not_of(" \n") + 1);
+
+        std::unique_ptr<Module> &module = modules[path];
+        if (!module) module.reset(new Module(path));
+
+        Mapping mapping = {(uintptr_t) start, (uintptr_t) end, (uintptr_t) offset, module.get()};
+        found.push_back(mapping);
+    }
+    fclose(maps);
+
+    std::sort(found.begin(), found.end());
+    mappings.swap(found);
+#endif
+}
+
+bool NativeSymbolizer::loadElf(Module &module) {
+#ifdef __linux__
+    int fd = open(module.path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(ElfW(Ehdr))) {
+        base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) return false;
+
+    const char *image = (const char *) base;
+    const size_t size = (size_t) st.st_size;
+    const ElfW(Ehdr) *header = (const ElfW(Ehdr) *) image;
+    bool valid = memcmp(header->e_ident, ELFMAG, SELFMAG) == 0 &&
+                 header->e_ident[EI_CLASS] == (sizeof(uintptr_t) == 8 ? ELFCLASS64 : ELFCLASS32) &&
+                 header->e_phoff + (size_t) header->e_phnum * sizeof(ElfW(Phdr)) <= size &&
+                 header->e_shoff + (size_t) header->e_shnum * sizeof(ElfW(Shdr)) <= size;
+
+    if (valid) {
+        const ElfW(Phdr) *programs = (const ElfW(Phdr) *) (image + header->e_phoff);
+        for (int i = 0; i < header->e_phnum; i++) {
+            if (programs[i].p_type == PT_LOAD) {
+                uintptr_t pageOffset = programs[i].p_offset & ~(kUnwindPageSize - 1);
+                module.segments[pageOffset] = programs[i].p_vaddr - programs[i].p_offset;
+            }
+        }
+
+        const ElfW(Shdr) *sections = (const ElfW(Shdr) *) (image + header->e_shoff);
+        for (int i = 0; i < header->e_shnum; i++) {
+            const ElfW(Shdr) &table = sections[i];
+            if ((table.sh_type != SHT_SYMTAB && table.sh_type != SHT_DYNSYM) ||
+                table.sh_link >= header->e_shnum || table.sh_entsize != sizeof(ElfW(Sym)) ||
+                table.sh_offset + table.sh_size > size) {
+                continue;
+            }
+            const ElfW(Shdr) &strings = sections[table.sh_link];
+            if (strings.sh_offset + strings.sh_size > size) continue;
+
+            const ElfW(Sym) *symbols = (const ElfW(Sym) *) (image + table.sh_offset);
+            const char *names = image + strings.sh_offset;
+            for (size_t s = 0; s < table.sh_size / sizeof(ElfW(Sym)); s++) {
+                const ElfW(Sym) &symbol = symbols[s];
+                int type = ELF64_ST_TYPE(symbol.st_info);
+                if ((type != STT_FUNC && type != STT_GNU_IFUNC) || symbol.st_shndx == SHN_UNDEF ||
+                    symbol.st_value == 0 || symbol.st_name >= strings.sh_size) {
+                    continue;
+                }
+                const char *name = names + symbol.st_name;
+                size_t length = strnlen(name, strings.sh_size - symbol.st_name);
+
+                Symbol entry = {(uintptr_t) symbol.st_value, (uintptr_t) symbol.st_size, (uint32_t) module.names.size()};
+                module.names.append(name, length).push_back('\0');
+                module.symbols.push_back(entry);
+            }
+        }
+
+        // .symtab repeats most of .dynsym
+        std::stable_sort(module.symbols.begin(), module.symbols.end());
+        module.symbols.erase(std::unique(module.symbols.begin(), module.symbols.end(),
+                                         [](const Symbol &a, const Symbol &b) { return a.address == b.address; }),
+                             module.symbols.end());
+    }
+
+    munmap(base, size);
+    return valid;
+#else
+    IMPLICITLY_USE(module);
+    return false;
+#endif
+}
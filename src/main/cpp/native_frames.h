@@ -0,0 +1,112 @@
+#ifndef NATIVE_FRAMES_H
+#define NATIVE_FRAMES_H
+
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "globals.h"
+#include "stacktraces.h"
+
+// A caller's frame further up the stack than this is taken for a broken chain
+const uintptr_t kMaxNativeFrameSize = 1024 * 1024;
+
+/**
+ * Frame pointer unwinder for samples AsyncGetCallTrace can't walk. Only code built with frame
+ * pointers shows up beyond the interrupted function, the walk stops at the first frame
+ * that breaks the chain. Every read goes through process_vm_readv, so a bogus frame pointer
+ * ends the walk rather than faulting in the signal handler.
+ */
+class NativeUnwinder {
+public:
+    // Whether this platform and kernel can unwind, checked once
+    static bool available();
+
+    // Async-signal-safe. Writes up to maxFrames pcs of the interrupted thread, leaf first,
+    // as kNativeFrameLineNo frames and returns how many it wrote.
+    static int unwind(void *context, JVMPI_CallFrame *frames, int maxFrames);
+
+    // Async-signal-safe, the interrupted pc or 0 where it isn't known
+    static uintptr_t pc(void *context);
+
+private:
+    static bool registers(void *context, uintptr_t &pc, uintptr_t &fp, uintptr_t &sp);
+
+    static bool readFrame(uintptr_t fp, uintptr_t *frame, uintptr_t &readablePage);
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(NativeUnwinder);
+};
+
+// Name of a native pc or VM stub frame, see kNativeFrameLineNo
+std::string nativeFrameName(const JVMPI_CallFrame &frame);
+
+/**
+ * Resolves native pcs to "module`symbol" from the ELF .symtab and .dynsym of the objects
+ * mapped into the process. /proc/self/maps is read again when a pc falls outside every
+ * known mapping, at most once per kNativeMapsRefreshSeconds. Symbol tables are loaded the
+ * first time one of their pcs is looked up and kept sorted for binary search.
+ */
+const int kNativeMapsRefreshSeconds = 1;
+const size_t kNativeNameCacheSize = 64 * 1024;
+
+class NativeSymbolizer {
+public:
+    static NativeSymbolizer &instance();
+
+    // module`symbol, module`0xoffset without a symbol, [native 0xpc] outside any module
+    std::string name(uintptr_t pc);
+
+private:
+    struct Symbol {
+        uintptr_t address;
+        uintptr_t size;
+        uint32_t nameOffset;
+
+        bool operator<(const Symbol &other) const { return address < other.address; }
+    };
+
+    struct Module {
+        std::string path;
+        std::string shortName;
+        bool loaded;
+        // p_vaddr - p_offset of each loadable segment, keyed by its page aligned file offset
+        std::map<uintptr_t, uintptr_t> segments;
+        std::vector<Symbol> symbols;
+        std::string names;
+
+        explicit Module(const std::string &p);
+    };
+
+    struct Mapping {
+        uintptr_t start;
+        uintptr_t end;
+        uintptr_t offset;
+        Module *module;
+
+        bool operator<(const Mapping &other) const { return start < other.start; }
+    };
+
+    std::mutex lock;
+    std::map<std::string, std::unique_ptr<Module>> modules;
+    std::vector<Mapping> mappings;
+    std::unordered_map<uintptr_t, std::string> cache;
+    time_t lastRefresh;
+
+    NativeSymbolizer();
+
+    void refreshMappings();
+
+    const Mapping *mappingFor(uintptr_t pc);
+
+    static bool loadElf(Module &module);
+
+    std::string resolve(uintptr_t pc);
+
+    DISALLOW_COPY_AND_ASSIGN(NativeSymbolizer);
+};
+
+#endif // NATIVE_FRAMES_H
@@ -0,0 +1,204 @@
+#include "pprof.h"
+
+#include <string.h>
+#include <unordered_map>
+#include <zlib.h>
+
+#include "globals.h"
+
+// profile.proto field numbers
+const int kProfileSampleType = 1;
+const int kProfileSample = 2;
+const int kProfileLocation = 4;
+const int kProfileFunction = 5;
+const int kProfileStringTable = 6;
+const int kProfileTimeNanos = 9;
+const int kProfileDurationNanos = 10;
+const int kProfilePeriodType = 11;
+const int kProfilePeriod = 12;
+
+const int kValueTypeType = 1;
+const int kValueTypeUnit = 2;
+
+const int kSampleLocationId = 1;
+const int kSampleValue = 2;
+const int kSampleLabel = 3;
+
+const int kLabelKey = 1;
+const int kLabelStr = 2;
+
+const int kLocationId = 1;
+const int kLocationLine = 4;
+
+const int kLineFunctionId = 1;
+
+const int kFunctionId = 1;
+const int kFunctionName = 2;
+const int kFunctionSystemName = 3;
+
+const int kWireVarint = 0;
+const int kWireLengthDelimited = 2;
+
+static void putVarint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((char) (value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char) value);
+}
+
+static void putTag(std::string &out, int field, int wireType) {
+    putVarint(out, ((uint64_t) field << 3) | wireType);
+}
+
+static void putVarintField(std::string &out, int field, uint64_t value) {
+    putTag(out, field, kWireVarint);
+    putVarint(out, value);
+}
+
+static void putBytesField(std::string &out, int field, const std::string &value) {
+    putTag(out, field, kWireLengthDelimited);
+    putVarint(out, value.size());
+    out.append(value);
+}
+
+static void putPackedField(std::string &out, int field, const std::vector<uint64_t> &values) {
+    std::string packed;
+    for (size_t i = 0; i < values.size(); i++) {
+        putVarint(packed, values[i]);
+    }
+    putBytesField(out, field, packed);
+}
+
+class PprofEncoder {
+public:
+    PprofEncoder() {
+        // index 0 is the empty string, as profile.proto requires
+        strings.push_back("");
+        stringIds[""] = 0;
+    }
+
+    int64_t string(const std::string &value) {
+        auto it = stringIds.find(value);
+        if (it != stringIds.end()) return it->second;
+        int64_t id = strings.size();
+        strings.push_back(value);
+        stringIds.emplace(value, id);
+        return id;
+    }
+
+    // One function and one location per distinct name, sharing their id
+    uint64_t location(const std::string &name) {
+        auto it = locationIds.find(name);
+        if (it != locationIds.end()) return it->second;
+        uint64_t id = locationIds.size() + 1;
+        locationIds.emplace(name, id);
+
+        std::string function;
+        putVarintField(function, kFunctionId, id);
+        putVarintField(function, kFunctionName, string(name));
+        putVarintField(function, kFunctionSystemName, string(name));
+        putBytesField(functions, kProfileFunction, function);
+
+        std::string line;
+        putVarintField(line, kLineFunctionId, id);
+        std::string location;
+        putVarintField(location, kLocationId, id);
+        putBytesField(location, kLocationLine, line);
+        putBytesField(locations, kProfileLocation, location);
+        return id;
+    }
+
+    std::string valueType(const std::string &type, const std::string &unit) {
+        std::string out;
+        putVarintField(out, kValueTypeType, string(type));
+        putVarintField(out, kValueTypeUnit, string(unit));
+        return out;
+    }
+
+    void sample(const std::string &thread, const std::vector<std::string> &frames, long count, int64_t periodNanos) {
+        std::vector<uint64_t> ids;
+        // leaf first in pprof
+        for (size_t i = frames.size(); i > 0; i--) {
+            ids.push_back(location(frames[i - 1]));
+        }
+        std::vector<uint64_t> values;
+        values.push_back(count);
+        values.push_back(count * periodNanos);
+
+        std::string sample;
+        putPackedField(sample, kSampleLocationId, ids);
+        putPackedField(sample, kSampleValue, values);
+        if (!thread.empty()) {
+            std::string label;
+            putVarintField(label, kLabelKey, string("thread"));
+            putVarintField(label, kLabelStr, string(thread));
+            putBytesField(sample, kSampleLabel, label);
+        }
+        putBytesField(samples, kProfileSample, sample);
+    }
+
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, int64_t> stringIds;
+    std::unordered_map<std::string, uint64_t> locationIds;
+    std::string samples;
+    std::string locations;
+    std::string functions;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(PprofEncoder);
+};
+
+std::string pprofProfile(const std::vector<WindowStack> &stacks, long truncated,
+                         time_t from, time_t to, int64_t periodNanos) {
+    PprofEncoder encoder;
+    std::string sampleTypes;
+    putBytesField(sampleTypes, kProfileSampleType, encoder.valueType("samples", "count"));
+    putBytesField(sampleTypes, kProfileSampleType, encoder.valueType("cpu", "nanoseconds"));
+    std::string periodType = encoder.valueType("cpu", "nanoseconds");
+
+    for (size_t i = 0; i < stacks.size(); i++) {
+        encoder.sample(stacks[i].thread, stacks[i].frames, stacks[i].samples, periodNanos);
+    }
+    if (truncated > 0) {
+        encoder.sample("", std::vector<std::string>(1, kWindowTruncatedFrame), truncated, periodNanos);
+    }
+
+    std::string out = sampleTypes;
+    out.append(encoder.samples);
+    out.append(encoder.locations);
+    out.append(encoder.functions);
+    for (size_t i = 0; i < encoder.strings.size(); i++) {
+        putBytesField(out, kProfileStringTable, encoder.strings[i]);
+    }
+    putVarintField(out, kProfileTimeNanos, (uint64_t) from * 1000000000ULL);
+    putVarintField(out, kProfileDurationNanos, (uint64_t) (to > from ? to - from : 0) * 1000000000ULL);
+    putBytesField(out, kProfilePeriodType, periodType);
+    putVarintField(out, kProfilePeriod, periodNanos);
+    return out;
+}
+
+bool gzipCompress(const std::string &in, std::string &out) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // 16 on top of the window bits asks for a gzip header and trailer
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        logError("ERROR: Failed to initialise zlib\n");
+        return false;
+    }
+
+    out.resize(deflateBound(&stream, in.size()) + 32);
+    stream.next_in = (Bytef *) in.data();
+    stream.avail_in = in.size();
+    stream.next_out = (Bytef *) &out[0];
+    stream.avail_out = out.size();
+
+    int result = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END) {
+        logError("ERROR: Failed to compress the profile: %d\n", result);
+        return false;
+    }
+    return true;
+}
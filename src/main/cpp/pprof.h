@@ -0,0 +1,23 @@
+#ifndef PPROF_H
+#define PPROF_H
+
+#include <stdint.h>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "rolling_window.h"
+
+/**
+ * The stacks of a rolling window as a pprof profile.proto message, encoded by hand. Every
+ * distinct frame name becomes a function with a location of its own, samples carry a sample
+ * count and the CPU time it stands for, and the thread as a "thread" label. Samples that
+ * didn't fit into the window are a single "[truncated]" frame.
+ */
+std::string pprofProfile(const std::vector<WindowStack> &stacks, long truncated,
+                         time_t from, time_t to, int64_t periodNanos);
+
+// gzip as pprof expects its input, false if zlib fails
+bool gzipCompress(const std::string &in, std::string &out);
+
+#endif // PPROF_H
@@ -1,6 +1,8 @@
+#include <chrono>
 #include <thread>
 #include <iostream>
 #include "processor.h"
+#include "metrics.h"
 
 #ifdef WINDOWS
 #include <windows.h>
@@ -21,6 +23,22 @@ void sleep_for_millis(uint period) {
 #endif
 }
 
+// CPU time of the calling thread, 0 where the platform can't tell
+static uint64_t threadCpuNanos() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+#endif
+    return 0;
+}
+
+static long currentMillis() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
 void Processor::sleep(uint period) {
     // check 'isRunning_' every STATUS_CHECK_PERIOD ms in case period is too large.
     // Allows agent to respond to stop/VM quit within STATUS_CHECK_PERIOD ms at the cost of fudging
@@ -43,33 +61,70 @@ TRACE_DEFINE_BEGIN(Processor, kTraceProcessorTotal)
     TRACE_DEFINE("start processor")
     TRACE_DEFINE("stop processor")
     TRACE_DEFINE("chech that processor is running")
+    TRACE_DEFINE("retire processor")
 TRACE_DEFINE_END(Processor, kTraceProcessorTotal);
 
 void Processor::run() {
     int popped = 0;
 
+    // a retired predecessor writing to the same LogWriter has to finish first, samples pile up
+    // in our own queue in the meantime
+    if (predecessorDrained_) {
+        while (!predecessorDrained_->load(std::memory_order_acquire)) {
+            sleep_for_millis(1);
+        }
+        predecessorDrained_.reset();
+    }
+
+    bool bursting = false;
+    uint64_t cpuNanos = threadCpuNanos();
     while (true) {
         while (buffer.pop()) {
             ++popped;
         }
-        if (popped > 200) {
+        uint64_t now = threadCpuNanos();
+        Metrics.processorCpuNanos.fetch_add(now - cpuNanos, std::memory_order_relaxed);
+        cpuNanos = now;
+        int burstInterval = burst.interval(currentMillis());
+        if (burstInterval > 0) {
+            // a no-op unless the burst just started
+            if (!handler.updateSigprofInterval(burstInterval)) {
+                break;
+            }
+            bursting = true;
+            popped = 0;
+        } else if (popped > 200 || bursting) {
+            // back on a baseline interval as soon as a burst is over
             if (!handler.updateSigprofInterval()) {
                 break;
             }
+            bursting = false;
             popped = 0;
         }
         if (!isRunning_.load(std::memory_order_relaxed)) {
-            while (buffer.pop()); // make all items are processed and released
             break;
         }
-        sleep(interval_);
+        sleep(bursting ? burstSleep_ : interval_);
     }
 
+    // make sure all items are processed and released, however the loop ended: a successor and
+    // the reaper wait for the flag either way
+    drain();
+
     // SIGPROF is already stopped in Profiler::stop, no need to call handler.stopSigprof();
+    // the processor may be deleted as soon as either is published, the flag outlives it
+    DrainedFlag drained = drained_;
     workerDone.clear(std::memory_order_release);
+    drained->store(true, std::memory_order_release);
     // no shared data access after this point, can be safely deleted
 }
 
+void Processor::drain() {
+    // a late signal may still be pushing into the queue
+    while (hasInFlight()) sched_yield();
+    while (buffer.pop());
+}
+
 void callbackToRunProcessor(jvmtiEnv *jvmti_env, JNIEnv *jni_env, void *arg) {
     IMPLICITLY_USE(jvmti_env);
     IMPLICITLY_USE(jni_env);
@@ -81,7 +136,10 @@ void callbackToRunProcessor(jvmtiEnv *jvmti_env, JNIEnv *jni_env, void *arg) {
         logError("ERROR: failed to set processor thread signal mask\n");
     }
     Processor *processor = (Processor *) arg;
+    // the log writer's method cache is read and written from this thread only
+    GCHelper::attachCurrentThread();
     processor->run();
+    GCHelper::detachCurrentThread();
 }
 
 bool Processor::start(JNIEnv *jniEnv) {
@@ -92,10 +150,12 @@ bool Processor::start(JNIEnv *jniEnv) {
 
     std::cout << "Starting sampling\n";
     isRunning_.store(true, std::memory_order_relaxed); // sequential
+    drained_->store(false, std::memory_order_relaxed);
     workerDone.test_and_set(std::memory_order_relaxed); // initial is true
     handler.SetAction(&bootstrapHandle);
 
     if (jniEnv) {
+        hasWorker_ = true;
         jthread thread = newThread(jniEnv, "Honest Profiler Processing Thread");
         jvmtiStartFunction callback = callbackToRunProcessor;
         result = jvmti_->RunAgentThread(thread, callback, this, JVMTI_THREAD_NORM_PRIORITY);
@@ -103,8 +163,10 @@ bool Processor::start(JNIEnv *jniEnv) {
         if (result != JVMTI_ERROR_NONE) {
             logError("ERROR: Running agent thread failed with: %d\n", result);
         }
+        handler.claimTimer();
         return handler.updateSigprofInterval();
     }
+    hasWorker_ = false;
     workerDone.clear(std::memory_order_relaxed);
     return true;
 }
@@ -115,16 +177,93 @@ void Processor::stop() {
     handler.stopSigprof();
     isRunning_.store(false, std::memory_order_seq_cst);
     std::cout << "Stopping sampling\n";
+    if (!hasWorker_) {
+        drain();
+        drained_->store(true, std::memory_order_release);
+    }
     while (workerDone.test_and_set(std::memory_order_seq_cst)) sched_yield();
     signal(SIGPROF, SIG_IGN);
   }
 
+void Processor::retire() {
+    TRACE(Processor, kTraceProcessorRetire);
+
+    isRunning_.store(false, std::memory_order_seq_cst);
+    if (!hasWorker_) { // nobody else will
+        drain();
+        drained_->store(true, std::memory_order_release);
+    }
+}
+
 bool Processor::isRunning() const {
     TRACE(Processor, kTraceProcessorRunning);
     return isRunning_.load(std::memory_order_relaxed);
 }
 
+bool Processor::isDrained() const {
+    return drained_->load(std::memory_order_acquire) && !hasInFlight();
+}
+
+void Processor::awaitDrained() const {
+    while (!isDrained()) sleep_for_millis(1);
+}
+
+void Processor::parseThreadFilter(const std::string &filter) {
+    size_t begin = 0;
+    while (begin < filter.size()) {
+        size_t end = filter.find(':', begin);
+        if (end == std::string::npos) end = filter.size();
+        if (end > begin) threadPrefixes.push_back(filter.substr(begin, end - begin));
+        begin = end + 1;
+    }
+}
+
+// called from the signal handler, only reads immutable state
+bool Processor::acceptsThread(ThreadBucketPtr &threadInfo) {
+    if (threadPrefixes.empty()) return true;
+    if (!threadInfo.defined()) return false;
+
+    const char *name = threadInfo->name;
+    for (size_t i = 0; i < threadPrefixes.size(); ++i) {
+        const std::string &prefix = threadPrefixes[i];
+        if (strncmp(name, prefix.c_str(), prefix.size()) == 0) return true;
+    }
+    return false;
+}
+
+// Replaces a failed trace by the native frames of the interrupted thread and a last frame
+// holding the error, see isRecoveredTrace
+void Processor::unwindNative(JVMPI_CallTrace &trace, void *context) {
+    int captured = NativeUnwinder::unwind(context, trace.frames, config.maxFramesToCapture - 1);
+    if (captured == 0) return;
+
+    trace.frames[captured].lineno = trace.num_frames;
+    trace.frames[captured].method_id = NULL;
+    trace.num_frames = captured + 1;
+}
+
+// Replaces a failed trace by the JIT compiled method or VM stub holding the interrupted pc and
+// a last frame holding the error, see isRecoveredTrace
+bool Processor::attributeCode(JVMPI_CallTrace &trace, void *context) {
+    CodeRange range;
+    if (!CodeIndex::instance().find(NativeUnwinder::pc(context), range)) return false;
+
+    if (range.method != NULL) {
+        trace.frames[0].lineno = kCompiledFrameLineNo;
+        trace.frames[0].method_id = range.method;
+    } else {
+        trace.frames[0].lineno = kStubFrameLineNo;
+        trace.frames[0].method_id = (jmethodID) range.stub;
+    }
+    trace.frames[1].lineno = trace.num_frames;
+    trace.frames[1].method_id = NULL;
+    trace.num_frames = 2;
+    return true;
+}
+
 void Processor::handle(JNIEnv *jniEnv, const timespec& ts, ThreadBucketPtr threadInfo, void *context) {
+    if (!acceptsThread(threadInfo)) return;
+
     // sample data structure
     STATIC_ARRAY(frames, JVMPI_CallFrame, config.maxFramesToCapture, MAX_FRAMES_TO_CAPTURE);
 
@@ -142,6 +281,9 @@ void Processor::handle(JNIEnv *jniEnv, const timespec& ts, ThreadBucketPtr threa
           (*asgct)(&trace, config.maxFramesToCapture, context);
           // i = config.samples;
       }
+      if (trace.num_frames < 0 && !(codeIndex_ && attributeCode(trace, context)) && nativeFrames_) {
+          unwindNative(trace, context);
+      }
 
       // log all samples, failures included, let the post processing sift through the data
       buffer.push(ts, trace, std::move(threadInfo));
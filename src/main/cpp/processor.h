@@ -2,31 +2,51 @@
 #define PROCESSOR_H
 
 #include <jvmti.h>
+#include <memory>
+#include <vector>
 #include "common.h"
 #include "log_writer.h"
 #include "buffer_reader.h"
 #include "signal_handler.h"
+#include "burst_policy.h"
+#include "native_frames.h"
+#include "code_index.h"
 
 #include "trace.h"
 
-const int kTraceProcessorTotal = 3;
+const int kTraceProcessorTotal = 4;
 
 const int kTraceProcessorStart = 0;
 const int kTraceProcessorStop = 1;
 const int kTraceProcessorRunning = 2;
+const int kTraceProcessorRetire = 3;
 
 TRACE_DECLARE(Processor, kTraceProcessorTotal);
 
+typedef std::shared_ptr<std::atomic_bool> DrainedFlag;
+
 class Processor {
 
 public:
-    explicit Processor(jvmtiEnv* jvmti, LogWriter& logWriter, const ConfigurationOptions &conf)
-        : jvmti_(jvmti), config(conf), logWriter_(logWriter),
-          buffer(logWriter_, config.maxFramesToCapture),
-          handler(config.samplingIntervalMin, config.samplingIntervalMax),
-          isRunning_(false) {
+    // A processor owns an immutable copy of the configuration it was built with, so swapping
+    // processors is how a new configuration gets published to the signal handler.
+    // Samples go to the listener, a LogWriter or the in-memory RollingWindow. If
+    // predecessorDrained is set, the processor shares its listener with a retired processor
+    // and won't consume anything until that one has drained its queue.
+    explicit Processor(jvmtiEnv* jvmti, QueueListener& listener, const ConfigurationOptions &conf,
+                       DrainedFlag predecessorDrained = DrainedFlag())
+        : jvmti_(jvmti), config(conf), listener_(listener),
+          buffer(listener_, config.maxFramesToCapture),
+          handler(config.samplingIntervalMin, config.samplingIntervalMax), burst(config),
+          isRunning_(false), hasWorker_(false), inFlight_(0),
+          drained_(new std::atomic_bool(false)), predecessorDrained_(predecessorDrained),
+          nativeFrames_(config.nativeFrames && NativeUnwinder::available()),
+          codeIndex_(config.codeIndex && config.maxFramesToCapture >= 2) {
         interval_ = Size * config.samplingIntervalMin / 1000 / 2;
         interval_ = interval_ > 0 ? interval_ : 1;
+        burstSleep_ = Size * config.burstInterval / 1000 / 2;
+        burstSleep_ = burstSleep_ > 0 ? burstSleep_ : 1;
+        parseThreadFilter(config.threadFilter);
     }
 
     // explicit Processor(jvmtiEnv* jvmti, BufferReader& reader, const ConfigurationOptions &conf)
@@ -44,29 +64,71 @@ public:
 
     void stop();
 
+    // Stops consuming once every in-flight signal handler has left, without touching SIGPROF,
+    // which by now belongs to the successor. Doesn't block.
+    void retire();
+
     bool isRunning() const;
 
+    bool isDrained() const;
+
+    void awaitDrained() const;
+
+    DrainedFlag drainedFlag() const { return drained_; }
+
+    // Signal handlers bracket their use of the processor so that it is never deleted under them
+    void enter() { inFlight_.fetch_add(1, std::memory_order_seq_cst); }
+
+    void leave() { inFlight_.fetch_sub(1, std::memory_order_release); }
+
+    bool hasInFlight() const { return inFlight_.load(std::memory_order_seq_cst) > 0; }
+
+    const ConfigurationOptions &configuration() const { return config; }
+
     void handle(JNIEnv *jni_env, const timespec& ts, ThreadBucketPtr threadInfo, void *context);
 
 private:
     jvmtiEnv *const jvmti_;
 
-    const ConfigurationOptions &config;
+    const ConfigurationOptions config;
 
-    LogWriter& logWriter_;
+    QueueListener& listener_;
     // BufferReader& reader_;
     CircularQueue buffer;
     SignalHandler handler;
+    BurstPolicy burst;
 
     std::atomic_bool isRunning_;
     std::atomic_flag workerDone;
+    bool hasWorker_;
+
+    std::atomic_int inFlight_;
+    DrainedFlag drained_;
+    DrainedFlag predecessorDrained_;
+
+    std::vector<std::string> threadPrefixes;
+
+    const bool nativeFrames_;
+    const bool codeIndex_;
 
     int interval_;
+    // how long to sleep between queue drains while bursting, the queue fills up much faster
+    int burstSleep_;
 
     void startCallback(jvmtiEnv *jvmti_env, JNIEnv *jni_env, void *arg);
 
     void sleep(uint period);
 
+    void drain();
+
+    void parseThreadFilter(const std::string &filter);
+
+    bool acceptsThread(ThreadBucketPtr &threadInfo);
+
+    void unwindNative(JVMPI_CallTrace &trace, void *context);
+
+    bool attributeCode(JVMPI_CallTrace &trace, void *context);
+
     DISALLOW_COPY_AND_ASSIGN(Processor);
 };
 
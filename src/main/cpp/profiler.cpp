@@ -5,14 +5,16 @@ ASGCTType Asgct::asgct_;
 TRACE_DEFINE_BEGIN(Profiler, kTraceProfilerTotal)
     TRACE_DEFINE("start failed")
     TRACE_DEFINE("start succeeded")
-    TRACE_DEFINE("set sampling interval failed")
+    TRACE_DEFINE("set sampling interval on running profiler")
     TRACE_DEFINE("set sampling interval succeeded")
-    TRACE_DEFINE("set stack frames to capture failed")
+    TRACE_DEFINE("set stack frames to capture on running profiler")
     TRACE_DEFINE("set stack frames to capture succeeded")
-    TRACE_DEFINE("set new file failed")
+    TRACE_DEFINE("set new file on running profiler")
     TRACE_DEFINE("set new file succeeded")
     TRACE_DEFINE("stop failed")
     TRACE_DEFINE("stop succeeded")
+    TRACE_DEFINE("running profiler reconfigured")
+    TRACE_DEFINE("running profiler reconfiguration failed")
 TRACE_DEFINE_END(Profiler, kTraceProfilerTotal);
 
 void Profiler::handle(int signum, siginfo_t *info, void *context) {
@@ -20,14 +22,41 @@ void Profiler::handle(int signum, siginfo_t *info, void *context) {
     IMPLICITLY_USE(info);
     timespec spec;
 
-    if (jvm_) {
-        JNIEnv *jniEnv = getJNIEnv(jvm_);
+    // counted before published is read, so reap knows when no handler can still be about to pin
+    // a processor it retired
+    handlers.fetch_add(1, std::memory_order_seq_cst);
+    Processor *current = acquireProcessor();
+    if (current != nullptr) {
+        JNIEnv *jniEnv = jvm_ ? getJNIEnv(jvm_) : nullptr;
         TimeUtils::current_utc_time(&spec); // sample current time
-        processor->handle(jniEnv, spec, jniEnv ? tMap_.get(jniEnv) : ThreadBucketPtr(nullptr), context);
+        current->handle(jniEnv, spec, jniEnv ? tMap_.get(jniEnv) : ThreadBucketPtr(nullptr), context);
+        current->leave();
     }
+    handlers.fetch_sub(1, std::memory_order_release);
+}
+
+// Async-signal-safe, pins the published processor so a concurrent reconfiguration can't delete it
+Processor *Profiler::acquireProcessor() {
+    Processor *current = published.load(std::memory_order_seq_cst);
+    while (current != nullptr) {
+        current->enter();
+        Processor *check = published.load(std::memory_order_seq_cst);
+        if (check == current) return current;
+        // swapped in between, whoever retires it may already be waiting for us to leave
+        current->leave();
+        current = check;
+    }
+    return nullptr;
 }
 
 bool Profiler::start(JNIEnv *jniEnv) {
+    // Only a deferred preparer holds up the start, until its backlog is done; otherwise the
+    // workers carry on in the background. Outside of the critical section, this may take a
+    // while, and the queued classes are global refs only let go of with a JNIEnv to hand.
+    if (methodIds_ != nullptr && jniEnv != NULL && liveConfiguration.deferMethodIds) {
+        methodIds_->drain(jniEnv);
+    }
+
     SimpleSpinLockGuard<true> guard(ongoingConf);
     /* within critical section */
 
@@ -56,6 +85,27 @@ void Profiler::stop() {
     processor->stop();
 }
 
+void Profiler::release() {
+    SimpleSpinLockGuard<true> guard(ongoingConf);
+
+    if (__is_running()) {
+        processor->stop();
+    }
+
+    if (processor) {
+        published.store(nullptr, std::memory_order_seq_cst);
+        processor->retire(); // drains a processor that never ran, so reap can wait for it
+        retired.push_back(RetiredPipeline(std::move(processor), std::move(writer)));
+    }
+    reap(true);
+
+    if (generatedPath) {
+        liveConfiguration.logFilePath.clear();
+        generatedPath = false;
+    }
+    reloadConfig = true;
+}
+
 bool Profiler::isRunning() {
     /* Make sure it doesn't overlap with configure */
     SimpleSpinLockGuard<true> guard(ongoingConf, false);
@@ -72,28 +122,22 @@ void Profiler::setFilePath(char *newFilePath) {
     /* Make sure it doesn't overlap with other sets */
     SimpleSpinLockGuard<true> guard(ongoingConf);
 
-    if (__is_running()) {
-        TRACE(Profiler, kTraceProfilerSetFileFailed);
-        logError("WARN: Unable to modify running profiler\n");
-        return;
-    }
-
     TRACE(Profiler, kTraceProfilerSetFileOk);
 
-    liveConfiguration.logFilePath.assign(newFilePath);
+    liveConfiguration.logFilePath.assign(newFilePath ? newFilePath : "");
+    generatedPath = false;
     reloadConfig = true;
+
+    if (__is_running()) {
+        TRACE(Profiler, kTraceProfilerSetFileLive);
+        reconfigure();
+    }
 }
 
 void Profiler::setSamplingInterval(int intervalMin, int intervalMax) {
     /* Make sure it doesn't overlap with other sets */
     SimpleSpinLockGuard<true> guard(ongoingConf);
 
-    if (__is_running()) {
-        TRACE(Profiler, kTraceProfilerSetIntervalFailed);
-        logError("WARN: Unable to modify running profiler\n");
-        return;
-    }
-
     TRACE(Profiler, kTraceProfilerSetIntervalOk);
 
     int min = intervalMin > 0 ? intervalMin : DEFAULT_SAMPLING_INTERVAL;
@@ -101,24 +145,38 @@ void Profiler::setSamplingInterval(int intervalMin, int intervalMax) {
     liveConfiguration.samplingIntervalMin = std::min(min, max);
     liveConfiguration.samplingIntervalMax = std::max(min, max);
     reloadConfig = true;
+
+    if (__is_running()) {
+        TRACE(Profiler, kTraceProfilerSetIntervalLive);
+        reconfigure();
+    }
 }
 
 void Profiler::setMaxFramesToCapture(int maxFramesToCapture) {
     /* Make sure it doesn't overlap with other sets */
     SimpleSpinLockGuard<true> guard(ongoingConf);
 
-    if (__is_running()) {
-        TRACE(Profiler, kTraceProfilerSetFramesFailed);
-        logError("WARN: Unable to modify running profiler\n");
-        return;
-    }
-
     TRACE(Profiler, kTraceProfilerSetFramesOk);
 
     int res = (maxFramesToCapture > 0 && maxFramesToCapture < MAX_FRAMES_TO_CAPTURE) ?
               maxFramesToCapture : DEFAULT_MAX_FRAMES_TO_CAPTURE;
     liveConfiguration.maxFramesToCapture = res;
     reloadConfig = true;
+
+    if (__is_running()) {
+        TRACE(Profiler, kTraceProfilerSetFramesLive);
+        reconfigure();
+    }
+}
+
+void Profiler::setThreadFilter(char *newThreadFilter) {
+    /* Make sure it doesn't overlap with other sets */
+    SimpleSpinLockGuard<true> guard(ongoingConf);
+
+    liveConfiguration.threadFilter.assign(newThreadFilter ? newThreadFilter : "");
+    reloadConfig = true;
+
+    if (__is_running()) reconfigure();
 }
 
 /* return copy of the string */
@@ -143,39 +201,166 @@ int Profiler::getMaxFramesToCapture() {
     return liveConfiguration.maxFramesToCapture;
 }
 
+/* return copy of the string */
+std::string Profiler::getThreadFilter() {
+    SimpleSpinLockGuard<true> guard(ongoingConf, true); // relaxed store
+    return liveConfiguration.threadFilter;
+}
+
 void Profiler::configure() {
     /* nested critical section, no need to acquire or CAS */
+    reap(true); // nothing may still be writing through the current writer
     bool needsUpdate = processor == NULL;
 
+    std::unique_ptr<LogWriter> oldWriter; // the current processor may still reference it
+
     needsUpdate = needsUpdate || configuration_.logFilePath != liveConfiguration.logFilePath;
     if (needsUpdate) {
-        if (liveConfiguration.logFilePath.empty()) {
-            std::ostringstream fileBuilder;
-            long epochMillis = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-            fileBuilder << "log-" << pid << "-" << epochMillis << ".hpl";
-            std::string filename(fileBuilder.str());
-            configuration_.logFilePath = filename;
-            liveConfiguration.logFilePath = std::move(filename);
-        } else {
-            configuration_.logFilePath = liveConfiguration.logFilePath;
-        }
-        writer = std::unique_ptr<LogWriter>(new LogWriter(liveConfiguration.logFilePath, jvmti_));
-        // reader = std::unique_ptr<BufferReader>(new BufferReader(jvmti_));
+        oldWriter = std::move(writer);
+        openWriter();
     }
 
     needsUpdate = needsUpdate ||
                   configuration_.maxFramesToCapture != liveConfiguration.maxFramesToCapture ||
                   configuration_.samplingIntervalMin != liveConfiguration.samplingIntervalMin ||
-                  configuration_.samplingIntervalMax != liveConfiguration.samplingIntervalMax;
+                  configuration_.samplingIntervalMax != liveConfiguration.samplingIntervalMax ||
+                  configuration_.threadFilter != liveConfiguration.threadFilter;
     if (needsUpdate) {
-        configuration_.maxFramesToCapture = liveConfiguration.maxFramesToCapture;
-        configuration_.samplingIntervalMin = liveConfiguration.samplingIntervalMin;
-        configuration_.samplingIntervalMax = liveConfiguration.samplingIntervalMax;
-        configuration_.samples = liveConfiguration.samples;
-        processor = std::unique_ptr<Processor>(new Processor(jvmti_, *writer.get(), configuration_));
-        // processor = std::unique_ptr<Processor>(new Processor(jvmti_, *reader.get(), configuration_));
+        applyConfiguration();
+        std::unique_ptr<Processor> next(new Processor(jvmti_, listener(), configuration_));
+        publish(std::move(next), std::move(oldWriter));
+        reap(true);
     }
     reloadConfig = false;
 }
 
-Profiler::~Profiler() {}
+// Swaps in a processor built from the live configuration while sampling continues.
+// The old processor stops consuming in the background; it keeps its own writer when the
+// output path changed, otherwise the new processor holds off until the shared writer is free.
+void Profiler::reconfigure() {
+    /* nested critical section, no need to acquire or CAS */
+    JNIEnv *jniEnv = jvm_ ? getJNIEnv(jvm_) : NULL;
+    if (jvm_ && jniEnv == NULL) {
+        // without a JNIEnv there's no way to start the new processing thread, keep the old pipeline
+        TRACE(Profiler, kTraceProfilerReconfigureFailed);
+        logError("WARN: Unable to reconfigure running profiler from a detached thread\n");
+        return;
+    }
+
+    reap(false);
+
+    std::unique_ptr<LogWriter> oldWriter;
+    DrainedFlag predecessor;
+    // only a log writer is tied to the path, the window and the reader carry on as they are
+    if (!window && !reader_ && configuration_.logFilePath != liveConfiguration.logFilePath) {
+        oldWriter = std::move(writer);
+        openWriter();
+    } else {
+        predecessor = processor->drainedFlag();
+    }
+
+    applyConfiguration();
+    std::unique_ptr<Processor> next(new Processor(jvmti_, listener(), configuration_, predecessor));
+    // start first so the new handler owns SIGPROF before signals are routed to its queue
+    next->start(jniEnv);
+    publish(std::move(next), std::move(oldWriter));
+
+    reloadConfig = false;
+    TRACE(Profiler, kTraceProfilerReconfigureOk);
+}
+
+// Opens the writer for the live file path, an empty path picks a fresh default name
+void Profiler::openWriter() {
+    generatedPath = liveConfiguration.logFilePath.empty();
+    if (generatedPath) {
+        std::ostringstream fileBuilder;
+        long epochMillis = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+        fileBuilder << "log-" << pid << "-" << epochMillis << ".hpl";
+        liveConfiguration.logFilePath = fileBuilder.str();
+    }
+    configuration_.logFilePath = liveConfiguration.logFilePath;
+    // samples stay in memory, the window's go to disk only when dumped
+    if (window || reader_) return;
+
+    writer = std::unique_ptr<LogWriter>(new LogWriter(liveConfiguration.logFilePath, jvmti_));
+}
+
+// Slots are sized for the frames captured now, stacks deeper than that are cut short later on
+void Profiler::openReader() {
+    ReaderOverflow policy = READER_DROP_NEWEST;
+    if (!parseReaderOverflow(liveConfiguration.readerOverflow, policy)) {
+        logError("WARN: Unknown readerOverflow %s, dropping new samples instead\n",
+                 liveConfiguration.readerOverflow.c_str());
+    }
+    size_t budget = liveConfiguration.readerBudget > 0 ?
+                    (size_t) liveConfiguration.readerBudget * 1024 : kReaderDefaultBudget;
+    reader_.reset(new BufferReader(jvmti_, liveConfiguration.maxFramesToCapture, budget, policy));
+}
+
+QueueListener &Profiler::listener() {
+    if (window) return *window;
+    if (reader_) return *reader_;
+    return *writer;
+}
+
+long Profiler::dumpWindow(std::ostream &out, time_t from, time_t to) {
+    // the window has its own lock, no need to hold off configuration changes
+    if (!window) return -1;
+    return window->dump(out, from, to);
+}
+
+long Profiler::windowStacks(time_t from, time_t to, std::vector<WindowStack> &out, long &truncated) {
+    if (!window) return -1;
+    return window->stacks(from, to, out, truncated);
+}
+
+void Profiler::applyConfiguration() {
+    configuration_.maxFramesToCapture = liveConfiguration.maxFramesToCapture;
+    configuration_.samplingIntervalMin = liveConfiguration.samplingIntervalMin;
+    configuration_.samplingIntervalMax = liveConfiguration.samplingIntervalMax;
+    configuration_.samples = liveConfiguration.samples;
+    configuration_.threadFilter = liveConfiguration.threadFilter;
+}
+
+// Routes signal handlers to the next processor and retires the current one, if any.
+void Profiler::publish(std::unique_ptr<Processor> next, std::unique_ptr<LogWriter> oldWriter) {
+    published.store(next.get(), std::memory_order_seq_cst);
+
+    if (processor) {
+        processor->retire();
+        retired.push_back(RetiredPipeline(std::move(processor), std::move(oldWriter)));
+    }
+    processor = std::move(next);
+}
+
+// Frees retired pipelines whose queues have been written out, waits for all of them if asked to.
+void Profiler::reap(bool wait) {
+    if (retired.empty()) return;
+
+    // A handler that read published before the last publish may not have pinned what it read
+    // yet. Once no handler is running, every later one reads what's published now.
+    while (handlers.load(std::memory_order_seq_cst) > 0) {
+        if (!wait) return;
+        sched_yield();
+    }
+
+    for (auto it = retired.begin(); it != retired.end();) {
+        if (wait) it->processor->awaitDrained();
+
+        if (it->processor->isDrained()) {
+            it = retired.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+Profiler::~Profiler() {
+    published.store(nullptr, std::memory_order_seq_cst);
+    reap(false);
+    // processing threads that haven't finished yet still reference these, leak them rather than crash
+    for (auto it = retired.begin(); it != retired.end(); ++it) {
+        it->processor.release();
+        it->writer.release();
+    }
+}
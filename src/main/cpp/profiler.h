@@ -1,12 +1,14 @@
 #ifndef PROFILER_H
 #define PROFILER_H
 
+#include <sched.h>
 #include <signal.h>
 #include <unistd.h>
 #include <chrono>
 #include <sstream>
 #include <string>
 #include <memory>
+#include <vector>
 
 #include "thread_map.h"
 #include "signal_handler.h"
@@ -14,6 +16,8 @@
 #include "processor.h"
 #include "log_writer.h"
 #include "buffer_reader.h"
+#include "rolling_window.h"
+#include "method_ids.h"
 
 using namespace std::chrono;
 using std::ostringstream;
@@ -21,18 +25,20 @@ using std::string;
 
 #include "trace.h"
 
-const int kTraceProfilerTotal = 10;
+const int kTraceProfilerTotal = 12;
 
 const int kTraceProfilerStartFailed = 0;
 const int kTraceProfilerStartOk = 1;
-const int kTraceProfilerSetIntervalFailed = 2;
+const int kTraceProfilerSetIntervalLive = 2;
 const int kTraceProfilerSetIntervalOk = 3;
-const int kTraceProfilerSetFramesFailed = 4;
+const int kTraceProfilerSetFramesLive = 4;
 const int kTraceProfilerSetFramesOk = 5;
-const int kTraceProfilerSetFileFailed = 6;
+const int kTraceProfilerSetFileLive = 6;
 const int kTraceProfilerSetFileOk = 7;
 const int kTraceProfilerStopFailed = 8;
 const int kTraceProfilerStopOk = 9;
+const int kTraceProfilerReconfigureOk = 10;
+const int kTraceProfilerReconfigureFailed = 11;
 
 TRACE_DECLARE(Profiler, kTraceProfilerTotal);
 
@@ -68,18 +74,28 @@ public:
 
 class Profiler {
 public:
-    explicit Profiler(JavaVM *jvm, jvmtiEnv *jvmti, ConfigurationOptions &configuration, ThreadMap &tMap)
-        : jvm_(jvm), jvmti_(jvmti), tMap_(tMap), liveConfiguration(configuration), ongoingConf(false) {
+    explicit Profiler(JavaVM *jvm, jvmtiEnv *jvmti, ConfigurationOptions &configuration, ThreadMap &tMap,
+                      MethodIdPreparer *methodIds = nullptr)
+        : jvm_(jvm), jvmti_(jvmti), tMap_(tMap), methodIds_(methodIds), liveConfiguration(configuration),
+          published(nullptr), handlers(0), reloadConfig(false), generatedPath(false), ongoingConf(false) {
         pid = (long) getpid();
 
         writer = nullptr;
-        // reader = nullptr;
         processor = nullptr;
 
+        if (liveConfiguration.windowBuckets > 0) {
+            window.reset(new RollingWindow(jvmti_, liveConfiguration.windowBuckets,
+                                           liveConfiguration.windowBucketSeconds, liveConfiguration.windowMaxStacks));
+        }
+
         // explicitly call setters to validate input params
         setSamplingInterval(liveConfiguration.samplingIntervalMin, liveConfiguration.samplingIntervalMax);
         setMaxFramesToCapture(liveConfiguration.maxFramesToCapture);
 
+        if (!window && liveConfiguration.asgctReader) {
+            openReader();
+        }
+
         configure();
     }
 
@@ -87,6 +103,10 @@ public:
 
     void stop();
 
+    // Stops sampling and frees the queue and log writer, the next start() builds them again.
+    // A generated log path is dropped too, so a restart doesn't truncate the previous log.
+    void release();
+
     void handle(int signum, siginfo_t *info, void *context);
 
     bool isRunning();
@@ -101,28 +121,80 @@ public:
 
     int getMaxFramesToCapture();
 
+    std::string getThreadFilter();
+
+    /* Setters take effect immediately, a running profiler switches over without a sampling gap */
+
     void setFilePath(char *newFilePath);
 
     void setSamplingInterval(int intervalMin, int intervalMax);
 
     void setMaxFramesToCapture(int maxFramesToCapture);
 
+    void setThreadFilter(char *newThreadFilter);
+
+    bool hasWindow() const { return window != nullptr; }
+
+    // NULL unless samples are staged for ASGCTReader
+    BufferReader *reader() const { return reader_.get(); }
+
+    // Merged folded stacks for [from, to] in epoch seconds, -1 when not keeping a rolling window
+    long dumpWindow(std::ostream &out, time_t from, time_t to);
+
+    // The same stacks unfolded, see RollingWindow::stacks, -1 when not keeping a rolling window
+    long windowStacks(time_t from, time_t to, std::vector<WindowStack> &out, long &truncated);
+
     ~Profiler();
 
 private:
+    // A processor replaced while running, along with its LogWriter if that was replaced too.
+    // Kept until its queue has been written out.
+    struct RetiredPipeline {
+        std::unique_ptr<LogWriter> writer;
+        std::unique_ptr<Processor> processor; // destroyed first, it references the writer
+
+        RetiredPipeline(std::unique_ptr<Processor> p, std::unique_ptr<LogWriter> w)
+            : writer(std::move(w)), processor(std::move(p)) {
+        }
+
+        RetiredPipeline(RetiredPipeline &&other)
+            : writer(std::move(other.writer)), processor(std::move(other.processor)) {
+        }
+
+        RetiredPipeline &operator=(RetiredPipeline &&other) {
+            processor = std::move(other.processor);
+            writer = std::move(other.writer);
+            return *this;
+        }
+    };
+
     JavaVM *const jvm_;
     jvmtiEnv *const jvmti_;
 
     ThreadMap &tMap_;
 
+    // classes still waiting for their jmethodIDs are prepared before the first sample
+    MethodIdPreparer *const methodIds_;
+
     ConfigurationOptions configuration_;
     ConfigurationOptions liveConfiguration;
 
     std::unique_ptr<LogWriter> writer;
-    // std::unique_ptr<BufferReader> reader;
+    // replaces the writer when samples are only kept in memory, lives as long as the profiler
+    std::unique_ptr<RollingWindow> window;
+    // replaces the writer when ASGCTReader drains samples in process, lives as long as the profiler
+    std::unique_ptr<BufferReader> reader_;
     std::unique_ptr<Processor> processor;
 
+    // the processor signal handlers sample into
+    std::atomic<Processor*> published;
+    // signal handlers between reading published and being done with what they read
+    std::atomic_int handlers;
+    std::vector<RetiredPipeline> retired;
+
     bool reloadConfig;
+    // the log path was made up by openWriter rather than configured
+    bool generatedPath;
     long pid;
 
     // indicates change of internal state
@@ -132,6 +204,22 @@ private:
 
     void configure();
 
+    void reconfigure();
+
+    void openWriter();
+
+    void openReader();
+
+    QueueListener &listener();
+
+    void applyConfiguration();
+
+    void publish(std::unique_ptr<Processor> next, std::unique_ptr<LogWriter> oldWriter);
+
+    Processor *acquireProcessor();
+
+    void reap(bool wait);
+
     bool __is_running();
 
     DISALLOW_COPY_AND_ASSIGN(Profiler);
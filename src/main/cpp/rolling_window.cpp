@@ -0,0 +1,202 @@
+#include "rolling_window.h"
+#include <algorithm>
+#include <map>
+#include <sstream>
+
+TRACE_DEFINE_BEGIN(Window, kTraceWindowTotal)
+    TRACE_DEFINE("samples aggregated")
+    TRACE_DEFINE("samples truncated in a full bucket")
+    TRACE_DEFINE("buckets rotated out")
+TRACE_DEFINE_END(Window, kTraceWindowTotal);
+
+size_t RollingWindow::StackKeyHasher::operator()(const StackKey &key) const {
+    // FNV-1a over the frame pointers, mixed with the thread name
+    size_t hash = 14695981039346656037ULL ^ (size_t) key.error ^ (key.recovered.size() << 40);
+    for (size_t i = 0; i < key.frames.size(); i++) {
+        hash ^= (size_t) key.frames[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash ^ std::hash<std::string>()(key.thread);
+}
+
+RollingWindow::RollingWindow(jvmtiEnv *jvmti, int bucketCount, int bucketSeconds, int maxStacks)
+        : jvmti_(jvmti), bucketSeconds_(bucketSeconds > 0 ? bucketSeconds : 1),
+          maxStacks_(maxStacks > 0 ? maxStacks : 1), buckets(bucketCount > 0 ? bucketCount : 1) {
+    for (size_t i = 0; i < buckets.size(); i++) {
+        buckets[i].stacks.reserve(maxStacks_);
+    }
+}
+
+// Called with the lock held, recycles the slot when its previous period has fallen out of the window
+RollingWindow::Bucket &RollingWindow::bucketFor(time_t seconds) {
+    time_t start = seconds - seconds % bucketSeconds_;
+    Bucket &bucket = buckets[(start / bucketSeconds_) % buckets.size()];
+
+    if (bucket.start != start) {
+        if (bucket.start != -1) TRACE(Window, kTraceWindowRotated);
+        bucket.start = start;
+        bucket.truncated = 0;
+        bucket.stacks.clear(); // keeps the table allocated
+    }
+    return bucket;
+}
+
+void RollingWindow::record(const timespec &ts, const JVMPI_CallTrace &trace, ThreadBucketPtr info) {
+    StackKey key;
+    if (info.defined()) key.thread = info->name;
+
+    if (isRecoveredTrace(trace)) {
+        // the root most frame holds the error
+        key.error = trace.frames[trace.num_frames - 1].lineno;
+        key.frames.reserve(trace.num_frames - 1);
+        key.recovered.reserve(trace.num_frames - 1);
+        for (int i = trace.num_frames - 2; i >= 0; i--) {
+            key.frames.push_back(trace.frames[i].method_id);
+            key.recovered.push_back(trace.frames[i].lineno);
+        }
+    } else if (trace.num_frames > 0) {
+        key.error = 0;
+        key.frames.reserve(trace.num_frames);
+        // ASGCT hands out frames callee first, folded stacks want the root first
+        for (int i = trace.num_frames - 1; i >= 0; i--)
+            key.frames.push_back(trace.frames[i].method_id);
+    } else {
+        key.error = trace.num_frames;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    Bucket &bucket = bucketFor(ts.tv_sec);
+
+    auto it = bucket.stacks.find(key);
+    if (it != bucket.stacks.end()) {
+        it->second++;
+    } else if (bucket.stacks.size() < maxStacks_) {
+        bucket.stacks.emplace(std::move(key), 1);
+    } else {
+        TRACE(Window, kTraceWindowDropped);
+        bucket.truncated++;
+        return;
+    }
+    TRACE(Window, kTraceWindowRecorded);
+}
+
+long RollingWindow::dump(std::ostream &out, time_t from, time_t to) {
+    std::vector<WindowStack> merged;
+    long truncated;
+    stacks(from, to, merged, truncated);
+
+    std::map<std::string, long> folded;
+    for (size_t i = 0; i < merged.size(); i++) {
+        std::string line = merged[i].thread.empty() ? "[unknown thread]" : merged[i].thread;
+        for (size_t f = 0; f < merged[i].frames.size(); f++) {
+            line.append(";").append(merged[i].frames[f]);
+        }
+        folded[line] += merged[i].samples;
+    }
+    if (truncated > 0) folded[kWindowTruncatedFrame] += truncated;
+
+    long total = 0;
+    for (auto it = folded.begin(); it != folded.end(); ++it) {
+        out << it->first << ' ' << it->second << '\n';
+        total += it->second;
+    }
+    return total;
+}
+
+long RollingWindow::stacks(time_t from, time_t to, std::vector<WindowStack> &out, long &truncated) {
+    // resolve and merge outside of the hot path, the lock only covers copying out the counts
+    std::vector<std::pair<StackKey, long>> samples;
+    truncated = 0;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (size_t i = 0; i < buckets.size(); i++) {
+            const Bucket &bucket = buckets[i];
+            if (bucket.start == -1 || bucket.start > to || bucket.start + bucketSeconds_ <= from)
+                continue;
+            truncated += bucket.truncated;
+            for (auto it = bucket.stacks.begin(); it != bucket.stacks.end(); ++it)
+                samples.push_back(*it);
+        }
+    }
+
+    std::unordered_map<jmethodID, std::string> names;
+    std::map<std::string, WindowStack> merged;
+    long total = truncated;
+    for (size_t i = 0; i < samples.size(); i++) {
+        const StackKey &key = samples[i].first;
+        WindowStack stack;
+        stack.thread = key.thread;
+        stack.samples = samples[i].second;
+        std::string line = key.thread.empty() ? "[unknown thread]" : key.thread;
+
+        if (key.error != 0) {
+            stack.frames.push_back("[asgct error " + std::to_string(key.error) + "]");
+        }
+        for (size_t f = 0; f < key.frames.size(); f++) {
+            if (!key.recovered.empty() && key.recovered[f] != kCompiledFrameLineNo) {
+                JVMPI_CallFrame frame = {key.recovered[f], key.frames[f]};
+                stack.frames.push_back(nativeFrameName(frame));
+                continue;
+            }
+            auto name = names.find(key.frames[f]);
+            if (name == names.end())
+                name = names.emplace(key.frames[f], frameName(key.frames[f])).first;
+            stack.frames.push_back(name->second);
+        }
+        for (size_t f = 0; f < stack.frames.size(); f++) {
+            line.append(";").append(stack.frames[f]);
+        }
+
+        auto it = merged.find(line);
+        if (it == merged.end()) {
+            merged.emplace(line, std::move(stack));
+        } else {
+            it->second.samples += stack.samples;
+        }
+        total += samples[i].second;
+    }
+
+    out.clear();
+    out.reserve(merged.size());
+    for (auto it = merged.begin(); it != merged.end(); ++it) {
+        out.push_back(std::move(it->second));
+    }
+    return total;
+}
+
+// Class.method in source notation, or the raw id when the method can't be resolved
+std::string RollingWindow::frameName(jmethodID methodId) {
+    std::ostringstream name;
+    if (jvmti_ == NULL || methodId == NULL) {
+        name << "0x" << std::hex << (uintptr_t) methodId;
+        return name.str();
+    }
+
+    JvmtiScopedPtr<char> methodName(jvmti_), methodSignature(jvmti_), methodGenericSignature(jvmti_);
+    if (jvmti_->GetMethodName(methodId, methodName.GetRef(), methodSignature.GetRef(),
+                              methodGenericSignature.GetRef()) != JVMTI_ERROR_NONE) {
+        methodName.AbandonBecauseOfError();
+        methodSignature.AbandonBecauseOfError();
+        methodGenericSignature.AbandonBecauseOfError();
+        // usually the declaring class has been unloaded since the sample was taken
+        name << "[unloaded 0x" << std::hex << (uintptr_t) methodId << "]";
+        return name.str();
+    }
+
+    jclass declaringClass;
+    JvmtiScopedPtr<char> classSignature(jvmti_), classSignatureGeneric(jvmti_);
+    if (jvmti_->GetMethodDeclaringClass(methodId, &declaringClass) != JVMTI_ERROR_NONE ||
+        jvmti_->GetClassSignature(declaringClass, classSignature.GetRef(), classSignatureGeneric.GetRef()) != JVMTI_ERROR_NONE) {
+        classSignature.AbandonBecauseOfError();
+        classSignatureGeneric.AbandonBecauseOfError();
+        return methodName.Get();
+    }
+
+    // Lcom/acme/Foo; -> com.acme.Foo
+    std::string className(classSignature.Get());
+    if (className.size() > 2 && className[0] == 'L' && className[className.size() - 1] == ';')
+        className = className.substr(1, className.size() - 2);
+    std::replace(className.begin(), className.end(), '/', '.');
+
+    return className + "." + methodName.Get();
+}
@@ -0,0 +1,103 @@
+#ifndef ROLLING_WINDOW_H
+#define ROLLING_WINDOW_H
+
+#include <jvmti.h>
+#include <ctime>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "circular_queue.h"
+#include "native_frames.h"
+
+#include "trace.h"
+
+const int kTraceWindowTotal = 3;
+
+const int kTraceWindowRecorded = 0;
+const int kTraceWindowDropped = 1;
+const int kTraceWindowRotated = 2;
+
+TRACE_DECLARE(Window, kTraceWindowTotal);
+
+// Folded stack label for samples that didn't fit into a full bucket
+const char *const kWindowTruncatedFrame = "[truncated]";
+
+// A distinct stack of a thread, frames root first and named, an AsyncGetCallTrace error
+// as a frame of its own
+struct WindowStack {
+    std::string thread;
+    std::vector<std::string> frames;
+    long samples;
+};
+
+/**
+ * Keeps the last bucketCount * bucketSeconds seconds of samples aggregated per distinct stack,
+ * instead of writing them out. Every bucket holds at most maxStacks distinct stacks, samples
+ * for new stacks beyond that are only counted, so the memory used is bounded by the
+ * configuration rather than by the sampling rate.
+ */
+class RollingWindow : public QueueListener {
+
+public:
+    explicit RollingWindow(jvmtiEnv *jvmti, int bucketCount, int bucketSeconds, int maxStacks);
+
+    virtual void record(const timespec &ts, const JVMPI_CallTrace &trace, ThreadBucketPtr info = ThreadBucketPtr(nullptr));
+
+    // Writes samples from buckets overlapping [from, to] (epoch seconds) as folded stacks,
+    // root frame first and prefixed by the thread name. Returns the number of samples written.
+    long dump(std::ostream &out, time_t from, time_t to);
+
+    // The same samples merged per thread and stack, sorted by their folded line. Samples that
+    // didn't fit into their bucket are only counted, in truncated. Returns the number of
+    // samples, truncated ones included.
+    long stacks(time_t from, time_t to, std::vector<WindowStack> &out, long &truncated);
+
+    int bucketSeconds() const { return bucketSeconds_; }
+
+    int bucketCount() const { return buckets.size(); }
+
+private:
+    struct StackKey {
+        std::string thread;
+        jint error; // num_frames of a trace ASGCT couldn't walk, 0 otherwise
+        std::vector<jmethodID> frames;
+        // linenos of the frames recovered after ASGCT failed, see isRecoveredTrace, empty otherwise
+        std::vector<jint> recovered;
+
+        bool operator==(const StackKey &other) const {
+            return error == other.error && frames == other.frames && recovered == other.recovered &&
+                   thread == other.thread;
+        }
+    };
+
+    struct StackKeyHasher {
+        size_t operator()(const StackKey &key) const;
+    };
+
+    struct Bucket {
+        time_t start;
+        long truncated;
+        std::unordered_map<StackKey, long, StackKeyHasher> stacks;
+
+        Bucket() : start(-1), truncated(0) {
+        }
+    };
+
+    jvmtiEnv *const jvmti_;
+    const int bucketSeconds_;
+    const size_t maxStacks_;
+
+    std::mutex lock;
+    std::vector<Bucket> buckets;
+
+    Bucket &bucketFor(time_t seconds);
+
+    std::string frameName(jmethodID methodId);
+
+    DISALLOW_COPY_AND_ASSIGN(RollingWindow);
+};
+
+#endif // ROLLING_WINDOW_H
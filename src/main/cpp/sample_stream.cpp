@@ -0,0 +1,213 @@
+#include "sample_stream.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "log_writer.h"
+#include "native_frames.h"
+
+TRACE_DEFINE_BEGIN(Stream, kTraceStreamTotal)
+    TRACE_DEFINE("samples streamed")
+    TRACE_DEFINE("samples dropped for a slow subscriber")
+    TRACE_DEFINE("samples missed while subscribers changed")
+TRACE_DEFINE_END(Stream, kTraceStreamTotal);
+
+static void putByte(std::string &out, uint8_t value) {
+    out.push_back((char) value);
+}
+
+static void putInt(std::string &out, int32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back((char) ((uint32_t) value >> shift));
+    }
+}
+
+static void putLong(std::string &out, int64_t value) {
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        out.push_back((char) ((uint64_t) value >> shift));
+    }
+}
+
+static void putString(std::string &out, const std::string &value) {
+    putInt(out, (int32_t) value.size());
+    out.append(value);
+}
+
+StreamSubscriber::StreamSubscriber(bool interned) : interned(interned), dropped(0) {
+    buffer.append(STREAM_MAGIC, sizeof(STREAM_MAGIC) - 1);
+    putInt(buffer, STREAM_VERSION);
+}
+
+void StreamSubscriber::take(std::string &out) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (out.empty()) {
+        out.swap(buffer);
+    } else {
+        out.append(buffer);
+        buffer.clear();
+    }
+}
+
+SampleStream &SampleStream::instance() {
+    static SampleStream stream;
+    return stream;
+}
+
+SampleStream::SampleStream() : jvmti_(NULL), subscriberCount(0) {
+}
+
+void SampleStream::setJvmti(jvmtiEnv *jvmti) {
+    jvmti_.store(jvmti, std::memory_order_release);
+}
+
+StreamSubscriberPtr SampleStream::subscribe(bool interned) {
+    StreamSubscriberPtr subscriber(new StreamSubscriber(interned));
+    std::lock_guard<std::mutex> guard(lock);
+    subscribers.push_back(subscriber);
+    subscriberCount.store((int) subscribers.size(), std::memory_order_relaxed);
+    return subscriber;
+}
+
+void SampleStream::unsubscribe(const StreamSubscriberPtr &subscriber) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t i = 0; i < subscribers.size(); i++) {
+        if (subscribers[i] == subscriber) {
+            subscribers.erase(subscribers.begin() + i);
+            break;
+        }
+    }
+    subscriberCount.store((int) subscribers.size(), std::memory_order_relaxed);
+}
+
+bool SampleStream::methodName(const JVMPI_CallFrame &frame, std::string &name) {
+    jvmtiEnv *jvmti = jvmti_.load(std::memory_order_acquire);
+    char fqn[FQN_MAX];
+    if (jvmti == NULL || !frameFqn(jvmti, frame, fqn)) return false;
+    name = fqn;
+    return true;
+}
+
+// Appends a METHOD record for every method of the trace the subscriber doesn't know yet.
+// The ones that could be named go to learned, the subscriber only knows them once sent.
+void SampleStream::describeMethods(const JVMPI_CallTrace &trace, StreamSubscriber &subscriber,
+                                   std::string &out, std::vector<int64_t> &learned) {
+    learned.clear();
+    for (int i = 0; i < trace.num_frames; i++) {
+        const JVMPI_CallFrame &frame = trace.frames[i];
+        int64_t id = (int64_t) frame.method_id;
+        if (frame.method_id == NULL || subscriber.knownMethods.count(id) > 0) continue;
+        // a recursive call
+        if (std::find(learned.begin(), learned.end(), id) != learned.end()) continue;
+
+        std::unordered_map<int64_t, std::string>::iterator it = methodNames.find(id);
+        if (it == methodNames.end()) {
+            std::string name;
+            if (frame.lineno == kNativeFrameLineNo || frame.lineno == kStubFrameLineNo) {
+                name = nativeFrameName(frame);
+            } else if (!methodName(frame, name)) {
+                // described again with the next sample it's in, until it can be named
+                putByte(out, STREAM_METHOD);
+                putLong(out, id);
+                putString(out, "[unknown method]");
+                continue;
+            }
+            it = methodNames.insert(std::make_pair(id, name)).first;
+        }
+        putByte(out, STREAM_METHOD);
+        putLong(out, id);
+        putString(out, it->second);
+        learned.push_back(id);
+    }
+}
+
+void SampleStream::record(const timespec &ts, const JVMPI_CallTrace &trace, ThreadBucketPtr &info) {
+    if (!hasSubscribers()) return;
+
+    // somebody is (un)subscribing, never wait for them
+    std::unique_lock<std::mutex> guard(lock, std::try_to_lock);
+    if (!guard.owns_lock()) {
+        TRACE(Stream, kTraceStreamContended);
+        return;
+    }
+
+    int64_t ms = (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    int tid = info.defined() ? info->tid : kUnknownTid;
+
+    std::string frames;
+    for (int i = 0; i < trace.num_frames; i++) {
+        putInt(frames, trace.frames[i].lineno);
+        putLong(frames, (int64_t) trace.frames[i].method_id);
+    }
+
+    std::string out;
+    std::vector<int64_t> learned;
+    for (size_t s = 0; s < subscribers.size(); s++) {
+        StreamSubscriber &subscriber = *subscribers[s];
+        std::unique_lock<std::mutex> subscriberGuard(subscriber.lock, std::try_to_lock);
+        if (!subscriberGuard.owns_lock()) {
+            subscriber.dropped++;
+            TRACE(Stream, kTraceStreamDropped);
+            continue;
+        }
+
+        out.clear();
+        if (subscriber.dropped > 0) {
+            putByte(out, STREAM_DROPPED);
+            putLong(out, subscriber.dropped);
+        }
+
+        // threads whose tid isn't known would all be named after the first of them
+        bool newThread = info.defined() && tid != kUnknownTid && subscriber.knownThreads.count(tid) == 0;
+        if (newThread) {
+            putByte(out, STREAM_THREAD);
+            putInt(out, tid);
+            putLong(out, info->jid);
+            putString(out, info->name);
+        }
+
+        describeMethods(trace, subscriber, out, learned);
+
+        int32_t stackId = -1;
+        bool newStack = false;
+        if (subscriber.interned && trace.num_frames > 0) {
+            std::unordered_map<std::string, int32_t>::iterator it = subscriber.stacks.find(frames);
+            if (it != subscriber.stacks.end()) {
+                stackId = it->second;
+            } else if (subscriber.stacks.size() < kStreamMaxStacks) {
+                stackId = (int32_t) subscriber.stacks.size();
+                newStack = true;
+                putByte(out, STREAM_STACK);
+                putInt(out, stackId);
+                putInt(out, trace.num_frames);
+                out.append(frames);
+            }
+        }
+
+        if (stackId >= 0) {
+            putByte(out, STREAM_STACK_SAMPLE);
+            putLong(out, ms);
+            putInt(out, tid);
+            putInt(out, stackId);
+        } else {
+            putByte(out, STREAM_SAMPLE);
+            putLong(out, ms);
+            putInt(out, tid);
+            putInt(out, trace.num_frames);
+            if (trace.num_frames > 0) out.append(frames);
+        }
+
+        if (subscriber.buffer.size() + out.size() > kStreamBufferSize) {
+            // nothing of it was sent, so nothing of it is known to the subscriber
+            subscriber.dropped++;
+            TRACE(Stream, kTraceStreamDropped);
+            continue;
+        }
+
+        subscriber.buffer.append(out);
+        subscriber.dropped = 0;
+        if (newThread) subscriber.knownThreads.insert(tid);
+        subscriber.knownMethods.insert(learned.begin(), learned.end());
+        if (newStack) subscriber.stacks[frames] = stackId;
+        TRACE(Stream, kTraceStreamSent);
+    }
+}
@@ -0,0 +1,129 @@
+#ifndef SAMPLE_STREAM_H
+#define SAMPLE_STREAM_H
+
+#include <stdint.h>
+#include <jvmti.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "globals.h"
+#include "stacktraces.h"
+#include "thread_map.h"
+
+#include "trace.h"
+
+const int kTraceStreamTotal = 3;
+
+const int kTraceStreamSent = 0;
+const int kTraceStreamDropped = 1;
+const int kTraceStreamContended = 2;
+
+TRACE_DECLARE(Stream, kTraceStreamTotal);
+
+// Bytes a subscriber may have queued, samples past that are dropped for it until it catches up
+const size_t kStreamBufferSize = 4 * 1024 * 1024;
+// Stacks interned per subscriber, later stacks are sent in full
+const size_t kStreamMaxStacks = 64 * 1024;
+
+/**
+ * Record types of the stream, each a type byte followed by big endian fields. A stream opens
+ * with STREAM_MAGIC and a version int. Frames are an int lineno (a BCI, or one of the
+ * recovered frame markers, see isRecoveredTrace) and a long method id. Methods and threads are
+ * described before the first record referring to them, and so are stacks in the interned mode.
+ */
+const char STREAM_MAGIC[] = "HPSTREAM";
+const int32_t STREAM_VERSION = 1;
+// long id, int length, name
+const uint8_t STREAM_METHOD = 1;
+// int tid, long jid, int length, name. Never sent for tid 0, a thread whose OS id isn't known.
+const uint8_t STREAM_THREAD = 2;
+// long epoch ms, int tid, int frame count (an AsyncGetCallTrace error when negative), frames
+const uint8_t STREAM_SAMPLE = 3;
+// int stack id, int frame count, frames
+const uint8_t STREAM_STACK = 4;
+// long epoch ms, int tid, int stack id
+const uint8_t STREAM_STACK_SAMPLE = 5;
+// long samples dropped since the last such record, the subscriber was too slow
+const uint8_t STREAM_DROPPED = 6;
+
+class StreamSubscriber {
+public:
+    // interned sends each distinct stack once and samples as stack ids
+    explicit StreamSubscriber(bool interned);
+
+    ~StreamSubscriber() {
+    }
+
+    // Moves whatever is queued into out, the controller's side
+    void take(std::string &out);
+
+private:
+    friend class SampleStream;
+
+    const bool interned;
+
+    std::mutex lock;
+    std::string buffer;
+
+    // only touched by the consumer side, under SampleStream's lock
+    long dropped;
+    std::unordered_set<int64_t> knownMethods;
+    std::unordered_set<int> knownThreads;
+    std::unordered_map<std::string, int32_t> stacks;
+
+    DISALLOW_COPY_AND_ASSIGN(StreamSubscriber);
+};
+
+typedef std::shared_ptr<StreamSubscriber> StreamSubscriberPtr;
+
+/**
+ * Fans the samples popped off the queues out to subscribers of the controller's stream
+ * command. Publishing never waits: a subscriber that is busy being drained or has its
+ * buffer full misses the sample and is told how many it missed. Samples are only encoded
+ * while somebody is subscribed.
+ */
+class SampleStream {
+public:
+    static SampleStream &instance();
+
+    void setJvmti(jvmtiEnv *jvmti);
+
+    StreamSubscriberPtr subscribe(bool interned);
+
+    void unsubscribe(const StreamSubscriberPtr &subscriber);
+
+    bool hasSubscribers() const { return subscriberCount.load(std::memory_order_relaxed) > 0; }
+
+    // Consumer side, called for every sample popped
+    void record(const timespec &ts, const JVMPI_CallTrace &trace, ThreadBucketPtr &info);
+
+    SampleStream();
+
+    virtual ~SampleStream() {
+    }
+
+protected:
+    // package.Class.method for a Java frame, false if it can't be named yet
+    virtual bool methodName(const JVMPI_CallFrame &frame, std::string &name);
+
+private:
+    std::atomic<jvmtiEnv *> jvmti_;
+    std::mutex lock;
+    std::vector<StreamSubscriberPtr> subscribers;
+    std::atomic_int subscriberCount;
+
+    // method names by id, shared by every subscriber
+    std::unordered_map<int64_t, std::string> methodNames;
+
+    void describeMethods(const JVMPI_CallTrace &trace, StreamSubscriber &subscriber,
+                         std::string &out, std::vector<int64_t> &learned);
+
+    DISALLOW_COPY_AND_ASSIGN(SampleStream);
+};
+
+#endif // SAMPLE_STREAM_H
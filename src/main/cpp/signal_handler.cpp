@@ -20,6 +20,21 @@ namespace {
     };
 } // namespace
 
+std::mutex SignalHandler::timerMutex;
+SignalHandler *SignalHandler::timerOwner = NULL;
+
+SignalHandler::~SignalHandler() {
+    std::lock_guard<std::mutex> guard(timerMutex);
+    if (timerOwner == this)
+        timerOwner = NULL;
+}
+
+void SignalHandler::claimTimer() {
+    std::lock_guard<std::mutex> guard(timerMutex);
+    timerOwner = this;
+    currentInterval = -1; // force the next update to rearm the timer
+}
+
 bool SignalHandler::updateSigprofInterval() {
     bool res = updateSigprofInterval(timingIntervals[intervalIndex]);
     intervalIndex = (intervalIndex + 1) % NUMBER_OF_INTERVALS;
@@ -27,6 +42,9 @@ bool SignalHandler::updateSigprofInterval() {
 }
 
 bool SignalHandler::updateSigprofInterval(const int timingInterval) {
+    std::lock_guard<std::mutex> guard(timerMutex);
+    if (timerOwner != this)
+        return true; // timer was handed over to a newer handler
     if (timingInterval == currentInterval)
         return true;
     static struct itimerval timer;
@@ -11,6 +11,7 @@
 
 #include <array>
 #include <iterator>
+#include <mutex>
 
 #include "globals.h"
 
@@ -29,19 +30,26 @@ public:
 
     struct sigaction SetAction(void (*sigaction)(int, siginfo_t *, void *));
 
+    // ITIMER_PROF is process wide, only the handler that claimed it last may rearm or stop it.
+    // This lets a replacement handler take over while the previous one is still draining.
+    void claimTimer();
+
     bool updateSigprofInterval();
 
     bool updateSigprofInterval(int);
 
     bool stopSigprof() { return updateSigprofInterval(0); }
 
-    ~SignalHandler() {}
+    ~SignalHandler();
 
 private:
     int intervalIndex;
     int currentInterval;
     std::array<int, NUMBER_OF_INTERVALS> timingIntervals;
 
+    static std::mutex timerMutex;
+    static SignalHandler *timerOwner;
+
     DISALLOW_COPY_AND_ASSIGN(SignalHandler);
 };
 
@@ -28,6 +28,20 @@ typedef struct {
 
 typedef void (*ASGCTType)(JVMPI_CallTrace *, jint, void *);
 
+// Frames recovered for a sample AsyncGetCallTrace failed on. The lineno tells what the
+// method_id holds: a pc found by the native unwinder, the jmethodID whose compiled code
+// held the pc, or the interned name of the VM stub that did. A recovered trace is made of
+// these only, its last (root most) frame has a NULL method_id and the AsyncGetCallTrace
+// error as its lineno.
+const jint kNativeFrameLineNo = -1000;
+const jint kCompiledFrameLineNo = -1001;
+const jint kStubFrameLineNo = -1002;
+
+inline bool isRecoveredTrace(const JVMPI_CallTrace &trace) {
+    return trace.num_frames > 1 && trace.frames[0].lineno <= kNativeFrameLineNo &&
+           trace.frames[0].lineno >= kStubFrameLineNo;
+}
+
 const int kNumCallTraceErrors = 10;
 
 enum CallTraceErrors {
@@ -2,6 +2,7 @@
 
 #include <sys/syscall.h>
 #include <unistd.h>
+#include <new>
 
 #ifdef __APPLE__
 #include <mach/mach.h>
@@ -29,3 +30,109 @@ int gettid() {
 #endif
   return ret;
 }
+
+__thread map::GC::EpochType currentGCSlot __attribute__((tls_model("initial-exec"))) = nullptr; // kEpochInitial
+
+ThreadBucketPool &ThreadBucketPool::instance() {
+  // never destroyed, the GC may hand buckets back during shutdown
+  static ThreadBucketPool *pool = new ThreadBucketPool();
+  return *pool;
+}
+
+ThreadBucketPool::ThreadBucketPool() : slabCount(0), freeHead(0), inUse(0), heapAllocated(0) {
+  for (int i = 0; i < kThreadBucketMaxSlabs; i++)
+    slabs[i].store(nullptr, std::memory_order_relaxed);
+}
+
+ThreadBucket *ThreadBucketPool::acquire(int tid, jlong jid, const char *name) {
+  uint32_t index;
+  ThreadBucket *bucket;
+  bool collected = false;
+  while (!pop(index)) {
+    // released buckets may only be waiting for the GC, rather than for a new slab
+    if (!collected) {
+      collected = true;
+      map::DefaultGC.collect();
+      continue;
+    }
+    if (!grow()) {
+      heapAllocated.fetch_add(1, std::memory_order_relaxed);
+      bucket = new ThreadBucket(tid, jid, name);
+      bucket->reclaim = &ThreadBucketPool::reclaim;
+      return bucket;
+    }
+  }
+  inUse.fetch_add(1, std::memory_order_relaxed);
+  bucket = new (storage(index)) ThreadBucket(tid, jid, name, index);
+  bucket->reclaim = &ThreadBucketPool::reclaim;
+  return bucket;
+}
+
+ThreadBucketPool::Occupancy ThreadBucketPool::occupancy() const {
+  Occupancy result;
+  result.inUse = inUse.load(std::memory_order_relaxed);
+  result.capacity = slabCount.load(std::memory_order_relaxed) * kThreadBucketSlabSize;
+  result.heapAllocated = heapAllocated.load(std::memory_order_relaxed);
+  return result;
+}
+
+bool ThreadBucketPool::pop(uint32_t &index) {
+  uint64_t head = freeHead.load(std::memory_order_acquire);
+  while (true) {
+    uint32_t first = (uint32_t)head;
+    if (first == 0)
+      return false;
+    // the slot may be popped and pushed back concurrently, the tag makes the CAS fail then
+    uint64_t next = ((head >> 32) + 1) << 32 | nextFree(first - 1).load(std::memory_order_relaxed);
+    if (freeHead.compare_exchange_weak(head, next, std::memory_order_acq_rel)) {
+      index = first - 1;
+      return true;
+    }
+  }
+}
+
+// pushes the chain first..last, already linked through nextFree
+void ThreadBucketPool::push(uint32_t first, uint32_t last) {
+  uint64_t head = freeHead.load(std::memory_order_relaxed);
+  while (true) {
+    nextFree(last).store((uint32_t)head, std::memory_order_relaxed);
+    uint64_t next = ((head >> 32) + 1) << 32 | (first + 1);
+    if (freeHead.compare_exchange_weak(head, next, std::memory_order_acq_rel))
+      return;
+  }
+}
+
+bool ThreadBucketPool::grow() {
+  std::lock_guard<std::mutex> guard(growth);
+  if ((uint32_t)freeHead.load(std::memory_order_acquire) != 0)
+    return true; // someone else grew the pool or buckets were recycled meanwhile
+
+  int count = slabCount.load(std::memory_order_relaxed);
+  if (count == kThreadBucketMaxSlabs)
+    return false;
+
+  Slab *slab = new Slab();
+  uint32_t base = count * kThreadBucketSlabSize;
+  for (int i = 0; i < kThreadBucketSlabSize - 1; i++)
+    slab->nextFree[i].store(base + i + 2, std::memory_order_relaxed);
+  slabs[count].store(slab, std::memory_order_release);
+  slabCount.store(count + 1, std::memory_order_release);
+
+  push(base, base + kThreadBucketSlabSize - 1);
+  return true;
+}
+
+void ThreadBucketPool::reclaim(map::GC::Retired *node) {
+  ThreadBucket *bucket = static_cast<ThreadBucket *>(node);
+  ThreadBucketPool &pool = instance();
+  int index = bucket->poolIndex;
+
+  bucket->~ThreadBucket();
+  if (index < 0) {
+    ::operator delete(bucket);
+    pool.heapAllocated.fetch_sub(1, std::memory_order_relaxed);
+  } else {
+    pool.inUse.fetch_sub(1, std::memory_order_relaxed);
+    pool.push(index, index);
+  }
+}
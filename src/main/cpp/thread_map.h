@@ -5,6 +5,8 @@
 #include <jni.h>
 #include <jvmti.h>
 #include <string.h>
+#include <mutex>
+#include <type_traits>
 
 int gettid();
 
@@ -30,6 +32,10 @@ template <typename PType> struct PointerHasher {
 
 const int kInitialMapSize = 256;
 
+// The calling thread's GC slot between GCHelper::attachCurrentThread and detachCurrentThread.
+// Initial-exec, so a signal handler reads it without going through the TLS allocator.
+extern __thread map::GC::EpochType currentGCSlot __attribute__((tls_model("initial-exec")));
+
 class GCHelper {
 public:
   static map::GC::EpochType attach() { return map::DefaultGC.attachThread(); }
@@ -39,25 +45,149 @@ public:
       map::DefaultGC.detachThread(localEpoch);
   }
 
-  static void safepoint(map::GC::EpochType &localEpoch) { map::DefaultGC.safepoint(localEpoch); }
+  // what the thread reads from the maps stays valid until it exits again
+  static void enter(map::GC::EpochType &localEpoch) {
+    if (localEpoch != map::GC::kEpochInitial)
+      map::DefaultGC.enter(localEpoch);
+  }
+
+  static void exit(map::GC::EpochType &localEpoch) {
+    if (localEpoch != map::GC::kEpochInitial)
+      map::DefaultGC.exit(localEpoch);
+  }
+
+  static void safepoint(map::GC::EpochType &localEpoch) {
+    if (localEpoch != map::GC::kEpochInitial)
+      map::DefaultGC.safepoint(localEpoch);
+  }
+
+  // Gives the calling thread a slot its Sections mark, rather than the counters shared by
+  // every thread without one. Not async-signal-safe, for when a thread starts.
+  static void attachCurrentThread() {
+    if (currentGCSlot != map::GC::kEpochInitial)
+      return;
+    map::GC::EpochType slot = attach();
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    currentGCSlot = slot;
+  }
 
-  static void signalSafepoint(map::GC::EpochType &localEpoch) { map::DefaultGC.ss_safepoint(localEpoch); }
+  static void detachCurrentThread() {
+    map::GC::EpochType slot = currentGCSlot;
+    // the thread's handlers go back to the shared counters before the slot is given up
+    currentGCSlot = map::GC::kEpochInitial;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    detach(slot);
+  }
+
+  // A read-side section for the scope, on the thread's own slot when it has one. Nests, and a
+  // signal handler may open one inside the thread's. Async-signal-safe.
+  class Section {
+  public:
+    Section() : slot(currentGCSlot), entered(false), epoch(0) {
+      if (slot != map::GC::kEpochInitial)
+        entered = map::DefaultGC.enterOutermost(slot);
+      else
+        epoch = map::DefaultGC.enterShared();
+    }
+
+    ~Section() {
+      if (slot == map::GC::kEpochInitial)
+        map::DefaultGC.exitShared(epoch);
+      else if (entered)
+        map::DefaultGC.exit(slot);
+    }
+
+  private:
+    const map::GC::EpochType slot;
+    bool entered;
+    unsigned long epoch;
+
+    Section(const Section &);
+    void operator=(const Section &);
+  };
 };
 
-struct ThreadBucket {
+// The tid of a thread registered without a ThreadStart of its own, whose OS id isn't known.
+// Error counts fold it into the other threads' row and the sample stream names no thread for it.
+const int kUnknownTid = 0;
+
+// Thread names are stored inline and truncated to fit, terminator included
+const int kThreadNameMax = 64;
+
+const int kThreadBucketSlabSize = 128;
+const int kThreadBucketMaxSlabs = 256;
+
+/* Buckets live in ThreadBucketPool slabs, the GC link is used to hand a released bucket
+   back to the pool only once no signal handler can still be reading it. */
+struct ThreadBucket : map::GC::Retired {
   const int tid;
   const jlong jid;
-  std::string name;
+  char name[kThreadNameMax];
   std::atomic_int refs;
-  map::GC::EpochType localEpoch;
+  const int poolIndex; // -1 when the pool was exhausted and the bucket came from the heap
 
-  explicit ThreadBucket(int id, int jid, const char *n) : tid(id), jid(jid), name(n), refs(1), localEpoch(GCHelper::attach()) {}
+  explicit ThreadBucket(int id, jlong jid, const char *n, int index = -1)
+      : tid(id), jid(jid), refs(1), poolIndex(index) {
+    strncpy(name, n ? n : "", kThreadNameMax - 1);
+    name[kThreadNameMax - 1] = '\0';
+  }
 
   int release() { return refs.fetch_sub(1, std::memory_order_acquire); }
 
   ~ThreadBucket() {}
 };
 
+/* Fixed-size slabs of buckets threaded through a lock-free free list, so thread churn doesn't
+   go through malloc from JVMTI callbacks. Slabs are added under a lock, at most
+   kThreadBucketMaxSlabs times, and never freed. Once they are all full buckets come from the heap. */
+class ThreadBucketPool {
+public:
+  struct Occupancy {
+    int inUse;
+    int capacity;
+    long heapAllocated;
+  };
+
+  static ThreadBucketPool &instance();
+
+  ThreadBucket *acquire(int tid, jlong jid, const char *name);
+
+  // lock-free and allocation free, the bucket is recycled once the GC says it's unreachable,
+  // which only waits for the read-side sections open at the time, see ThreadMapBase
+  void release(ThreadBucket *bucket) { map::DefaultGC.retire(bucket); }
+
+  Occupancy occupancy() const;
+
+private:
+  struct Slab {
+    std::aligned_storage<sizeof(ThreadBucket), alignof(ThreadBucket)>::type buckets[kThreadBucketSlabSize];
+    std::atomic<uint32_t> nextFree[kThreadBucketSlabSize];
+  };
+
+  std::atomic<Slab *> slabs[kThreadBucketMaxSlabs];
+  std::atomic_int slabCount;
+  // index + 1 of the first free bucket in the low half, 0 if none, ABA tag in the high half
+  std::atomic<uint64_t> freeHead;
+  std::mutex growth;
+
+  std::atomic_int inUse;
+  std::atomic_long heapAllocated;
+
+  ThreadBucketPool();
+
+  void *storage(uint32_t index) { return &slabs[index / kThreadBucketSlabSize].load(std::memory_order_acquire)->buckets[index % kThreadBucketSlabSize]; }
+
+  std::atomic<uint32_t> &nextFree(uint32_t index) { return slabs[index / kThreadBucketSlabSize].load(std::memory_order_acquire)->nextFree[index % kThreadBucketSlabSize]; }
+
+  bool pop(uint32_t &index);
+
+  void push(uint32_t first, uint32_t last);
+
+  bool grow();
+
+  static void reclaim(map::GC::Retired *node);
+};
+
 /* ThreadBucket* wrapper that does atomic reference counting and only supports
    move semantic. Here weak means that ref counter is not incremented when
    wrapper is created, but it will be decremented once object is destroyed.
@@ -69,8 +199,9 @@ public:
       int prev = bucket->refs.fetch_add(1, std::memory_order_relaxed);
       assert(prev >= 0);
       if (prev == 0) {
-        // return to released state
+        // return to released state, the GC keeps the memory valid until we're out of here
         bucket->refs.fetch_sub(1, std::memory_order_relaxed);
+        bucket = nullptr;
       }
     }
   }
@@ -81,7 +212,7 @@ public:
 
   ThreadBucketPtr &operator=(ThreadBucketPtr &&tb) {
     if (bucket && bucket->release() == 1) {
-      delete bucket;
+      ThreadBucketPool::instance().release(bucket);
     }
     bucket = tb.bucket;
     tb.bucket = nullptr;
@@ -96,14 +227,14 @@ public:
 
   void reset() {
     if (bucket && bucket->release() == 1) {
-      delete bucket;
+      ThreadBucketPool::instance().release(bucket);
     }
     bucket = nullptr;
   }
 
   ~ThreadBucketPtr() {
     if (bucket && bucket->release() == 1) {
-      delete bucket;
+      ThreadBucketPool::instance().release(bucket);
     }
   }
 
@@ -111,9 +242,9 @@ private:
   ThreadBucket *bucket;
 };
 
-template <typename MapProvider> class ThreadMapBase {
+template <typename Map> class ThreadMapBase {
 private:
-  MapProvider map;
+  Map map;
 
 public:
   explicit ThreadMapBase(int capacity = kInitialMapSize) : map(capacity) {}
@@ -121,25 +252,38 @@ public:
   void put(JNIEnv *jni_env, const char *name, jlong jid) { put(jni_env, name, gettid(), jid); }
 
   void put(JNIEnv *jni_env, const char *name, int tid, jlong jid) {
-    ThreadBucket *info = new ThreadBucket(tid, jid, name);
-    ThreadBucketPtr oldRef((ThreadBucket *)map.put((map::KeyType)jni_env, (map::ValueType)info)); // weak ref to object
-    GCHelper::safepoint(info->localEpoch); // each thread inserts once
+    ThreadBucket *info = ThreadBucketPool::instance().acquire(tid, jid, name);
+    ThreadBucket *old = nullptr;
+    {
+      GCHelper::Section section;
+      map.put(jni_env, info, &old);
+    }
+    ThreadBucketPtr oldRef(old); // weak ref to object
+    oldRef.reset();
+    map::DefaultGC.collect(); // thread churn is what recycles buckets and old tables
   }
 
+  // called from signal handlers
   ThreadBucketPtr get(JNIEnv *jni_env) {
-    ThreadBucketPtr info((ThreadBucket *)map.get((map::KeyType)jni_env), false); // non-weak ref
-    if (info.defined())
-      GCHelper::signalSafepoint(info->localEpoch);
+    GCHelper::Section section; // until the bucket is referenced, it may be released meanwhile
+    ThreadBucket *bucket = nullptr;
+    map.find(jni_env, bucket);
+    ThreadBucketPtr info(bucket, false); // non-weak ref
     return info; // move
   }
 
   void remove(JNIEnv *jni_env) {
-    ThreadBucketPtr info((ThreadBucket *)map.remove((map::KeyType)jni_env)); // weak ref to object
-    if (info.defined())
-      GCHelper::detach(info->localEpoch);
+    ThreadBucket *old = nullptr;
+    {
+      GCHelper::Section section;
+      map.remove(jni_env, &old);
+    }
+    ThreadBucketPtr info(old); // weak ref to object
+    info.reset();
+    map::DefaultGC.collect();
   }
 };
 
-typedef ThreadMapBase<map::ConcurrentMapProvider<PointerHasher<JNIEnv>, true>> ThreadMap;
+typedef ThreadMapBase<map::ConcurrentMap<JNIEnv *, ThreadBucket *, PointerHasher<JNIEnv>>> ThreadMap;
 
 #endif
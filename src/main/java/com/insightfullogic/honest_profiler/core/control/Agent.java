@@ -43,5 +43,19 @@ public class Agent
 
     public static native void setMaxFramesToCapture(int maxFramesToCapture);
 
+    public static native String getThreadFilter();
+
+    /**
+     * Restricts sampling to threads whose name starts with one of the ':'-separated prefixes.
+     * An empty or null filter samples every thread. Takes effect without stopping the profiler.
+     */
+    public static native void setThreadFilter(String threadFilter);
+
+    /**
+     * Switches sampling to the burst interval for the configured burst duration, starting on the next
+     * processor tick. Does nothing unless the agent was started with burstInterval set.
+     */
+    public static native void trigger();
+
     public static native int getCurrentNativeThreadId();
 }
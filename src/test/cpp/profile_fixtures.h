@@ -0,0 +1,67 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "test.h"
+#include "../../tools/cpp/profile.h"
+
+#ifndef PROFILE_FIXTURES_H
+#define PROFILE_FIXTURES_H
+
+// thread first, then the methods root first
+typedef std::vector<std::string> Stack;
+typedef std::vector<std::pair<Stack, int>> Samples;
+
+inline ProfileEntry entryOf(uint8_t kind, const std::string &name) {
+  ProfileEntry entry;
+  entry.kind = kind;
+  entry.name = name;
+  entry.signature = kind == ENTRY_METHOD ? "()V" : "";
+  return entry;
+}
+
+// An empty file of its own
+inline std::string tempPath() {
+  char path[] = "/tmp/profile-test-XXXXXX";
+  close(mkstemp(path));
+  return path;
+}
+
+// A file of its own holding text
+inline std::string tempPath(const std::string &text) {
+  std::string path = tempPath();
+  std::ofstream(path.c_str(), std::ofstream::out | std::ofstream::binary) << text;
+  return path;
+}
+
+// A profile file of the samples, in a file of its own
+inline std::string writeTestProfile(const Samples &samples) {
+  Profile profile;
+  for (size_t i = 0; i < samples.size(); i++) {
+    const Stack &stack = samples[i].first;
+    for (size_t j = 0; j < stack.size(); j++) {
+      profile.entries.push_back(entryOf(j == 0 ? ENTRY_THREAD : ENTRY_METHOD, stack[j]));
+    }
+  }
+  std::sort(profile.entries.begin(), profile.entries.end());
+  profile.entries.erase(std::unique(profile.entries.begin(), profile.entries.end()), profile.entries.end());
+
+  for (size_t i = 0; i < samples.size(); i++) {
+    const Stack &stack = samples[i].first;
+    std::vector<int64_t> path;
+    for (size_t j = 0; j < stack.size(); j++) {
+      ProfileEntry entry = entryOf(j == 0 ? ENTRY_THREAD : ENTRY_METHOD, stack[j]);
+      path.push_back(std::lower_bound(profile.entries.begin(), profile.entries.end(), entry) - profile.entries.begin());
+    }
+    profile.tree.add(path.data(), (int) path.size(), samples[i].second);
+  }
+
+  std::string path = tempPath();
+  writeProfile(profile, path);
+  return path;
+}
+
+#endif /* PROFILE_FIXTURES_H */
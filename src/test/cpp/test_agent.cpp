@@ -46,6 +46,20 @@ TEST(ParsesMultipleArguments) {
     CHECK_EQUAL("/home/richard/log.hpl", options.logFilePath);
 }
 
+TEST(ParsesMethodIdOptions) {
+    ConfigurationOptions options;
+    CHECK_EQUAL(DEFAULT_METHOD_ID_THREADS, options.methodIdThreads);
+    CHECK(!options.deferMethodIds);
+
+    parseArguments((char *) "methodIdThreads=0,deferMethodIds=1", options);
+    CHECK_EQUAL(0, options.methodIdThreads);
+    CHECK(options.deferMethodIds);
+
+    ConfigurationOptions copy(options);
+    CHECK_EQUAL(0, copy.methodIdThreads);
+    CHECK(copy.deferMethodIds);
+}
+
 TEST(SafelyTerminatesStrings) {
     char* string = (char *) "/home/richard/log.hpl";
     char* result = safe_copy_string(string, NULL);
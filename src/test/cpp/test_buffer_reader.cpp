@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <string.h>
+#include <memory>
+#include "test.h"
+#include "../../main/cpp/buffer_reader.h"
+
+class NamingBufferReader : public BufferReader {
+public:
+  explicit NamingBufferReader(size_t budget = kReaderDefaultBudget, ReaderOverflow policy = READER_DROP_NEWEST)
+      : BufferReader(NULL, 4, budget, policy) {
+  }
+
+protected:
+  virtual bool methodName(jmethodID method, std::string &name) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "method%ld", (long) method);
+    name = buffer;
+    return true;
+  }
+};
+
+template<typename T>
+static T take(const char *&at) {
+  T value;
+  memcpy(&value, at, sizeof(value));
+  at += sizeof(value);
+  return value;
+}
+
+static void recordTrace(BufferReader &reader, ThreadBucketPtr &owner, long seconds, jint numFrames, long firstMethod) {
+  JVMPI_CallFrame frames[8] = {};
+  for (int i = 0; i < numFrames; i++) {
+    frames[i].lineno = 10;
+    frames[i].method_id = (jmethodID) (firstMethod + i);
+  }
+  JVMPI_CallTrace trace = {};
+  trace.num_frames = numFrames;
+  trace.frames = frames;
+  timespec ts = { seconds, 5000000 };
+  // another reference to the same bucket, as the processor hands it over
+  reader.record(ts, trace, ThreadBucketPtr(owner.operator->(), false));
+}
+
+TEST(BufferReaderDrainsPackedRecords) {
+  NamingBufferReader reader;
+  ThreadBucketPtr info(ThreadBucketPool::instance().acquire(301, 31, "worker"));
+  recordTrace(reader, info, 1, 2, 7);
+  recordTrace(reader, info, 2, kGcTraceError, 0);
+  // truncated to the reader's 4 frames
+  recordTrace(reader, info, 3, 6, 8);
+  info.reset();
+  CHECK_EQUAL(3u, reader.size());
+
+  char buffer[256];
+  long size = reader.drain(buffer, sizeof(buffer));
+  CHECK_EQUAL((long) (3 * kReaderRecordHeader + 6 * sizeof(int32_t)), size);
+  CHECK_EQUAL(0u, reader.size());
+
+  const char *at = buffer;
+  CHECK_EQUAL(1005, take<int64_t>(at));
+  CHECK_EQUAL(31, take<int64_t>(at));
+  CHECK_EQUAL(0, take<int32_t>(at));
+  CHECK_EQUAL(2, take<int32_t>(at));
+  CHECK_EQUAL(0, take<int32_t>(at));
+  CHECK_EQUAL(1, take<int32_t>(at));
+
+  CHECK_EQUAL(2005, take<int64_t>(at));
+  at += sizeof(int64_t) + sizeof(int32_t);
+  CHECK_EQUAL(kGcTraceError, take<int32_t>(at));
+
+  at += 2 * sizeof(int64_t) + sizeof(int32_t);
+  CHECK_EQUAL(4, take<int32_t>(at));
+  // method 8 was interned by the first record
+  CHECK_EQUAL(1, take<int32_t>(at));
+  CHECK_EQUAL(2, take<int32_t>(at));
+
+  std::vector<std::string> names;
+  reader.methods(1, names);
+  CHECK_EQUAL(4u, names.size());
+  CHECK_EQUAL("method8", names[0]);
+  CHECK_EQUAL("method11", names[3]);
+  reader.threads(0, names);
+  CHECK_EQUAL(1u, names.size());
+  CHECK_EQUAL("worker", names[0]);
+}
+
+// the smallest ring there is, kReaderMinSlots samples
+static NamingBufferReader *fill(ReaderOverflow policy, size_t samples) {
+  NamingBufferReader *reader = new NamingBufferReader(0, policy);
+  ThreadBucketPtr info(ThreadBucketPool::instance().acquire(302, 32, "busy"));
+  for (size_t i = 0; i < samples; i++) {
+    recordTrace(*reader, info, i, 3, 1);
+  }
+  info.reset();
+  return reader;
+}
+
+static int64_t firstTimestamp(BufferReader &reader) {
+  char buffer[64];
+  CHECK(reader.drain(buffer, sizeof(buffer)) > 0);
+  const char *at = buffer;
+  return take<int64_t>(at);
+}
+
+TEST(BufferReaderDropsNewestWhenFullAndAsksForRoom) {
+  std::unique_ptr<NamingBufferReader> reader(fill(READER_DROP_NEWEST, kReaderMinSlots + 3));
+  CHECK_EQUAL(kReaderMinSlots, reader->capacity());
+  CHECK_EQUAL(kReaderMinSlots, reader->size());
+  CHECK_EQUAL((long) kReaderMinSlots, reader->counters().staged);
+  CHECK_EQUAL(3, reader->counters().dropped);
+
+  char buffer[64];
+  CHECK_EQUAL(-(long) (kReaderRecordHeader + 3 * sizeof(int32_t)), reader->drain(buffer, kReaderRecordHeader));
+  CHECK_EQUAL(kReaderMinSlots, reader->size());
+
+  CHECK_EQUAL(5, firstTimestamp(*reader));
+  CHECK_EQUAL(kReaderMinSlots - 1, reader->size());
+}
+
+TEST(BufferReaderOverwritesOldestWhenFull) {
+  std::unique_ptr<NamingBufferReader> reader(fill(READER_DROP_OLDEST, kReaderMinSlots + 3));
+  CHECK_EQUAL(kReaderMinSlots, reader->size());
+  CHECK_EQUAL(3, reader->counters().overwritten);
+  CHECK_EQUAL(0, reader->counters().dropped);
+
+  // the first three are gone
+  CHECK_EQUAL(3005, firstTimestamp(*reader));
+}
+
+TEST(BufferReaderDownsamplesPastHalfFull) {
+  std::unique_ptr<NamingBufferReader> reader(fill(READER_DOWNSAMPLE, 4 * kReaderMinSlots));
+  BufferReader::Counters counters = reader->counters();
+  CHECK(reader->size() > kReaderMinSlots / 2);
+  CHECK_EQUAL((long) reader->size(), counters.staged);
+  CHECK(counters.downsampled > 0);
+  CHECK_EQUAL(4 * (long) kReaderMinSlots, counters.staged + counters.downsampled + counters.dropped);
+  // up to half full everything was kept
+  CHECK_EQUAL(5, firstTimestamp(*reader));
+
+  // a budget is rounded down to whole slots
+  NamingBufferReader budgeted(1024 * 1024);
+  CHECK(budgeted.capacity() > kReaderMinSlots);
+  CHECK(budgeted.capacity() * 4 * sizeof(jmethodID) < 1024 * 1024);
+}
+
+TEST(BufferReaderDrainsArraysWithInternedStacks) {
+  NamingBufferReader reader;
+  ThreadBucketPtr info(ThreadBucketPool::instance().acquire(303, 33, "aggregated"));
+  recordTrace(reader, info, 1, 2, 7);
+  recordTrace(reader, info, 2, kGcTraceError, 0);
+  recordTrace(reader, info, 3, 2, 7);
+  recordTrace(reader, info, 4, 3, 7);
+  info.reset();
+
+  jlong timestamps[8], threadIds[8], stackIds[8], frames[8], offsets[8];
+  // 2 frames don't fit the first stack
+  CHECK_EQUAL(-2, reader.drainArrays(timestamps, threadIds, stackIds, 8, frames, 1, offsets, 8));
+  // 3 frames are enough for the first stack, not the second
+  CHECK_EQUAL(3, reader.drainArrays(timestamps, threadIds, stackIds, 8, frames, 3, offsets, 8));
+  CHECK_EQUAL(1, offsets[0]);
+  CHECK_EQUAL(0, offsets[1]);
+  CHECK_EQUAL(2, offsets[2]);
+  CHECK_EQUAL(0, frames[0]);
+  CHECK_EQUAL(1, frames[1]);
+  CHECK_EQUAL(1005, timestamps[0]);
+  CHECK_EQUAL(33, threadIds[0]);
+  CHECK_EQUAL(0, stackIds[0]);
+  CHECK_EQUAL(kGcTraceError - 1, stackIds[1]);
+  CHECK_EQUAL(0, stackIds[2]);
+
+  CHECK_EQUAL(1, reader.drainArrays(timestamps, threadIds, stackIds, 8, frames, 8, offsets, 8));
+  CHECK_EQUAL(1, stackIds[0]);
+  CHECK_EQUAL(1, offsets[0]);
+  CHECK_EQUAL(3, offsets[2]);
+  CHECK_EQUAL(2, frames[2]);
+  CHECK_EQUAL(0u, reader.size());
+}
@@ -0,0 +1,65 @@
+#include "test.h"
+#include "../../main/cpp/burst_policy.h"
+
+static ConfigurationOptions burstConfig(int interval, int seconds, int cpuThreshold) {
+  ConfigurationOptions conf;
+  conf.burstInterval = interval;
+  conf.burstSeconds = seconds;
+  conf.burstCpuThreshold = cpuThreshold;
+  return conf;
+}
+
+TEST(BurstPolicyDisabledByDefault) {
+  ConfigurationOptions conf;
+  BurstPolicy policy(conf);
+
+  BurstPolicy::requestBurst();
+
+  CHECK(!policy.enabled());
+  CHECK_EQUAL(0, policy.interval(1000));
+}
+
+TEST(BurstPolicyBurstsOnRequestForItsDuration) {
+  BurstPolicy policy(burstConfig(1, 30, 0));
+  CHECK_EQUAL(0, policy.interval(1000));
+
+  BurstPolicy::requestBurst();
+
+  CHECK_EQUAL(1, policy.interval(2000));
+  CHECK_EQUAL(1, policy.interval(31999));
+  CHECK_EQUAL(0, policy.interval(32000));
+}
+
+TEST(BurstPolicyIgnoresRequestsMadeBeforeItExisted) {
+  BurstPolicy::requestBurst();
+  BurstPolicy policy(burstConfig(1, 30, 0));
+
+  CHECK_EQUAL(0, policy.interval(1000));
+}
+
+TEST(BurstPolicyBurstsWhileCpuIsAboveThreshold) {
+  BurstPolicy policy(burstConfig(2, 10, 150));
+
+  // 1 core busy over one second, below the threshold
+  policy.observeCpu(0, 0);
+  policy.observeCpu(1000, 1000);
+  CHECK_EQUAL(0, policy.interval(1500));
+
+  // 2 cores busy
+  policy.observeCpu(2000, 3000);
+  CHECK_EQUAL(2, policy.interval(2500));
+
+  // still hot a second later, the burst is extended to 13s
+  policy.observeCpu(3000, 5000);
+  CHECK_EQUAL(2, policy.interval(3500));
+
+  // cooled down, the burst runs its course
+  policy.observeCpu(12000, 5100);
+  CHECK_EQUAL(2, policy.interval(12500));
+  policy.observeCpu(13000, 5200);
+  CHECK_EQUAL(0, policy.interval(13500));
+}
+
+TEST(BurstPolicyReadsProcessCpu) {
+  CHECK(BurstPolicy::processCpuMillis() >= 0);
+}
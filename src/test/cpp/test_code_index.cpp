@@ -0,0 +1,71 @@
+#include "test.h"
+#include "../../main/cpp/code_index.h"
+
+#define code(address) ((const void *)(uintptr_t)(address))
+#define method(id) ((jmethodID)(uintptr_t)(id))
+
+TEST(CodeIndexFindsMethodsAndStubs) {
+  CodeIndex index;
+  index.addMethod(method(1), code(0x1000), 0x100);
+  index.addStub("vtable stub", code(0x2000), 0x20);
+
+  CodeRange range;
+  CHECK(index.find(0x1080, range));
+  CHECK_EQUAL(method(1), range.method);
+  CHECK(range.stub == NULL);
+
+  CHECK(index.find(0x2000, range));
+  CHECK(range.method == NULL);
+  CHECK_EQUAL(std::string("vtable stub"), std::string(range.stub));
+
+  CHECK(!index.find(0x1100, range));
+  CHECK(!index.find(0x0fff, range));
+  CHECK(!index.find(0x2020, range));
+}
+
+TEST(CodeIndexForgetsUnloadedMethods) {
+  CodeIndex index;
+  index.addMethod(method(1), code(0x1000), 0x100);
+  index.addMethod(method(2), code(0x1100), 0x100);
+  index.remove(code(0x1000));
+
+  CodeRange range;
+  CHECK(!index.find(0x1010, range));
+  CHECK(index.find(0x1110, range));
+  CHECK_EQUAL(method(2), range.method);
+}
+
+TEST(CodeIndexMergesWhenPendingChangesFillUp) {
+  CodeIndex index;
+  for (int i = 0; i < 3 * kCodeIndexPendingSize; i++) {
+    index.addMethod(method(i + 1), code(0x10000 + i * 0x100), 0x80);
+  }
+  index.remove(code(0x10000));
+
+  CHECK(index.size() >= (size_t) 2 * kCodeIndexPendingSize);
+  CodeRange range;
+  CHECK(!index.find(0x10010, range));
+  for (int i = 1; i < 3 * kCodeIndexPendingSize; i++) {
+    CHECK(index.find(0x10000 + i * 0x100 + 0x7f, range));
+    CHECK_EQUAL(method(i + 1), range.method);
+    CHECK(!index.find(0x10000 + i * 0x100 + 0x80, range));
+  }
+}
+
+TEST(CodeIndexReplacesOverlappingCode) {
+  CodeIndex index;
+  index.addMethod(method(1), code(0x1000), 0x100);
+  for (int i = 0; i < kCodeIndexPendingSize; i++) {
+    index.addStub("filler", code(0x100000 + i * 0x10), 0x10);
+  }
+  // the code cache reused the space without an unload event
+  index.addMethod(method(2), code(0x1080), 0x100);
+  for (int i = 0; i < kCodeIndexPendingSize; i++) {
+    index.addStub("filler", code(0x200000 + i * 0x10), 0x10);
+  }
+
+  CodeRange range;
+  CHECK(index.find(0x1090, range));
+  CHECK_EQUAL(method(2), range.method);
+  CHECK(!index.find(0x1010, range));
+}
@@ -0,0 +1,188 @@
+#include "test.h"
+
+#ifndef DISABLE_CPP11
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <fstream>
+#include <string>
+#include <thread>
+#include "../../main/cpp/controller.h"
+
+#ifndef TEST_SKIP_PROFILER
+
+static ThreadMap controllerThreads; // empty map
+
+// A controller serving its Unix socket from a thread of its own
+class ControllerServer {
+public:
+  ConfigurationOptions config;
+  Profiler *profiler;
+  Controller *controller;
+  std::thread server;
+
+  ControllerServer() {
+    char path[] = "/tmp/controller-XXXXXX";
+    close(mkstemp(path));
+    unlink(path);
+    config.controlSocket = path;
+    config.maxFramesToCapture = 42;
+    config.samplingIntervalMin = 3;
+    config.samplingIntervalMax = 7;
+
+    profiler = new Profiler(NULL, NULL, config, controllerThreads);
+    controller = new Controller(NULL, NULL, profiler, config);
+    server = std::thread(&Controller::serve, controller);
+  }
+
+  ~ControllerServer() {
+    controller->stop();
+    server.join();
+    delete controller;
+    delete profiler;
+  }
+
+  // A blocking connection, once the controller is listening
+  int connectClient() {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, config.controlSocket.c_str(), sizeof(address.sun_path) - 1);
+
+    for (int attempt = 0; attempt < 500; attempt++) {
+      int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (connect(fd, (struct sockaddr *) &address, sizeof(address)) == 0) {
+        struct timeval timeout = {5, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        return fd;
+      }
+      close(fd);
+      usleep(10000);
+    }
+    return -1;
+  }
+};
+
+static void sendText(int fd, const std::string &text) {
+  size_t sent = 0;
+  while (sent < text.size()) {
+    ssize_t result = send(fd, text.data() + sent, text.size() - sent, 0);
+    if (result <= 0) return;
+    sent += result;
+  }
+}
+
+// Reads until lines newlines have come in, or the controller closes the connection
+static std::string readLines(int fd, int lines) {
+  std::string reply;
+  char buf[256];
+  while (lines > 0) {
+    ssize_t bytesRead = recv(fd, buf, sizeof(buf), 0);
+    if (bytesRead <= 0) break;
+    for (ssize_t i = 0; i < bytesRead; i++) {
+      if (buf[i] == '\n') lines--;
+    }
+    reply.append(buf, bytesRead);
+  }
+  return reply;
+}
+
+TEST_FIXTURE(ControllerServer, ControllerAnswersPipelinedCommandsInOrder) {
+  int fd = connectClient();
+  CHECK(fd != -1);
+
+  sendText(fd, "get maxFrames\nget intervalMin\r\nget intervalMax\nget interval\n");
+  CHECK_EQUAL("42\n3\n7\n3 7\n", readLines(fd, 4));
+
+  // the connection stays open for more
+  sendText(fd, "get maxFr");
+  usleep(20000);
+  sendText(fd, "ames\n");
+  CHECK_EQUAL("42\n", readLines(fd, 1));
+
+  close(fd);
+}
+
+TEST_FIXTURE(ControllerServer, ControllerServesSeveralClientsAtOnce) {
+  const int kClients = 8;
+  int fds[kClients];
+  for (int i = 0; i < kClients; i++) {
+    fds[i] = connectClient();
+    CHECK(fds[i] != -1);
+  }
+
+  // each starts a command before any finishes its own, in reverse order
+  for (int i = 0; i < kClients; i++) {
+    sendText(fds[i], i % 2 == 0 ? "get maxF" : "get intervalM");
+  }
+  for (int i = kClients - 1; i >= 0; i--) {
+    sendText(fds[i], i % 2 == 0 ? "rames\n" : "in\nget intervalMax\n");
+  }
+
+  for (int i = 0; i < kClients; i++) {
+    CHECK_EQUAL(i % 2 == 0 ? "42\n" : "3\n7\n", readLines(fds[i], i % 2 == 0 ? 1 : 2));
+    close(fds[i]);
+  }
+}
+
+TEST_FIXTURE(ControllerServer, ControllerRunsTrailingCommandAfterHalfClose) {
+  int fd = connectClient();
+  CHECK(fd != -1);
+
+  sendText(fd, "get intervalMin\nget maxFrames");
+  CHECK_EQUAL(0, shutdown(fd, SHUT_WR));
+
+  // both replies, then the controller closes its side too
+  CHECK_EQUAL("3\n42\n", readLines(fd, 3));
+
+  close(fd);
+}
+
+TEST_FIXTURE(ControllerServer, ControllerKeepsRepliesInOrderAroundWorkerCommands) {
+  int fd = connectClient();
+  int other = connectClient();
+  CHECK(fd != -1);
+  CHECK(other != -1);
+
+  // the gets wait for the sets before them, which run on the worker
+  sendText(fd, "set maxFrames 17\nget maxFrames\nset intervalMin 5\nget intervalMin\n");
+  sendText(other, "get intervalMax\n");
+  CHECK_EQUAL("7\n", readLines(other, 1));
+  CHECK_EQUAL("17\n5\n", readLines(fd, 2));
+
+  // a set left unterminated still runs before the connection is closed
+  sendText(fd, "get maxFrames\nset maxFrames 23");
+  CHECK_EQUAL(0, shutdown(fd, SHUT_WR));
+  CHECK_EQUAL("17\n", readLines(fd, 2));
+  sendText(other, "get maxFrames\n");
+  CHECK_EQUAL("23\n", readLines(other, 1));
+
+  close(fd);
+  close(other);
+}
+
+TEST(ControllerLeavesAFileAtItsSocketPathAlone) {
+  char path[] = "/tmp/controller-XXXXXX";
+  close(mkstemp(path));
+  std::ofstream(path) << "not a socket\n";
+
+  ConfigurationOptions config;
+  config.controlSocket = path;
+  Profiler profiler(NULL, NULL, config, controllerThreads);
+  Controller controller(NULL, NULL, &profiler, config);
+  // nothing to listen on, so this returns straight away
+  controller.serve();
+
+  struct stat info;
+  CHECK_EQUAL(0, lstat(path, &info));
+  CHECK(S_ISREG(info.st_mode));
+  unlink(path);
+}
+
+#endif // TEST_SKIP_PROFILER
+
+#endif // DISABLE_CPP11
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "../../tools/cpp/csv_parser.h"
+
+// The folded lines, a stack and its samples each
+static std::vector<std::string> fold(const std::string &text, int threads, CsvSummary &summary) {
+  FrameDictionary dictionary;
+  StackCounts stacks;
+  parseSamples(text.data(), text.size(), threads, dictionary, stacks, summary);
+
+  char buffer[1 << 16] = {};
+  FILE *out = fmemopen(buffer, sizeof(buffer) - 1, "w");
+  writeFolded(dictionary, stacks, out);
+  fclose(out);
+
+  std::vector<std::string> lines;
+  std::string folded(buffer);
+  size_t at = 0, newline;
+  while ((newline = folded.find('\n', at)) != std::string::npos) {
+    lines.push_back(folded.substr(at, newline - at));
+    at = newline + 1;
+  }
+  return lines;
+}
+
+TEST(FindsBytesInEveryPositionOfABlock) {
+  std::string text(100, 'x');
+  for (size_t i = 0; i < text.size(); i++) {
+    text[i] = ';';
+    CHECK_EQUAL((long) i, (long) (findByte(text.data(), text.data() + text.size(), ';') - text.data()));
+    // not past the end it's given
+    CHECK(findByte(text.data(), text.data() + i, ';') == text.data() + i);
+    text[i] = 'x';
+  }
+  CHECK(findByte(text.data(), text.data() + text.size(), ';') == text.data() + text.size());
+}
+
+TEST(FoldsSampleLinesRootFirst) {
+  std::string text =
+      "main,1000,1,com.acme.Codec.encode;com.acme.Main.run;com.acme.Main.main;end\n"
+      "main,1010,1,com.acme.Codec.encode;com.acme.Main.run;com.acme.Main.main;end\n"
+      "main,1020,1,com.acme.Main.run;com.acme.Main.main;end\n"
+      "#asgct,1020,gcActive=3;end\n"
+      "worker,1030,2,end\n";
+  CsvSummary summary;
+  std::vector<std::string> lines = fold(text, 1, summary);
+
+  CHECK_EQUAL(5, summary.lines);
+  CHECK_EQUAL(4, summary.samples);
+  CHECK_EQUAL(1, summary.skipped);
+  CHECK_EQUAL(3u, lines.size());
+  CHECK_EQUAL("main;com.acme.Main.main;com.acme.Main.run 1", lines[0]);
+  CHECK_EQUAL("main;com.acme.Main.main;com.acme.Main.run;com.acme.Codec.encode 2", lines[1]);
+  CHECK_EQUAL("worker 1", lines[2]);
+}
+
+TEST(TakesCommasInThreadNames) {
+  std::string text = "pool-1, worker 2,1000,17,Foo.bar;end\r\n";
+  CsvSummary summary;
+  std::vector<std::string> lines = fold(text, 1, summary);
+
+  CHECK_EQUAL(1, summary.samples);
+  CHECK_EQUAL(1u, lines.size());
+  CHECK_EQUAL("pool-1, worker 2;Foo.bar 1", lines[0]);
+}
+
+TEST(SkipsLinesStillBeingWritten) {
+  std::string text =
+      "main,1000,1,Foo.bar;end\n"
+      "main,1010,1,Foo.baz;Foo.b";
+  CsvSummary summary;
+  std::vector<std::string> lines = fold(text, 1, summary);
+
+  CHECK_EQUAL(1, summary.samples);
+  CHECK_EQUAL(1, summary.skipped);
+  CHECK_EQUAL(1u, lines.size());
+  CHECK_EQUAL("main;Foo.bar 1", lines[0]);
+}
+
+TEST(FoldsInParallelLikeSequentially) {
+  std::string text;
+  char line[128];
+  for (int i = 0; i < 20000; i++) {
+    snprintf(line, sizeof(line), "thread-%d,%d,%d,Leaf%d.run;Middle%d.call;Root.main;end\n",
+             i % 4, 1000 + i, i % 4, i % 7, i % 3);
+    text.append(line);
+  }
+
+  CsvSummary sequentialSummary, parallelSummary;
+  std::vector<std::string> sequential = fold(text, 1, sequentialSummary);
+  std::vector<std::string> parallel = fold(text, 8, parallelSummary);
+  CHECK_EQUAL(20000, parallelSummary.samples);
+  CHECK_EQUAL(0, parallelSummary.skipped);
+  CHECK_EQUAL(4u * 3 * 7, sequential.size());
+  CHECK(sequential == parallel);
+}
+
+TEST(InternsNamesOnceAcrossThreads) {
+  FrameDictionary dictionary;
+  CHECK_EQUAL(0, dictionary.intern("a", 1));
+  CHECK_EQUAL(1, dictionary.intern("bc", 2));
+  CHECK_EQUAL(0, dictionary.intern("abc", 1));
+  CHECK_EQUAL(2u, dictionary.size());
+
+  std::vector<std::string> names;
+  dictionary.names(names);
+  CHECK_EQUAL("a", names[0]);
+  CHECK_EQUAL("bc", names[1]);
+}
@@ -0,0 +1,92 @@
+#include <sstream>
+#include "test.h"
+#include "../../main/cpp/error_histogram.h"
+
+static JVMPI_CallTrace traceOf(jint numFrames, JVMPI_CallFrame *frames = NULL) {
+  JVMPI_CallTrace trace = {};
+  trace.num_frames = numFrames;
+  trace.frames = frames;
+  return trace;
+}
+
+static long countOf(const ErrorHistogram::Row &row, jint error) {
+  return row.counts[ErrorHistogram::bucketOf(traceOf(error))];
+}
+
+TEST(ErrorHistogramBucketsEveryErrorCode) {
+  JVMPI_CallFrame frames[2] = {};
+  frames[0].lineno = 10;
+  frames[0].method_id = (jmethodID)1;
+  CHECK_EQUAL(kErrorBucketWalked, ErrorHistogram::bucketOf(traceOf(2, frames)));
+  CHECK_EQUAL("walked", ErrorHistogram::bucketName(kErrorBucketWalked));
+
+  CHECK_EQUAL("native", ErrorHistogram::bucketName(ErrorHistogram::bucketOf(traceOf(kNativeStackTrace))));
+  CHECK_EQUAL("gcActive", ErrorHistogram::bucketName(ErrorHistogram::bucketOf(traceOf(kGcTraceError))));
+  CHECK_EQUAL("safepoint", ErrorHistogram::bucketName(ErrorHistogram::bucketOf(traceOf(kSafepoint))));
+  CHECK_EQUAL(kErrorBucketOther, ErrorHistogram::bucketOf(traceOf(-42)));
+
+  // a recovered trace counts under the error it was recovered from
+  frames[0].lineno = kNativeFrameLineNo;
+  frames[1].lineno = kDeoptHandler;
+  CHECK_EQUAL("deopt", ErrorHistogram::bucketName(ErrorHistogram::bucketOf(traceOf(2, frames))));
+}
+
+TEST(ErrorHistogramCountsPerThread) {
+  ErrorHistogram histogram;
+  ThreadBucketPtr first(ThreadBucketPool::instance().acquire(101, 1, "first"));
+  ThreadBucketPtr second(ThreadBucketPool::instance().acquire(102, 2, "second"));
+  ThreadBucketPtr unknown(nullptr);
+
+  JVMPI_CallTrace gc = traceOf(kGcTraceError);
+  JVMPI_CallTrace safepoint = traceOf(kSafepoint);
+  histogram.record(gc, first);
+  histogram.record(gc, first);
+  histogram.record(safepoint, second);
+  histogram.record(safepoint, unknown);
+  first.reset();
+  second.reset();
+
+  ErrorHistogram::Row total;
+  std::vector<ErrorHistogram::Row> threads;
+  histogram.snapshot(total, threads);
+
+  CHECK_EQUAL(4, total.samples());
+  CHECK_EQUAL(2, countOf(total, kGcTraceError));
+  CHECK_EQUAL(2, countOf(total, kSafepoint));
+
+  CHECK_EQUAL(2u, threads.size());
+  for (size_t i = 0; i < threads.size(); i++) {
+    if (threads[i].tid == 101) {
+      CHECK_EQUAL("first", threads[i].name);
+      CHECK_EQUAL(2, countOf(threads[i], kGcTraceError));
+      CHECK_EQUAL(2, threads[i].failures());
+    } else {
+      CHECK_EQUAL(102, threads[i].tid);
+      CHECK_EQUAL("second", threads[i].name);
+      CHECK_EQUAL(1, countOf(threads[i], kSafepoint));
+    }
+  }
+
+  std::ostringstream out;
+  ErrorHistogram::writeCounts(out, total, ';');
+  CHECK_EQUAL("samples=4;gcActive=2;safepoint=2", out.str());
+}
+
+TEST(ErrorHistogramFoldsThreadsBeyondItsCapacity) {
+  ErrorHistogram histogram;
+  JVMPI_CallTrace trace = traceOf(kUnknownState);
+  for (int i = 0; i < kErrorHistogramThreads + 10; i++) {
+    ThreadBucketPtr info(ThreadBucketPool::instance().acquire(1000 + i, i, "worker"));
+    histogram.record(trace, info);
+    info.reset();
+  }
+
+  ErrorHistogram::Row total;
+  std::vector<ErrorHistogram::Row> threads;
+  histogram.snapshot(total, threads);
+
+  CHECK_EQUAL(kErrorHistogramThreads + 10, total.samples());
+  CHECK_EQUAL((size_t) kErrorHistogramThreads + 1, threads.size());
+  CHECK_EQUAL(0, threads.back().tid);
+  CHECK_EQUAL(10, threads.back().samples());
+}
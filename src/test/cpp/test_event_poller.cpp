@@ -0,0 +1,34 @@
+#include <unistd.h>
+#include "test.h"
+#include "../../main/cpp/event_poller.h"
+
+TEST(EventPollerReportsReadableAndWritableDescriptors) {
+  EventPoller poller;
+  CHECK(poller.valid());
+
+  int fds[2];
+  CHECK_EQUAL(0, pipe(fds));
+  CHECK(poller.add(fds[0]));
+  CHECK(poller.add(fds[1]));
+
+  std::vector<PollEvent> events;
+  CHECK_EQUAL(0, poller.wait(events, 0));
+
+  CHECK(poller.modify(fds[1], false, true));
+  CHECK_EQUAL(1, poller.wait(events, 100));
+  CHECK_EQUAL(fds[1], events[0].fd);
+  CHECK(events[0].writable);
+  CHECK(!events[0].readable);
+
+  CHECK_EQUAL(1, (int) write(fds[1], "x", 1));
+  CHECK(poller.modify(fds[1], false, false));
+  CHECK_EQUAL(1, poller.wait(events, 100));
+  CHECK_EQUAL(fds[0], events[0].fd);
+  CHECK(events[0].readable);
+
+  poller.remove(fds[0]);
+  CHECK_EQUAL(0, poller.wait(events, 0));
+
+  close(fds[0]);
+  close(fds[1]);
+}
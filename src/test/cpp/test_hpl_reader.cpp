@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "../../main/cpp/log_writer.h"
+#include "../../tools/cpp/hpl_reader.h"
+
+// A log as the agent writes it: named methods 1 to 4, then traces of two threads
+struct TestLog {
+  std::ostringstream output;
+  LogWriter writer;
+  ThreadBucketPtr main;
+  ThreadBucketPtr worker;
+
+  TestLog() : writer(output, NULL, NULL),
+              main(ThreadBucketPool::instance().acquire(401, 41, "main")),
+              worker(ThreadBucketPool::instance().acquire(402, 42, "worker")) {
+    writer.recordNewMethod(1, "Main.java", "Lcom/acme/Main;", "", "main", "([Ljava/lang/String;)V", "");
+    writer.recordNewMethod(2, "Main.java", "Lcom/acme/Main;", "", "run", "()V", "");
+    writer.recordNewMethod(3, "Codec.java", "Lcom/acme/Codec;", "encode");
+    writer.recordNewMethod(4, "Main.java", "Lcom/acme/Main;", "", "run", "(I)V", "");
+  }
+
+  ~TestLog() {
+    main.reset();
+    worker.reset();
+  }
+
+  // methods given root first, logged leaf first as the agent does
+  void trace(ThreadBucketPtr &thread, const std::vector<method_id> &methods) {
+    timespec ts = {5, 0};
+    writer.recordTraceStart((jint) methods.size(), 0, ts, thread);
+    for (size_t i = methods.size(); i > 0; i--) {
+      writer.recordFrame(7, 70, methods[i - 1]);
+    }
+  }
+
+  void error(ThreadBucketPtr &thread, jint error) {
+    timespec ts = {5, 0};
+    writer.recordTraceStart(error, 0, ts, thread);
+  }
+
+  std::string bytes() { return output.str(); }
+};
+
+static int32_t entryOf(const Profile &profile, uint8_t kind, const std::string &name, const std::string &signature = "") {
+  for (size_t i = 0; i < profile.entries.size(); i++) {
+    const ProfileEntry &entry = profile.entries[i];
+    if (entry.kind == kind && entry.name == name && entry.signature == signature) return (int32_t) i;
+  }
+  return -1;
+}
+
+// The node at the end of a path of entries, -1 if there's none
+static int32_t nodeAt(const Profile &profile, const std::vector<int32_t> &path) {
+  const std::vector<CallTree::Node> &nodes = profile.tree.nodes();
+  int32_t node = 0;
+  for (size_t i = 0; i < path.size() && node >= 0; i++) {
+    int32_t parent = node;
+    node = -1;
+    for (size_t j = 1; j < nodes.size(); j++) {
+      if (nodes[j].parent == parent && nodes[j].key == path[i]) node = (int32_t) j;
+    }
+  }
+  return node;
+}
+
+static bool aggregate(const std::string &log, Profile &profile, LogSummary &summary, int threads = 1) {
+  return aggregateLog(log.data(), log.size(), threads, profile, summary);
+}
+
+TEST(AggregatesLogIntoThreadAndMethodTree) {
+  TestLog log;
+  log.trace(log.main, {1, 2, 3});
+  log.trace(log.main, {1, 2, 3});
+  log.trace(log.main, {1, 2});
+  log.trace(log.worker, {4, 3});
+  log.error(log.worker, -2);
+
+  Profile profile;
+  LogSummary summary;
+  CHECK(aggregate(log.bytes(), profile, summary));
+  CHECK_EQUAL(5, summary.traces);
+  CHECK_EQUAL(4, summary.methods);
+  CHECK_EQUAL(2, summary.threads);
+  CHECK_EQUAL(0u, summary.partialBytes);
+  CHECK_EQUAL(5, profile.tree.samples());
+
+  // threads, then methods by name and signature, then errors
+  CHECK_EQUAL(7u, profile.entries.size());
+  int32_t main = entryOf(profile, ENTRY_THREAD, "main");
+  int32_t worker = entryOf(profile, ENTRY_THREAD, "worker");
+  int32_t encode = entryOf(profile, ENTRY_METHOD, "com.acme.Codec.encode");
+  int32_t mainMethod = entryOf(profile, ENTRY_METHOD, "com.acme.Main.main", "([Ljava/lang/String;)V");
+  int32_t run = entryOf(profile, ENTRY_METHOD, "com.acme.Main.run", "()V");
+  int32_t runInt = entryOf(profile, ENTRY_METHOD, "com.acme.Main.run", "(I)V");
+  int32_t error = entryOf(profile, ENTRY_ERROR, "[asgct error -2]");
+  CHECK_EQUAL(0, main);
+  CHECK_EQUAL(1, worker);
+  CHECK_EQUAL(2, encode);
+  CHECK_EQUAL(3, mainMethod);
+  CHECK_EQUAL(4, run);
+  CHECK_EQUAL(5, runInt);
+  CHECK_EQUAL(6, error);
+
+  const std::vector<CallTree::Node> &nodes = profile.tree.nodes();
+  int32_t leaf = nodeAt(profile, {main, mainMethod, run, encode});
+  CHECK(leaf > 0);
+  CHECK_EQUAL(2, nodes[leaf].self);
+  int32_t middle = nodeAt(profile, {main, mainMethod, run});
+  CHECK_EQUAL(1, nodes[middle].self);
+  CHECK_EQUAL(3, nodes[middle].total);
+  CHECK_EQUAL(3, nodes[nodeAt(profile, {main})].total);
+  CHECK_EQUAL(1, nodes[nodeAt(profile, {worker, error})].self);
+  CHECK_EQUAL(1, nodes[nodeAt(profile, {worker, runInt, encode})].self);
+
+  std::vector<int64_t> self, total;
+  profile.flat(self, total);
+  CHECK_EQUAL(3, self[encode]);
+  CHECK_EQUAL(3, total[encode]);
+  CHECK_EQUAL(0, self[mainMethod]);
+  CHECK_EQUAL(3, total[mainMethod]);
+  CHECK_EQUAL(2, total[worker]);
+}
+
+TEST(CountsRecursiveMethodsOnceTowardsTheirTotal) {
+  TestLog log;
+  log.trace(log.main, {2, 2, 2});
+  log.trace(log.main, {2, 3, 2});
+
+  Profile profile;
+  LogSummary summary;
+  CHECK(aggregate(log.bytes(), profile, summary));
+
+  std::vector<int64_t> self, total;
+  profile.flat(self, total);
+  int32_t run = entryOf(profile, ENTRY_METHOD, "com.acme.Main.run", "()V");
+  CHECK_EQUAL(2, self[run]);
+  CHECK_EQUAL(2, total[run]);
+}
+
+TEST(IgnoresPartialRecordAtTheEndOfTheLog) {
+  TestLog log;
+  log.trace(log.main, {1, 2});
+  log.trace(log.main, {1, 3});
+  std::string bytes = log.bytes();
+  // the last frame of the last trace, minus its last byte
+  bytes.resize(bytes.size() - 1);
+
+  Profile profile;
+  LogSummary summary;
+  CHECK(aggregate(bytes, profile, summary));
+  CHECK_EQUAL(1, summary.traces);
+  CHECK_EQUAL(16u, summary.partialBytes);
+  CHECK_EQUAL(1, profile.tree.samples());
+}
+
+TEST(RejectsWhatIsNotALog) {
+  std::string bytes = "HPROFAGG";
+  Profile profile;
+  LogSummary summary;
+  CHECK(!aggregate(bytes, profile, summary));
+}
+
+TEST(AggregatesEmptyLogIntoEmptyProfile) {
+  Profile profile;
+  LogSummary summary;
+  CHECK(aggregateLog(NULL, 0, 4, profile, summary));
+  CHECK_EQUAL(0, profile.tree.samples());
+  CHECK(profile.entries.empty());
+}
+
+TEST(AggregatesChunksInParallelLikeSequentially) {
+  TestLog log;
+  // a few MB, so that the log is split
+  for (int i = 0; i < 60000; i++) {
+    log.trace(i % 3 == 0 ? log.worker : log.main, {1, (method_id) (2 + i % 3), 3});
+    if (i % 1000 == 0) log.error(log.worker, 0);
+  }
+  std::string bytes = log.bytes();
+
+  Profile sequential, parallel;
+  LogSummary summary;
+  CHECK(aggregate(bytes, sequential, summary, 1));
+  CHECK(aggregate(bytes, parallel, summary, 4));
+  CHECK_EQUAL(60060, summary.traces);
+
+  CHECK(sequential.entries == parallel.entries);
+  std::vector<int64_t> self1, total1, self2, total2;
+  sequential.flat(self1, total1);
+  parallel.flat(self2, total2);
+  CHECK(self1 == self2);
+  CHECK(total1 == total2);
+  CHECK_EQUAL(sequential.tree.nodes().size(), parallel.tree.nodes().size());
+}
+
+static JVMPI_CallFrame stubFrame(const char *name) {
+  JVMPI_CallFrame frame;
+  frame.lineno = kStubFrameLineNo;
+  frame.method_id = (jmethodID) name;
+  return frame;
+}
+
+// What the agent writes now, through the same path hplAggregate reads its log by
+TEST(AggregatesTheSampleLinesLogWriterWrites) {
+  char path[] = "/tmp/hpl-reader-XXXXXX";
+  close(mkstemp(path));
+  {
+    std::ofstream output(path, std::ofstream::out | std::ofstream::binary);
+    LogWriter writer(output, NULL, NULL);
+    ThreadBucketPtr main(ThreadBucketPool::instance().acquire(403, 43, "main"));
+    ThreadBucketPtr worker(ThreadBucketPool::instance().acquire(404, 44, "worker"));
+
+    // leaf first
+    JVMPI_CallFrame frames[] = {stubFrame("vtable stub"), stubFrame("Interpreter"), stubFrame("call_stub")};
+    JVMPI_CallTrace trace = {};
+    trace.frames = frames;
+    trace.num_frames = 3;
+    timespec ts = {5, 0};
+    writer.record(ts, trace, ThreadBucketPtr(main.operator->(), false));
+    writer.record(ts, trace, ThreadBucketPtr(main.operator->(), false));
+    trace.frames = frames + 1;
+    trace.num_frames = 2;
+    writer.record(ts, trace, ThreadBucketPtr(worker.operator->(), false));
+    writer.recordErrors(ts);
+    writer.writeIndex();
+    main.reset();
+    worker.reset();
+  }
+
+  Profile profile;
+  LogSummary summary;
+  CHECK(aggregateLog(path, 2, profile, summary));
+  unlink(path);
+  CHECK_EQUAL(3, summary.traces);
+  CHECK_EQUAL(3, summary.methods);
+  CHECK_EQUAL(2, summary.threads);
+  CHECK_EQUAL(0u, summary.partialBytes);
+  CHECK_EQUAL(3, profile.tree.samples());
+
+  int32_t main = entryOf(profile, ENTRY_THREAD, "main");
+  int32_t worker = entryOf(profile, ENTRY_THREAD, "worker");
+  int32_t callStub = entryOf(profile, ENTRY_METHOD, "[call_stub]");
+  int32_t interpreter = entryOf(profile, ENTRY_METHOD, "[Interpreter]");
+  int32_t vtableStub = entryOf(profile, ENTRY_METHOD, "[vtable stub]");
+  CHECK_EQUAL(5u, profile.entries.size());
+
+  const std::vector<CallTree::Node> &nodes = profile.tree.nodes();
+  int32_t leaf = nodeAt(profile, {main, callStub, interpreter, vtableStub});
+  CHECK(leaf > 0);
+  CHECK_EQUAL(2, nodes[leaf].self);
+  CHECK_EQUAL(1, nodes[nodeAt(profile, {worker, callStub, interpreter})].self);
+}
+
+TEST(TellsSampleLinesFromWhatIsNotALog) {
+  Profile profile;
+  LogSummary summary;
+  std::string lines = "main,5000,43,Leaf.run;Root.main;end\nmain,5001,43,Root.main;en";
+  CHECK(aggregate(lines, profile, summary));
+  CHECK_EQUAL(1, summary.traces);
+  CHECK_EQUAL(25u, summary.partialBytes);
+
+  // a profile file's header, text up to its version
+  std::string header("HPROFAGG,\0\0\0\1", 13);
+  CHECK(!aggregate(header, profile, summary));
+}
+
+TEST(RoundTripsProfilesThroughProfileFiles) {
+  TestLog log;
+  log.trace(log.main, {1, 2, 3});
+  log.trace(log.main, {1, 4});
+  log.trace(log.worker, {2, 2});
+  log.error(log.worker, -5);
+
+  Profile profile;
+  LogSummary summary;
+  CHECK(aggregate(log.bytes(), profile, summary));
+
+  char path[] = "/tmp/hpl-reader-XXXXXX";
+  close(mkstemp(path));
+  CHECK(writeProfile(profile, path));
+
+  ProfileReader reader;
+  CHECK(reader.open(path));
+  CHECK_EQUAL(4, reader.samples());
+  CHECK(reader.entries() == profile.entries);
+  std::vector<int64_t> self, total;
+  profile.flat(self, total);
+  CHECK(reader.self() == self);
+  CHECK(reader.total() == total);
+
+  // threads first, each before its children, which are ordered by entry
+  int32_t entry;
+  int64_t nodeSelf, nodeTotal;
+  CHECK(reader.next(entry, nodeSelf, nodeTotal));
+  CHECK_EQUAL(entryOf(profile, ENTRY_THREAD, "main"), entry);
+  CHECK_EQUAL(2, nodeTotal);
+
+  Profile read;
+  CHECK(readProfile(path, read));
+  CHECK(read.entries == profile.entries);
+  CHECK_EQUAL(profile.tree.nodes().size(), read.tree.nodes().size());
+  std::vector<int64_t> readSelf, readTotal;
+  read.flat(readSelf, readTotal);
+  CHECK(readSelf == self);
+  CHECK(readTotal == total);
+  int32_t leaf = nodeAt(read, {entryOf(read, ENTRY_THREAD, "main"),
+                               entryOf(read, ENTRY_METHOD, "com.acme.Main.main", "([Ljava/lang/String;)V"),
+                               entryOf(read, ENTRY_METHOD, "com.acme.Main.run", "()V"),
+                               entryOf(read, ENTRY_METHOD, "com.acme.Codec.encode")});
+  CHECK(leaf > 0);
+  CHECK_EQUAL(1, read.tree.nodes()[leaf].self);
+  unlink(path);
+}
+
+TEST(RejectsTruncatedProfileFiles) {
+  TestLog log;
+  log.trace(log.main, {1, 2, 3});
+  Profile profile;
+  LogSummary summary;
+  CHECK(aggregate(log.bytes(), profile, summary));
+
+  char path[] = "/tmp/hpl-reader-XXXXXX";
+  close(mkstemp(path));
+  CHECK(writeProfile(profile, path));
+  CHECK_EQUAL(0, truncate(path, 60));
+
+  Profile read;
+  CHECK(!readProfile(path, read));
+  unlink(path);
+}
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "profile_fixtures.h"
+#include "test.h"
+#include "../../main/cpp/log_index.h"
+#include "../../tools/cpp/csv_parser.h"
+
+// A sample a second for ten minutes, from threads 1 to 3 in turn, written as LogWriter does
+static std::string writeTestLog(LogIndex &index, bool finished) {
+  std::ostringstream log;
+  char line[128];
+  for (int i = 0; i < 600; i++) {
+    int64_t millis = 1000000 + i * 1000L;
+    int jid = 1 + i % 3;
+    int length = snprintf(line, sizeof(line), "thread-%d,%lld,%d,Leaf%d.run;Root.main;end\n", jid,
+                          (long long) millis, jid, i % 2);
+    index.addSample(millis, jid, length);
+    log.write(line, length);
+    if (i % 100 == 50) {
+      length = snprintf(line, sizeof(line), "#asgct,%lld,samples=1;walked=1;end\n", (long long) millis);
+      index.add(millis, length);
+      log.write(line, length);
+    }
+  }
+  if (finished) index.write(log);
+  return log.str();
+}
+
+TEST(SplitsLogIntoChunksByTime) {
+  LogIndex index;
+  std::string log = writeTestLog(index, true);
+
+  const std::vector<LogChunk> &chunks = index.chunks();
+  CHECK_EQUAL(20u, chunks.size());
+  CHECK_EQUAL(0, chunks[0].offset);
+  CHECK_EQUAL(1000000, chunks[0].firstMillis);
+  CHECK_EQUAL(1029000, chunks[0].lastMillis);
+  CHECK_EQUAL(30, chunks[0].samples);
+  CHECK_EQUAL(3u, chunks[0].threads.size());
+  CHECK_EQUAL(chunks[0].offset + chunks[0].bytes, chunks[1].offset);
+  CHECK_EQUAL(1030000, chunks[1].firstMillis);
+
+  std::vector<LogChunk> read;
+  size_t linesEnd;
+  CHECK(readLogIndex(log.data(), log.size(), read, linesEnd));
+  CHECK_EQUAL(chunks.size(), read.size());
+  CHECK_EQUAL(chunks.back().offset + chunks.back().bytes, (int64_t) linesEnd);
+  for (size_t i = 0; i < read.size() && i < chunks.size(); i++) {
+    CHECK_EQUAL(chunks[i].offset, read[i].offset);
+    CHECK_EQUAL(chunks[i].bytes, read[i].bytes);
+    CHECK_EQUAL(chunks[i].firstMillis, read[i].firstMillis);
+    CHECK_EQUAL(chunks[i].lastMillis, read[i].lastMillis);
+    CHECK_EQUAL(chunks[i].samples, read[i].samples);
+    CHECK(chunks[i].threads == read[i].threads);
+  }
+}
+
+TEST(ReadsOnlyTheChunksInTheWindow) {
+  LogIndex index;
+  std::string log = writeTestLog(index, true);
+  std::string path = tempPath(log);
+
+  // a minute from the middle of the fourth chunk
+  SampleWindow window = {1100000, 1159000};
+  FrameDictionary dictionary;
+  StackCounts stacks;
+  CsvSummary summary;
+  CHECK(parseSamples(path, 2, dictionary, stacks, summary, window));
+  CHECK_EQUAL(60, summary.samples);
+  CHECK_EQUAL(index.chunks()[3].bytes + index.chunks()[4].bytes + index.chunks()[5].bytes, summary.bytes);
+
+  FrameDictionary all;
+  StackCounts allStacks;
+  CHECK(parseSamples(path, 2, all, allStacks, summary));
+  CHECK_EQUAL(600, summary.samples);
+  CHECK_EQUAL(6, summary.skipped);
+
+  unlink(path.c_str());
+}
+
+TEST(ReadsAllOfALogWithoutAnIndex) {
+  LogIndex index;
+  std::string log = writeTestLog(index, false);
+  std::vector<LogChunk> chunks;
+  size_t linesEnd;
+  CHECK(!readLogIndex(log.data(), log.size(), chunks, linesEnd));
+
+  std::string path = tempPath(log);
+  SampleWindow window = {1100000, 1159000};
+  FrameDictionary dictionary;
+  StackCounts stacks;
+  CsvSummary summary;
+  CHECK(parseSamples(path, 2, dictionary, stacks, summary, window));
+  CHECK_EQUAL(60, summary.samples);
+  CHECK_EQUAL((int64_t) log.size(), summary.bytes);
+
+  unlink(path.c_str());
+}
+
+TEST(IgnoresAnIndexThatDoesNotAddUp) {
+  LogIndex index;
+  std::string log = writeTestLog(index, true);
+  std::vector<LogChunk> chunks;
+  size_t linesEnd;
+
+  std::string cut = log.substr(0, log.size() - 1);
+  CHECK(!readLogIndex(cut.data(), cut.size(), chunks, linesEnd));
+
+  CHECK(readLogIndex(log.data(), log.size(), chunks, linesEnd));
+  std::string corrupt = log;
+  corrupt[linesEnd + sizeof(LOG_CHUNK_LINE) - 1] = 'x';
+  CHECK(!readLogIndex(corrupt.data(), corrupt.size(), chunks, linesEnd));
+  CHECK(chunks.empty());
+}
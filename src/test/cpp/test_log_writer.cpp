@@ -53,7 +53,6 @@ TEST(RecordsStartOfStackTrace) {
   CHECK_EQUAL(44, buffer[cnt+=8]);
   CHECK_EQUAL(55, buffer[cnt+=8]);
 
-  GCHelper::detach(threadInfo->localEpoch);
   done();
 }
 
@@ -43,6 +43,7 @@ void deallocateTestBuffer(void **b, size_t size) {
 
 void mapWriter(AbstractMapProvider &map, void **keys, void **values, std::atomic<void*> *result, size_t size, bool reverse=false) {
 	map::GC::EpochType id = GCHelper::attach();
+	GCHelper::enter(id);
 	for (int i = 0; i < size; i++) {
 		map.put(keys[IDX(reverse, i, size)], values[IDX(reverse, i, size)]);
 	}
@@ -52,6 +53,7 @@ void mapWriter(AbstractMapProvider &map, void **keys, void **values, std::atomic
 
 void mapReader(AbstractMapProvider &map, void **keys, void **values, std::atomic<void*> *result, size_t size, bool reverse=false) {
 	map::GC::EpochType id = GCHelper::attach();
+	GCHelper::enter(id);
 	for (int i = 0; i < size; i++) {
 		void *res = map.get(keys[IDX(reverse, i, size)]);
 		result[IDX(reverse, i, size)].store(res, std::memory_order_relaxed);
@@ -62,6 +64,7 @@ void mapReader(AbstractMapProvider &map, void **keys, void **values, std::atomic
 
 void mapRemover(AbstractMapProvider &map, void **keys, void **values, std::atomic<void*> *result, size_t size, bool reverse=false) {
 	map::GC::EpochType id = GCHelper::attach();
+	GCHelper::enter(id);
 	for (int i = 0; i < size; i++) {
 		void *res = map.remove(keys[IDX(reverse, i, size)]);
 		result[IDX(reverse, i, size)].store(res, std::memory_order_relaxed);
@@ -164,6 +167,10 @@ TEST(LockFreeHashMapSequentialSpec) {
 	int *key2 = new int(1);
 	int *val2 = new int(1);
 	mapWriter(map, (void**)&key2, (void**)&val2, results, 1);
+	// the insert only starts the shrink, readers that can help finish it a few chunks at a time
+	CHECK_EQUAL(val2, map.get(key2));
+	for (int i = 0; i < (1 << 16) && map.capacity() != kSizeMin; i++)
+		mapReader(map, (void**)&key2, (void**)&val2, results, 1);
 	CHECK_EQUAL(kSizeMin, map.capacity());
 	CHECK_EQUAL(1, map.unsafeUsed());
 	CHECK_EQUAL(1, map.unsafeDirty());
@@ -186,12 +193,40 @@ TEST(LockFreeHashMapSequentialSpec) {
 	CONCURRENT_EPILOGUE();
 }
 
+TEST(LockFreeHashMapWritesReturnBeforeMigrationEnds) {
+	CONCURRENT_PROLOGUE_RESIZE(TestLockFreeMap, 10, 11);
+	map::GC::EpochType id = GCHelper::attach();
+	GCHelper::enter(id);
+
+	bool sawMigration = false;
+	for (int i = 0; i < bSize; i++) {
+		map.put(keys[i], values[i]);
+		if (i % 3 == 0)
+			CHECK_EQUAL(values[i], map.remove(keys[i]));
+
+		sawMigration |= map.unsafeMigrating();
+
+		for (int k = std::max(0, i - 64); k <= i; k++)
+			CHECK_EQUAL(k % 3 == 0 ? nullptr : values[k], map.get(keys[k]));
+	}
+	CHECK(sawMigration);
+	CHECK_EQUAL(bSize - (bSize + 2) / 3, map.unsafeUsed());
+
+	mapReader(map, keys, values, results, bSize);
+	for (int i = 0; i < bSize; i++)
+		CHECK_EQUAL(i % 3 == 0 ? nullptr : values[i], results[i].load());
+
+	GCHelper::detach(id);
+	CONCURRENT_EPILOGUE();
+}
+
 TEST(LockFreeHashMapBasicConcurrentChecks) {
 	CONCURRENT_PROLOGUE(TestLockFreeMap, 4);
 
 	void *res;
 
 	map::GC::EpochType id = GCHelper::attach();
+	GCHelper::enter(id);
 
 	mapReader(map, keys, values, results, 1);
 	CHECK_ARRAY_EQUAL(nullarr, results, 1);
@@ -329,6 +364,7 @@ TEST(LockFreeHashMapConcurrentMixedLoad) {
 			int conditionsMet = 0;
 
 			map::GC::EpochType id = GCHelper::attach();
+			GCHelper::enter(id);
 			
 			while (conditionsMet < bSize) {
 				for (int i = 0; i < jobSize; ++i) {
@@ -368,4 +404,149 @@ TEST(LockFreeHashMapConcurrentMixedLoad) {
 	}
 }
 
+static void threadChurn(int rounds) {
+	for (int i = 0; i < rounds; ++i) {
+		map::GC::EpochType id = GCHelper::attach();
+		GCHelper::enter(id);
+		GCHelper::safepoint(id);
+		GCHelper::detach(id);
+	}
+}
+
+TEST(GCReclaimsWhileThreadsAttachAndDetach) {
+	CONCURRENT_PROLOGUE_RESIZE(TestLockFreeMap, 1, 14);
+
+	// registrations race with migrations scheduling garbage
+	std::vector<std::thread> churners;
+	for (int i = 0; i < 8; ++i)
+		churners.push_back(std::thread(threadChurn, 2000));
+
+	REPEAT_OLD_MAP(3) {
+		doParallel(2, mapWriter, map, keys, values, results, bSize);
+		doParallel(2, mapRemover, map, keys, values, results, bSize);
+		mapWriter(map, keys, values, results, 1); // shrinks the table
+		mapRemover(map, keys, values, results, 1);
+	}
+
+	for (size_t i = 0; i < churners.size(); ++i)
+		churners[i].join();
+
+	CHECK_EQUAL(0, map.unsafeUsed());
+#ifdef DEBUG_MAP_GC
+	CHECK_EQUAL(DefaultGC.statsScheduled, DefaultGC.statsRemoved);
+#endif
+
+	CONCURRENT_EPILOGUE();
+}
+
+static std::atomic_int testReclaimed(0);
+
+static void countReclaim(GC::Retired *node) {
+	testReclaimed++;
+	delete node;
+}
+
+static void retireTestNode() {
+	GC::Retired *node = new GC::Retired();
+	node->reclaim = &countReclaim;
+	DefaultGC.retire(node);
+}
+
+TEST(GCReclaimsPastIdleAttachedThreads) {
+	// attached, but never reads nor reaches a safepoint
+	GC::EpochType idle = GCHelper::attach();
+	GC::EpochType reading = GCHelper::attach();
+	GCHelper::enter(reading);
+	int before = testReclaimed.load();
+
+	retireTestNode();
+	DefaultGC.collect();
+	CHECK_EQUAL(before, testReclaimed.load()); // the reader may still reach it
+	GCHelper::exit(reading);
+	DefaultGC.collect();
+	CHECK_EQUAL(before + 1, testReclaimed.load());
+
+	{
+		GCHelper::Section section;
+		retireTestNode();
+		DefaultGC.collect();
+		CHECK_EQUAL(before + 1, testReclaimed.load());
+	}
+	DefaultGC.collect();
+	CHECK_EQUAL(before + 2, testReclaimed.load());
+
+	GCHelper::detach(reading);
+	GCHelper::detach(idle);
+}
+
+TEST(GCSectionsNestOnTheThreadsOwnSlot) {
+	GCHelper::attachCurrentThread();
+	CHECK(currentGCSlot != GC::kEpochInitial);
+	int before = testReclaimed.load();
+
+	{
+		GCHelper::Section outer;
+		{
+			// as a signal handler reading the map would, inside the thread's own section
+			GCHelper::Section inner;
+			retireTestNode();
+		}
+		DefaultGC.collect();
+		CHECK_EQUAL(before, testReclaimed.load()); // the outer section may still reach it
+	}
+	DefaultGC.collect();
+	CHECK_EQUAL(before + 1, testReclaimed.load());
+
+	GCHelper::detachCurrentThread();
+	CHECK(currentGCSlot == GC::kEpochInitial);
+}
+
+struct IntKeyHasher {
+	static int64_t hash(int key) {
+		return (uint32_t)key;
+	}
+};
+
+typedef ConcurrentMap<int, int, IntKeyHasher> TestTypedMap;
+
+TEST(TypedMapRoundTripsReservedWords) {
+	TestTypedMap map(kSizeMin);
+	int value = 42;
+
+	// 0 and -1 are the empty and move markers of the untyped map
+	CHECK(!map.put(0, 0));
+	CHECK(!map.put(-1, -1));
+	CHECK(!map.find(1, value));
+	CHECK_EQUAL(42, value);
+
+	CHECK(map.find(0, value));
+	CHECK_EQUAL(0, value);
+	CHECK(map.find(-1, value));
+	CHECK_EQUAL(-1, value);
+
+	int previous = 42;
+	CHECK(map.put(-1, 7, &previous));
+	CHECK_EQUAL(-1, previous);
+	CHECK(map.remove(0, &previous));
+	CHECK_EQUAL(0, previous);
+	CHECK(!map.contains(0));
+	CHECK(!map.remove(0));
+	CHECK_EQUAL(1, map.unsafeUsed());
+}
+
+TEST(TypedMapFindsEveryKeyAcrossMigrations) {
+	TestTypedMap map(kSizeMin);
+	const int size = 4096;
+	for (int i = 0; i < size; ++i)
+		map.put(i, size - i);
+
+	CHECK(map.capacity() > kSizeMin);
+	int value;
+	for (int i = 0; i < size; ++i) {
+		CHECK(map.find(i, value));
+		CHECK_EQUAL(size - i, value);
+	}
+	CHECK_EQUAL(size, map.unsafeUsed());
+}
+
 #endif
\ No newline at end of file
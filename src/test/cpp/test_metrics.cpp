@@ -0,0 +1,59 @@
+#include <sstream>
+#include "fixtures.h"
+#include "test.h"
+#include "../../main/cpp/metrics.h"
+
+static uint64_t value(const std::string &exposition, const std::string &name) {
+  std::string key = "\nhonest_profiler_" + name + " ";
+  size_t at = exposition.find(key);
+  if (at == std::string::npos) return (uint64_t) -1;
+  return strtoull(exposition.c_str() + at + key.size(), NULL, 10);
+}
+
+static std::string exposition() {
+  std::ostringstream out;
+  Metrics.write(out);
+  return out.str();
+}
+
+TEST_FIXTURE(GivenQueue, MetricsCountQueueTraffic) {
+  JVMPI_CallFrame frames[2] = {};
+  frames[0].lineno = 52;
+  frames[0].method_id = (jmethodID)1;
+  frames[1].lineno = 25;
+  frames[1].method_id = (jmethodID)2;
+  JVMPI_CallTrace trace = {};
+  trace.env_id = (JNIEnv *)5;
+  trace.num_frames = 2;
+  trace.frames = frames;
+
+  std::string before = exposition();
+  CHECK(queue.push(trace));
+  CHECK(queue.push(trace));
+  CHECK(pop(5));
+  CHECK(pop(5));
+  std::string after = exposition();
+
+  CHECK_EQUAL(2u, value(after, "queue_pushes_total") - value(before, "queue_pushes_total"));
+  CHECK_EQUAL(2u, value(after, "samples_total") - value(before, "samples_total"));
+  CHECK(value(after, "queue_high_water") >= 2);
+  CHECK(after.find("# TYPE honest_profiler_queue_drops_total counter\n") != std::string::npos);
+  CHECK(after.find("honest_profiler_asgct_samples_total{outcome=\"walked\"} ") != std::string::npos);
+}
+
+TEST(MetricsSamplesPerSecondCoversTheLastFullSecond) {
+  ProfilerMetrics metrics{};
+  metrics.popped(100, 1);
+  metrics.popped(100, 3);
+  metrics.popped(100, 2);
+  CHECK_EQUAL(0u, metrics.samplesLastSecond.load());
+
+  metrics.popped(101, 1);
+  CHECK_EQUAL(3u, metrics.samplesLastSecond.load());
+  CHECK_EQUAL(3u, metrics.queueHighWater.load());
+  CHECK_EQUAL(4u, metrics.samples.load());
+
+  // nothing was popped during 102
+  metrics.popped(103, 1);
+  CHECK_EQUAL(0u, metrics.samplesLastSecond.load());
+}
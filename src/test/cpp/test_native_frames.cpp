@@ -0,0 +1,78 @@
+#include "test.h"
+#include "../../main/cpp/native_frames.h"
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+
+#include <ucontext.h>
+
+static std::string symbolAt(const JVMPI_CallFrame &frame) {
+  return NativeSymbolizer::instance().name((uintptr_t) frame.method_id);
+}
+
+static bool anyFrameIn(JVMPI_CallFrame *frames, int count, const char *function) {
+  for (int i = 0; i < count; i++) {
+    if (symbolAt(frames[i]).find(function) != std::string::npos) return true;
+  }
+  return false;
+}
+
+static int __attribute__((noinline)) nativeFramesInner(JVMPI_CallFrame *frames, int maxFrames) {
+  ucontext_t context;
+  getcontext(&context);
+  return NativeUnwinder::unwind(&context, frames, maxFrames);
+}
+
+static int __attribute__((noinline)) nativeFramesOuter(JVMPI_CallFrame *frames, int maxFrames) {
+  int count = nativeFramesInner(frames, maxFrames);
+  // keeps the call above from turning into a tail call
+  asm volatile("" ::: "memory");
+  return count;
+}
+
+TEST(NativeUnwinderWalksFramePointers) {
+  CHECK(NativeUnwinder::available());
+
+  JVMPI_CallFrame frames[64] = {};
+  int count = nativeFramesOuter(frames, 64);
+
+  CHECK(count >= 3);
+  for (int i = 0; i < count; i++) {
+    CHECK_EQUAL(kNativeFrameLineNo, frames[i].lineno);
+  }
+  CHECK(symbolAt(frames[0]).find("nativeFramesInner") != std::string::npos);
+  CHECK(anyFrameIn(frames, count, "nativeFramesOuter"));
+}
+
+TEST(NativeUnwinderStopsAtMaxFrames) {
+  JVMPI_CallFrame frames[64] = {};
+  CHECK_EQUAL(2, nativeFramesOuter(frames, 2));
+  CHECK(frames[2].method_id == NULL);
+  CHECK_EQUAL(0, nativeFramesOuter(frames, 0));
+}
+
+TEST(NativeUnwinderStopsAtABrokenChain) {
+  ucontext_t context;
+  getcontext(&context);
+#if defined(__x86_64__)
+  context.uc_mcontext.gregs[REG_RBP] = 0x10;
+#else
+  context.uc_mcontext.regs[29] = 0x10;
+#endif
+
+  JVMPI_CallFrame frames[8] = {};
+  // the interrupted pc only, the frame pointer is below the stack pointer
+  CHECK_EQUAL(1, NativeUnwinder::unwind(&context, frames, 8));
+}
+
+TEST(NativeSymbolizerNamesModuleAndSymbol) {
+  std::string name = NativeSymbolizer::instance().name((uintptr_t) &nativeFramesOuter);
+  CHECK(name.find("`") != std::string::npos);
+  CHECK(name.find("nativeFramesOuter") != std::string::npos);
+  CHECK_EQUAL(name, NativeSymbolizer::instance().name((uintptr_t) &nativeFramesOuter));
+}
+
+TEST(NativeSymbolizerFallsBackToTheAddress) {
+  CHECK_EQUAL("[native 0x10]", NativeSymbolizer::instance().name(0x10));
+}
+
+#endif
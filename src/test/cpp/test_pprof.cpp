@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <map>
+#include <zlib.h>
+#include "test.h"
+#include "../../main/cpp/pprof.h"
+
+// Just enough of a protobuf reader to look at the top level fields of a profile
+struct ProtoReader {
+  const std::string &data;
+  size_t at;
+
+  explicit ProtoReader(const std::string &d) : data(d), at(0) {}
+
+  uint64_t varint() {
+    uint64_t value = 0;
+    for (int shift = 0; at < data.size(); shift += 7) {
+      unsigned char byte = data[at++];
+      value |= (uint64_t)(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) break;
+    }
+    return value;
+  }
+
+  // field number to its varints or length delimited payloads, in order
+  void fields(std::multimap<int, std::string> &bytes, std::multimap<int, uint64_t> &varints) {
+    while (at < data.size()) {
+      uint64_t tag = varint();
+      if ((tag & 7) == 0) {
+        varints.insert(std::make_pair((int)(tag >> 3), varint()));
+      } else {
+        size_t length = varint();
+        bytes.insert(std::make_pair((int)(tag >> 3), data.substr(at, length)));
+        at += length;
+      }
+    }
+  }
+};
+
+static WindowStack stackOf(const char *thread, const char *root, const char *leaf, long samples) {
+  WindowStack stack;
+  stack.thread = thread;
+  stack.frames.push_back(root);
+  stack.frames.push_back(leaf);
+  stack.samples = samples;
+  return stack;
+}
+
+TEST(PprofProfileHoldsTablesAndSamples) {
+  std::vector<WindowStack> stacks;
+  stacks.push_back(stackOf("main", "Main.run", "Foo.bar", 3));
+  stacks.push_back(stackOf("worker", "Main.run", "Foo.baz", 2));
+
+  std::string profile = pprofProfile(stacks, 1, 1000, 1060, 10000000);
+  std::multimap<int, std::string> bytes;
+  std::multimap<int, uint64_t> varints;
+  ProtoReader(profile).fields(bytes, varints);
+
+  CHECK_EQUAL(2u, bytes.count(1));  // sample types
+  CHECK_EQUAL(3u, bytes.count(2));  // samples, the truncated one included
+  CHECK_EQUAL(4u, bytes.count(4));  // locations
+  CHECK_EQUAL(4u, bytes.count(5));  // functions
+
+  std::vector<std::string> strings;
+  for (auto it = bytes.lower_bound(6); it != bytes.upper_bound(6); ++it) strings.push_back(it->second);
+  CHECK_EQUAL("", strings[0]);
+  CHECK(std::find(strings.begin(), strings.end(), "Foo.baz") != strings.end());
+  CHECK(std::find(strings.begin(), strings.end(), "thread") != strings.end());
+  CHECK(std::find(strings.begin(), strings.end(), "[truncated]") != strings.end());
+
+  CHECK_EQUAL(1000000000000ULL, varints.find(9)->second);
+  CHECK_EQUAL(60000000000ULL, varints.find(10)->second);
+  CHECK_EQUAL(10000000ULL, varints.find(12)->second);
+
+  // the first sample: leaf first locations, then a count and its CPU time
+  std::multimap<int, std::string> sampleBytes;
+  std::multimap<int, uint64_t> sampleVarints;
+  ProtoReader(bytes.find(2)->second).fields(sampleBytes, sampleVarints);
+  std::string locations = sampleBytes.find(1)->second;
+  CHECK_EQUAL(2u, locations.size());
+  CHECK_EQUAL(1, (int) locations[0]);
+  CHECK_EQUAL(2, (int) locations[1]);
+  std::string values = sampleBytes.find(2)->second;
+  ProtoReader valueReader(values);
+  CHECK_EQUAL(3u, valueReader.varint());
+  CHECK_EQUAL(30000000u, valueReader.varint());
+  CHECK_EQUAL(1u, sampleBytes.count(3));
+}
+
+TEST(GzipCompressRoundTrips) {
+  std::string in(10000, 'a');
+  std::string out;
+  CHECK(gzipCompress(in, out));
+  CHECK(out.size() < in.size());
+  CHECK_EQUAL(0x1f, (unsigned char) out[0]);
+  CHECK_EQUAL(0x8b, (unsigned char) out[1]);
+
+  z_stream stream = {};
+  CHECK_EQUAL(Z_OK, inflateInit2(&stream, 15 + 16));
+  std::string back(in.size(), '\0');
+  stream.next_in = (Bytef *) out.data();
+  stream.avail_in = out.size();
+  stream.next_out = (Bytef *) &back[0];
+  stream.avail_out = back.size();
+  CHECK_EQUAL(Z_STREAM_END, inflate(&stream, Z_FINISH));
+  inflateEnd(&stream);
+  CHECK(back == in);
+}
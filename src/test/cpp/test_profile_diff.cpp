@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include "profile_fixtures.h"
+#include "test.h"
+#include "../../tools/cpp/profile.h"
+#include "../../tools/cpp/profile_diff.h"
+
+// The diff's nodes in preorder, as path base-self/base-total changed-self/changed-total
+static void readTree(DiffReader &reader, const std::string &prefix, std::vector<std::string> &nodes) {
+  int32_t entry;
+  DiffCounts counts;
+  while (reader.next(entry, counts)) {
+    std::string path = prefix + "/" + reader.entries()[entry].name;
+    char node[256];
+    snprintf(node, sizeof(node), "%s %lld/%lld %lld/%lld", path.c_str(),
+             (long long) counts.baseSelf, (long long) counts.baseTotal,
+             (long long) counts.changedSelf, (long long) counts.changedTotal);
+    nodes.push_back(node);
+    readTree(reader, path, nodes);
+  }
+}
+
+struct DiffFixture {
+  std::string base;
+  std::string changed;
+  std::string output;
+
+  DiffFixture() {
+    base = writeTestProfile({{{"main", "a", "b"}, 2}, {{"main", "c"}, 2}});
+    changed = writeTestProfile({{{"main", "a", "b"}, 1}, {{"main", "a", "d"}, 3}, {{"worker", "c"}, 1}});
+    output = tempPath();
+  }
+
+  ~DiffFixture() {
+    unlink(base.c_str());
+    unlink(changed.c_str());
+    unlink(output.c_str());
+  }
+};
+
+TEST(ScoresChangesInShareOfSamples) {
+  CHECK_CLOSE(2.8868, significance(50, 100, 70, 100), 0.001);
+  CHECK_CLOSE(-2.8868, significance(70, 100, 50, 100), 0.001);
+  CHECK_EQUAL(0.0, significance(30, 100, 300, 1000));
+  CHECK_EQUAL(0.0, significance(0, 100, 0, 100));
+  CHECK_EQUAL(0.0, significance(0, 0, 5, 10));
+}
+
+TEST_FIXTURE(DiffFixture, AlignsTreesByFrameIdentity) {
+  CHECK(diffProfiles(base, changed, output));
+
+  DiffReader reader;
+  CHECK(reader.open(output));
+  CHECK_EQUAL(4, reader.baseSamples());
+  CHECK_EQUAL(5, reader.changedSamples());
+  CHECK_EQUAL(6u, reader.entries().size());
+
+  std::vector<std::string> nodes;
+  readTree(reader, "", nodes);
+  CHECK(!reader.failed());
+  std::vector<std::string> expected = {
+    "/main 0/4 0/4",
+    "/main/a 0/2 0/4",
+    "/main/a/b 2/2 1/1",
+    "/main/a/d 0/0 3/3",
+    "/main/c 2/2 0/0",
+    "/worker 0/0 0/1",
+    "/worker/c 0/0 1/1"
+  };
+  CHECK_EQUAL(expected.size(), nodes.size());
+  for (size_t i = 0; i < expected.size() && i < nodes.size(); i++) {
+    CHECK_EQUAL(expected[i], nodes[i]);
+  }
+
+  const std::vector<ProfileEntry> &entries = reader.entries();
+  int32_t c = std::lower_bound(entries.begin(), entries.end(), entryOf(ENTRY_METHOD, "c")) - entries.begin();
+  const DiffCounts &flat = reader.flat()[c];
+  CHECK_EQUAL(2, flat.baseTotal);
+  CHECK_EQUAL(1, flat.changedTotal);
+  CHECK_CLOSE(significance(2, 4, 1, 5), flat.totalScore, 0.0001);
+  CHECK(flat.totalScore < 0);
+}
+
+TEST_FIXTURE(DiffFixture, LeavesOutSubtreesBelowMinimumOnBothSides) {
+  CHECK(diffProfiles(base, changed, output, 3));
+
+  DiffReader reader;
+  CHECK(reader.open(output));
+  std::vector<std::string> nodes;
+  readTree(reader, "", nodes);
+  CHECK(!reader.failed());
+  CHECK_EQUAL(3u, nodes.size());
+  CHECK_EQUAL("/main 0/4 0/4", nodes[0]);
+  CHECK_EQUAL("/main/a 0/2 0/4", nodes[1]);
+  CHECK_EQUAL("/main/a/d 0/0 3/3", nodes[2]);
+  // the flat profile is complete
+  CHECK_EQUAL(6u, reader.flat().size());
+}
+
+TEST(RejectsDiffOfWhatIsNotAProfile) {
+  std::string base = writeTestProfile({{{"main", "a"}, 1}});
+  std::string notProfile = tempPath();
+  std::string output = tempPath();
+  CHECK(!diffProfiles(base, notProfile, output));
+
+  unlink(base.c_str());
+  unlink(notProfile.c_str());
+  unlink(output.c_str());
+}
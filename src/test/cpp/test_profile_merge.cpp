@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "profile_fixtures.h"
+#include "test.h"
+#include "../../tools/cpp/profile.h"
+#include "../../tools/cpp/profile_merge.h"
+
+// The node at the end of a stack, -1 if there's none
+static int32_t nodeAt(const Profile &profile, const Stack &stack) {
+  const std::vector<CallTree::Node> &nodes = profile.tree.nodes();
+  int32_t node = 0;
+  for (size_t i = 0; i < stack.size() && node >= 0; i++) {
+    ProfileEntry entry = entryOf(i == 0 ? ENTRY_THREAD : ENTRY_METHOD, stack[i]);
+    int32_t parent = node;
+    node = -1;
+    for (size_t j = 1; j < nodes.size(); j++) {
+      if (nodes[j].parent == parent && profile.entries[nodes[j].key] == entry) node = (int32_t) j;
+    }
+  }
+  return node;
+}
+
+static std::string contents(const std::string &path) {
+  std::ifstream in(path.c_str(), std::ios::binary);
+  std::stringstream out;
+  out << in.rdbuf();
+  return out.str();
+}
+
+static void removeAll(const std::vector<std::string> &paths) {
+  for (size_t i = 0; i < paths.size(); i++) {
+    unlink(paths[i].c_str());
+  }
+}
+
+TEST(MergesProfilesMatchingMethodsByName) {
+  std::vector<std::string> inputs;
+  inputs.push_back(writeTestProfile({{{"main", "a", "b"}, 2}, {{"main", "a"}, 1}}));
+  inputs.push_back(writeTestProfile({{{"main", "a", "b"}, 1}, {{"main", "c"}, 3}, {{"worker", "b"}, 1}}));
+  std::string output = tempPath();
+
+  CHECK(mergeProfiles(inputs, output));
+  Profile merged;
+  CHECK(readProfile(output, merged));
+
+  CHECK_EQUAL(8, merged.tree.samples());
+  CHECK_EQUAL(5u, merged.entries.size());
+  CHECK(std::is_sorted(merged.entries.begin(), merged.entries.end()));
+
+  const std::vector<CallTree::Node> &nodes = merged.tree.nodes();
+  CHECK_EQUAL(3, nodes[nodeAt(merged, {"main", "a", "b"})].self);
+  CHECK_EQUAL(1, nodes[nodeAt(merged, {"main", "a"})].self);
+  CHECK_EQUAL(4, nodes[nodeAt(merged, {"main", "a"})].total);
+  CHECK_EQUAL(3, nodes[nodeAt(merged, {"main", "c"})].self);
+  CHECK_EQUAL(1, nodes[nodeAt(merged, {"worker", "b"})].self);
+  CHECK_EQUAL(7, nodes[nodeAt(merged, {"main"})].total);
+
+  ProfileReader reader;
+  CHECK(reader.open(output));
+  int32_t b = std::lower_bound(merged.entries.begin(), merged.entries.end(), entryOf(ENTRY_METHOD, "b")) - merged.entries.begin();
+  CHECK_EQUAL(4, reader.self()[b]);
+  CHECK_EQUAL(4, reader.total()[b]);
+
+  removeAll(inputs);
+  unlink(output.c_str());
+}
+
+TEST(MergesInRoundsLikeAtOnce) {
+  std::vector<std::string> inputs;
+  for (int i = 0; i < 7; i++) {
+    std::string thread = i % 2 == 0 ? "main" : "worker";
+    std::string method = std::string(1, (char) ('a' + i));
+    inputs.push_back(writeTestProfile({{{thread, "run", method}, i + 1}, {{thread, "run"}, 1}, {{"gc", method}, 2}}));
+  }
+  std::string atOnce = tempPath();
+  std::string inRounds = tempPath();
+
+  CHECK(mergeProfiles(inputs, atOnce));
+  CHECK(mergeProfiles(inputs, inRounds, 3, 2));
+  CHECK(contents(atOnce) == contents(inRounds));
+  // the rounds clean up after themselves
+  CHECK(access((inRounds + ".merge-0-0").c_str(), F_OK) != 0);
+  CHECK(access((inRounds + ".merge-1-0").c_str(), F_OK) != 0);
+
+  Profile merged;
+  CHECK(readProfile(inRounds, merged));
+  CHECK_EQUAL(1 + 2 + 3 + 4 + 5 + 6 + 7 + 7 + 14, merged.tree.samples());
+  // inputs 1, 3 and 5
+  CHECK_EQUAL(3 + 5 + 7, merged.tree.nodes()[nodeAt(merged, {"worker", "run"})].total);
+
+  removeAll(inputs);
+  unlink(atOnce.c_str());
+  unlink(inRounds.c_str());
+}
+
+TEST(RejectsTruncatedInputs) {
+  std::vector<std::string> inputs;
+  inputs.push_back(writeTestProfile({{{"main", "a", "b"}, 2}}));
+  inputs.push_back(writeTestProfile({{{"main", "a", "b"}, 1}, {{"main", "c"}, 3}}));
+  std::ifstream in(inputs[1].c_str(), std::ios::binary | std::ios::ate);
+  CHECK_EQUAL(0, truncate(inputs[1].c_str(), (off_t) in.tellg() - 6));
+  std::string output = tempPath();
+
+  CHECK(!mergeProfiles(inputs, output));
+
+  removeAll(inputs);
+  unlink(output.c_str());
+}
@@ -2,6 +2,10 @@
 
 #ifndef DISABLE_CPP11
 
+#include <atomic>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <thread>
 #include <vector>
 #include <iostream>
@@ -58,7 +62,7 @@ TEST_FIXTURE(ProfilerControl, ProfilerChangeSettings) {
 	int newSamplingIntervalMax = 17;
 	int newMaxFramesToCapture = 225;
 	char *newFilePath1 = (char*)"/dev/null";
-	char *newFilePath2 = (char*)"/dev/sda";
+	char *newFilePath2 = (char*)"profiler-live.hpl";
 
 	// modify settings
 	CHECK(!profiler->isRunning());
@@ -97,9 +101,10 @@ TEST_FIXTURE(ProfilerControl, ProfilerChangeSettings) {
 	CHECK_EQUAL(newMaxFramesToCapture, profiler->getMaxFramesToCapture());
 	CHECK_EQUAL(newFilePath1, profiler->getFilePath());
 
-	// no changes allowed when profiler is running
+	// changes are applied while the profiler keeps running
 	profiler->setFilePath(newFilePath2);
-	CHECK_EQUAL(std::string(newFilePath1), profiler->getFilePath());
+	CHECK_EQUAL(std::string(newFilePath2), profiler->getFilePath());
+	CHECK(profiler->isRunning());
 
 	// set 2 values in a row (valgrind: check that memory is reclaimed)
 	profiler->stop();
@@ -115,6 +120,87 @@ TEST_FIXTURE(ProfilerControl, ProfilerChangeSettings) {
 	CHECK(profiler->getMaxFramesToCapture() > 0);
 
 	profiler->stop();
+	remove(newFilePath2);
+}
+
+TEST_FIXTURE(ProfilerControl, ProfilerLiveReconfiguration) {
+	profiler->setFilePath((char*)"/dev/null");
+	CHECK(profiler->start(NULL));
+
+#ifdef ENABLE_TRACING
+	int prevOk = Trace_Profiler[kTraceProfilerReconfigureOk].count.load();
+	int prevStop = Trace_Processor[kTraceProcessorStop].count.load();
+#endif
+
+	profiler->setSamplingInterval(3, 7);
+	profiler->setMaxFramesToCapture(64);
+	profiler->setThreadFilter((char*)"main:worker-");
+
+	CHECK(profiler->isRunning());
+	CHECK_EQUAL(3, profiler->getSamplingIntervalMin());
+	CHECK_EQUAL(7, profiler->getSamplingIntervalMax());
+	CHECK_EQUAL(64, profiler->getMaxFramesToCapture());
+	CHECK_EQUAL(std::string("main:worker-"), profiler->getThreadFilter());
+
+#ifdef ENABLE_TRACING
+	// every change swaps in a new processor, none of them stops sampling
+	CHECK_EQUAL(prevOk + 3, Trace_Profiler[kTraceProfilerReconfigureOk].count.load());
+	CHECK_EQUAL(prevStop, Trace_Processor[kTraceProcessorStop].count.load());
+#endif
+
+	profiler->setThreadFilter(NULL);
+	CHECK_EQUAL(std::string(""), profiler->getThreadFilter());
+
+	profiler->stop();
+	CHECK(!profiler->isRunning());
+}
+
+TEST_FIXTURE(ProfilerControl, ProfilerReleaseRebuildsOnNextStart) {
+	std::string generated = profiler->getFilePath();
+	CHECK(profiler->start(NULL));
+
+	profiler->release();
+	CHECK(!profiler->isRunning());
+	profiler->release(); // nothing left to free
+
+	// a made up log path is made up afresh, the first log isn't truncated
+	std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	CHECK(profiler->start(NULL));
+	CHECK(profiler->isRunning());
+	CHECK(generated != profiler->getFilePath());
+
+	profiler->setFilePath((char*)"/dev/null");
+	profiler->release();
+	CHECK(profiler->start(NULL));
+	CHECK_EQUAL(std::string("/dev/null"), profiler->getFilePath());
+
+	profiler->stop();
+	CHECK(!profiler->isRunning());
+}
+
+// The in process reader takes every sample, a log path change mustn't open a writer beside it
+TEST(ProfilerInReaderModeKeepsOffTheLogPath) {
+	char first[] = "/tmp/reader-log-XXXXXX";
+	close(mkstemp(first));
+	unlink(first);
+	std::string second = std::string(first) + "-moved";
+
+	ConfigurationOptions config;
+	config.asgctReader = true;
+	config.logFilePath = first;
+	Profiler *profiler = new Profiler(NULL, NULL, config, threadMap);
+	setProfiler(profiler);
+	CHECK(profiler->reader() != NULL);
+
+	CHECK(profiler->start(NULL));
+	profiler->setFilePath((char*)second.c_str());
+	CHECK(profiler->isRunning());
+	CHECK_EQUAL(second, profiler->getFilePath());
+	profiler->stop();
+
+	CHECK(access(first, F_OK) != 0);
+	CHECK(access(second.c_str(), F_OK) != 0);
+	delete profiler;
 }
 
 TEST_FIXTURE(ProfilerControl, ProfilerConcurrentStartStop) {
@@ -151,6 +237,40 @@ TEST_FIXTURE(ProfilerControl, ProfilerConcurrentStartStop) {
 	}
 }
 
+static void raiseSigprofUntil(std::atomic_bool *done, std::atomic_long *raised) {
+	while (!done->load()) {
+		raise(SIGPROF);
+		raised->fetch_add(1);
+	}
+}
+
+// retired processors are freed while handlers keep reading the published one
+TEST_FIXTURE(ProfilerControl, ProfilerReconfiguresWhileSignalsFire) {
+	profiler->setFilePath((char*)"/dev/null");
+	CHECK(profiler->start(NULL));
+
+	std::atomic_bool done(false);
+	std::atomic_long raised(0);
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 4; i++) {
+		threads.push_back(std::thread(&raiseSigprofUntil, &done, &raised));
+	}
+
+	for (int it = 0; it < 200; it++) {
+		profiler->setSamplingInterval(1 + it % 5, 10);
+		CHECK(profiler->isRunning());
+	}
+
+	done.store(true);
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+	CHECK(raised.load() > 0);
+
+	profiler->stop();
+	CHECK(!profiler->isRunning());
+}
+
 TEST_FIXTURE(ProfilerControl, ProfilerConcurrentModification) {
 	void (Profiler::*setFoo)(int) = &Profiler::setMaxFramesToCapture;
 	const int tsize = 4;
@@ -0,0 +1,117 @@
+#include <sstream>
+#include "test.h"
+#include "../../main/cpp/rolling_window.h"
+
+#define givenWindowTrace(first, second)                                        \
+  JVMPI_CallFrame frames[2] = {};                                              \
+  frames[0].method_id = (jmethodID)first;                                      \
+  frames[1].method_id = (jmethodID)second;                                     \
+                                                                               \
+  JVMPI_CallTrace trace = {};                                                  \
+  trace.num_frames = 2;                                                        \
+  trace.frames = frames;
+
+static timespec at(time_t seconds) {
+  timespec ts = {};
+  ts.tv_sec = seconds;
+  return ts;
+}
+
+static std::string dumpOf(RollingWindow &window, time_t from, time_t to, long expectedSamples) {
+  std::ostringstream out;
+  CHECK_EQUAL(expectedSamples, window.dump(out, from, to));
+  return out.str();
+}
+
+TEST(RollingWindowAggregatesIdenticalStacks) {
+  RollingWindow window(NULL, 4, 10, 16);
+  givenWindowTrace(0x1, 0x2);
+
+  window.record(at(1000), trace);
+  window.record(at(1001), trace);
+  window.record(at(1009), trace);
+
+  // root frame first
+  CHECK_EQUAL("[unknown thread];0x2;0x1 3\n", dumpOf(window, 1000, 1009, 3));
+}
+
+TEST(RollingWindowDumpsOnlyTheRequestedRange) {
+  RollingWindow window(NULL, 4, 10, 16);
+  givenWindowTrace(0x1, 0x2);
+  window.record(at(1000), trace);
+  frames[1].method_id = (jmethodID)0x3;
+  window.record(at(1020), trace);
+  window.record(at(1025), trace);
+
+  CHECK_EQUAL("[unknown thread];0x2;0x1 1\n", dumpOf(window, 1000, 1009, 1));
+  CHECK_EQUAL("[unknown thread];0x3;0x1 2\n", dumpOf(window, 1015, 1030, 2));
+  CHECK_EQUAL("[unknown thread];0x2;0x1 1\n[unknown thread];0x3;0x1 2\n", dumpOf(window, 0, 2000, 3));
+  CHECK_EQUAL("", dumpOf(window, 1040, 1050, 0));
+}
+
+TEST(RollingWindowForgetsBucketsThatRotatedOut) {
+  RollingWindow window(NULL, 2, 10, 16);
+  givenWindowTrace(0x1, 0x2);
+
+  window.record(at(1000), trace);
+  window.record(at(1010), trace);
+  // reuses the slot of the bucket starting at 1000
+  window.record(at(1020), trace);
+
+  CHECK_EQUAL("", dumpOf(window, 1000, 1009, 0));
+  CHECK_EQUAL("[unknown thread];0x2;0x1 2\n", dumpOf(window, 1000, 1029, 2));
+}
+
+TEST(RollingWindowCountsStacksBeyondItsCapacity) {
+  RollingWindow window(NULL, 1, 10, 1);
+  givenWindowTrace(0x1, 0x2);
+
+  window.record(at(1000), trace);
+  frames[0].method_id = (jmethodID)0x5;
+  window.record(at(1001), trace);
+  window.record(at(1002), trace);
+
+  CHECK_EQUAL("[truncated] 2\n[unknown thread];0x2;0x1 1\n", dumpOf(window, 1000, 1009, 3));
+}
+
+TEST(RollingWindowKeepsUnwalkableTraces) {
+  RollingWindow window(NULL, 1, 10, 4);
+  JVMPI_CallTrace trace = {};
+  trace.num_frames = -2;
+
+  window.record(at(1000), trace);
+
+  CHECK_EQUAL("[unknown thread];[asgct error -2] 1\n", dumpOf(window, 1000, 1009, 1));
+}
+
+TEST(RollingWindowNamesNativeFramesUnderTheirError) {
+  RollingWindow window(NULL, 1, 10, 4);
+  JVMPI_CallFrame frames[3] = {};
+  frames[0].lineno = kNativeFrameLineNo;
+  frames[0].method_id = (jmethodID)0x10;
+  frames[1].lineno = kNativeFrameLineNo;
+  frames[1].method_id = (jmethodID)0x20;
+  frames[2].lineno = -3;
+
+  JVMPI_CallTrace trace = {};
+  trace.num_frames = 3;
+  trace.frames = frames;
+  window.record(at(1000), trace);
+
+  CHECK_EQUAL("[unknown thread];[asgct error -3];[native 0x20];[native 0x10] 1\n", dumpOf(window, 1000, 1009, 1));
+}
+
+TEST(RollingWindowNamesStubFramesUnderTheirError) {
+  RollingWindow window(NULL, 1, 10, 4);
+  JVMPI_CallFrame frames[2] = {};
+  frames[0].lineno = kStubFrameLineNo;
+  frames[0].method_id = (jmethodID)"StubRoutines::jbyte_arraycopy";
+  frames[1].lineno = -6;
+
+  JVMPI_CallTrace trace = {};
+  trace.num_frames = 2;
+  trace.frames = frames;
+  window.record(at(1000), trace);
+
+  CHECK_EQUAL("[unknown thread];[asgct error -6];[StubRoutines::jbyte_arraycopy] 1\n", dumpOf(window, 1000, 1009, 1));
+}
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include "test.h"
+#include "../../main/cpp/sample_stream.h"
+
+class NamingStream : public SampleStream {
+protected:
+  virtual bool methodName(const JVMPI_CallFrame &frame, std::string &name) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "method%ld", (long) frame.method_id);
+    name = buf;
+    return true;
+  }
+};
+
+// Reads the big endian records back
+struct StreamReader {
+  std::string data;
+  size_t at;
+
+  explicit StreamReader(const std::string &d) : data(d), at(0) {}
+
+  bool done() const { return at >= data.size(); }
+
+  int64_t read(int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) value = (value << 8) | (unsigned char) data[at++];
+    return bytes == 4 ? (int64_t)(int32_t) value : (int64_t) value;
+  }
+
+  std::string readString() {
+    int length = (int) read(4);
+    std::string value = data.substr(at, length);
+    at += length;
+    return value;
+  }
+};
+
+static JVMPI_CallTrace twoFrames(JVMPI_CallFrame *frames) {
+  frames[0].lineno = 5;
+  frames[0].method_id = (jmethodID)1;
+  frames[1].lineno = 7;
+  frames[1].method_id = (jmethodID)2;
+  JVMPI_CallTrace trace = {};
+  trace.num_frames = 2;
+  trace.frames = frames;
+  return trace;
+}
+
+static timespec at(time_t seconds) {
+  timespec ts = {};
+  ts.tv_sec = seconds;
+  return ts;
+}
+
+TEST(SampleStreamInternsStacks) {
+  NamingStream stream;
+  StreamSubscriberPtr subscriber = stream.subscribe(true);
+  JVMPI_CallFrame frames[2] = {};
+  JVMPI_CallTrace trace = twoFrames(frames);
+  ThreadBucketPtr info(nullptr);
+
+  stream.record(at(1), trace, info);
+  stream.record(at(2), trace, info);
+
+  std::string out;
+  subscriber->take(out);
+  StreamReader reader(out);
+  CHECK_EQUAL("HPSTREAM", out.substr(0, 8));
+  reader.at = 8;
+  CHECK_EQUAL(STREAM_VERSION, reader.read(4));
+
+  CHECK_EQUAL(STREAM_METHOD, reader.read(1));
+  CHECK_EQUAL(1, reader.read(8));
+  CHECK_EQUAL("method1", reader.readString());
+  CHECK_EQUAL(STREAM_METHOD, reader.read(1));
+  CHECK_EQUAL(2, reader.read(8));
+  CHECK_EQUAL("method2", reader.readString());
+
+  CHECK_EQUAL(STREAM_STACK, reader.read(1));
+  CHECK_EQUAL(0, reader.read(4));
+  CHECK_EQUAL(2, reader.read(4));
+  CHECK_EQUAL(5, reader.read(4));
+  CHECK_EQUAL(1, reader.read(8));
+  CHECK_EQUAL(7, reader.read(4));
+  CHECK_EQUAL(2, reader.read(8));
+
+  for (int second = 1; second <= 2; second++) {
+    CHECK_EQUAL(STREAM_STACK_SAMPLE, reader.read(1));
+    CHECK_EQUAL(second * 1000, reader.read(8));
+    CHECK_EQUAL(0, reader.read(4));
+    CHECK_EQUAL(0, reader.read(4));
+  }
+  CHECK(reader.done());
+  stream.unsubscribe(subscriber);
+  CHECK(!stream.hasSubscribers());
+}
+
+TEST(SampleStreamSendsFramesAndErrors) {
+  NamingStream stream;
+  StreamSubscriberPtr subscriber = stream.subscribe(false);
+  JVMPI_CallFrame frames[2] = {};
+  JVMPI_CallTrace trace = twoFrames(frames);
+  JVMPI_CallTrace failed = {};
+  failed.num_frames = kGcTraceError;
+  ThreadBucketPtr info(nullptr);
+
+  stream.record(at(1), trace, info);
+  stream.record(at(1), failed, info);
+
+  std::string out;
+  subscriber->take(out);
+  StreamReader reader(out);
+  reader.at = 12;
+  for (int i = 0; i < 2; i++) {
+    CHECK_EQUAL(STREAM_METHOD, reader.read(1));
+    reader.read(8);
+    reader.readString();
+  }
+  CHECK_EQUAL(STREAM_SAMPLE, reader.read(1));
+  CHECK_EQUAL(1000, reader.read(8));
+  CHECK_EQUAL(0, reader.read(4));
+  CHECK_EQUAL(2, reader.read(4));
+  reader.at += 2 * 12;
+
+  CHECK_EQUAL(STREAM_SAMPLE, reader.read(1));
+  CHECK_EQUAL(1000, reader.read(8));
+  CHECK_EQUAL(0, reader.read(4));
+  CHECK_EQUAL(kGcTraceError, reader.read(4));
+  CHECK(reader.done());
+}
+
+TEST(SampleStreamDropsSamplesForASlowSubscriber) {
+  NamingStream stream;
+  StreamSubscriberPtr slow = stream.subscribe(true);
+  JVMPI_CallFrame frames[2] = {};
+  JVMPI_CallTrace trace = twoFrames(frames);
+  ThreadBucketPtr info(nullptr);
+
+  // 17 bytes a sample, a few more than fit
+  long samples = kStreamBufferSize / 17 + 10;
+  for (long i = 0; i < samples; i++) {
+    stream.record(at(1), trace, info);
+  }
+
+  std::string out;
+  slow->take(out);
+  CHECK(out.size() <= kStreamBufferSize);
+
+  stream.record(at(2), trace, info);
+  out.clear();
+  slow->take(out);
+  StreamReader reader(out);
+  CHECK_EQUAL(STREAM_DROPPED, reader.read(1));
+  CHECK(reader.read(8) >= 10);
+  CHECK_EQUAL(STREAM_STACK_SAMPLE, reader.read(1));
+  CHECK_EQUAL(2000, reader.read(8));
+}
@@ -4,6 +4,7 @@
 
 #include "../../main/cpp/thread_map.h"
 
+#include <algorithm>
 #include <memory>
 #include <thread>
 #include <vector>
@@ -186,4 +187,59 @@ TEST(ThreadMapConcurrentTest) {
   }
 }
 
+TEST(ThreadBucketNamesAreTruncated) {
+  std::string longName(2 * kThreadNameMax, 'x');
+  ThreadBucket *bucket = ThreadBucketPool::instance().acquire(1, 2, longName.c_str());
+
+  CHECK_EQUAL(std::string(kThreadNameMax - 1, 'x'), bucket->name);
+  ThreadBucketPtr release(bucket);
+}
+
+TEST(ThreadBucketPoolRecyclesReleasedBuckets) {
+  ThreadBucketPool &pool = ThreadBucketPool::instance();
+  map::DefaultGC.collect(); // nothing released earlier comes back while the pool fills up
+  ThreadBucketPool::Occupancy before = pool.occupancy();
+
+  std::vector<ThreadBucket *> buckets;
+  for (int i = 0; i < kThreadBucketSlabSize + 1; i++)
+    buckets.push_back(pool.acquire(i, i, "pooled"));
+
+  ThreadBucketPool::Occupancy full = pool.occupancy();
+  CHECK_EQUAL(before.inUse + kThreadBucketSlabSize + 1, full.inUse);
+  CHECK(full.capacity >= full.inUse);
+  CHECK_EQUAL(before.heapAllocated, full.heapAllocated);
+
+  // released buckets go through the GC, they're back once it collects
+  for (size_t i = 0; i < buckets.size(); i++) {
+    ThreadBucketPtr release(buckets[i]);
+  }
+  map::DefaultGC.collect();
+
+  // buckets released by earlier tests may have been recycled too
+  ThreadBucketPool::Occupancy after = pool.occupancy();
+  CHECK(after.inUse <= before.inUse);
+  CHECK_EQUAL(full.capacity, after.capacity);
+}
+
+TEST(ThreadBucketsComeBackWhileAThreadSitsIdle) {
+  // attached to the GC, but never reads nor reaches a safepoint
+  map::GC::EpochType idle = GCHelper::attach();
+  ThreadBucketPool &pool = ThreadBucketPool::instance();
+  ThreadBucketPool::Occupancy before = pool.occupancy();
+
+  ThreadMap churn;
+  for (int i = 0; i < 4 * kThreadBucketSlabSize; i++) {
+    JNIEnv *env = (JNIEnv *)(intptr_t)((i + 1) * 16);
+    churn.put(env, "churn", i, i);
+    CHECK(churn.get(env).defined());
+    churn.remove(env);
+  }
+
+  ThreadBucketPool::Occupancy after = pool.occupancy();
+  CHECK(after.inUse <= before.inUse);
+  CHECK(after.capacity <= std::max(before.capacity, kThreadBucketSlabSize));
+  CHECK_EQUAL(before.heapAllocated, after.heapAllocated);
+  GCHelper::detach(idle);
+}
+
 #endif // DISABLE_CPP11
\ No newline at end of file
@@ -0,0 +1,74 @@
+// Folds the agent's sample lines into stack counts for flame graphs, the samples taken from and
+// to the given epoch milliseconds only if asked:
+//   csvFold [--threads=N] [--from=MS] [--to=MS] samples.csv [folded.txt]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "csv_parser.h"
+
+struct Options {
+    int threads;
+    SampleWindow window;
+    std::string input;
+    std::string output;
+};
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--threads=N] [--from=MS] [--to=MS] samples.csv [folded.txt]\n", name);
+    exit(1);
+}
+
+static void parseOptions(int argc, char **argv, Options &options) {
+    options.threads = std::max(1, (int) std::thread::hardware_concurrency());
+    options.window = kAllSamples;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--threads=", 10) == 0) {
+            options.threads = std::max(1, atoi(argv[i] + 10));
+        } else if (strncmp(argv[i], "--from=", 7) == 0) {
+            options.window.from = atoll(argv[i] + 7);
+        } else if (strncmp(argv[i], "--to=", 5) == 0) {
+            options.window.to = atoll(argv[i] + 5);
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.empty() || files.size() > 2) usage(argv[0]);
+    options.input = files[0];
+    if (files.size() == 2) options.output = files[1];
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    parseOptions(argc, argv, options);
+
+    FrameDictionary dictionary;
+    StackCounts stacks;
+    CsvSummary summary;
+    if (!parseSamples(options.input, options.threads, dictionary, stacks, summary, options.window)) return 1;
+
+    FILE *out = stdout;
+    if (!options.output.empty() && (out = fopen(options.output.c_str(), "w")) == NULL) {
+        fprintf(stderr, "ERROR: Failed to create %s\n", options.output.c_str());
+        return 1;
+    }
+    bool written = writeFolded(dictionary, stacks, out);
+    if (out != stdout) written = fclose(out) == 0 && written;
+    if (!written) {
+        fprintf(stderr, "ERROR: Failed to write the folded stacks\n");
+        return 1;
+    }
+
+    fprintf(stderr, "%lld bytes read, %lld lines, %lld samples, %lld skipped, %zu names, %zu stacks\n",
+            (long long) summary.bytes, (long long) summary.lines, (long long) summary.samples,
+            (long long) summary.skipped, dictionary.size(), stacks.size());
+    return 0;
+}
@@ -0,0 +1,355 @@
+#include "csv_parser.h"
+
+#include <string.h>
+#include <algorithm>
+#include <thread>
+
+#include "mapped_file.h"
+
+static inline uint64_t hashBytes(const char *data, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char) data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+FrameDictionary::FrameDictionary() : next(0) {
+}
+
+int32_t FrameDictionary::intern(const char *name, size_t length) {
+    Shard &shard = shards[hashBytes(name, length) % kShards];
+    std::string key(name, length);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    std::unordered_map<std::string, int32_t>::iterator it = shard.ids.find(key);
+    if (it != shard.ids.end()) return it->second;
+
+    int32_t id = next.fetch_add(1, std::memory_order_acq_rel);
+    shard.ids.insert(std::make_pair(key, id));
+    return id;
+}
+
+void FrameDictionary::names(std::vector<std::string> &out) const {
+    out.assign(size(), std::string());
+    for (int i = 0; i < kShards; i++) {
+        std::lock_guard<std::mutex> guard(shards[i].lock);
+        std::unordered_map<std::string, int32_t>::const_iterator it;
+        for (it = shards[i].ids.begin(); it != shards[i].ids.end(); ++it) {
+            out[it->second] = it->first;
+        }
+    }
+}
+
+size_t StackHash::operator()(const std::vector<int32_t> &stack) const {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < stack.size(); i++) {
+        hash = (hash ^ (uint32_t) stack[i]) * 1099511628211ULL;
+    }
+    return (size_t) hash;
+}
+
+// A name in the mapped file, which outlives the parsers
+struct Span {
+    const char *data;
+    size_t length;
+
+    bool operator==(const Span &other) const {
+        return length == other.length && memcmp(data, other.data, length) == 0;
+    }
+};
+
+struct SpanHash {
+    size_t operator()(const Span &span) const { return (size_t) hashBytes(span.data, span.length); }
+};
+
+// Past the digits at at and the comma after them, NULL if that's not what's there
+static inline const char *skipNumber(const char *at, const char *end) {
+    const char *start = at;
+    if (at < end && *at == '-') at++;
+    while (at < end && *at >= '0' && *at <= '9') at++;
+    if (at == start || at == end || *at != ',' || (at - start == 1 && *start == '-')) return NULL;
+    return at + 1;
+}
+
+// The number of the digits from at to end, which skipNumber found there
+static inline int64_t numberOf(const char *at, const char *end) {
+    bool negative = *at == '-';
+    if (negative) at++;
+    int64_t value = 0;
+    while (at < end) {
+        value = value * 10 + (*at++ - '0');
+    }
+    return negative ? -value : value;
+}
+
+// Parses a chunk of whole lines on a thread of its own
+class ChunkParser {
+public:
+    ChunkParser(FrameDictionary &dictionary, const SampleWindow &window) : dictionary(dictionary), window(window) {
+        summary.lines = 0;
+        summary.samples = 0;
+        summary.skipped = 0;
+        summary.bytes = 0;
+    }
+
+    void parse(const char *at, const char *end) {
+        while (at < end) {
+            const char *lineEnd = findByte(at, end, '\n');
+            summary.lines++;
+            // the last line is still being written without its newline
+            if (lineEnd == end || !parseLine(at, lineEnd)) summary.skipped++;
+            at = lineEnd + 1;
+        }
+    }
+
+    StackCounts stacks;
+    CsvSummary summary;
+
+private:
+    FrameDictionary &dictionary;
+    const SampleWindow window;
+    std::unordered_map<Span, int32_t, SpanHash> cache;
+    std::vector<int32_t> stack;
+
+    int32_t idOf(const char *at, const char *end) {
+        Span span = {at, (size_t) (end - at)};
+        std::unordered_map<Span, int32_t, SpanHash>::iterator it = cache.find(span);
+        if (it != cache.end()) return it->second;
+
+        int32_t id = dictionary.intern(span.data, span.length);
+        cache.insert(std::make_pair(span, id));
+        return id;
+    }
+
+    bool parseLine(const char *at, const char *end) {
+        // #asgct error counts and the like
+        if (at == end || *at == '#') return false;
+
+        const char *comma = at;
+        const char *jid = NULL;
+        const char *frames = NULL;
+        while ((comma = findByte(comma, end, ',')) < end) {
+            jid = skipNumber(comma + 1, end);
+            if (jid != NULL && (frames = skipNumber(jid, end)) != NULL) break;
+            comma++;
+        }
+        if (frames == NULL) return false;
+
+        int64_t millis = numberOf(comma + 1, jid - 1);
+        if (millis < window.from || millis > window.to) return false;
+
+        // frame;...;frame;end or just end, when there were none
+        const char *last = end;
+        if (last > frames && last[-1] == '\r') last--;
+        if (last - frames < 3 || memcmp(last - 3, "end", 3) != 0) return false;
+        const char *stop = last - 3;
+        if (stop != frames && stop[-1] != ';') return false;
+
+        stack.clear();
+        stack.push_back(idOf(at, comma));
+        while (frames < stop) {
+            const char *semicolon = findByte(frames, stop, ';');
+            stack.push_back(idOf(frames, semicolon));
+            frames = semicolon + 1;
+        }
+        // logged leaf first
+        std::reverse(stack.begin() + 1, stack.end());
+        stacks[stack]++;
+        summary.samples++;
+        return true;
+    }
+
+    ChunkParser(const ChunkParser &);
+    void operator=(const ChunkParser &);
+};
+
+static void parseChunk(ChunkParser *parser, const char *at, const char *end) {
+    parser->parse(at, end);
+}
+
+void parseSamples(const char *data, size_t size, int threads, FrameDictionary &dictionary,
+                  StackCounts &stacks, CsvSummary &summary, const SampleWindow &window) {
+    const char *end = data + size;
+    threads = std::max(1, threads);
+
+    // chunks start after the first newline past an even split
+    std::vector<const char *> starts;
+    starts.push_back(data);
+    for (int i = 1; i < threads; i++) {
+        const char *split = std::max(starts.back(), data + size / threads * i);
+        const char *newline = findByte(split, end, '\n');
+        if (newline >= end - 1) break;
+        if (newline + 1 > starts.back()) starts.push_back(newline + 1);
+    }
+    starts.push_back(end);
+
+    size_t count = starts.size() - 1;
+    std::vector<ChunkParser *> parsers;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < count; i++) {
+        parsers.push_back(new ChunkParser(dictionary, window));
+    }
+    for (size_t i = 1; i < count; i++) {
+        workers.push_back(std::thread(parseChunk, parsers[i], starts[i], starts[i + 1]));
+    }
+    parseChunk(parsers[0], starts[0], starts[1]);
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+
+    summary.lines = 0;
+    summary.samples = 0;
+    summary.skipped = 0;
+    summary.bytes = (int64_t) size;
+    for (size_t i = 0; i < count; i++) {
+        ChunkParser *parser = parsers[i];
+        if (stacks.empty()) {
+            stacks.swap(parser->stacks);
+        } else {
+            for (StackCounts::iterator it = parser->stacks.begin(); it != parser->stacks.end(); ++it) {
+                stacks[it->first] += it->second;
+            }
+        }
+        summary.lines += parser->summary.lines;
+        summary.samples += parser->summary.samples;
+        summary.skipped += parser->summary.skipped;
+        delete parser;
+    }
+}
+
+// Past the number at at and the delimiter after it, NULL if that's not what's there
+static const char *readNumber(const char *at, const char *end, char delimiter, int64_t &value) {
+    const char *start = at;
+    while (at < end && *at >= '0' && *at <= '9') at++;
+    if (at == start || at == end || *at != delimiter) return NULL;
+    value = numberOf(start, at);
+    return at + 1;
+}
+
+// Times may be before the epoch on a badly set clock
+static const char *readMillis(const char *at, const char *end, int64_t &value) {
+    const char *next = skipNumber(at, end);
+    if (next != NULL) value = numberOf(at, next - 1);
+    return next;
+}
+
+// A #chunk line of the index, NULL unless it's one
+static const char *readChunk(const char *at, const char *end, LogChunk &chunk) {
+    size_t prefix = sizeof(LOG_CHUNK_LINE) - 1;
+    if ((size_t) (end - at) < prefix || memcmp(at, LOG_CHUNK_LINE, prefix) != 0) return NULL;
+    at += prefix;
+    if ((at = readNumber(at, end, ',', chunk.offset)) == NULL ||
+        (at = readNumber(at, end, ',', chunk.bytes)) == NULL) {
+        return NULL;
+    }
+    if ((at = readMillis(at, end, chunk.firstMillis)) == NULL ||
+        (at = readMillis(at, end, chunk.lastMillis)) == NULL ||
+        (at = readNumber(at, end, ',', chunk.samples)) == NULL) {
+        return NULL;
+    }
+
+    chunk.threads.clear();
+    int64_t jid;
+    const char *next;
+    while ((next = readNumber(at, end, ';', jid)) != NULL) {
+        chunk.threads.push_back(jid);
+        at = next;
+    }
+    if (end - at < 4 || memcmp(at, "end\n", 4) != 0) return NULL;
+    return at + 4;
+}
+
+bool readLogIndex(const char *data, size_t size, std::vector<LogChunk> &chunks, size_t &linesEnd) {
+    chunks.clear();
+    if (size < LOG_INDEX_TRAILER_SIZE) return false;
+
+    const char *trailer = data + size - LOG_INDEX_TRAILER_SIZE;
+    const char *end = data + size;
+    size_t prefix = sizeof(LOG_INDEX_TRAILER) - 1;
+    int64_t start;
+    if (memcmp(trailer, LOG_INDEX_TRAILER, prefix) != 0 ||
+        readNumber(trailer + prefix, end, '\n', start) != end ||
+        start > (int64_t) (trailer - data)) {
+        return false;
+    }
+
+    const char *at = data + start;
+    int64_t covered = 0;
+    while (at < trailer) {
+        LogChunk chunk;
+        if ((at = readChunk(at, trailer, chunk)) == NULL || chunk.offset < covered ||
+            chunk.offset + chunk.bytes > start) {
+            chunks.clear();
+            return false;
+        }
+        covered = chunk.offset + chunk.bytes;
+        chunks.push_back(chunk);
+    }
+    linesEnd = (size_t) start;
+    return true;
+}
+
+bool parseSamples(const std::string &path, int threads, FrameDictionary &dictionary,
+                  StackCounts &stacks, CsvSummary &summary, const SampleWindow &window) {
+    MappedFile file;
+    if (!file.open(path)) return false;
+
+    std::vector<LogChunk> chunks;
+    size_t linesEnd;
+    if (!readLogIndex(file.data(), file.size(), chunks, linesEnd)) {
+        parseSamples(file.data(), file.size(), threads, dictionary, stacks, summary, window);
+        return true;
+    }
+
+    // neighbouring chunks in the window are read together
+    summary.lines = 0;
+    summary.samples = 0;
+    summary.skipped = 0;
+    summary.bytes = 0;
+    size_t i = 0;
+    while (i < chunks.size()) {
+        const LogChunk &first = chunks[i++];
+        if (first.samples == 0 || first.lastMillis < window.from || first.firstMillis > window.to) continue;
+
+        int64_t end = first.offset + first.bytes;
+        while (i < chunks.size() && chunks[i].offset == end && chunks[i].samples > 0 &&
+               chunks[i].lastMillis >= window.from && chunks[i].firstMillis <= window.to) {
+            end += chunks[i++].bytes;
+        }
+
+        CsvSummary span;
+        parseSamples(file.data() + first.offset, (size_t) (end - first.offset), threads, dictionary, stacks,
+                     span, window);
+        summary.lines += span.lines;
+        summary.samples += span.samples;
+        summary.skipped += span.skipped;
+        summary.bytes += span.bytes;
+    }
+    return true;
+}
+
+bool writeFolded(const FrameDictionary &dictionary, const StackCounts &stacks, FILE *out) {
+    std::vector<std::string> names;
+    dictionary.names(names);
+
+    std::vector<std::string> lines;
+    lines.reserve(stacks.size());
+    for (StackCounts::const_iterator it = stacks.begin(); it != stacks.end(); ++it) {
+        std::string line;
+        const std::vector<int32_t> &stack = it->first;
+        for (size_t i = 0; i < stack.size(); i++) {
+            if (i > 0) line.push_back(';');
+            line.append(names[stack[i]]);
+        }
+        char count[32];
+        snprintf(count, sizeof(count), " %lld\n", (long long) it->second);
+        line.append(count);
+        lines.push_back(line);
+    }
+    std::sort(lines.begin(), lines.end());
+
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (fwrite(lines[i].data(), 1, lines[i].size(), out) != lines[i].size()) return false;
+    }
+    return fflush(out) == 0;
+}
@@ -0,0 +1,126 @@
+#ifndef CSV_PARSER_H
+#define CSV_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../../main/cpp/log_index.h"
+
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#elif defined(__SSE2__)
+#   include <emmintrin.h>
+#endif
+
+// The first byte at or after at that is value, end if there's none. Delimiters in sample lines
+// are a few dozen bytes apart, too close for memchr's call and setup to pay off.
+inline const char *findByte(const char *at, const char *end, char value) {
+#if defined(__AVX2__)
+    const __m256i pattern = _mm256_set1_epi8(value);
+    while (end - at >= 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) at);
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, pattern));
+        if (mask != 0) return at + __builtin_ctz(mask);
+        at += 32;
+    }
+#elif defined(__SSE2__)
+    const __m128i pattern = _mm_set1_epi8(value);
+    while (end - at >= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *) at);
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern));
+        if (mask != 0) return at + __builtin_ctz(mask);
+        at += 16;
+    }
+#endif
+    while (at < end && *at != value) at++;
+    return at;
+}
+
+/**
+ * Frame and thread names interned to dense ids by any number of threads at once. Names are
+ * spread over shards by hash, each with its own lock, so parsers only contend when they meet a
+ * name at the same time; they keep ids they've seen in a cache of their own besides.
+ */
+class FrameDictionary {
+public:
+    FrameDictionary();
+
+    int32_t intern(const char *name, size_t length);
+
+    // Every name, by id
+    void names(std::vector<std::string> &out) const;
+
+    size_t size() const { return (size_t) next.load(std::memory_order_acquire); }
+
+private:
+    static const int kShards = 64;
+
+    struct Shard {
+        mutable std::mutex lock;
+        std::unordered_map<std::string, int32_t> ids;
+    };
+
+    Shard shards[kShards];
+    std::atomic<int32_t> next;
+
+    FrameDictionary(const FrameDictionary &);
+    void operator=(const FrameDictionary &);
+};
+
+struct StackHash {
+    size_t operator()(const std::vector<int32_t> &stack) const;
+};
+
+// Stacks as the thread's id followed by the frames' ids root first, and their samples
+typedef std::unordered_map<std::vector<int32_t>, int64_t, StackHash> StackCounts;
+
+struct CsvSummary {
+    int64_t lines;
+    int64_t samples;
+    // not sample lines, taken outside the window asked for, or cut off at the end of a log
+    // that's still being written
+    int64_t skipped;
+    // of the log that had to be read
+    int64_t bytes;
+};
+
+// Samples taken from one time to another, in milliseconds since the epoch, both included
+struct SampleWindow {
+    int64_t from;
+    int64_t to;
+};
+
+const SampleWindow kAllSamples = {INT64_MIN, INT64_MAX};
+
+/**
+ * Folds the sample lines LogWriter writes, threadName,millis,jid,frame;...;frame;end with the
+ * frames leaf first, into stack counts. The file is split at line boundaries into a chunk per
+ * thread; each is scanned for delimiters 16 or 32 bytes at a time and its stacks counted on
+ * their own, the counts are merged at the end. A thread name may have commas in it, the first
+ * one followed by two numbers ends it.
+ */
+void parseSamples(const char *data, size_t size, int threads, FrameDictionary &dictionary,
+                  StackCounts &stacks, CsvSummary &summary, const SampleWindow &window = kAllSamples);
+
+/**
+ * The chunks in the footer index of a log LogWriter finished, and where its sample lines end.
+ * False when there's no index, as in a log still being written or one cut short, or when it
+ * doesn't add up.
+ */
+bool readLogIndex(const char *data, size_t size, std::vector<LogChunk> &chunks, size_t &linesEnd);
+
+// Maps the file and parses it, false with the reason logged if it can't be read. Only the
+// chunks with samples in the window are read when the log has an index, all of it otherwise.
+bool parseSamples(const std::string &path, int threads, FrameDictionary &dictionary,
+                  StackCounts &stacks, CsvSummary &summary, const SampleWindow &window = kAllSamples);
+
+// A thread;root;...;leaf samples line per stack, sorted, as flame graph tools take them
+bool writeFolded(const FrameDictionary &dictionary, const StackCounts &stacks, FILE *out);
+
+#endif // CSV_PARSER_H
@@ -0,0 +1,91 @@
+// Aggregates an agent log, sample lines or an older agent's binary records, into a profile file
+// the UI opens without decoding the log:
+//   hplAggregate [--threads=N] [--top=N] log.hpl profile.hpa
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hpl_reader.h"
+#include "profile.h"
+
+struct Options {
+    int threads;
+    int top;
+    std::string log;
+    std::string output;
+};
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--threads=N] [--top=N] log.hpl profile.hpa\n", name);
+    fprintf(stderr, "  logs of sample lines name frames without a signature, a method's overloads count as one\n");
+    exit(1);
+}
+
+static void parseOptions(int argc, char **argv, Options &options) {
+    options.threads = std::max(1, (int) std::thread::hardware_concurrency());
+    options.top = 0;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--threads=", 10) == 0) {
+            options.threads = std::max(1, atoi(argv[i] + 10));
+        } else if (strncmp(argv[i], "--top=", 6) == 0) {
+            options.top = std::max(0, atoi(argv[i] + 6));
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.size() != 2) usage(argv[0]);
+    options.log = files[0];
+    options.output = files[1];
+}
+
+// The methods with the most self samples
+static void printTop(const Profile &profile, int top) {
+    std::vector<int64_t> self, total;
+    profile.flat(self, total);
+
+    std::vector<int32_t> methods;
+    for (size_t i = 0; i < profile.entries.size(); i++) {
+        if (profile.entries[i].kind != ENTRY_THREAD && self[i] > 0) methods.push_back((int32_t) i);
+    }
+    std::sort(methods.begin(), methods.end(), [&self](int32_t a, int32_t b) {
+        return self[a] > self[b];
+    });
+
+    int64_t samples = std::max((int64_t) 1, profile.tree.samples());
+    printf("%10s %6s %10s %6s  %s\n", "self", "%", "total", "%", "method");
+    for (size_t i = 0; i < methods.size() && i < (size_t) top; i++) {
+        int32_t entry = methods[i];
+        printf("%10lld %6.2f %10lld %6.2f  %s\n",
+               (long long) self[entry], 100.0 * self[entry] / samples,
+               (long long) total[entry], 100.0 * total[entry] / samples,
+               profile.entries[entry].name.c_str());
+    }
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    parseOptions(argc, argv, options);
+
+    Profile profile;
+    LogSummary summary;
+    if (!aggregateLog(options.log, options.threads, profile, summary)) return 1;
+    if (summary.partialBytes > 0) {
+        fprintf(stderr, "WARN: Ignored a partial record or line of %zu bytes at the end of %s\n",
+                summary.partialBytes, options.log.c_str());
+    }
+    if (!writeProfile(profile, options.output)) return 1;
+
+    printf("%lld records, %lld samples, %lld methods, %lld threads, %zu tree nodes\n",
+           (long long) summary.records, (long long) summary.traces, (long long) summary.methods,
+           (long long) summary.threads, profile.tree.nodes().size() - 1);
+    if (options.top > 0) printTop(profile, options.top);
+    return 0;
+}
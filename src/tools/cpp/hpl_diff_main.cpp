@@ -0,0 +1,112 @@
+// Compares the profiles of two runs, logs or profile files, into a diff file for the UI:
+//   hplDiff [--threads=N] [--min-total=N] [--top=N] base.hpl|base.hpa changed.hpl|changed.hpa diff.hpd
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hpl_reader.h"
+#include "profile.h"
+#include "profile_diff.h"
+
+struct Options {
+    int threads;
+    long minTotal;
+    int top;
+    std::string base;
+    std::string changed;
+    std::string output;
+};
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--threads=N] [--min-total=N] [--top=N] base changed diff.hpd\n", name);
+    fprintf(stderr, "  logs of sample lines name frames without a signature, a method's overloads count as one\n");
+    exit(1);
+}
+
+static void parseOptions(int argc, char **argv, Options &options) {
+    options.threads = std::max(1, (int) std::thread::hardware_concurrency());
+    options.minTotal = 0;
+    options.top = 0;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--threads=", 10) == 0) {
+            options.threads = std::max(1, atoi(argv[i] + 10));
+        } else if (strncmp(argv[i], "--min-total=", 12) == 0) {
+            options.minTotal = std::max(0L, atol(argv[i] + 12));
+        } else if (strncmp(argv[i], "--top=", 6) == 0) {
+            options.top = std::max(0, atoi(argv[i] + 6));
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.size() != 3) usage(argv[0]);
+    options.base = files[0];
+    options.changed = files[1];
+    options.output = files[2];
+}
+
+// A profile file for the input, aggregated next to the output when it's a log
+static bool profileOf(const std::string &input, const std::string &temporary, int threads,
+                      std::string &profile, std::vector<std::string> &aggregated) {
+    if (isProfileFile(input)) {
+        profile = input;
+        return true;
+    }
+    Profile aggregate;
+    LogSummary summary;
+    profile = temporary;
+    aggregated.push_back(temporary);
+    return aggregateLog(input, threads, aggregate, summary) && writeProfile(aggregate, temporary);
+}
+
+// The methods whose share of samples changed most significantly
+static void printTop(const DiffReader &diff, int top) {
+    const std::vector<DiffCounts> &flat = diff.flat();
+    std::vector<int32_t> methods;
+    for (size_t i = 0; i < flat.size(); i++) {
+        if (diff.entries()[i].kind != ENTRY_THREAD) methods.push_back((int32_t) i);
+    }
+    std::sort(methods.begin(), methods.end(), [&flat](int32_t a, int32_t b) {
+        return fabs(flat[a].totalScore) > fabs(flat[b].totalScore);
+    });
+
+    double baseSamples = std::max((int64_t) 1, diff.baseSamples());
+    double changedSamples = std::max((int64_t) 1, diff.changedSamples());
+    printf("%8s %8s %8s  %s\n", "base %", "new %", "z", "method");
+    for (size_t i = 0; i < methods.size() && i < (size_t) top; i++) {
+        const DiffCounts &counts = flat[methods[i]];
+        printf("%8.2f %8.2f %8.1f  %s\n", 100.0 * counts.baseTotal / baseSamples,
+               100.0 * counts.changedTotal / changedSamples, counts.totalScore,
+               diff.entries()[methods[i]].name.c_str());
+    }
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    parseOptions(argc, argv, options);
+
+    std::string base, changed;
+    std::vector<std::string> aggregated;
+    bool ok = profileOf(options.base, options.output + ".base", options.threads, base, aggregated) &&
+              profileOf(options.changed, options.output + ".changed", options.threads, changed, aggregated) &&
+              diffProfiles(base, changed, options.output, options.minTotal);
+    for (size_t i = 0; i < aggregated.size(); i++) {
+        remove(aggregated[i].c_str());
+    }
+    if (!ok) return 1;
+
+    DiffReader diff;
+    if (!diff.open(options.output)) return 1;
+    printf("%lld base samples, %lld changed samples, %zu entries\n", (long long) diff.baseSamples(),
+           (long long) diff.changedSamples(), diff.entries().size());
+    if (options.top > 0) printTop(diff, options.top);
+    return 0;
+}
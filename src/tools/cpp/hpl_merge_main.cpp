@@ -0,0 +1,84 @@
+// Merges agent logs and profile files of many JVMs into one profile file:
+//   hplMerge [--threads=N] [--fan-in=N] merged.hpa input.hpl|input.hpa...
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hpl_reader.h"
+#include "profile.h"
+#include "profile_merge.h"
+
+struct Options {
+    int threads;
+    size_t fanIn;
+    std::string output;
+    std::vector<std::string> inputs;
+};
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--threads=N] [--fan-in=N] merged.hpa input.hpl|input.hpa...\n", name);
+    fprintf(stderr, "  logs of sample lines name frames without a signature, a method's overloads count as one\n");
+    exit(1);
+}
+
+static void parseOptions(int argc, char **argv, Options &options) {
+    options.threads = std::max(1, (int) std::thread::hardware_concurrency());
+    options.fanIn = kDefaultMergeFanIn;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--threads=", 10) == 0) {
+            options.threads = std::max(1, atoi(argv[i] + 10));
+        } else if (strncmp(argv[i], "--fan-in=", 9) == 0) {
+            options.fanIn = (size_t) std::max(2, atoi(argv[i] + 9));
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.size() < 2) usage(argv[0]);
+    options.output = files[0];
+    options.inputs.assign(files.begin() + 1, files.end());
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    parseOptions(argc, argv, options);
+
+    // logs are aggregated one at a time, each on every thread, so only one log's tree is held
+    std::vector<std::string> profiles, aggregated;
+    bool ok = true;
+    for (size_t i = 0; i < options.inputs.size() && ok; i++) {
+        const std::string &input = options.inputs[i];
+        if (isProfileFile(input)) {
+            profiles.push_back(input);
+            continue;
+        }
+
+        char suffix[64];
+        snprintf(suffix, sizeof(suffix), ".log-%zu", i);
+        std::string path = options.output + suffix;
+        Profile profile;
+        LogSummary summary;
+        ok = aggregateLog(input, options.threads, profile, summary) && writeProfile(profile, path);
+        profiles.push_back(path);
+        aggregated.push_back(path);
+    }
+
+    ok = ok && mergeProfiles(profiles, options.output, options.threads, options.fanIn);
+    for (size_t i = 0; i < aggregated.size(); i++) {
+        remove(aggregated[i].c_str());
+    }
+    if (!ok) return 1;
+
+    ProfileReader merged;
+    if (!merged.open(options.output)) return 1;
+    printf("%zu inputs, %lld samples, %zu entries\n", options.inputs.size(),
+           (long long) merged.samples(), merged.entries().size());
+    return 0;
+}
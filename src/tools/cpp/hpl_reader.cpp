@@ -0,0 +1,373 @@
+#include "hpl_reader.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../../main/cpp/log_writer.h"
+#include "csv_parser.h"
+
+// Logs smaller than this per thread aren't worth splitting
+static const size_t kMinChunkBytes = 1 << 20;
+
+// AsyncGetCallTrace errors are counted as a frame below the thread, keyed apart from method ids,
+// which are jmethodIDs and never this far down the negative range
+static const int64_t kErrorKeyBase = INT64_MIN;
+
+static inline int64_t errorKey(int32_t numFrames) {
+    return kErrorKeyBase - (int64_t) numFrames;
+}
+
+static inline bool isErrorKey(int64_t key) {
+    return key >= kErrorKeyBase && key <= kErrorKeyBase + INT32_MAX;
+}
+
+static inline int32_t getInt(const char *at) {
+    const unsigned char *bytes = (const unsigned char *) at;
+    return (int32_t) ((uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16 | (uint32_t) bytes[2] << 8 | bytes[3]);
+}
+
+static inline int64_t getLong(const char *at) {
+    return (int64_t) ((uint64_t) (uint32_t) getInt(at) << 32 | (uint32_t) getInt(at + 4));
+}
+
+// Bytes after the type byte every record of a type has, and how many strings follow them
+struct RecordLayouts {
+    int fixed[256];
+    int strings[256];
+
+    RecordLayouts() {
+        for (int i = 0; i < 256; i++) {
+            fixed[i] = -1;
+            strings[i] = 0;
+        }
+        set(TRACE_START, 4 + 8, 0);
+        set(TRACE_WITH_TIME, 4 + 8 + 8 + 8, 0);
+        set(FRAME_BCI_ONLY, 4 + 8, 0);
+        set(FRAME_FULL, 4 + 4 + 8, 0);
+        set(NEW_METHOD, 8, 3);
+        set(NEW_METHOD_SIGNATURE, 8, 6);
+        set(THREAD_META, 8, 1);
+    }
+
+    void set(byte type, int fixedBytes, int stringCount) {
+        fixed[type] = fixedBytes;
+        strings[type] = stringCount;
+    }
+};
+
+static const RecordLayouts kLayouts;
+
+// Length of the record at at, 0 if it runs past end and -1 if it's not a record
+static inline ptrdiff_t recordLength(const char *at, const char *end) {
+    unsigned char type = (unsigned char) *at;
+    ptrdiff_t length = 1 + kLayouts.fixed[type];
+    if (length == 0) return -1;
+    for (int i = kLayouts.strings[type]; i > 0; i--) {
+        if (end - at < length + 4) return 0;
+        int32_t size = getInt(at + length);
+        if (size < 0) return -1;
+        length += 4 + size;
+    }
+    return end - at < length ? 0 : length;
+}
+
+static const char *getString(const char *at, std::string &value) {
+    int32_t size = getInt(at);
+    value.assign(at + 4, (size_t) size);
+    return at + 4 + size;
+}
+
+// Lcom/foo/Bar; as com.foo.Bar, anything but a class signature as it is
+static std::string className(const std::string &signature) {
+    if (signature.size() < 2 || signature[0] != 'L' || signature[signature.size() - 1] != ';') {
+        return signature;
+    }
+    std::string name = signature.substr(1, signature.size() - 2);
+    std::replace(name.begin(), name.end(), '/', '.');
+    return name;
+}
+
+struct Dictionaries {
+    std::unordered_map<int64_t, ProfileEntry> methods;
+    std::unordered_map<int64_t, std::string> threads;
+};
+
+static void readMethod(const char *at, bool withSignature, Dictionaries &dictionaries) {
+    int64_t id = getLong(at + 1);
+    std::string file, className_, genericClassName, methodName, signature;
+    at = getString(at + 9, file);
+    at = getString(at, className_);
+    if (withSignature) at = getString(at, genericClassName);
+    at = getString(at, methodName);
+    if (withSignature) getString(at, signature);
+
+    ProfileEntry entry;
+    entry.kind = ENTRY_METHOD;
+    entry.name = className(className_) + "." + methodName;
+    entry.signature = signature;
+    dictionaries.methods.insert(std::make_pair(id, entry));
+}
+
+static void readThread(const char *at, Dictionaries &dictionaries) {
+    int64_t id = getLong(at + 1);
+    std::string name;
+    getString(at + 9, name);
+    if (!name.empty()) dictionaries.threads[id] = name;
+}
+
+// The sequential pass, finds where the last whole record ends, false for a corrupt log
+static bool scan(const char *data, size_t size, size_t chunkBytes, Dictionaries &dictionaries,
+                 std::vector<const char *> &chunks, LogSummary &summary) {
+    const char *at = data;
+    const char *end = data + size;
+    const char *nextChunk = data + chunkBytes;
+    chunks.push_back(data);
+    while (at < end) {
+        ptrdiff_t length = recordLength(at, end);
+        if (length <= 0) {
+            if (length == 0) break;
+            fprintf(stderr, "ERROR: Unknown record type %d at offset %zu\n", (unsigned char) *at, (size_t) (at - data));
+            return false;
+        }
+
+        switch ((byte) *at) {
+            case TRACE_START:
+            case TRACE_WITH_TIME:
+                if (at >= nextChunk) {
+                    chunks.push_back(at);
+                    nextChunk = at + chunkBytes;
+                }
+                break;
+            case NEW_METHOD:
+                readMethod(at, false, dictionaries);
+                break;
+            case NEW_METHOD_SIGNATURE:
+                readMethod(at, true, dictionaries);
+                break;
+            case THREAD_META:
+                readThread(at, dictionaries);
+                break;
+        }
+        summary.records++;
+        at += length;
+    }
+    summary.partialBytes = (size_t) (end - at);
+    chunks.push_back(at);
+    return true;
+}
+
+// Counts the traces between at and end, whole records the scan found, into tree by raw ids:
+// the thread id, then the method ids root first or the error
+static void aggregateChunk(const char *at, const char *end, CallTree &tree, int64_t &traces) {
+    std::vector<int64_t> path;
+    // frames of the current trace still to come, they're logged leaf first
+    int32_t expected = 0;
+    while (at < end) {
+        ptrdiff_t length = recordLength(at, end);
+        byte type = (byte) *at;
+        if (type == TRACE_START || type == TRACE_WITH_TIME) {
+            int32_t numFrames = getInt(at + 1);
+            path.assign(1, getLong(at + 5));
+            if (numFrames <= 0) {
+                path.push_back(errorKey(numFrames));
+                tree.add(path.data(), (int) path.size(), 1);
+                traces++;
+                expected = 0;
+            } else {
+                // a trace cut short by the next one is dropped
+                path.resize(1 + numFrames);
+                expected = numFrames;
+            }
+        } else if ((type == FRAME_BCI_ONLY || type == FRAME_FULL) && expected > 0) {
+            // the method id ends both kinds of frame
+            path[expected--] = getLong(at + length - 8);
+            if (expected == 0) {
+                tree.add(path.data(), (int) path.size(), 1);
+                traces++;
+            }
+        }
+        at += length;
+    }
+}
+
+static ProfileEntry frameEntry(int64_t key, const Dictionaries &dictionaries) {
+    ProfileEntry entry;
+    char name[64];
+    if (isErrorKey(key)) {
+        entry.kind = ENTRY_ERROR;
+        snprintf(name, sizeof(name), "[asgct error %d]", (int) -(key - kErrorKeyBase));
+        entry.name = name;
+        return entry;
+    }
+
+    std::unordered_map<int64_t, ProfileEntry>::const_iterator it = dictionaries.methods.find(key);
+    if (it != dictionaries.methods.end()) return it->second;
+    entry.kind = ENTRY_METHOD;
+    snprintf(name, sizeof(name), "[unknown method %#llx]", (unsigned long long) key);
+    entry.name = name;
+    return entry;
+}
+
+static ProfileEntry threadEntry(int64_t id, const Dictionaries &dictionaries) {
+    ProfileEntry entry;
+    entry.kind = ENTRY_THREAD;
+    std::unordered_map<int64_t, std::string>::const_iterator it = dictionaries.threads.find(id);
+    if (it != dictionaries.threads.end()) {
+        entry.name = it->second;
+    } else {
+        char name[64];
+        snprintf(name, sizeof(name), "[thread %lld]", (long long) id);
+        entry.name = name;
+    }
+    return entry;
+}
+
+static int32_t indexOf(const std::vector<ProfileEntry> &entries, const ProfileEntry &entry) {
+    return (int32_t) (std::lower_bound(entries.begin(), entries.end(), entry) - entries.begin());
+}
+
+// Names the raw tree's ids and merges the nodes that end up with the same name
+static void resolve(const CallTree &raw, const Dictionaries &dictionaries, Profile &profile) {
+    const std::vector<CallTree::Node> &nodes = raw.nodes();
+    std::unordered_map<int64_t, ProfileEntry> threads, frames;
+    for (size_t i = 1; i < nodes.size(); i++) {
+        int64_t key = nodes[i].key;
+        if (nodes[i].parent == 0) {
+            if (threads.count(key) == 0) threads[key] = threadEntry(key, dictionaries);
+        } else if (frames.count(key) == 0) {
+            frames[key] = frameEntry(key, dictionaries);
+        }
+    }
+
+    std::vector<ProfileEntry> &entries = profile.entries;
+    entries.clear();
+    for (std::unordered_map<int64_t, ProfileEntry>::iterator it = threads.begin(); it != threads.end(); ++it) {
+        entries.push_back(it->second);
+    }
+    for (std::unordered_map<int64_t, ProfileEntry>::iterator it = frames.begin(); it != frames.end(); ++it) {
+        entries.push_back(it->second);
+    }
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+    std::unordered_map<int64_t, int32_t> threadIndexes, frameIndexes;
+    for (std::unordered_map<int64_t, ProfileEntry>::iterator it = threads.begin(); it != threads.end(); ++it) {
+        threadIndexes[it->first] = indexOf(entries, it->second);
+    }
+    for (std::unordered_map<int64_t, ProfileEntry>::iterator it = frames.begin(); it != frames.end(); ++it) {
+        frameIndexes[it->first] = indexOf(entries, it->second);
+    }
+
+    std::vector<int64_t> keyOf(nodes.size(), 0);
+    for (size_t i = 1; i < nodes.size(); i++) {
+        keyOf[i] = nodes[i].parent == 0 ? threadIndexes[nodes[i].key] : frameIndexes[nodes[i].key];
+    }
+    profile.tree = CallTree();
+    profile.tree.merge(raw, keyOf);
+}
+
+// Whether the log holds the sample lines LogWriter writes now rather than binary records: its
+// first line is text with a comma in it, where a record starts with a type byte below ' '
+static bool isSampleLines(const char *data, size_t size) {
+    bool comma = false;
+    for (size_t i = 0; i < size && data[i] != '\n'; i++) {
+        unsigned char c = (unsigned char) data[i];
+        if (c < ' ' && c != '\t' && c != '\r') return false;
+        if (c == ',') comma = true;
+    }
+    return comma;
+}
+
+// Counts the stacks csv_parser folds the sample lines into, the names it interns standing in
+// for the ids of the binary records. The lines have no signatures, so neither do the entries.
+static void aggregateLines(const char *data, size_t size, int threads, Profile &profile, LogSummary &summary) {
+    FrameDictionary dictionary;
+    StackCounts stacks;
+    CsvSummary lines;
+    parseSamples(data, size, threads, dictionary, stacks, lines);
+
+    std::vector<std::string> names;
+    dictionary.names(names);
+
+    Dictionaries dictionaries;
+    CallTree raw;
+    std::vector<int64_t> path;
+    for (StackCounts::const_iterator it = stacks.begin(); it != stacks.end(); ++it) {
+        const std::vector<int32_t> &stack = it->first;
+        dictionaries.threads[stack[0]] = names[stack[0]];
+        path.assign(stack.begin(), stack.end());
+        for (size_t i = 1; i < stack.size(); i++) {
+            ProfileEntry &entry = dictionaries.methods[stack[i]];
+            entry.name = names[stack[i]];
+            entry.kind = entry.name.compare(0, 13, "[asgct error ") == 0 ? ENTRY_ERROR : ENTRY_METHOD;
+        }
+        raw.add(path.data(), (int) path.size(), it->second);
+    }
+
+    const char *lastLine = data + size;
+    while (lastLine > data && lastLine[-1] != '\n') lastLine--;
+    summary.records = lines.lines;
+    summary.traces = lines.samples;
+    summary.methods = (int64_t) dictionaries.methods.size();
+    summary.threads = (int64_t) dictionaries.threads.size();
+    summary.partialBytes = (size_t) (data + size - lastLine);
+    resolve(raw, dictionaries, profile);
+}
+
+bool aggregateLog(const char *data, size_t size, int threads, Profile &profile, LogSummary &summary) {
+    summary.records = 0;
+    summary.traces = 0;
+    summary.methods = 0;
+    summary.threads = 0;
+    summary.partialBytes = 0;
+
+    threads = std::max(1, threads);
+    if (isSampleLines(data, size)) {
+        aggregateLines(data, size, threads, profile, summary);
+        return true;
+    }
+    size_t chunkBytes = std::max(kMinChunkBytes, size / threads + 1);
+
+    Dictionaries dictionaries;
+    std::vector<const char *> chunks;
+    if (!scan(data, size, chunkBytes, dictionaries, chunks, summary)) return false;
+    summary.methods = (int64_t) dictionaries.methods.size();
+    summary.threads = (int64_t) dictionaries.threads.size();
+
+    size_t count = chunks.size() - 1;
+    std::vector<CallTree> trees(count);
+    std::vector<int64_t> traces(count, 0);
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < count; i++) {
+        workers.push_back(std::thread(aggregateChunk, chunks[i], chunks[i + 1], std::ref(trees[i]), std::ref(traces[i])));
+    }
+    aggregateChunk(chunks[0], chunks[1], trees[0], traces[0]);
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+
+    for (size_t i = 1; i < count; i++) {
+        trees[0].merge(trees[i]);
+        // merged trees can be large, don't hold on to both
+        trees[i] = CallTree();
+    }
+    for (size_t i = 0; i < count; i++) {
+        summary.traces += traces[i];
+    }
+
+    resolve(trees[0], dictionaries, profile);
+    return true;
+}
+
+bool aggregateLog(const std::string &path, int threads, Profile &profile, LogSummary &summary) {
+    MappedFile file;
+    if (!file.open(path)) return false;
+    if (!aggregateLog(file.data(), file.size(), threads, profile, summary)) {
+        fprintf(stderr, "ERROR: %s is not a profiler log\n", path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,38 @@
+#ifndef HPL_READER_H
+#define HPL_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "profile.h"
+
+struct LogSummary {
+    // records, or lines of a log of sample lines
+    int64_t records;
+    int64_t traces;
+    int64_t methods;
+    int64_t threads;
+    // a record or line cut off at the end of the log, from a profiler that's still writing it
+    size_t partialBytes;
+};
+
+/**
+ * Aggregates an agent log (.hpl, see log_writer.h) into a profile of threads and methods.
+ *
+ * The agent writes a sample line per trace, which csv_parser folds into stack counts in
+ * parallel; frames are named in the line, so each name is an entry of its own. The names are
+ * class and method only, so the entries have no signature and a method's overloads are one
+ * entry. Only the binary records carry signatures. Older agents
+ * wrote binary records, still read for their logs. Records are variable length, so one
+ * sequential pass finds where they are: it only looks at type bytes and string lengths, decodes
+ * the few method and thread records, and cuts the log into a chunk per thread at trace starts.
+ * The chunks are then decoded and counted into call trees in parallel, the trees merged and
+ * their ids mapped to the dictionary entries.
+ */
+bool aggregateLog(const char *data, size_t size, int threads, Profile &profile, LogSummary &summary);
+
+// Maps the log and aggregates it, false with the reason logged if it's not a log
+bool aggregateLog(const std::string &path, int threads, Profile &profile, LogSummary &summary);
+
+#endif // HPL_READER_H
@@ -0,0 +1,57 @@
+#include "mapped_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile() : data_(NULL), size_(0) {
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string &path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Failed to open %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "ERROR: Failed to stat %s: %s\n", path.c_str(), strerror(errno));
+        ::close(fd);
+        return false;
+    }
+
+    // an empty file can't be mapped, but it's a valid empty log
+    if (st.st_size > 0) {
+        void *mapped = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            fprintf(stderr, "ERROR: Failed to map %s: %s\n", path.c_str(), strerror(errno));
+            ::close(fd);
+            return false;
+        }
+        madvise(mapped, (size_t) st.st_size, MADV_SEQUENTIAL);
+        data_ = (const char *) mapped;
+        size_ = (size_t) st.st_size;
+    }
+    // the mapping stays valid without the descriptor
+    ::close(fd);
+    return true;
+}
+
+void MappedFile::close() {
+    if (data_ != NULL) {
+        munmap((void *) data_, size_);
+    }
+    data_ = NULL;
+    size_ = 0;
+}
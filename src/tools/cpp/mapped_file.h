@@ -0,0 +1,34 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+#include <string>
+
+/**
+ * A file mapped read only into memory for as long as this lives. Logs are read front to back,
+ * or in a few large ranges in parallel, so the kernel is told to read ahead.
+ */
+class MappedFile {
+public:
+    MappedFile();
+
+    ~MappedFile();
+
+    // false, with the reason logged, if the file can't be opened or mapped
+    bool open(const std::string &path);
+
+    const char *data() const { return data_; }
+
+    size_t size() const { return size_; }
+
+private:
+    const char *data_;
+    size_t size_;
+
+    void close();
+
+    MappedFile(const MappedFile &);
+    void operator=(const MappedFile &);
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,423 @@
+#include "profile.h"
+
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+bool ProfileEntry::operator<(const ProfileEntry &other) const {
+    if (kind != other.kind) return kind < other.kind;
+    int order = name.compare(other.name);
+    if (order != 0) return order < 0;
+    return signature < other.signature;
+}
+
+bool ProfileEntry::operator==(const ProfileEntry &other) const {
+    return kind == other.kind && name == other.name && signature == other.signature;
+}
+
+CallTree::CallTree() {
+    Node root = {0, -1, 0, 0};
+    nodes_.push_back(root);
+}
+
+int32_t CallTree::child(int32_t parent, int64_t key) {
+    ChildKey childKey = {parent, key};
+    std::unordered_map<ChildKey, int32_t, ChildKeyHash>::iterator it = children_.find(childKey);
+    if (it != children_.end()) return it->second;
+
+    int32_t index = (int32_t) nodes_.size();
+    Node node = {key, parent, 0, 0};
+    nodes_.push_back(node);
+    children_.insert(std::make_pair(childKey, index));
+    return index;
+}
+
+void CallTree::add(const int64_t *path, int length, int64_t samples) {
+    int32_t node = 0;
+    nodes_[0].total += samples;
+    for (int i = 0; i < length; i++) {
+        node = child(node, path[i]);
+        nodes_[node].total += samples;
+    }
+    nodes_[node].self += samples;
+}
+
+void CallTree::count(int32_t node, int64_t self, int64_t total) {
+    nodes_[node].self += self;
+    nodes_[node].total += total;
+}
+
+void CallTree::merge(const CallTree &other, const std::vector<int64_t> &keyOf) {
+    const std::vector<Node> &from = other.nodes_;
+    // parents come before their children, so they're always placed already
+    std::vector<int32_t> placed(from.size());
+    placed[0] = 0;
+    count(0, from[0].self, from[0].total);
+    for (size_t i = 1; i < from.size(); i++) {
+        placed[i] = child(placed[from[i].parent], keyOf[i]);
+        count(placed[i], from[i].self, from[i].total);
+    }
+}
+
+void CallTree::merge(const CallTree &other) {
+    std::vector<int64_t> keyOf(other.nodes_.size());
+    for (size_t i = 0; i < other.nodes_.size(); i++) {
+        keyOf[i] = other.nodes_[i].key;
+    }
+    merge(other, keyOf);
+}
+
+void CallTree::childLists(std::vector<std::vector<int32_t>> &children) const {
+    children.assign(nodes_.size(), std::vector<int32_t>());
+    for (size_t i = 1; i < nodes_.size(); i++) {
+        children[nodes_[i].parent].push_back((int32_t) i);
+    }
+    for (size_t i = 0; i < children.size(); i++) {
+        std::vector<int32_t> &list = children[i];
+        if (list.size() < 2) continue;
+        std::sort(list.begin(), list.end(), [this](int32_t a, int32_t b) {
+            return nodes_[a].key < nodes_[b].key;
+        });
+    }
+}
+
+void Profile::flat(std::vector<int64_t> &self, std::vector<int64_t> &total) const {
+    self.assign(entries.size(), 0);
+    total.assign(entries.size(), 0);
+
+    const std::vector<CallTree::Node> &nodes = tree.nodes();
+    std::vector<std::vector<int32_t>> children;
+    tree.childLists(children);
+
+    // how often each entry is on the current path, only its outermost call counts to the total
+    std::vector<int32_t> onPath(entries.size(), 0);
+    // nodes on the path and how many of their children were visited
+    std::vector<std::pair<int32_t, size_t>> path;
+    path.push_back(std::make_pair(0, (size_t) 0));
+    while (!path.empty()) {
+        std::pair<int32_t, size_t> &top = path.back();
+        if (top.second == children[top.first].size()) {
+            if (top.first != 0) onPath[nodes[top.first].key]--;
+            path.pop_back();
+            continue;
+        }
+
+        int32_t next = children[top.first][top.second++];
+        const CallTree::Node &node = nodes[next];
+        self[node.key] += node.self;
+        if (onPath[node.key]++ == 0) total[node.key] += node.total;
+        path.push_back(std::make_pair(next, (size_t) 0));
+    }
+}
+
+void mergeEntries(const std::vector<const std::vector<ProfileEntry> *> &dictionaries,
+                  std::vector<ProfileEntry> &entries, std::vector<std::vector<int32_t>> &remap) {
+    entries.clear();
+    remap.assign(dictionaries.size(), std::vector<int32_t>());
+    std::vector<size_t> at(dictionaries.size(), 0);
+    for (size_t i = 0; i < dictionaries.size(); i++) {
+        remap[i].resize(dictionaries[i]->size());
+    }
+
+    while (true) {
+        const ProfileEntry *least = NULL;
+        for (size_t i = 0; i < dictionaries.size(); i++) {
+            const std::vector<ProfileEntry> &from = *dictionaries[i];
+            if (at[i] < from.size() && (least == NULL || from[at[i]] < *least)) least = &from[at[i]];
+        }
+        if (least == NULL) break;
+
+        int32_t index = (int32_t) entries.size();
+        entries.push_back(*least);
+        for (size_t i = 0; i < dictionaries.size(); i++) {
+            const std::vector<ProfileEntry> &from = *dictionaries[i];
+            if (at[i] < from.size() && from[at[i]] == entries.back()) remap[i][at[i]++] = index;
+        }
+    }
+}
+
+BinaryOutput::BinaryOutput() : file(NULL), failed(false) {
+}
+
+BinaryOutput::~BinaryOutput() {
+    if (file != NULL) fclose(file);
+}
+
+bool BinaryOutput::open(const std::string &path) {
+    file = fopen(path.c_str(), "wb");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: Failed to create %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    path_ = path;
+    failed = false;
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+    return true;
+}
+
+void BinaryOutput::putBytes(const char *data, size_t size) {
+    failed |= fwrite(data, 1, size, file) != size;
+}
+
+void BinaryOutput::putByte(uint8_t value) {
+    failed |= fputc(value, file) == EOF;
+}
+
+void BinaryOutput::putInt(int32_t value) {
+    char bytes[4];
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = (char) ((uint32_t) value >> (24 - 8 * i));
+    }
+    putBytes(bytes, sizeof(bytes));
+}
+
+void BinaryOutput::putLong(int64_t value) {
+    char bytes[8];
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = (char) ((uint64_t) value >> (56 - 8 * i));
+    }
+    putBytes(bytes, sizeof(bytes));
+}
+
+void BinaryOutput::putFloat(float value) {
+    int32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    putInt(bits);
+}
+
+void BinaryOutput::putString(const std::string &value) {
+    putInt((int32_t) value.size());
+    putBytes(value.data(), value.size());
+}
+
+void BinaryOutput::putEntries(const std::vector<ProfileEntry> &entries) {
+    putInt((int32_t) entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        putByte(entries[i].kind);
+        putString(entries[i].name);
+        putString(entries[i].signature);
+    }
+}
+
+bool BinaryOutput::close() {
+    if (file == NULL) return false;
+    failed |= fclose(file) != 0;
+    file = NULL;
+    if (failed) {
+        fprintf(stderr, "ERROR: Failed to write %s: %s\n", path_.c_str(), strerror(errno));
+    }
+    return !failed;
+}
+
+BinaryInput::BinaryInput() : at(NULL), end(NULL), failed_(false) {
+}
+
+bool BinaryInput::open(const std::string &path) {
+    if (!file.open(path)) return false;
+    path_ = path;
+    at = file.data();
+    end = at + file.size();
+    failed_ = false;
+    return true;
+}
+
+bool BinaryInput::has(size_t bytes) {
+    if (failed_ || (size_t) (end - at) < bytes) {
+        failed_ = true;
+        return false;
+    }
+    return true;
+}
+
+bool BinaryInput::header(const char *magic, int32_t version) {
+    size_t length = strlen(magic);
+    if (!has(length) || memcmp(at, magic, length) != 0) {
+        fprintf(stderr, "ERROR: %s is not a %s file\n", path_.c_str(), magic);
+        return false;
+    }
+    at += length;
+    int32_t actual = getInt();
+    if (actual != version) {
+        fprintf(stderr, "ERROR: %s is a version %d file, expected version %d\n", path_.c_str(), actual, version);
+        return false;
+    }
+    return true;
+}
+
+uint8_t BinaryInput::getByte() {
+    if (!has(1)) return 0;
+    return (uint8_t) *at++;
+}
+
+int32_t BinaryInput::getInt() {
+    if (!has(4)) return 0;
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value = (value << 8) | (unsigned char) at[i];
+    }
+    at += 4;
+    return (int32_t) value;
+}
+
+int64_t BinaryInput::getLong() {
+    if (!has(8)) return 0;
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value = (value << 8) | (unsigned char) at[i];
+    }
+    at += 8;
+    return (int64_t) value;
+}
+
+float BinaryInput::getFloat() {
+    int32_t bits = getInt();
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+bool BinaryInput::getString(std::string &value) {
+    int32_t length = getInt();
+    if (length < 0 || !has((size_t) length)) {
+        failed_ = true;
+        return false;
+    }
+    value.assign(at, (size_t) length);
+    at += length;
+    return true;
+}
+
+bool BinaryInput::getEntries(std::vector<ProfileEntry> &entries) {
+    entries.clear();
+    int32_t count = getInt();
+    if (count < 0) failed_ = true;
+    for (int32_t i = 0; i < count && !failed_; i++) {
+        ProfileEntry entry;
+        entry.kind = getByte();
+        if (!getString(entry.name) || !getString(entry.signature)) break;
+        entries.push_back(entry);
+    }
+    return !failed_;
+}
+
+void ProfileWriter::header(int64_t samples, const std::vector<ProfileEntry> &entries,
+                           const std::vector<int64_t> &self, const std::vector<int64_t> &total) {
+    out.putBytes(PROFILE_MAGIC, sizeof(PROFILE_MAGIC) - 1);
+    out.putInt(PROFILE_VERSION);
+    out.putLong(samples);
+    out.putEntries(entries);
+    for (size_t i = 0; i < entries.size(); i++) {
+        out.putLong(self[i]);
+        out.putLong(total[i]);
+    }
+}
+
+void ProfileWriter::node(int32_t entry, int64_t self, int64_t total) {
+    out.putInt(entry);
+    out.putLong(self);
+    out.putLong(total);
+}
+
+void ProfileWriter::end() {
+    out.putInt(PROFILE_END);
+}
+
+bool writeProfile(const Profile &profile, const std::string &path) {
+    ProfileWriter writer;
+    if (!writer.open(path)) return false;
+
+    std::vector<int64_t> self, total;
+    profile.flat(self, total);
+    writer.header(profile.tree.samples(), profile.entries, self, total);
+
+    const std::vector<CallTree::Node> &nodes = profile.tree.nodes();
+    std::vector<std::vector<int32_t>> children;
+    profile.tree.childLists(children);
+
+    std::vector<std::pair<int32_t, size_t>> parents;
+    parents.push_back(std::make_pair(0, (size_t) 0));
+    while (!parents.empty()) {
+        std::pair<int32_t, size_t> &top = parents.back();
+        if (top.second == children[top.first].size()) {
+            writer.end();
+            parents.pop_back();
+            continue;
+        }
+
+        int32_t next = children[top.first][top.second++];
+        writer.node((int32_t) nodes[next].key, nodes[next].self, nodes[next].total);
+        parents.push_back(std::make_pair(next, (size_t) 0));
+    }
+    return writer.close();
+}
+
+ProfileReader::ProfileReader() : samples_(0), corrupt(false) {
+}
+
+bool ProfileReader::open(const std::string &path) {
+    if (!in.open(path) || !in.header(PROFILE_MAGIC, PROFILE_VERSION)) return false;
+
+    samples_ = in.getLong();
+    in.getEntries(entries_);
+    self_.assign(entries_.size(), 0);
+    total_.assign(entries_.size(), 0);
+    for (size_t i = 0; i < entries_.size(); i++) {
+        self_[i] = in.getLong();
+        total_[i] = in.getLong();
+    }
+
+    if (in.failed()) {
+        fprintf(stderr, "ERROR: %s is truncated\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool ProfileReader::next(int32_t &entry, int64_t &self, int64_t &total) {
+    entry = in.getInt();
+    if (in.failed() || entry == PROFILE_END) return false;
+    if (entry < 0 || entry >= (int32_t) entries_.size()) {
+        corrupt = true;
+        return false;
+    }
+    self = in.getLong();
+    total = in.getLong();
+    return !in.failed();
+}
+
+bool readProfile(const std::string &path, Profile &profile) {
+    ProfileReader reader;
+    if (!reader.open(path)) return false;
+
+    profile.entries = reader.entries();
+    profile.tree = CallTree();
+    profile.tree.count(0, 0, reader.samples());
+
+    std::vector<int32_t> parents;
+    parents.push_back(0);
+    int32_t entry;
+    int64_t self, total;
+    while (!parents.empty()) {
+        if (reader.next(entry, self, total)) {
+            int32_t node = profile.tree.child(parents.back(), entry);
+            profile.tree.count(node, self, total);
+            parents.push_back(node);
+        } else if (reader.failed()) {
+            fprintf(stderr, "ERROR: %s is truncated\n", path.c_str());
+            return false;
+        } else {
+            parents.pop_back();
+        }
+    }
+    return true;
+}
+
+bool isProfileFile(const std::string &path) {
+    char magic[sizeof(PROFILE_MAGIC) - 1];
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == NULL) return false;
+    bool matches = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                   memcmp(magic, PROFILE_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return matches;
+}
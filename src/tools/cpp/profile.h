@@ -0,0 +1,263 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mapped_file.h"
+
+// Kinds of profile entries, in the order they sort in
+const uint8_t ENTRY_THREAD = 0;
+const uint8_t ENTRY_METHOD = 1;
+const uint8_t ENTRY_ERROR = 2;
+
+// A thread, a method or an AsyncGetCallTrace error, the same one in any log it shows up in
+struct ProfileEntry {
+    uint8_t kind;
+    // thread name, package.Class.method or [asgct error N]
+    std::string name;
+    // a method's JVM signature, empty for the others
+    std::string signature;
+
+    bool operator<(const ProfileEntry &other) const;
+
+    bool operator==(const ProfileEntry &other) const;
+};
+
+/**
+ * Call tree of 64 bit frame keys under a synthetic root, node 0. Nodes are only ever added, a
+ * child always after its parent. Counts are samples: self where the node was the leaf, total
+ * where it was on the stack at all.
+ */
+class CallTree {
+public:
+    struct Node {
+        int64_t key;
+        int32_t parent;
+        int64_t self;
+        int64_t total;
+    };
+
+    CallTree();
+
+    // Counts samples for a stack given root first
+    void add(const int64_t *path, int length, int64_t samples);
+
+    // The child of parent with key, added without samples if it's new
+    int32_t child(int32_t parent, int64_t key);
+
+    // Adds samples to a node's counts
+    void count(int32_t node, int64_t self, int64_t total);
+
+    // Adds other's counts, its node i under key keyOf[i]. Nodes of other whose keys map to the
+    // same key under the same parent are counted together.
+    void merge(const CallTree &other, const std::vector<int64_t> &keyOf);
+
+    // Adds other's counts, keys from the same space
+    void merge(const CallTree &other);
+
+    const std::vector<Node> &nodes() const { return nodes_; }
+
+    int64_t samples() const { return nodes_[0].total; }
+
+    // Children of every node, ordered by key
+    void childLists(std::vector<std::vector<int32_t>> &children) const;
+
+private:
+    struct ChildKey {
+        int32_t parent;
+        int64_t key;
+
+        bool operator==(const ChildKey &other) const { return parent == other.parent && key == other.key; }
+    };
+
+    struct ChildKeyHash {
+        size_t operator()(const ChildKey &k) const {
+            return (size_t) (k.key * 0x9E3779B97F4A7C15ULL) ^ (size_t) k.parent;
+        }
+    };
+
+    std::vector<Node> nodes_;
+    std::unordered_map<ChildKey, int32_t, ChildKeyHash> children_;
+};
+
+/**
+ * An aggregated profile: the entries sorted, and a call tree keyed by entry index with the
+ * threads as the root's children. Sorting the entries sorts every list of children by name as
+ * well, which is what lets profiles be merged and compared a node at a time.
+ */
+struct Profile {
+    std::vector<ProfileEntry> entries;
+    CallTree tree;
+
+    // Self and total samples per entry, a method recursing is counted once towards its total
+    void flat(std::vector<int64_t> &self, std::vector<int64_t> &total) const;
+};
+
+// Merges sorted dictionaries into one, remap[i][j] being the merged index of dictionaries[i][j].
+// Merging keeps the order, so children ordered by entry stay ordered when remapped.
+void mergeEntries(const std::vector<const std::vector<ProfileEntry> *> &dictionaries,
+                  std::vector<ProfileEntry> &entries, std::vector<std::vector<int32_t>> &remap);
+
+// Big endian values written to a file, remembering whether any of them failed to be
+class BinaryOutput {
+public:
+    BinaryOutput();
+
+    ~BinaryOutput();
+
+    // false, with the reason logged, if the file can't be created
+    bool open(const std::string &path);
+
+    void putBytes(const char *data, size_t size);
+
+    void putByte(uint8_t value);
+
+    void putInt(int32_t value);
+
+    void putLong(int64_t value);
+
+    void putFloat(float value);
+
+    // an int length and the bytes
+    void putString(const std::string &value);
+
+    // a kind byte, name and signature each
+    void putEntries(const std::vector<ProfileEntry> &entries);
+
+    // false, with the reason logged, if anything failed to be written
+    bool close();
+
+private:
+    FILE *file;
+    std::string path_;
+    bool failed;
+
+    BinaryOutput(const BinaryOutput &);
+    void operator=(const BinaryOutput &);
+};
+
+// Big endian values read off a mapped file. Reading past its end fails it for good, with the
+// values read as zero.
+class BinaryInput {
+public:
+    BinaryInput();
+
+    bool open(const std::string &path);
+
+    // the magic, and the version a reader wants, false with the reason logged otherwise
+    bool header(const char *magic, int32_t version);
+
+    uint8_t getByte();
+
+    int32_t getInt();
+
+    int64_t getLong();
+
+    float getFloat();
+
+    bool getString(std::string &value);
+
+    bool getEntries(std::vector<ProfileEntry> &entries);
+
+    bool failed() const { return failed_; }
+
+    const std::string &path() const { return path_; }
+
+private:
+    MappedFile file;
+    std::string path_;
+    const char *at;
+    const char *end;
+    bool failed_;
+
+    bool has(size_t bytes);
+
+    BinaryInput(const BinaryInput &);
+    void operator=(const BinaryInput &);
+};
+
+/**
+ * Aggregated profile files, all values big endian like the agent's log:
+ *   PROFILE_MAGIC, int version, long samples, int entry count, the entries as a kind byte, and
+ *   an int length and the bytes of name and signature each, then the flat profile as a long
+ *   self and total per entry, then the call tree in preorder: int entry, long self, long total,
+ *   the node's children and PROFILE_END after the last of them. Children are ordered by entry
+ *   and the threads at the top are the root's children.
+ */
+const char PROFILE_MAGIC[] = "HPROFAGG";
+const int32_t PROFILE_VERSION = 1;
+const int32_t PROFILE_END = -1;
+
+// Writes a profile file front to back, for tools that produce one without holding the tree
+class ProfileWriter {
+public:
+    ProfileWriter() {
+    }
+
+    bool open(const std::string &path) { return out.open(path); }
+
+    void header(int64_t samples, const std::vector<ProfileEntry> &entries,
+                const std::vector<int64_t> &self, const std::vector<int64_t> &total);
+
+    // a node, followed by its children and an end()
+    void node(int32_t entry, int64_t self, int64_t total);
+
+    void end();
+
+    // false if anything failed to be written
+    bool close() { return out.close(); }
+
+private:
+    BinaryOutput out;
+
+    ProfileWriter(const ProfileWriter &);
+    void operator=(const ProfileWriter &);
+};
+
+bool writeProfile(const Profile &profile, const std::string &path);
+
+// Reads a profile file through a mapping, the tree a node at a time
+class ProfileReader {
+public:
+    ProfileReader();
+
+    // false, with the reason logged, unless it's a profile file of a version this reads
+    bool open(const std::string &path);
+
+    int64_t samples() const { return samples_; }
+
+    const std::vector<ProfileEntry> &entries() const { return entries_; }
+
+    const std::vector<int64_t> &self() const { return self_; }
+
+    const std::vector<int64_t> &total() const { return total_; }
+
+    // The next node in preorder, false at the end of a list of children
+    bool next(int32_t &entry, int64_t &self, int64_t &total);
+
+    // a truncated or corrupt file
+    bool failed() const { return corrupt || in.failed(); }
+
+private:
+    BinaryInput in;
+    int64_t samples_;
+    std::vector<ProfileEntry> entries_;
+    std::vector<int64_t> self_;
+    std::vector<int64_t> total_;
+    bool corrupt;
+
+    ProfileReader(const ProfileReader &);
+    void operator=(const ProfileReader &);
+};
+
+// Loads a whole profile file
+bool readProfile(const std::string &path, Profile &profile);
+
+// Whether the file starts like a profile file, for tools that take logs as well
+bool isProfileFile(const std::string &path);
+
+#endif // PROFILE_H
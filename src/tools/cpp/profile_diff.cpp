@@ -0,0 +1,199 @@
+#include "profile_diff.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+
+double significance(int64_t base, int64_t baseSamples, int64_t changed, int64_t changedSamples) {
+    if (baseSamples <= 0 || changedSamples <= 0) return 0;
+
+    double baseShare = (double) base / baseSamples;
+    double changedShare = (double) changed / changedSamples;
+    double pooled = (double) (base + changed) / (baseSamples + changedSamples);
+    double variance = pooled * (1 - pooled) * (1.0 / baseSamples + 1.0 / changedSamples);
+    if (variance <= 0) return 0;
+    return (changedShare - baseShare) / sqrt(variance);
+}
+
+static const DiffCounts kNoCounts = {0, 0, 0, 0, 0, 0};
+
+// The two profiles' trees walked side by side, a node at a time
+class ProfileDiff {
+public:
+    explicit ProfileDiff(int64_t minTotal) : minTotal(minTotal) {
+    }
+
+    bool run(const std::string &base, const std::string &changed, const std::string &output) {
+        if (!readers[0].open(base) || !readers[1].open(changed) || !out.open(output)) return false;
+
+        std::vector<const std::vector<ProfileEntry> *> dictionaries;
+        dictionaries.push_back(&readers[0].entries());
+        dictionaries.push_back(&readers[1].entries());
+        std::vector<ProfileEntry> entries;
+        mergeEntries(dictionaries, entries, remap);
+
+        out.putBytes(DIFF_MAGIC, sizeof(DIFF_MAGIC) - 1);
+        out.putInt(DIFF_VERSION);
+        out.putLong(readers[0].samples());
+        out.putLong(readers[1].samples());
+        out.putEntries(entries);
+
+        std::vector<DiffCounts> flat(entries.size(), kNoCounts);
+        for (size_t j = 0; j < remap[0].size(); j++) {
+            flat[remap[0][j]].baseSelf = readers[0].self()[j];
+            flat[remap[0][j]].baseTotal = readers[0].total()[j];
+        }
+        for (size_t j = 0; j < remap[1].size(); j++) {
+            flat[remap[1][j]].changedSelf = readers[1].self()[j];
+            flat[remap[1][j]].changedTotal = readers[1].total()[j];
+        }
+        for (size_t i = 0; i < flat.size(); i++) {
+            score(flat[i]);
+            putCounts(flat[i]);
+        }
+
+        walk(true, true, true);
+
+        bool failed = false;
+        for (int side = 0; side < 2; side++) {
+            if (readers[side].failed()) {
+                fprintf(stderr, "ERROR: %s is truncated\n", side == 0 ? base.c_str() : changed.c_str());
+                failed = true;
+            }
+        }
+        return out.close() && !failed;
+    }
+
+private:
+    // A side's next node, with its entry in the diff's dictionary, or the end of a list
+    struct Head {
+        int32_t entry;
+        int64_t self;
+        int64_t total;
+    };
+
+    const int64_t minTotal;
+    ProfileReader readers[2];
+    std::vector<std::vector<int32_t>> remap;
+    BinaryOutput out;
+
+    void score(DiffCounts &counts) {
+        int64_t baseSamples = readers[0].samples(), changedSamples = readers[1].samples();
+        counts.selfScore = (float) significance(counts.baseSelf, baseSamples, counts.changedSelf, changedSamples);
+        counts.totalScore = (float) significance(counts.baseTotal, baseSamples, counts.changedTotal, changedSamples);
+    }
+
+    void putCounts(const DiffCounts &counts) {
+        out.putLong(counts.baseSelf);
+        out.putLong(counts.baseTotal);
+        out.putLong(counts.changedSelf);
+        out.putLong(counts.changedTotal);
+        out.putFloat(counts.selfScore);
+        out.putFloat(counts.totalScore);
+    }
+
+    void next(int side, Head &head) {
+        int32_t entry;
+        if (readers[side].next(entry, head.self, head.total)) {
+            head.entry = remap[side][entry];
+        } else {
+            head.entry = DIFF_END;
+        }
+    }
+
+    // Aligns the lists of children the sides in it are at, written unless they've been pruned
+    void walk(bool inBase, bool inChanged, bool write) {
+        bool in[2] = {inBase, inChanged};
+        Head heads[2];
+        for (int side = 0; side < 2; side++) {
+            if (in[side]) {
+                next(side, heads[side]);
+            } else {
+                heads[side].entry = DIFF_END;
+            }
+        }
+
+        while (true) {
+            int32_t least = DIFF_END;
+            for (int side = 0; side < 2; side++) {
+                if (heads[side].entry != DIFF_END && (least == DIFF_END || heads[side].entry < least)) {
+                    least = heads[side].entry;
+                }
+            }
+            if (least == DIFF_END) break;
+
+            DiffCounts counts = kNoCounts;
+            bool has[2] = {heads[0].entry == least, heads[1].entry == least};
+            if (has[0]) {
+                counts.baseSelf = heads[0].self;
+                counts.baseTotal = heads[0].total;
+            }
+            if (has[1]) {
+                counts.changedSelf = heads[1].self;
+                counts.changedTotal = heads[1].total;
+            }
+
+            bool keep = write && std::max(counts.baseTotal, counts.changedTotal) >= minTotal;
+            if (keep) {
+                score(counts);
+                out.putInt(least);
+                putCounts(counts);
+            }
+            walk(has[0], has[1], keep);
+            for (int side = 0; side < 2; side++) {
+                if (has[side]) next(side, heads[side]);
+            }
+        }
+        if (write) out.putInt(DIFF_END);
+    }
+
+    ProfileDiff(const ProfileDiff &);
+    void operator=(const ProfileDiff &);
+};
+
+bool diffProfiles(const std::string &base, const std::string &changed, const std::string &output,
+                  int64_t minTotal) {
+    ProfileDiff diff(minTotal);
+    return diff.run(base, changed, output);
+}
+
+DiffReader::DiffReader() : baseSamples_(0), changedSamples_(0), corrupt(false) {
+}
+
+void DiffReader::getCounts(DiffCounts &counts) {
+    counts.baseSelf = in.getLong();
+    counts.baseTotal = in.getLong();
+    counts.changedSelf = in.getLong();
+    counts.changedTotal = in.getLong();
+    counts.selfScore = in.getFloat();
+    counts.totalScore = in.getFloat();
+}
+
+bool DiffReader::open(const std::string &path) {
+    if (!in.open(path) || !in.header(DIFF_MAGIC, DIFF_VERSION)) return false;
+
+    baseSamples_ = in.getLong();
+    changedSamples_ = in.getLong();
+    in.getEntries(entries_);
+    flat_.assign(entries_.size(), kNoCounts);
+    for (size_t i = 0; i < flat_.size(); i++) {
+        getCounts(flat_[i]);
+    }
+
+    if (in.failed()) {
+        fprintf(stderr, "ERROR: %s is truncated\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool DiffReader::next(int32_t &entry, DiffCounts &counts) {
+    entry = in.getInt();
+    if (in.failed() || entry == DIFF_END) return false;
+    if (entry < 0 || entry >= (int32_t) entries_.size()) {
+        corrupt = true;
+        return false;
+    }
+    getCounts(counts);
+    return !in.failed();
+}
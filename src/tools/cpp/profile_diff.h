@@ -0,0 +1,80 @@
+#ifndef PROFILE_DIFF_H
+#define PROFILE_DIFF_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "profile.h"
+
+/**
+ * Diff files, big endian like profile files:
+ *   DIFF_MAGIC, int version, long base samples, long changed samples, the union of both
+ *   profiles' entries as in a profile file, then DiffCounts per entry for the flat profiles, then
+ *   the aligned call trees in preorder: int entry, DiffCounts, the node's children and DIFF_END
+ *   after the last of them. DiffCounts are long base self, base total, changed self and changed
+ *   total, then float self and total scores. A node on one side only has zeros on the other.
+ */
+const char DIFF_MAGIC[] = "HPROFDIF";
+const int32_t DIFF_VERSION = 1;
+const int32_t DIFF_END = -1;
+
+struct DiffCounts {
+    int64_t baseSelf;
+    int64_t baseTotal;
+    int64_t changedSelf;
+    int64_t changedTotal;
+    // significance of the change in the share of samples, positive where it grew
+    float selfScore;
+    float totalScore;
+};
+
+// Two proportion z-score of count out of samples, base against changed. 0 when either profile
+// is empty or neither has the count, as there's nothing to tell apart.
+double significance(int64_t base, int64_t baseSamples, int64_t changed, int64_t changedSamples);
+
+/**
+ * Compares two profile files. Both trees are already ordered by entry and their dictionaries
+ * merge keeping that order, so the trees are aligned by walking them side by side, in time
+ * linear in their size and reading both mappings front to back once. Subtrees with fewer than
+ * minTotal samples on both sides are left out.
+ */
+bool diffProfiles(const std::string &base, const std::string &changed, const std::string &output,
+                  int64_t minTotal = 0);
+
+// Reads a diff file through a mapping, the tree a node at a time
+class DiffReader {
+public:
+    DiffReader();
+
+    // false, with the reason logged, unless it's a diff file of a version this reads
+    bool open(const std::string &path);
+
+    int64_t baseSamples() const { return baseSamples_; }
+
+    int64_t changedSamples() const { return changedSamples_; }
+
+    const std::vector<ProfileEntry> &entries() const { return entries_; }
+
+    const std::vector<DiffCounts> &flat() const { return flat_; }
+
+    // The next node in preorder, false at the end of a list of children
+    bool next(int32_t &entry, DiffCounts &counts);
+
+    bool failed() const { return corrupt || in.failed(); }
+
+private:
+    BinaryInput in;
+    int64_t baseSamples_;
+    int64_t changedSamples_;
+    std::vector<ProfileEntry> entries_;
+    std::vector<DiffCounts> flat_;
+    bool corrupt;
+
+    void getCounts(DiffCounts &counts);
+
+    DiffReader(const DiffReader &);
+    void operator=(const DiffReader &);
+};
+
+#endif // PROFILE_DIFF_H
@@ -0,0 +1,178 @@
+#include "profile_merge.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "profile.h"
+
+// One merge of a few inputs into an output, a node at a time
+class GroupMerge {
+public:
+    explicit GroupMerge(const std::vector<std::string> &inputs) : inputs(inputs), failed(false) {
+    }
+
+    bool run(const std::string &output) {
+        for (size_t i = 0; i < inputs.size(); i++) {
+            readers.push_back(std::unique_ptr<ProfileReader>(new ProfileReader()));
+            if (!readers[i]->open(inputs[i])) return false;
+        }
+        if (!writer.open(output)) return false;
+
+        std::vector<const std::vector<ProfileEntry> *> dictionaries;
+        for (size_t i = 0; i < readers.size(); i++) {
+            dictionaries.push_back(&readers[i]->entries());
+        }
+        std::vector<ProfileEntry> entries;
+        mergeEntries(dictionaries, entries, remap);
+
+        int64_t samples = 0;
+        std::vector<int64_t> self(entries.size(), 0), total(entries.size(), 0);
+        for (size_t i = 0; i < readers.size(); i++) {
+            samples += readers[i]->samples();
+            for (size_t j = 0; j < remap[i].size(); j++) {
+                self[remap[i][j]] += readers[i]->self()[j];
+                total[remap[i][j]] += readers[i]->total()[j];
+            }
+        }
+        writer.header(samples, entries, self, total);
+
+        std::vector<size_t> all;
+        for (size_t i = 0; i < readers.size(); i++) {
+            all.push_back(i);
+        }
+        mergeChildren(all);
+
+        for (size_t i = 0; i < readers.size(); i++) {
+            if (readers[i]->failed()) {
+                fprintf(stderr, "ERROR: %s is truncated\n", inputs[i].c_str());
+                failed = true;
+            }
+        }
+        return writer.close() && !failed;
+    }
+
+private:
+    // An input's next node, with its entry in the output's dictionary, or the end of a list
+    struct Head {
+        int32_t entry;
+        int64_t self;
+        int64_t total;
+    };
+
+    const std::vector<std::string> &inputs;
+    std::vector<std::unique_ptr<ProfileReader>> readers;
+    // input's entry to output's entry, per input
+    std::vector<std::vector<int32_t>> remap;
+    ProfileWriter writer;
+    bool failed;
+
+    void next(size_t input, Head &head) {
+        int32_t entry;
+        if (readers[input]->next(entry, head.self, head.total)) {
+            head.entry = remap[input][entry];
+        } else {
+            head.entry = PROFILE_END;
+        }
+    }
+
+    // Merges the list of children each of the inputs is at, children by the same entry into one
+    void mergeChildren(const std::vector<size_t> &group) {
+        std::vector<Head> heads(group.size());
+        for (size_t i = 0; i < group.size(); i++) {
+            next(group[i], heads[i]);
+        }
+
+        std::vector<size_t> same;
+        while (true) {
+            int32_t least = PROFILE_END;
+            for (size_t i = 0; i < heads.size(); i++) {
+                if (heads[i].entry != PROFILE_END && (least == PROFILE_END || heads[i].entry < least)) {
+                    least = heads[i].entry;
+                }
+            }
+            if (least == PROFILE_END) break;
+
+            same.clear();
+            int64_t self = 0, total = 0;
+            for (size_t i = 0; i < heads.size(); i++) {
+                if (heads[i].entry != least) continue;
+                same.push_back(group[i]);
+                self += heads[i].self;
+                total += heads[i].total;
+            }
+            writer.node(least, self, total);
+            mergeChildren(same);
+            for (size_t i = 0; i < heads.size(); i++) {
+                if (heads[i].entry == least) next(group[i], heads[i]);
+            }
+        }
+        writer.end();
+    }
+
+    GroupMerge(const GroupMerge &);
+    void operator=(const GroupMerge &);
+};
+
+static bool mergeGroup(const std::vector<std::string> &inputs, const std::string &output) {
+    GroupMerge merge(inputs);
+    return merge.run(output);
+}
+
+static void removeAll(const std::vector<std::string> &paths) {
+    for (size_t i = 0; i < paths.size(); i++) {
+        remove(paths[i].c_str());
+    }
+}
+
+bool mergeProfiles(const std::vector<std::string> &inputs, const std::string &output,
+                   int threads, size_t fanIn) {
+    fanIn = std::max((size_t) 2, fanIn);
+    threads = std::max(1, threads);
+
+    std::vector<std::string> current = inputs;
+    std::vector<std::string> temporary;
+    for (int round = 0; current.size() > fanIn; round++) {
+        size_t groups = (current.size() + fanIn - 1) / fanIn;
+        std::vector<std::string> merged(groups);
+        for (size_t i = 0; i < groups; i++) {
+            char suffix[64];
+            snprintf(suffix, sizeof(suffix), ".merge-%d-%zu", round, i);
+            merged[i] = output + suffix;
+        }
+
+        std::atomic<size_t> nextGroup(0);
+        std::atomic<bool> ok(true);
+        std::vector<std::thread> workers;
+        auto work = [&]() {
+            size_t group;
+            while ((group = nextGroup.fetch_add(1)) < groups) {
+                std::vector<std::string> members(current.begin() + group * fanIn,
+                                                 current.begin() + std::min(current.size(), (group + 1) * fanIn));
+                if (!mergeGroup(members, merged[group])) ok = false;
+            }
+        };
+        for (int i = 1; i < threads && (size_t) i < groups; i++) {
+            workers.push_back(std::thread(work));
+        }
+        work();
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+
+        removeAll(temporary);
+        temporary = merged;
+        if (!ok) {
+            removeAll(temporary);
+            return false;
+        }
+        current = merged;
+    }
+
+    bool ok = mergeGroup(current, output);
+    removeAll(temporary);
+    return ok;
+}
@@ -0,0 +1,28 @@
+#ifndef PROFILE_MERGE_H
+#define PROFILE_MERGE_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Profiles merged at once, more are merged in rounds
+const size_t kDefaultMergeFanIn = 64;
+
+/**
+ * Merges profile files into one without loading their trees. Entries are matched by kind, name
+ * and signature, which is what makes profiles of different JVMs comparable where jmethodIDs
+ * aren't. Logs of sample lines name frames without a signature, so a method's overloads are
+ * one entry there, which won't match the entries of binary logs that have one.
+ *
+ * The inputs' sorted dictionaries are merged into the output's, and since that keeps their
+ * order, every list of children stays ordered as well. The trees then merge a node at a time,
+ * each input read front to back once, so memory is bounded by the dictionaries and the depth
+ * of the trees rather than their size.
+ *
+ * More inputs than fanIn are merged in rounds, the groups of a round on up to threads threads,
+ * through temporary files next to the output.
+ */
+bool mergeProfiles(const std::vector<std::string> &inputs, const std::string &output,
+                   int threads = 1, size_t fanIn = kDefaultMergeFanIn);
+
+#endif // PROFILE_MERGE_H